@@ -13,6 +13,14 @@
 #define CULL_PRIMITIVE_VSM      (1 << 5)
 #define USE_HASHED_TRANSPARENCY (1 << 6)
 
+// Culling kernels may be compiled with CULL_FLAGS defined to a fixed set of the CULL_* flags.
+// Checks then fold to constants, so code for disabled tests is removed. Otherwise, flags are read from the per-frame uniforms
+#ifdef CULL_FLAGS
+  #define IsCullFlagEnabled(flag) ((CULL_FLAGS & (flag)) != 0)
+#else
+  #define IsCullFlagEnabled(flag) ((perFrameUniformsBuffers[globalUniformsIndex].flags & (flag)) != 0)
+#endif
+
 //layout (binding = 0, std140) uniform PerFrameUniformsBuffer
 FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly PerFrameUniformsBuffer)
 {
@@ -28,6 +36,7 @@ FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly PerFrameUniformsBuffer)
   float bindlessSamplerLodBias;
   uint flags;
   float alphaHashScale;
+  uint meshInstanceCount;
 } perFrameUniformsBuffers[];
 
 #endif // GLOBAL_UNIFORMS_H
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include "shadows/vsm/VsmCommon.h.glsl"
 #include "Utility.h.glsl"
 #include "Color.h.glsl"
+#include "lights/LightClusters.h.glsl"
 
 #define d_perFrameUniforms perFrameUniformsBuffers[globalUniformsIndex]
 
@@ -283,15 +284,67 @@ float ShadowVsmPcss(vec3 fragWorldPos, vec3 flatNormal)
 
 
 
-vec3 LocalLightIntensity(vec3 viewDir, Surface surface)
+// Single tap of a point or spot light's VSM. Unshadowed lights and pages that weren't allocated are lit
+float ShadowVsmLocal(uint lightIndex, GpuLight light, vec3 fragWorldPos, vec3 flatNormal)
+{
+  const uint firstView = d_vsmLocalLightViews[lightIndex];
+  if (firstView == VSM_NO_LOCAL_VIEW)
+  {
+    return 1.0;
+  }
+
+  const vec3 lightToFrag = fragWorldPos - light.position;
+  const VsmLocalView view = d_vsmLocalViews[GetVsmLocalViewIndex(firstView, light.type == LIGHT_TYPE_POINT, lightToFrag)];
+
+  // Texels grow with distance from the light, so the bias does too
+  const float texelSize = length(lightToFrag) * view.texelSizeAtUnitDistance;
+  const vec3 L = -normalize(lightToFrag);
+  const float bias = min(GetShadowBias(flatNormal, L, texelSize), 10.0 * texelSize);
+  const vec3 biasedPos = fragWorldPos + L * bias + flatNormal * texelSize * 0.5;
+
+  VsmLocalPageInfo info;
+  if (!GetVsmLocalPage(view, biasedPos, info))
+  {
+    return 1.0;
+  }
+
+  const uint pageData = imageLoad(i_pageTables, info.pageAddress).x;
+  if (!GetIsPageBacked(pageData))
+  {
+    return 1.0;
+  }
+
+  const float shadowDepth = LoadPageTexel(info.pageTexel, GetPagePhysicalAddress(pageData));
+  return shadowDepth < info.projectedDepth ? 0.0 : 1.0;
+}
+
+vec3 LocalLightIntensity(vec3 viewDir, Surface surface, vec3 flatNormal)
 {
   vec3 color = { 0, 0, 0 };
 
-  for (uint i = 0; i < shadingUniforms.numberOfLights; i++)
+  if ((shadingUniforms.debugFlags & SHADE_ALL_LIGHTS) != 0)
+  {
+    for (uint i = 0; i < shadingUniforms.numberOfLights; i++)
+    {
+      GpuLight light = d_lightBuffer.lights[i];
+
+      color += EvaluatePunctualLight(viewDir, light, surface, shadingUniforms.shadingInternalColorSpace) * ShadowVsmLocal(i, light, surface.position, flatNormal);
+    }
+
+    return color;
+  }
+
+  // Only the lights that can reach this pixel's cluster are evaluated
+  const float viewDepth = -(d_lightClusterUniforms.view * vec4(surface.position, 1.0)).z;
+  const uvec3 clusterId = GetLightCluster(v_uv, viewDepth, d_lightClusterUniforms.nearDepth, d_lightClusterUniforms.farDepth);
+  const LightCluster cluster = d_lightClusters[GetLightClusterIndex(clusterId)];
+
+  for (uint i = 0; i < cluster.count; i++)
   {
-    GpuLight light = d_lightBuffer.lights[i];
+    const uint lightIndex = d_lightIndices.indices[cluster.offset + i];
+    GpuLight light = d_lightBuffer.lights[lightIndex];
 
-    color += EvaluatePunctualLight(viewDir, light, surface, shadingUniforms.shadingInternalColorSpace);
+    color += EvaluatePunctualLight(viewDir, light, surface, shadingUniforms.shadingInternalColorSpace) * ShadowVsmLocal(lightIndex, light, surface.position, flatNormal);
   }
 
   return color;
@@ -369,7 +422,7 @@ void main()
     COLOR_SPACE_sRGB_LINEAR,
     shadingUniforms.shadingInternalColorSpace);
   finalColor += BRDF(viewDir, -shadingUniforms.sunDir.xyz, surface) * sunColor_internal_space * NoL_sun * shadowSun;
-  finalColor += LocalLightIntensity(viewDir, surface);
+  finalColor += LocalLightIntensity(viewDir, surface, flatNormal);
   finalColor += emission_internal;
 
   o_color = finalColor;
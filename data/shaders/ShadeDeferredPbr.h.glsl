@@ -28,6 +28,13 @@ FVOG_DECLARE_ARGUMENTS(ShadingPushConstants)
   FVOG_UINT32 nearestSamplerIndex;
   
   FVOG_UINT32 physicalPagesOverdrawIndex;
+
+  FVOG_UINT32 lightClusterUniformsIndex;
+  FVOG_UINT32 lightClustersIndex;
+  FVOG_UINT32 lightIndicesIndex;
+
+  FVOG_UINT32 vsmLocalViewsIndex;
+  FVOG_UINT32 vsmLocalLightViewsIndex;
 };
 #endif
 
@@ -103,6 +110,7 @@ struct ShadowUniforms
 #define VSM_SHOW_DIRTY_PAGES   (1 << 4)
 #define BLEND_NORMALS          (1 << 5)
 #define VSM_SHOW_OVERDRAW      (1 << 6)
+#define SHADE_ALL_LIGHTS       (1 << 7) // Ignore light clusters
 
 struct ShadingUniforms
 {
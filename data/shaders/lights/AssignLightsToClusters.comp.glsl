@@ -0,0 +1,211 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#include "LightClusters.h.glsl"
+#include "LightBvh.h.glsl"
+#include "../ShadeDeferredPbr.h.glsl"
+#include "../Config.shared.h"
+#include "../Math.h.glsl"
+
+FVOG_DECLARE_ARGUMENTS(AssignLightsToClustersPushConstants)
+{
+  FVOG_UINT32 lightClusterUniformsIndex;
+  FVOG_UINT32 lightClustersIndex;
+  FVOG_UINT32 lightIndicesIndex;
+  FVOG_UINT32 lightBufferIndex;
+  FVOG_UINT32 lightBvhNodesIndex;
+  FVOG_UINT32 useLightBvh;
+};
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly LightBuffer)
+{
+  GpuLight lights[];
+}lightBuffers[];
+
+#define d_lights lightBuffers[lightBufferIndex].lights
+
+shared uint sh_lightCount;
+shared uint sh_lightIndices[MAX_LIGHTS_PER_CLUSTER];
+shared uint sh_indexOffset;
+shared uint sh_indexCount;
+
+// Nodes of the light BVH that are yet to be tested
+#define LIGHT_BVH_STACK_SIZE 1024
+shared uint sh_nodeStack[LIGHT_BVH_STACK_SIZE];
+shared uint sh_nodeStackSize;
+shared bool sh_nodeStackOverflowed;
+
+// Lights are tested as spheres against the view space box that bounds the cluster
+bool LightReachesCluster(GpuLight light, vec3 clusterMin, vec3 clusterMax)
+{
+  if (light.type == LIGHT_TYPE_DIRECTIONAL || isinf(light.range))
+  {
+    return true;
+  }
+
+  const vec3 center = (d_lightClusterUniforms.view * vec4(light.position, 1.0)).xyz;
+  const vec3 offset = center - clamp(center, clusterMin, clusterMax);
+  return dot(offset, offset) <= light.range * light.range;
+}
+
+bool NodeReachesCluster(LightBvhNode node, vec3 clusterMin, vec3 clusterMax)
+{
+  // View space box that bounds the node's world space box
+  const vec3 center = (d_lightClusterUniforms.view * vec4((node.boundsMin + node.boundsMax) * 0.5, 1.0)).xyz;
+  const vec3 extent = mat3(abs(d_lightClusterUniforms.view[0].xyz), abs(d_lightClusterUniforms.view[1].xyz), abs(d_lightClusterUniforms.view[2].xyz)) * ((node.boundsMax - node.boundsMin) * 0.5);
+  return all(lessThanEqual(center - extent, clusterMax)) && all(greaterThanEqual(center + extent, clusterMin));
+}
+
+void AddLight(uint lightIndex)
+{
+  const uint slot = atomicAdd(sh_lightCount, 1);
+  if (slot < MAX_LIGHTS_PER_CLUSTER)
+  {
+    sh_lightIndices[slot] = lightIndex;
+  }
+}
+
+void AddLightsLinear(vec3 clusterMin, vec3 clusterMax)
+{
+  for (uint i = gl_LocalInvocationIndex; i < d_lightClusterUniforms.numLights; i += gl_WorkGroupSize.x)
+  {
+    if (LightReachesCluster(d_lights[i], clusterMin, clusterMax))
+    {
+      AddLight(i);
+    }
+  }
+}
+
+// The workgroup traverses the light BVH together, with each invocation taking a node from the shared stack per iteration.
+// Returns false if the stack overflowed, in which case the cluster's lights must be found another way
+bool AddLightsBvh(vec3 clusterMin, vec3 clusterMax)
+{
+  if (gl_LocalInvocationIndex == 0)
+  {
+    sh_nodeStack[0] = 0; // Root
+    sh_nodeStackSize = 1;
+    sh_nodeStackOverflowed = false;
+  }
+
+  barrier();
+
+  while (true)
+  {
+    const uint stackSize = sh_nodeStackSize;
+    if (stackSize == 0 || sh_nodeStackOverflowed)
+    {
+      break;
+    }
+
+    const uint take = min(stackSize, gl_WorkGroupSize.x);
+    const uint nodeIndex = gl_LocalInvocationIndex < take ? sh_nodeStack[stackSize - take + gl_LocalInvocationIndex] : LIGHT_BVH_INVALID_NODE;
+
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0)
+    {
+      sh_nodeStackSize = stackSize - take;
+    }
+
+    barrier();
+
+    if (nodeIndex != LIGHT_BVH_INVALID_NODE)
+    {
+      const LightBvhNode node = lightBvhNodesBuffers[lightBvhNodesIndex].nodes[nodeIndex];
+      if (node.right == LIGHT_BVH_LEAF)
+      {
+        if (LightReachesCluster(d_lights[node.left], clusterMin, clusterMax))
+        {
+          AddLight(node.left);
+        }
+      }
+      else if (NodeReachesCluster(node, clusterMin, clusterMax))
+      {
+        const uint slot = atomicAdd(sh_nodeStackSize, 2);
+        if (slot + 2 <= LIGHT_BVH_STACK_SIZE)
+        {
+          sh_nodeStack[slot] = node.left;
+          sh_nodeStack[slot + 1] = node.right;
+        }
+        else
+        {
+          sh_nodeStackOverflowed = true;
+        }
+      }
+    }
+
+    barrier();
+  }
+
+  return !sh_nodeStackOverflowed;
+}
+
+// One workgroup per cluster, so each light is tested by one invocation
+layout(local_size_x = 64) in;
+void main()
+{
+  const uvec3 cluster = gl_WorkGroupID;
+  const uint localId = gl_LocalInvocationIndex;
+  const LightClusterUniforms uniforms = d_lightClusterUniforms;
+
+  if (localId == 0)
+  {
+    sh_lightCount = 0;
+  }
+
+  // Scale the rays through the tile's corners to the depths of the slice's bounds
+  const float depthStart = GetLightClusterSliceStart(cluster.z, uniforms.nearDepth, uniforms.farDepth);
+  const float depthEnd = GetLightClusterSliceStart(cluster.z + 1, uniforms.nearDepth, uniforms.farDepth);
+  const vec2 uvMin = vec2(cluster.xy) / vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y);
+  const vec2 uvMax = vec2(cluster.xy + 1) / vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y);
+  vec3 clusterMin = vec3(LIGHT_CLUSTER_MAX_DEPTH);
+  vec3 clusterMax = vec3(-LIGHT_CLUSTER_MAX_DEPTH);
+  for (uint i = 0; i < 4; i++)
+  {
+    const vec2 uv = vec2((i & 1) == 0 ? uvMin.x : uvMax.x, (i & 2) == 0 ? uvMin.y : uvMax.y);
+    const vec3 pointOnNearPlane = UnprojectUV_ZO(NEAR_DEPTH, uv, uniforms.invProj);
+    const vec3 direction = pointOnNearPlane / -pointOnNearPlane.z;
+    clusterMin = min(clusterMin, min(direction * depthStart, direction * depthEnd));
+    clusterMax = max(clusterMax, max(direction * depthStart, direction * depthEnd));
+  }
+
+  barrier();
+
+  if (useLightBvh != 0 && uniforms.numLights > 0)
+  {
+    if (!AddLightsBvh(clusterMin, clusterMax))
+    {
+      // Start over without the BVH, as lights may have been added already
+      barrier();
+      if (localId == 0)
+      {
+        sh_lightCount = 0;
+      }
+      barrier();
+      AddLightsLinear(clusterMin, clusterMax);
+    }
+  }
+  else
+  {
+    AddLightsLinear(clusterMin, clusterMax);
+  }
+
+  barrier();
+
+  // Reserve a contiguous range of the index list for this cluster
+  if (localId == 0)
+  {
+    const uint count = min(sh_lightCount, MAX_LIGHTS_PER_CLUSTER);
+    const uint offset = count > 0 ? atomicAdd(d_lightIndices.count, count) : 0;
+    sh_indexOffset = offset;
+    sh_indexCount = offset < uniforms.indexCapacity ? min(count, uniforms.indexCapacity - offset) : 0;
+    d_lightClusters[GetLightClusterIndex(cluster)] = LightCluster(sh_indexOffset, sh_indexCount);
+  }
+
+  barrier();
+
+  for (uint i = localId; i < sh_indexCount; i += gl_WorkGroupSize.x)
+  {
+    d_lightIndices.indices[sh_indexOffset + i] = sh_lightIndices[i];
+  }
+}
@@ -0,0 +1,177 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "../Resources.h.glsl"
+#include "../ShadeDeferredPbr.h.glsl"
+
+// Linear BVH over the bounds of every light, built on the GPU (Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees").
+// Lights are sorted by the Morton codes of their positions, then each internal node finds the range of sorted lights it covers in parallel.
+// With N lights, nodes [0, N - 1) are internal and nodes [N - 1, 2N - 1) are leaves in sorted order. The root is always node 0.
+// Lights without bounds (directional or infinite range) are sorted last and given infinite bounds, so every query reaches them
+
+// Marks leaves in LightBvhNode::right
+#define LIGHT_BVH_LEAF 0xFFFFFFFFu
+#define LIGHT_BVH_INVALID_NODE 0xFFFFFFFFu
+
+// Stands in for the bounds of lights that reach everywhere
+#define LIGHT_BVH_INFINITY 1e30
+
+// Sort keys are padded to a power of two no smaller than this, which is also how many keys a workgroup sorts at once
+#define LIGHT_BVH_SORT_GROUP_KEYS 512
+
+#define LIGHT_BVH_SORT_MODE_LOCAL 0 // Sort each group of keys
+#define LIGHT_BVH_SORT_MODE_GLOBAL_STEP 1 // Compare keys sortJ apart for the sortK merge
+#define LIGHT_BVH_SORT_MODE_LOCAL_MERGE 2 // Finish the sortK merge for every step within a group of keys
+
+struct LightBvhNode
+{
+  FVOG_VEC3 boundsMin;
+  FVOG_UINT32 left; // Index of the light for leaves
+  FVOG_VEC3 boundsMax;
+  FVOG_UINT32 right; // LIGHT_BVH_LEAF for leaves
+  // Estimate of the total emitted power of the lights below this node, for importance sampling
+  FVOG_FLOAT power;
+  FVOG_UINT32 parent;
+  FVOG_UINT32 _padding0;
+  FVOG_UINT32 _padding1;
+};
+
+// Centroid bounds of the bounded lights, as floats mapped to uints that sort the same way (see LightBvh_FloatToOrderedUint)
+struct LightBvhSceneBounds
+{
+  FVOG_UINT32 min[3];
+  FVOG_UINT32 max[3];
+};
+
+#if defined(__cplusplus) || defined(LIGHT_BVH_PUSH_CONSTANTS)
+FVOG_DECLARE_ARGUMENTS(LightBvhPushConstants)
+{
+  FVOG_UINT32 lightBufferIndex;
+  FVOG_UINT32 numLights;
+  FVOG_UINT32 keysIndex;
+  FVOG_UINT32 nodesIndex;
+  FVOG_UINT32 refitCountersIndex;
+  FVOG_UINT32 sceneBoundsIndex;
+  // Padded number of keys
+  FVOG_UINT32 sortCount;
+  FVOG_UINT32 sortMode;
+  FVOG_UINT32 sortK;
+  FVOG_UINT32 sortJ;
+};
+#endif
+
+#ifndef __cplusplus
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly LightBvhNodesBuffer)
+{
+  LightBvhNode nodes[];
+} lightBvhNodesBuffers[];
+
+// Maps floats to uints that compare in the same order, so atomicMin and atomicMax can reduce them
+uint LightBvh_FloatToOrderedUint(float f)
+{
+  const uint bits = floatBitsToUint(f);
+  return (bits & 0x80000000u) != 0 ? ~bits : bits | 0x80000000u;
+}
+
+float LightBvh_OrderedUintToFloat(uint u)
+{
+  return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7FFFFFFFu : ~u);
+}
+
+float LightBvh_Luminance(vec3 color, uint colorSpace)
+{
+  if (colorSpace == COLOR_SPACE_BT2020_LINEAR)
+  {
+    return dot(color, vec3(0.2627, 0.6780, 0.0593));
+  }
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Spot lights get the bounds of a point light with the same range
+void LightBvh_GetLightBounds(GpuLight light, out vec3 boundsMin, out vec3 boundsMax)
+{
+  if (light.type == LIGHT_TYPE_DIRECTIONAL || isinf(light.range))
+  {
+    boundsMin = vec3(-LIGHT_BVH_INFINITY);
+    boundsMax = vec3(LIGHT_BVH_INFINITY);
+    return;
+  }
+
+  boundsMin = light.position - light.range;
+  boundsMax = light.position + light.range;
+}
+
+// Emitted power in lumens. Directional lights have no meaningful power, so they are given none and must be sampled separately
+float LightBvh_GetLightPower(GpuLight light)
+{
+  const float luminousIntensity = light.intensity * LightBvh_Luminance(light.color, light.colorSpace);
+  if (light.type == LIGHT_TYPE_POINT)
+  {
+    return 4.0 * 3.141592654 * luminousIntensity;
+  }
+  if (light.type == LIGHT_TYPE_SPOT)
+  {
+    return 2.0 * 3.141592654 * (1.0 - cos(light.outerConeAngle)) * luminousIntensity;
+  }
+  return 0;
+}
+
+// Smallest distance used to weigh a node, so nodes containing a point don't take all the weight
+#define LIGHT_BVH_MIN_IMPORTANCE_DISTANCE 0.1
+
+// How much a node is expected to contribute at a point: its power over the squared distance to its bounds
+float LightBvh_NodeImportance(LightBvhNode node, vec3 position)
+{
+  const vec3 offset = position - clamp(position, node.boundsMin, node.boundsMax);
+  return node.power / max(dot(offset, offset), LIGHT_BVH_MIN_IMPORTANCE_DISTANCE * LIGHT_BVH_MIN_IMPORTANCE_DISTANCE);
+}
+
+// Stochastically descends from the root, choosing each child with probability proportional to its importance.
+// Returns the index of the chosen light, or LIGHT_BVH_INVALID_NODE if there are no lights with power. pdf is the probability of the choice.
+// u is a uniform random number in [0, 1), which is rescaled at each level so one number suffices
+uint LightBvh_SampleLight(uint nodesIndex, uint numLights, vec3 position, float u, out float pdf)
+{
+  pdf = 0;
+  if (numLights == 0)
+  {
+    return LIGHT_BVH_INVALID_NODE;
+  }
+
+  pdf = 1;
+  LightBvhNode node = lightBvhNodesBuffers[nodesIndex].nodes[0];
+  while (node.right != LIGHT_BVH_LEAF)
+  {
+    const LightBvhNode left = lightBvhNodesBuffers[nodesIndex].nodes[node.left];
+    const LightBvhNode right = lightBvhNodesBuffers[nodesIndex].nodes[node.right];
+    const float importanceLeft = LightBvh_NodeImportance(left, position);
+    const float importanceRight = LightBvh_NodeImportance(right, position);
+    const float importanceSum = importanceLeft + importanceRight;
+    if (importanceSum <= 0)
+    {
+      pdf = 0;
+      return LIGHT_BVH_INVALID_NODE;
+    }
+
+    const float probabilityLeft = importanceLeft / importanceSum;
+    if (u < probabilityLeft)
+    {
+      u = u / probabilityLeft;
+      pdf *= probabilityLeft;
+      node = left;
+    }
+    else
+    {
+      u = (u - probabilityLeft) / (1.0 - probabilityLeft);
+      pdf *= 1.0 - probabilityLeft;
+      node = right;
+    }
+    u = min(u, 0.99999994);
+  }
+
+  return node.left;
+}
+
+#endif // !__cplusplus
+
+#endif // LIGHT_BVH_H
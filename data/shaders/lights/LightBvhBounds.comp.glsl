@@ -0,0 +1,44 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#include "LightBvhBuild.h.glsl"
+
+shared uint sh_min[3];
+shared uint sh_max[3];
+
+// Finds the bounds of the positions of bounded lights, which Morton codes are relative to
+layout(local_size_x = 256) in;
+void main()
+{
+  const uint i = gl_GlobalInvocationID.x;
+
+  if (gl_LocalInvocationIndex < 3)
+  {
+    sh_min[gl_LocalInvocationIndex] = 0xFFFFFFFFu;
+    sh_max[gl_LocalInvocationIndex] = 0;
+  }
+
+  barrier();
+
+  if (i < numLights && LightBvh_IsBounded(d_lights[i]))
+  {
+    const vec3 position = d_lights[i].position;
+    for (uint c = 0; c < 3; c++)
+    {
+      const uint value = LightBvh_FloatToOrderedUint(position[c]);
+      atomicMin(sh_min[c], value);
+      atomicMax(sh_max[c], value);
+    }
+  }
+
+  barrier();
+
+  if (gl_LocalInvocationIndex == 0)
+  {
+    for (uint c = 0; c < 3; c++)
+    {
+      atomicMin(d_sceneBounds.min[c], sh_min[c]);
+      atomicMax(d_sceneBounds.max[c], sh_max[c]);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef LIGHT_BVH_BUILD_H
+#define LIGHT_BVH_BUILD_H
+
+// Resources shared by the passes that build the light BVH
+#define LIGHT_BVH_PUSH_CONSTANTS
+#include "LightBvh.h.glsl"
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly LightBuffer)
+{
+  GpuLight lights[];
+}lightBuffers[];
+
+#define d_lights lightBuffers[lightBufferIndex].lights
+
+// Morton code and index of each light, padded to sortCount
+FVOG_DECLARE_STORAGE_BUFFERS(restrict LightBvhKeysBuffer)
+{
+  uvec2 keys[];
+}lightBvhKeysBuffers[];
+
+#define d_keys lightBvhKeysBuffers[keysIndex].keys
+
+// Coherent because refitting reads nodes that other invocations wrote
+FVOG_DECLARE_STORAGE_BUFFERS(restrict coherent LightBvhNodesBufferRW)
+{
+  LightBvhNode nodes[];
+}lightBvhNodesBuffersRW[];
+
+#define d_nodes lightBvhNodesBuffersRW[nodesIndex].nodes
+
+// How many children of each internal node have been refit
+FVOG_DECLARE_STORAGE_BUFFERS(restrict LightBvhRefitCountersBuffer)
+{
+  uint counters[];
+}lightBvhRefitCountersBuffers[];
+
+#define d_refitCounters lightBvhRefitCountersBuffers[refitCountersIndex].counters
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict LightBvhSceneBoundsBuffer)
+{
+  LightBvhSceneBounds bounds;
+}lightBvhSceneBoundsBuffers[];
+
+#define d_sceneBounds lightBvhSceneBoundsBuffers[sceneBoundsIndex].bounds
+
+bool LightBvh_IsBounded(GpuLight light)
+{
+  return light.type != LIGHT_TYPE_DIRECTIONAL && !isinf(light.range);
+}
+
+#endif // LIGHT_BVH_BUILD_H
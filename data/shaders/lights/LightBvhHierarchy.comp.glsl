@@ -0,0 +1,81 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#include "LightBvhBuild.h.glsl"
+
+// Length of the common prefix of the keys at i and j, where keys with equal codes are told apart by their position.
+// -1 if j is out of range
+int Delta(int i, int j)
+{
+  if (j < 0 || j >= int(numLights))
+  {
+    return -1;
+  }
+
+  const uint codeI = d_keys[i].x;
+  const uint codeJ = d_keys[j].x;
+  if (codeI == codeJ)
+  {
+    return 32 + 31 - findMSB(uint(i ^ j));
+  }
+  return 31 - findMSB(codeI ^ codeJ);
+}
+
+// A child whose range ends at the end of its parent's range covers a single light
+uint ChildIndex(int rangeEnd, int child)
+{
+  return rangeEnd == child ? numLights - 1 + uint(child) : uint(child);
+}
+
+// One invocation per internal node
+layout(local_size_x = 64) in;
+void main()
+{
+  const int i = int(gl_GlobalInvocationID.x);
+  if (i >= int(numLights) - 1)
+  {
+    return;
+  }
+
+  // Direction of the range that this node covers
+  const int d = Delta(i, i + 1) - Delta(i, i - 1) >= 0 ? 1 : -1;
+
+  // Find the other end of the range with an exponential then binary search
+  const int deltaMin = Delta(i, i - d);
+  int lengthMax = 2;
+  while (Delta(i, i + lengthMax * d) > deltaMin)
+  {
+    lengthMax *= 2;
+  }
+
+  int length = 0;
+  for (int t = lengthMax / 2; t >= 1; t /= 2)
+  {
+    if (Delta(i, i + (length + t) * d) > deltaMin)
+    {
+      length += t;
+    }
+  }
+  const int j = i + length * d;
+
+  // Find where the keys' common prefix grows
+  const int deltaNode = Delta(i, j);
+  int split = 0;
+  int t = length;
+  do
+  {
+    t = (t + 1) / 2;
+    if (Delta(i, i + (split + t) * d) > deltaNode)
+    {
+      split += t;
+    }
+  } while (t > 1);
+  const int gamma = i + split * d + min(d, 0);
+
+  const uint left = ChildIndex(min(i, j), gamma);
+  const uint right = ChildIndex(max(i, j), gamma + 1);
+  d_nodes[i].left = left;
+  d_nodes[i].right = right;
+  d_nodes[left].parent = i;
+  d_nodes[right].parent = i;
+}
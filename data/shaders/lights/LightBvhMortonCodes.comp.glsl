@@ -0,0 +1,58 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#include "LightBvhBuild.h.glsl"
+
+// Inserts two zero bits after each of the lower 10 bits
+uint ExpandBits(uint v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// 30-bit Morton code of a point in the unit cube
+uint MortonCode(vec3 p)
+{
+  const uvec3 q = uvec3(clamp(p * 1024.0, 0.0, 1023.0));
+  return (ExpandBits(q.x) << 2) | (ExpandBits(q.y) << 1) | ExpandBits(q.z);
+}
+
+layout(local_size_x = 256) in;
+void main()
+{
+  const uint i = gl_GlobalInvocationID.x;
+
+  if (i == 0)
+  {
+    d_nodes[0].parent = LIGHT_BVH_INVALID_NODE;
+  }
+
+  if (i >= sortCount)
+  {
+    return;
+  }
+
+  // Padding sorts after every light
+  if (i >= numLights)
+  {
+    d_keys[i] = uvec2(0xFFFFFFFFu);
+    return;
+  }
+
+  // Unbounded lights sort after bounded lights
+  const GpuLight light = d_lights[i];
+  if (!LightBvh_IsBounded(light))
+  {
+    d_keys[i] = uvec2(0xFFFFFFFFu, i);
+    return;
+  }
+
+  const LightBvhSceneBounds bounds = d_sceneBounds;
+  const vec3 boundsMin = vec3(LightBvh_OrderedUintToFloat(bounds.min[0]), LightBvh_OrderedUintToFloat(bounds.min[1]), LightBvh_OrderedUintToFloat(bounds.min[2]));
+  const vec3 boundsMax = vec3(LightBvh_OrderedUintToFloat(bounds.max[0]), LightBvh_OrderedUintToFloat(bounds.max[1]), LightBvh_OrderedUintToFloat(bounds.max[2]));
+  const vec3 p = (light.position - boundsMin) / max(boundsMax - boundsMin, vec3(1e-6));
+  d_keys[i] = uvec2(MortonCode(p), i);
+}
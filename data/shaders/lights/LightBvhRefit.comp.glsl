@@ -0,0 +1,47 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#include "LightBvhBuild.h.glsl"
+
+// One invocation per leaf. Each leaf is written, then invocations walk toward the root. Only the second child to arrive at a node
+// continues, as the node's bounds can only be computed once both children are done
+layout(local_size_x = 64) in;
+void main()
+{
+  const uint i = gl_GlobalInvocationID.x;
+  if (i >= numLights)
+  {
+    return;
+  }
+
+  const uint lightIndex = d_keys[i].y;
+  const GpuLight light = d_lights[lightIndex];
+  const uint leaf = numLights - 1 + i;
+  vec3 boundsMin;
+  vec3 boundsMax;
+  LightBvh_GetLightBounds(light, boundsMin, boundsMax);
+  d_nodes[leaf].boundsMin = boundsMin;
+  d_nodes[leaf].boundsMax = boundsMax;
+  d_nodes[leaf].left = lightIndex;
+  d_nodes[leaf].right = LIGHT_BVH_LEAF;
+  d_nodes[leaf].power = LightBvh_GetLightPower(light);
+
+  uint node = d_nodes[leaf].parent;
+  while (node != LIGHT_BVH_INVALID_NODE)
+  {
+    // Make this invocation's writes visible before signaling that they're done, and the other child's writes visible after
+    memoryBarrierBuffer();
+    if (atomicAdd(d_refitCounters[node], 1) == 0)
+    {
+      return;
+    }
+    memoryBarrierBuffer();
+
+    const LightBvhNode left = d_nodes[d_nodes[node].left];
+    const LightBvhNode right = d_nodes[d_nodes[node].right];
+    d_nodes[node].boundsMin = min(left.boundsMin, right.boundsMin);
+    d_nodes[node].boundsMax = max(left.boundsMax, right.boundsMax);
+    d_nodes[node].power = left.power + right.power;
+    node = d_nodes[node].parent;
+  }
+}
@@ -0,0 +1,82 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#include "LightBvhBuild.h.glsl"
+
+// Bitonic sort of the keys by Morton code, then by light index.
+// Steps that compare keys less than LIGHT_BVH_SORT_GROUP_KEYS apart are done in shared memory
+
+shared uvec2 sh_keys[LIGHT_BVH_SORT_GROUP_KEYS];
+
+bool Greater(uvec2 a, uvec2 b)
+{
+  return a.x > b.x || (a.x == b.x && a.y > b.y);
+}
+
+// Compares and swaps sh_keys[i] and sh_keys[i + j] for one step of the k merge, for every pair in the group
+void LocalStep(uint groupBase, uint k, uint j)
+{
+  const uint t = gl_LocalInvocationIndex;
+  const uint i = 2 * j * (t / j) + t % j;
+  const bool ascending = ((groupBase + i) & k) == 0;
+  const uvec2 a = sh_keys[i];
+  const uvec2 b = sh_keys[i + j];
+  if (Greater(a, b) == ascending)
+  {
+    sh_keys[i] = b;
+    sh_keys[i + j] = a;
+  }
+}
+
+layout(local_size_x = LIGHT_BVH_SORT_GROUP_KEYS / 2) in;
+void main()
+{
+  if (sortMode == LIGHT_BVH_SORT_MODE_GLOBAL_STEP)
+  {
+    const uint t = gl_GlobalInvocationID.x;
+    const uint i = 2 * sortJ * (t / sortJ) + t % sortJ;
+    if (i + sortJ >= sortCount)
+    {
+      return;
+    }
+
+    const bool ascending = (i & sortK) == 0;
+    const uvec2 a = d_keys[i];
+    const uvec2 b = d_keys[i + sortJ];
+    if (Greater(a, b) == ascending)
+    {
+      d_keys[i] = b;
+      d_keys[i + sortJ] = a;
+    }
+    return;
+  }
+
+  const uint groupBase = gl_WorkGroupID.x * LIGHT_BVH_SORT_GROUP_KEYS;
+  const uint t = gl_LocalInvocationIndex;
+  sh_keys[t] = d_keys[groupBase + t];
+  sh_keys[t + gl_WorkGroupSize.x] = d_keys[groupBase + t + gl_WorkGroupSize.x];
+
+  if (sortMode == LIGHT_BVH_SORT_MODE_LOCAL)
+  {
+    for (uint k = 2; k <= LIGHT_BVH_SORT_GROUP_KEYS; k *= 2)
+    {
+      for (uint j = k / 2; j > 0; j /= 2)
+      {
+        barrier();
+        LocalStep(groupBase, k, j);
+      }
+    }
+  }
+  else // LIGHT_BVH_SORT_MODE_LOCAL_MERGE
+  {
+    for (uint j = LIGHT_BVH_SORT_GROUP_KEYS / 2; j > 0; j /= 2)
+    {
+      barrier();
+      LocalStep(groupBase, sortK, j);
+    }
+  }
+
+  barrier();
+  d_keys[groupBase + t] = sh_keys[t];
+  d_keys[groupBase + t + gl_WorkGroupSize.x] = sh_keys[t + gl_WorkGroupSize.x];
+}
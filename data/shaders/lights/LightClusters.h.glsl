@@ -0,0 +1,105 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include "../Resources.h.glsl"
+
+// The view frustum is divided into a grid of clusters: screen space tiles, each split into slices along view depth.
+// AssignLightsToClusters.comp lists the lights that can reach each cluster, so shading only evaluates those.
+// The first slice starts at the camera and the last slice extends to infinity. The slices between are exponentially
+// distributed from nearDepth to farDepth, so clusters are roughly cube-shaped
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+// Lights past this many in one cluster are dropped
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+// The light index list is sized for this many lights per cluster on average. Clusters that don't fit are truncated
+#define AVERAGE_LIGHTS_PER_CLUSTER 32
+
+// Stands in for the infinite far bound of the last slice
+#define LIGHT_CLUSTER_MAX_DEPTH 1e30
+
+struct LightClusterUniforms
+{
+  FVOG_MAT4 view;
+  FVOG_MAT4 invProj;
+  FVOG_FLOAT nearDepth; // View depth at which the second slice starts
+  FVOG_FLOAT farDepth;  // View depth at which the last slice starts
+  FVOG_UINT32 numLights;
+  FVOG_UINT32 indexCapacity;
+};
+
+// Range in the light index list
+struct LightCluster
+{
+  FVOG_UINT32 offset;
+  FVOG_UINT32 count;
+};
+
+#ifndef __cplusplus
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly LightClusterUniformsBuffer)
+{
+  LightClusterUniforms uniforms;
+} lightClusterUniformsBuffers[];
+
+#define d_lightClusterUniforms lightClusterUniformsBuffers[lightClusterUniformsIndex].uniforms
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict LightClustersBuffer)
+{
+  LightCluster clusters[];
+} lightClustersBuffers[];
+
+#define d_lightClusters lightClustersBuffers[lightClustersIndex].clusters
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict LightIndicesBuffer)
+{
+  uint count; // Indices requested by every cluster. May exceed indexCapacity
+  uint indices[];
+} lightIndicesBuffers[];
+
+#define d_lightIndices lightIndicesBuffers[lightIndicesIndex]
+
+uint GetLightClusterSlice(float viewDepth, float nearDepth, float farDepth)
+{
+  if (viewDepth < nearDepth)
+  {
+    return 0;
+  }
+
+  const float slice = 1.0 + log(viewDepth / nearDepth) / log(farDepth / nearDepth) * (LIGHT_CLUSTERS_Z - 2);
+  return min(uint(slice), LIGHT_CLUSTERS_Z - 1);
+}
+
+// View depth at which a slice starts
+float GetLightClusterSliceStart(uint slice, float nearDepth, float farDepth)
+{
+  if (slice == 0)
+  {
+    return 0;
+  }
+
+  if (slice >= LIGHT_CLUSTERS_Z)
+  {
+    return LIGHT_CLUSTER_MAX_DEPTH;
+  }
+
+  return nearDepth * pow(farDepth / nearDepth, float(slice - 1) / (LIGHT_CLUSTERS_Z - 2));
+}
+
+uint GetLightClusterIndex(uvec3 cluster)
+{
+  return cluster.x + cluster.y * LIGHT_CLUSTERS_X + cluster.z * LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y;
+}
+
+uvec3 GetLightCluster(vec2 uv, float viewDepth, float nearDepth, float farDepth)
+{
+  const uvec2 tile = min(uvec2(uv * vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y)), uvec2(LIGHT_CLUSTERS_X - 1, LIGHT_CLUSTERS_Y - 1));
+  return uvec3(tile, GetLightClusterSlice(viewDepth, nearDepth, farDepth));
+}
+
+#endif // !__cplusplus
+
+#endif // LIGHT_CLUSTERS_H
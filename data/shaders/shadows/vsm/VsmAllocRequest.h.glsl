@@ -10,7 +10,7 @@ struct VsmPageAllocRequest
   // Address of the requester
   ivec3 pageTableAddress;
 
-  // Unused until local lights are supported
+  // LOD level of local lights, which only use part of their table. Clipmaps are always level 0
   uint pageTableLevel;
 };
 
@@ -48,4 +48,32 @@ bool TryPushAllocRequest(VsmPageAllocRequest request)
   return true;
 }
 
+// Flags a page as visible this frame. Backed pages are kept from being reallocated, and unbacked pages request an allocation
+void MarkPageVisible(ivec3 pageAddress, uint pageTableLevel)
+{
+  const uint pageData = imageAtomicOr(i_pageTables, pageAddress, PAGE_VISIBLE_BIT);
+
+  if ((vsmUniforms.debugFlags & VSM_FORCE_DIRTY_VISIBLE_PAGES) != 0)
+  {
+    imageAtomicOr(i_pageTables, pageAddress, PAGE_DIRTY_BIT);
+  }
+
+  if (!GetIsPageVisible(pageData))
+  {
+    if (GetIsPageBacked(pageData))
+    {
+      // Mark visible in bitmask so allocator doesn't overwrite
+      const uint physicalAddress = GetPagePhysicalAddress(pageData);
+      atomicOr(visiblePagesBitmask.data[physicalAddress / 32], 1 << (physicalAddress % 32));
+    }
+    else // Page fault
+    {
+      VsmPageAllocRequest request;
+      request.pageTableAddress = pageAddress;
+      request.pageTableLevel = pageTableLevel;
+      TryPushAllocRequest(request);
+    }
+  }
+}
+
 #endif // VSM_ALLOC_REQUEST_H
\ No newline at end of file
@@ -47,6 +47,54 @@ FVOG_DECLARE_ARGUMENTS(VsmPushConstants)
   FVOG_UINT32 physicalPagesUintIndex;
 
   FVOG_UINT32 physicalPagesOverdrawIndex;
+
+  // VsmMarkDirtyBounds
+  FVOG_UINT32 dirtyBoundsIndex;
+  FVOG_UINT32 numDirtyBounds;
+};
+#endif
+
+// World-space bounds of a caster that moved, appeared, or disappeared. Every backed page they overlap is redrawn
+struct VsmDirtyBounds
+{
+  FVOG_VEC3 boundsMin;
+  FVOG_UINT32 _padding0;
+  FVOG_VEC3 boundsMax;
+  FVOG_UINT32 _padding1;
+};
+
+// Point lights have a view for each cube face, in the order +X, -X, +Y, -Y, +Z, -Z. Spot lights have one
+#define VSM_POINT_LIGHT_VIEWS 6
+
+// Marks lights without a shadow in the light to view table
+#define VSM_NO_LOCAL_VIEW 0xFFFFFFFFu
+
+// Perspective view of a local light's VSM. Each view has its own page table layer.
+// The LOD level shrinks the virtual extent: only the first (page table size >> tableLevel) pages on each side of the layer are used
+struct VsmLocalView
+{
+  FVOG_MAT4 viewProj; // Depth is not reversed
+  FVOG_UINT32 tableIndex;
+  FVOG_UINT32 tableLevel;
+  FVOG_FLOAT texelSizeAtUnitDistance; // World-space width of a shadow texel one unit from the light
+  FVOG_UINT32 _padding;
+};
+
+#if defined(__cplusplus) || defined(VSM_MARK_LOCAL_PAGES_PUSH_CONSTANTS)
+FVOG_DECLARE_ARGUMENTS(VsmMarkLocalPagesPushConstants)
+{
+  FVOG_UINT32 globalUniformsIndex;
+  FVOG_UINT32 gDepthIndex;
+  FVOG_UINT32 pageTablesIndex;
+  FVOG_UINT32 vsmUniformsBufferIndex;
+  FVOG_UINT32 allocRequestsIndex;
+  FVOG_UINT32 visiblePagesBitmaskIndex;
+  FVOG_UINT32 lightBufferIndex;
+  FVOG_UINT32 lightClusterUniformsIndex;
+  FVOG_UINT32 lightClustersIndex;
+  FVOG_UINT32 lightIndicesIndex;
+  FVOG_UINT32 vsmLocalViewsIndex;
+  FVOG_UINT32 vsmLocalLightViewsIndex;
 };
 #endif
 
@@ -109,6 +157,20 @@ FVOG_DECLARE_STORAGE_BUFFERS(VsmDirtyPageList)
   uint data[];
 }dirtyPageListBuffers[];
 
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly VsmLocalViewsBuffer)
+{
+  VsmLocalView views[];
+}vsmLocalViewsBuffers[];
+
+// First view of each light in the light buffer, or VSM_NO_LOCAL_VIEW
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly VsmLocalLightViewsBuffer)
+{
+  uint firstViews[];
+}vsmLocalLightViewsBuffers[];
+
+#define d_vsmLocalViews vsmLocalViewsBuffers[vsmLocalViewsIndex].views
+#define d_vsmLocalLightViews vsmLocalLightViewsBuffers[vsmLocalLightViewsIndex].firstViews
+
 ////////////// Helpers
 bool GetIsPageVisible(uint pageData)
 {
@@ -217,6 +279,65 @@ bool CullQuadVsm(vec2 minXY, vec2 maxXY, uint virtualTableIndex)
   return false;
 }
 
+// Clipmaps wrap around their page tables, but local views don't, so the bounds are clamped to the view before being scaled to the used part of the table
+bool CullQuadVsmLocal(vec2 minXY, vec2 maxXY, uint virtualTableIndex, uint virtualTableLevel)
+{
+  const float scale = 1.0 / float(1u << virtualTableLevel);
+  const vec2 clampedMin = clamp(minXY, vec2(0), vec2(0.99999)) * scale;
+  const vec2 clampedMax = clamp(maxXY, vec2(0), vec2(0.99999)) * scale;
+  return CullQuadVsm(clampedMin, clampedMax, virtualTableIndex);
+}
+
+// Picks the cube face that contains the direction for point lights
+uint GetVsmLocalViewIndex(uint firstView, bool isPointLight, vec3 lightToPosition)
+{
+  if (!isPointLight)
+  {
+    return firstView;
+  }
+
+  const vec3 a = abs(lightToPosition);
+  if (a.x >= a.y && a.x >= a.z)
+  {
+    return firstView + (lightToPosition.x >= 0 ? 0 : 1);
+  }
+  if (a.y >= a.z)
+  {
+    return firstView + (lightToPosition.y >= 0 ? 2 : 3);
+  }
+  return firstView + (lightToPosition.z >= 0 ? 4 : 5);
+}
+
+struct VsmLocalPageInfo
+{
+  ivec3 pageAddress;
+  ivec2 pageTexel;
+  float projectedDepth;
+};
+
+// Returns false if the position is outside the view
+bool GetVsmLocalPage(VsmLocalView view, vec3 posW, out VsmLocalPageInfo info)
+{
+  const vec4 posLightC = view.viewProj * vec4(posW, 1.0);
+  if (posLightC.w <= 0)
+  {
+    return false;
+  }
+
+  const vec3 posLightNdc = posLightC.xyz / posLightC.w;
+  if (any(greaterThan(abs(posLightNdc.xy), vec2(1))) || posLightNdc.z < 0 || posLightNdc.z > 1)
+  {
+    return false;
+  }
+
+  const int extent = (imageSize(i_pageTables).x >> view.tableLevel) * PAGE_SIZE;
+  const ivec2 texel = min(ivec2((posLightNdc.xy * 0.5 + 0.5) * extent), ivec2(extent - 1));
+  info.pageAddress = ivec3(texel / PAGE_SIZE, view.tableIndex);
+  info.pageTexel = texel % PAGE_SIZE;
+  info.projectedDepth = posLightNdc.z;
+  return true;
+}
+
 struct PageAddressInfo
 {
   ivec3 pageAddress;
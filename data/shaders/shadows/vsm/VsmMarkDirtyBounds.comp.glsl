@@ -0,0 +1,65 @@
+#version 450 core
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "../../Math.h.glsl"
+#include "../../GlobalUniforms.h.glsl"
+#include "VsmCommon.h.glsl"
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly VsmDirtyBoundsBuffer)
+{
+  VsmDirtyBounds data[];
+}dirtyBoundsBuffers[];
+
+#define dirtyBounds dirtyBoundsBuffers[dirtyBoundsIndex]
+
+// One workgroup per pair of bounds and clipmap. Depth is ignored, so every page the bounds cover in light space is invalidated
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main()
+{
+  const uint boundsIndex = gl_WorkGroupID.x;
+  const uint clipmapLevel = gl_WorkGroupID.y;
+
+  if (boundsIndex >= numDirtyBounds || clipmapLevel >= clipmapUniforms.numClipmaps)
+  {
+    return;
+  }
+
+  const VsmDirtyBounds bounds = dirtyBounds.data[boundsIndex];
+  const mat4 viewProj = clipmapUniforms.clipmapViewProjections[clipmapLevel];
+
+  // Project the corners with the stable clipmap matrix and leave the UVs unwrapped, so the covered range of pages is contiguous
+  vec2 uvMin = vec2(1e30);
+  vec2 uvMax = vec2(-1e30);
+  for (uint i = 0; i < 8; i++)
+  {
+    const vec3 corner = mix(bounds.boundsMin, bounds.boundsMax, bvec3(i & 1u, i & 2u, i & 4u));
+    const vec4 posLightC = viewProj * vec4(corner, 1.0);
+    const vec2 uv = posLightC.xy / posLightC.w * 0.5 + 0.5;
+    uvMin = min(uvMin, uv);
+    uvMax = max(uvMax, uv);
+  }
+
+  const ivec2 tableSize = imageSize(i_pageTables).xy;
+  const ivec2 pageMin = ivec2(floor(uvMin * tableSize));
+  // Bounds covering more than the table would touch every page, possibly more than once
+  const ivec2 pageCount = min(ivec2(floor(uvMax * tableSize)) - pageMin + 1, tableSize);
+  const uint clipmapIndex = clipmapUniforms.clipmapTableIndices[clipmapLevel];
+
+  for (int y = int(gl_LocalInvocationID.y); y < pageCount.y; y += int(gl_WorkGroupSize.y))
+  {
+    for (int x = int(gl_LocalInvocationID.x); x < pageCount.x; x += int(gl_WorkGroupSize.x))
+    {
+      // Pages wrap around the table the same way as in GetClipmapPageFromDepth
+      const ivec2 pageAddressXy = ivec2(mod(vec2(pageMin + ivec2(x, y)), vec2(tableSize)));
+      const ivec3 pageAddress = ivec3(pageAddressXy, clipmapIndex);
+
+      // Unbacked pages are dirtied when they are allocated, and already dirty pages need no atomic
+      const uint pageData = imageLoad(i_pageTables, pageAddress).x;
+      if (GetIsPageBacked(pageData) && !GetIsPageDirty(pageData))
+      {
+        imageAtomicOr(i_pageTables, pageAddress, PAGE_DIRTY_BIT);
+      }
+    }
+  }
+}
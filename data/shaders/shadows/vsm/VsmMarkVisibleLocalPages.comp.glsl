@@ -0,0 +1,73 @@
+#version 450 core
+
+#extension GL_GOOGLE_include_directive : enable
+
+#include "../../Config.shared.h"
+#include "../../ShadeDeferredPbr.h.glsl"
+#define VSM_NO_PUSH_CONSTANTS
+#define VSM_MARK_LOCAL_PAGES_PUSH_CONSTANTS
+#include "VsmCommon.h.glsl"
+#include "VsmAllocRequest.h.glsl"
+#include "../../lights/LightClusters.h.glsl"
+
+FVOG_DECLARE_SAMPLED_IMAGES(texture2D);
+
+#define s_gDepth FvogGetSampledImage(texture2D, gDepthIndex)
+
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly LightBuffer)
+{
+  GpuLight lights[];
+}lightBuffers[];
+
+#define d_lightBuffer lightBuffers[lightBufferIndex]
+
+// Only lights listed in a pixel's cluster can reach it, so only their views are considered
+layout(local_size_x = 8, local_size_y = 8) in;
+void main()
+{
+  const ivec2 gid = ivec2(gl_GlobalInvocationID.xy);
+  const ivec2 depthSize = textureSize(s_gDepth, 0);
+
+  if (any(greaterThanEqual(gid, depthSize)))
+  {
+    return;
+  }
+
+  const float depthSample = texelFetch(s_gDepth, gid, 0).x;
+
+  if (depthSample == FAR_DEPTH)
+  {
+    return;
+  }
+
+  const vec2 uv = (vec2(gid) + 0.5) / depthSize;
+  const vec3 posW = UnprojectUV_ZO(depthSample, uv, perFrameUniforms.invViewProj);
+  const float viewDepth = -(d_lightClusterUniforms.view * vec4(posW, 1.0)).z;
+  const uvec3 clusterId = GetLightCluster(uv, viewDepth, d_lightClusterUniforms.nearDepth, d_lightClusterUniforms.farDepth);
+  const LightCluster cluster = d_lightClusters[GetLightClusterIndex(clusterId)];
+
+  for (uint i = 0; i < cluster.count; i++)
+  {
+    const uint lightIndex = d_lightIndices.indices[cluster.offset + i];
+    const uint firstView = d_vsmLocalLightViews[lightIndex];
+    if (firstView == VSM_NO_LOCAL_VIEW)
+    {
+      continue;
+    }
+
+    const GpuLight light = d_lightBuffer.lights[lightIndex];
+    const VsmLocalView view = d_vsmLocalViews[GetVsmLocalViewIndex(firstView, light.type == LIGHT_TYPE_POINT, posW - light.position)];
+
+    VsmLocalPageInfo info;
+    if (!GetVsmLocalPage(view, posW, info))
+    {
+      continue;
+    }
+
+    // Neighboring pixels mostly hit the same pages, so skip the atomic when another pixel got there first
+    if (!GetIsPageVisible(imageLoad(i_pageTables, info.pageAddress).x))
+    {
+      MarkPageVisible(info.pageAddress, view.tableLevel);
+    }
+  }
+}
@@ -45,29 +45,7 @@ void main()
     {
       if (subgroupElect())
       {
-        const uint pageData = imageAtomicOr(i_pageTables, addr.pageAddress, PAGE_VISIBLE_BIT);
-
-        if ((vsmUniforms.debugFlags & VSM_FORCE_DIRTY_VISIBLE_PAGES) != 0)
-        {
-          imageAtomicOr(i_pageTables, addr.pageAddress, PAGE_DIRTY_BIT);
-        }
-
-        if (!GetIsPageVisible(pageData))
-        {
-          if (GetIsPageBacked(pageData))
-          {
-            // Mark visible in bitmask so allocator doesn't overwrite
-            const uint physicalAddress = GetPagePhysicalAddress(pageData);
-            atomicOr(visiblePagesBitmask.data[physicalAddress / 32], 1 << (physicalAddress % 32));
-          }
-          else // Page fault
-          {
-            VsmPageAllocRequest request;
-            request.pageTableAddress = addr.pageAddress;
-            request.pageTableLevel = 0; // TODO: change for lower-res mipmaps
-            TryPushAllocRequest(request);
-          }
-        }
+        MarkPageVisible(addr.pageAddress, 0);
       }
       //break;
       loop = false;
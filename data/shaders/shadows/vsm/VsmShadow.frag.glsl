@@ -55,10 +55,15 @@ void main()
   }
 #endif
 
-  const uint clipmapIndex = clipmapUniforms.clipmapTableIndices[clipmapLod];
-  const ivec2 pageOffset = clipmapUniforms.clipmapPageOffsets[clipmapLod];
-  const ivec2 pageAddressXy = ivec2(mod(vec2(ivec2(gl_FragCoord.xy) / PAGE_SIZE + pageOffset), vec2(imageSize(i_pageTables).xy)));
-  const uint pageData = imageLoad(i_pageTables, ivec3(pageAddressXy, clipmapIndex)).x;
+  // Local views are rendered at their LOD's extent, so their pages map directly to the start of their table
+  ivec3 pageAddress = ivec3(ivec2(gl_FragCoord.xy) / PAGE_SIZE, d_currentView.virtualTableIndex);
+  if (d_currentView.type != VIEW_TYPE_VIRTUAL_LOCAL)
+  {
+    const uint clipmapIndex = clipmapUniforms.clipmapTableIndices[clipmapLod];
+    const ivec2 pageOffset = clipmapUniforms.clipmapPageOffsets[clipmapLod];
+    pageAddress = ivec3(ivec2(mod(vec2(ivec2(gl_FragCoord.xy) / PAGE_SIZE + pageOffset), vec2(imageSize(i_pageTables).xy))), clipmapIndex);
+  }
+  const uint pageData = imageLoad(i_pageTables, pageAddress).x;
   if (GetIsPageBacked(pageData) && GetIsPageDirty(pageData))
   {
     const ivec2 pageTexel = ivec2(gl_FragCoord.xy) % PAGE_SIZE;
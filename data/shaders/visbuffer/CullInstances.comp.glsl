@@ -0,0 +1,52 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#define VISBUFFER_NO_PUSH_CONSTANTS
+#include "CullMeshlets.h.glsl"
+#include "VisbufferCommon.h.glsl"
+#include "Frustum.h.glsl"
+
+// Culls whole meshes, then splits the meshlets of those that survive into chunks for CullMeshlets.comp
+layout (local_size_x = 128) in;
+void main()
+{
+  const uint meshInstanceId = gl_GlobalInvocationID.x;
+
+  if (meshInstanceId >= d_perFrameUniforms.meshInstanceCount)
+  {
+    return;
+  }
+
+  const GpuMeshInstance meshInstance = d_meshInstances[meshInstanceId];
+
+  if (IsCullFlagEnabled(CULL_MESHLET_FRUSTUM))
+  {
+    const mat4 transform = d_transforms[meshInstance.instanceId].modelCurrent;
+#ifdef CULL_MULTI_VIEW
+    // The chunks are shared by all views, so a mesh is kept if any of them sees it
+    bool isInAnyView = false;
+    for (uint i = 0; i < viewCount && !isInAnyView; i++)
+    {
+      isInAnyView = IsObjectAabbInFrustum(PackedToVec3(meshInstance.aabbMin), PackedToVec3(meshInstance.aabbMax), transform, d_views[i]);
+    }
+
+    if (!isInAnyView)
+    {
+      return;
+    }
+#else
+    if (!IsObjectAabbInFrustum(PackedToVec3(meshInstance.aabbMin), PackedToVec3(meshInstance.aabbMax), transform, d_currentView))
+    {
+      return;
+    }
+#endif
+  }
+
+  const uint chunkCount = (meshInstance.meshletCount + MESHLET_CULL_CHUNK_SIZE - 1) / MESHLET_CULL_CHUNK_SIZE;
+  const uint firstChunk = atomicAdd(d_meshletCullChunks.groupCountX, chunkCount);
+  for (uint i = 0; i < chunkCount; i++)
+  {
+    const uint firstMeshlet = i * MESHLET_CULL_CHUNK_SIZE;
+    d_meshletCullChunks.chunks[firstChunk + i] = uvec2(meshInstance.meshletInstanceOffset + firstMeshlet, min(MESHLET_CULL_CHUNK_SIZE, meshInstance.meshletCount - firstMeshlet));
+  }
+}
@@ -7,11 +7,11 @@
 #include "CullMeshlets.h.glsl"
 
 #include "VisbufferCommon.h.glsl"
+#include "Frustum.h.glsl"
 #include "../hzb/HZBCommon.h.glsl"
 #include "../shadows/vsm/VsmCommon.h.glsl"
 
-#define ENABLE_DEBUG_DRAWING
-
+// ENABLE_DEBUG_DRAWING is defined by the host for the variant that is used while debug AABBs or rects are shown
 #ifdef ENABLE_DEBUG_DRAWING
 
 #include "../debug/DebugCommon.h.glsl"
@@ -58,21 +58,12 @@ void DebugDrawMeshletAabb(in uint meshletInstanceId)
 FVOG_DECLARE_SAMPLERS;
 FVOG_DECLARE_SAMPLED_IMAGES(texture2D);
 
-FVOG_DECLARE_STORAGE_BUFFERS(restrict CullTrianglesDispatchParams)
+FVOG_DECLARE_STORAGE_BUFFERS(restrict MeshletVisibilityBuffer)
 {
-  uint groupCountX;
-  uint groupCountY;
-  uint groupCountZ;
-} cullTrianglesDispatchBuffers[];
+  uint bits[];
+} meshletVisibilityBuffers[];
 
-#define d_cullTrianglesDispatch cullTrianglesDispatchBuffers[cullTrianglesDispatchIndex]
-
-bool IsAABBInsidePlane(in vec3 center, in vec3 extent, in vec4 plane)
-{
-  const vec3 normal = plane.xyz;
-  const float radius = dot(extent, abs(normal));
-  return (dot(normal, center) - plane.w) >= -radius;
-}
+#define d_meshletVisibility meshletVisibilityBuffers[meshletVisibilityIndex].bits
 
 struct GetMeshletUvBoundsParams
 {
@@ -178,64 +169,114 @@ bool CullQuadHiz(vec2 minXY, vec2 maxXY, float nearestZ)
 bool CullMeshletFrustum(uint meshletInstanceId, View view)
 {
   const MeshletInstance meshletInstance = d_meshletInstances[meshletInstanceId];
-  const uint meshletId = meshletInstance.meshletId;
-  const Meshlet meshlet = d_meshlets[meshletId];
-  const uint instanceId = meshletInstance.instanceId;
-  const mat4 transform = d_transforms[instanceId].modelCurrent;
-  const vec3 aabbMin = PackedToVec3(meshlet.aabbMin);
-  const vec3 aabbMax = PackedToVec3(meshlet.aabbMax);
-  const vec3 aabbCenter = (aabbMin + aabbMax) / 2.0;
-  const vec3 aabbExtent = aabbMax - aabbCenter;
-  const vec3 worldAabbCenter = vec3(transform * vec4(aabbCenter, 1.0));
-  const vec3 right = vec3(transform[0]) * aabbExtent.x;
-  const vec3 up = vec3(transform[1]) * aabbExtent.y;
-  const vec3 forward = vec3(-transform[2]) * aabbExtent.z;
-
-  const vec3 worldExtent = vec3(
-    abs(dot(vec3(1.0, 0.0, 0.0), right)) +
-    abs(dot(vec3(1.0, 0.0, 0.0), up)) +
-    abs(dot(vec3(1.0, 0.0, 0.0), forward)),
-
-    abs(dot(vec3(0.0, 1.0, 0.0), right)) +
-    abs(dot(vec3(0.0, 1.0, 0.0), up)) +
-    abs(dot(vec3(0.0, 1.0, 0.0), forward)),
-
-    abs(dot(vec3(0.0, 0.0, 1.0), right)) +
-    abs(dot(vec3(0.0, 0.0, 1.0), up)) +
-    abs(dot(vec3(0.0, 0.0, 1.0), forward)));
-  for (uint i = 0; i < 6; ++i)
+  const Meshlet meshlet = d_meshlets[meshletInstance.meshletId];
+  const mat4 transform = d_transforms[meshletInstance.instanceId].modelCurrent;
+  return IsObjectAabbInFrustum(PackedToVec3(meshlet.aabbMin), PackedToVec3(meshlet.aabbMax), transform, view);
+}
+
+#ifdef CULL_MULTI_VIEW
+// Frustum and VSM page test of a meshlet in a sun clipmap or local light view
+bool IsMeshletVisibleInVirtualView(uint meshletInstanceId, View view)
+{
+  if (IsCullFlagEnabled(CULL_MESHLET_FRUSTUM) && !CullMeshletFrustum(meshletInstanceId, view))
   {
-    if (!IsAABBInsidePlane(worldAabbCenter, worldExtent, view.frustumPlanes[i]))
-    {
-      return false;
-    }
+    return false;
   }
 
-  return true;
+  GetMeshletUvBoundsParams params;
+  params.meshletInstanceId = meshletInstanceId;
+  params.viewProj = view.type == VIEW_TYPE_VIRTUAL ? view.viewProjStableForVsmOnly : view.viewProj;
+  params.clampNdc = view.type == VIEW_TYPE_VIRTUAL_LOCAL;
+  params.reverseZ = false;
+
+  vec2 minXY;
+  vec2 maxXY;
+  float nearestZ;
+  bool intersectsNearPlane;
+  GetMeshletUvBounds(params, minXY, maxXY, nearestZ, intersectsNearPlane);
+  if (intersectsNearPlane)
+  {
+    return true;
+  }
+
+  if (view.type == VIEW_TYPE_VIRTUAL)
+  {
+    return CullQuadVsm(minXY, maxXY, view.virtualTableIndex);
+  }
+
+  return CullQuadVsmLocal(minXY, maxXY, view.virtualTableIndex, view.virtualTableLevel);
 }
 
-layout (local_size_x = 128) in;
+// Culls each meshlet against every view in d_views. View i's visible meshlets are written to its own range of the
+// visible list, starting at i * meshletCount, and their indices are added to the view's budget
+layout (local_size_x = MESHLET_CULL_CHUNK_SIZE) in;
 void main()
 {
-  const uint meshletInstanceId = gl_GlobalInvocationID.x;
+  const uvec2 chunk = d_meshletCullChunks.chunks[gl_WorkGroupID.x];
+  if (gl_LocalInvocationID.x >= chunk.y)
+  {
+    return;
+  }
+
+  const uint meshletInstanceId = chunk.x + gl_LocalInvocationID.x;
+  const uint indexCount = d_meshlets[d_meshletInstances[meshletInstanceId].meshletId].primitiveCount * 3;
 
-  if (meshletInstanceId >= d_perFrameUniforms.meshletCount)
+  for (uint viewId = 0; viewId < viewCount; viewId++)
+  {
+    if (IsMeshletVisibleInVirtualView(meshletInstanceId, d_views[viewId]))
+    {
+      const uint idx = atomicAdd(d_multiViewCull.visibleMeshletCounts[viewId], 1);
+      atomicAdd(d_multiViewCull.indexBudgets[viewId], indexCount);
+      d_visibleMeshlets.indices[viewId * d_perFrameUniforms.meshletCount + idx] = meshletInstanceId;
+    }
+  }
+}
+#else
+layout (local_size_x = MESHLET_CULL_CHUNK_SIZE) in;
+void main()
+{
+  // Triangles of meshlets drawn by the late phase are appended after those of the early phase
+  if (cullPhase == CULL_PHASE_LATE && gl_GlobalInvocationID.x == 0)
+  {
+    d_indirectCommands[1].firstIndex = d_indirectCommands[0].indexCount;
+  }
+
+  // Only meshlets of meshes that passed instance culling are visited. Visibility bits of the others are left as they were,
+  // which at worst makes the early phase draw a few occluded meshlets when their mesh comes back into view
+  const uvec2 chunk = d_meshletCullChunks.chunks[gl_WorkGroupID.x];
+  if (gl_LocalInvocationID.x >= chunk.y)
   {
     return;
   }
 
-  const MeshletInstance meshletInstance = d_meshletInstances[meshletInstanceId];
+  const uint meshletInstanceId = chunk.x + gl_LocalInvocationID.x;
 
-  if ((d_perFrameUniforms.flags & CULL_MESHLET_FRUSTUM) == 0 || CullMeshletFrustum(meshletInstanceId, d_currentView))
+  const uint visibilityBit = 1u << (meshletInstanceId % 32);
+  bool wasVisible = false;
+  if (cullPhase != CULL_PHASE_SINGLE)
+  {
+    wasVisible = (d_meshletVisibility[meshletInstanceId / 32] & visibilityBit) != 0;
+  }
+
+  // The early phase only draws meshlets that were visible last frame
+  if (cullPhase == CULL_PHASE_EARLY && !wasVisible)
+  {
+    return;
+  }
+
+  bool isVisible = false;
+  vec2 minXY;
+  vec2 maxXY;
+  float nearestZ;
+  if (!IsCullFlagEnabled(CULL_MESHLET_FRUSTUM) || CullMeshletFrustum(meshletInstanceId, d_currentView))
   {
-    bool isVisible = false;
-    
     GetMeshletUvBoundsParams params;
     params.meshletInstanceId = meshletInstanceId;
 
     if (d_currentView.type == VIEW_TYPE_MAIN)
     {
-      params.viewProj = d_perFrameUniforms.oldViewProjUnjittered;
+      // The late phase tests against an HZB built from this frame's early depth
+      params.viewProj = d_perFrameUniforms.viewProjUnjittered;
       params.clampNdc = true;
       params.reverseZ = bool(REVERSE_Z);
     }
@@ -245,10 +286,13 @@ void main()
       params.clampNdc = false;
       params.reverseZ = false;
     }
+    else if (d_currentView.type == VIEW_TYPE_VIRTUAL_LOCAL)
+    {
+      params.viewProj = d_currentView.viewProj;
+      params.clampNdc = true;
+      params.reverseZ = false;
+    }
 
-    vec2 minXY;
-    vec2 maxXY;
-    float nearestZ;
     bool intersectsNearPlane;
     GetMeshletUvBounds(params, minXY, maxXY, nearestZ, intersectsNearPlane);
     isVisible = intersectsNearPlane;
@@ -257,7 +301,8 @@ void main()
     {
       if (d_currentView.type == VIEW_TYPE_MAIN)
       {
-        if ((d_perFrameUniforms.flags & CULL_MESHLET_HIZ) == 0)
+        // There is no HZB for this frame yet in the early phase, so meshlets that were visible last frame are only frustum culled
+        if (cullPhase != CULL_PHASE_LATE || !IsCullFlagEnabled(CULL_MESHLET_HIZ))
         {
           isVisible = true;
         }
@@ -271,27 +316,55 @@ void main()
       {
         isVisible = CullQuadVsm(minXY, maxXY, d_currentView.virtualTableIndex);
       }
+      else if (d_currentView.type == VIEW_TYPE_VIRTUAL_LOCAL)
+      {
+        isVisible = CullQuadVsmLocal(minXY, maxXY, d_currentView.virtualTableIndex, d_currentView.virtualTableLevel);
+      }
+    }
+  }
+
+  if (cullPhase == CULL_PHASE_LATE)
+  {
+    // Only the late phase sees every meshlet, so it decides what the early phase draws next frame
+    if (isVisible != wasVisible)
+    {
+      atomicXor(d_meshletVisibility[meshletInstanceId / 32], visibilityBit);
     }
+
+    // Already drawn by the early phase
+    if (wasVisible)
+    {
+      return;
+    }
+  }
     
-    if (isVisible)
+  if (isVisible)
+  {
+    uint idx;
+    if (cullPhase == CULL_PHASE_LATE)
+    {
+      idx = d_cullTrianglesDispatch[0].groupCountX + atomicAdd(d_cullTrianglesDispatch[1].groupCountX, 1);
+    }
+    else
     {
-      const uint idx = atomicAdd(d_cullTrianglesDispatch.groupCountX, 1);
-      d_visibleMeshlets.indices[idx] = meshletInstanceId;
+      idx = atomicAdd(d_cullTrianglesDispatch[0].groupCountX, 1);
+    }
+    d_visibleMeshlets.indices[idx] = meshletInstanceId;
 
  #ifdef ENABLE_DEBUG_DRAWING
-      if (d_currentView.type == VIEW_TYPE_MAIN)
-      {
-        DebugDrawMeshletAabb(meshletInstanceId);
-        DebugRect rect;
-        rect.minOffset = Vec2ToPacked(minXY);
-        rect.maxOffset = Vec2ToPacked(maxXY);
-        const float GOLDEN_CONJ = 0.6180339887498948482045868343656;
-        vec4 color = vec4(2.0 * hsv_to_rgb(vec3(float(meshletInstanceId) * GOLDEN_CONJ, 0.875, 0.85)), 1.0);
-        rect.color = Vec4ToPacked(color);
-        rect.depth = nearestZ;
-        TryPushDebugRect(debugRectBufferIndex, rect);
-      }
- #endif // ENABLE_DEBUG_DRAWING
+    if (d_currentView.type == VIEW_TYPE_MAIN)
+    {
+      DebugDrawMeshletAabb(meshletInstanceId);
+      DebugRect rect;
+      rect.minOffset = Vec2ToPacked(minXY);
+      rect.maxOffset = Vec2ToPacked(maxXY);
+      const float GOLDEN_CONJ = 0.6180339887498948482045868343656;
+      vec4 color = vec4(2.0 * hsv_to_rgb(vec3(float(meshletInstanceId) * GOLDEN_CONJ, 0.875, 0.85)), 1.0);
+      rect.color = Vec4ToPacked(color);
+      rect.depth = nearestZ;
+      TryPushDebugRect(debugRectBufferIndex, rect);
     }
+ #endif // ENABLE_DEBUG_DRAWING
   }
-}
\ No newline at end of file
+}
+#endif // CULL_MULTI_VIEW
@@ -3,6 +3,57 @@
 
 #include "../Resources.h.glsl"
 
+// The main view is culled in two phases. The early phase draws meshlets that were visible last frame, then the HZB is
+// rebuilt from that depth and the late phase tests every meshlet against it, drawing only those that were missed.
+// Other views are culled in a single phase
+#define CULL_PHASE_SINGLE 0
+#define CULL_PHASE_EARLY  1
+#define CULL_PHASE_LATE   2
+
+// Meshes that pass instance culling have their meshlets split into chunks of this size. CullMeshlets.comp culls one chunk per workgroup
+#define MESHLET_CULL_CHUNK_SIZE 128
+
+// Written by CullTriangles.comp and read back on the host to size the index buffer
+struct TriangleCullFeedback
+{
+  // Indices that survived culling in the current view, including any that didn't fit in the index buffer.
+  // Multi-view culls count each view's indices in MultiViewCullParams instead
+  FVOG_UINT32 viewRequestedIndexCount;
+
+  // Largest end of the indices requested by any cull this frame, which is how many the index buffer needs to hold them all
+  FVOG_UINT32 frameMaxRequestedIndexCount;
+
+  // Indices that survived culling but didn't fit in the index buffer, summed over every cull this frame
+  FVOG_UINT32 droppedIndexCount;
+};
+
+// Views that the CULL_MULTI_VIEW variants of the cull shaders can cull together
+#define MAX_MULTI_VIEWS 32
+
+// Lets one dispatch of CullTriangles.comp cull the triangles of every view. Each view's indices get their own range of
+// the index buffer, as large as its visible meshlets could need, so no view waits for another's count
+struct MultiViewCullParams
+{
+  // Indirect dispatch of CullTriangles.comp, with one workgroup per visible meshlet of every view. Written by MultiViewPrefixSum.comp
+  FVOG_UINT32 groupCountX;
+  FVOG_UINT32 groupCountY;
+  FVOG_UINT32 groupCountZ;
+  FVOG_UINT32 _padding;
+
+  // Counted by CullMeshlets.comp
+  FVOG_UINT32 visibleMeshletCounts[MAX_MULTI_VIEWS];
+
+  // Three indices per primitive of each view's visible meshlets. Summed by CullMeshlets.comp
+  FVOG_UINT32 indexBudgets[MAX_MULTI_VIEWS];
+
+  // Workgroup of CullTriangles.comp where each view's meshlets start. Written by MultiViewPrefixSum.comp
+  FVOG_UINT32 firstWorkgroups[MAX_MULTI_VIEWS];
+
+  // Indices that survived culling in each view, including any that didn't fit in the index buffer
+  FVOG_UINT32 requestedIndexCounts[MAX_MULTI_VIEWS];
+};
+
+#ifndef CULL_MESHLETS_NO_PUSH_CONSTANTS
 FVOG_DECLARE_ARGUMENTS(CullMeshletsPushConstants)
 {
   FVOG_UINT32 globalUniformsIndex;
@@ -30,13 +81,36 @@ FVOG_DECLARE_ARGUMENTS(CullMeshletsPushConstants)
   FVOG_UINT32 cullTrianglesDispatchIndex;
 
   FVOG_UINT32 visibleMeshletsIndex;
+
+  // One of the CULL_PHASE_* values
+  FVOG_UINT32 cullPhase;
+  // One bit per meshlet instance that is set if it was visible in the main view last frame
+  FVOG_UINT32 meshletVisibilityIndex;
+
+  // CullInstances.comp
+  FVOG_UINT32 meshInstancesIndex;
+  FVOG_UINT32 meshletCullChunksIndex;
   
   // CullTriangles.comp
   FVOG_UINT32 indexBufferIndex;
+  FVOG_UINT32 triangleCullFeedbackIndex;
+
+  // CULL_MULTI_VIEW. viewIndex refers to an array of views, and cullTrianglesDispatchIndex to a MultiViewCullParams
+  FVOG_UINT32 viewCount;
   
   // Debug
   FVOG_UINT32 debugAabbBufferIndex;
   FVOG_UINT32 debugRectBufferIndex;
 };
+#endif
+
+#ifndef __cplusplus
+FVOG_DECLARE_STORAGE_BUFFERS(restrict MultiViewCullParamsBuffer)
+{
+  MultiViewCullParams params;
+} multiViewCullParamsBuffers[];
+
+#define d_multiViewCull multiViewCullParamsBuffers[cullTrianglesDispatchIndex].params
+#endif
 
 #endif // CULL_MESHLETS_H
\ No newline at end of file
@@ -5,6 +5,7 @@
 #define VSM_NO_PUSH_CONSTANTS
 #include "CullMeshlets.h.glsl"
 #include "VisbufferCommon.h.glsl"
+#include "TriangleCulling.h.glsl"
 #include "../Math.h.glsl"
 #include "../debug/DebugCommon.h.glsl"
 #include "../shadows/vsm/VsmCommon.h.glsl"
@@ -16,74 +17,35 @@ FVOG_DECLARE_STORAGE_BUFFERS(writeonly MeshletPackedBuffer)
 
 #define d_indexBuffer indexBuffers[indexBufferIndex]
 
+FVOG_DECLARE_STORAGE_BUFFERS(restrict TriangleCullFeedbackBuffer)
+{
+  TriangleCullFeedback feedback;
+} triangleCullFeedbackBuffers[];
+
+#define d_triangleCullFeedback triangleCullFeedbackBuffers[triangleCullFeedbackIndex].feedback
+
 shared uint sh_baseIndex;
 shared uint sh_primitivesPassed;
 shared mat4 sh_mvp;
 
-// Taken from:
-// https://github.com/GPUOpen-Effects/GeometryFX/blob/master/amd_geometryfx/src/Shaders/AMD_GeometryFX_Filtering.hlsl
-// Parameters: vertices in UV space, viewport extent
-bool CullSmallPrimitive(vec2 vertices[3], vec2 viewportExtent)
-{
-  const uint SUBPIXEL_BITS = 8;
-  const uint SUBPIXEL_MASK = 0xFF;
-  const uint SUBPIXEL_SAMPLES = 1 << SUBPIXEL_BITS;
-  /**
-  Computing this in float-point is not precise enough
-  We switch to a 23.8 representation here which should match the
-  HW subpixel resolution.
-  We use a 8-bit wide guard-band to avoid clipping. If
-  a triangle is outside the guard-band, it will be ignored.
-
-  That is, the actual viewport supported here is 31 bit, one bit is
-  unused, and the guard band is 1 << 23 bit large (8388608 pixels)
-  */
-
-  ivec2 minBB = ivec2(1 << 30, 1 << 30);
-  ivec2 maxBB = ivec2(-(1 << 30), -(1 << 30));
-
-  for (uint i = 0; i < 3; ++i)
-  {
-    vec2 screenSpacePositionFP = vertices[i].xy * viewportExtent;
-    // Check if we would overflow after conversion
-    if ( screenSpacePositionFP.x < -(1 << 23)
-      || screenSpacePositionFP.x >  (1 << 23)
-      || screenSpacePositionFP.y < -(1 << 23)
-      || screenSpacePositionFP.y >  (1 << 23))
-    {
-      return true;
-    }
-
-    ivec2 screenSpacePosition = ivec2(screenSpacePositionFP * SUBPIXEL_SAMPLES);
-    minBB = min(screenSpacePosition, minBB);
-    maxBB = max(screenSpacePosition, maxBB);
-  }
+#ifdef CULL_MULTI_VIEW
+// Every view is culled by one dispatch, so each workgroup finds its own view in main()
+uint multiViewId;
+#undef d_currentView
+#define d_currentView d_views[multiViewId]
+#endif
 
-  /**
-  Test is:
-
-  Is the minimum of the bounding box right or above the sample
-  point and is the width less than the pixel width in samples in
-  one direction.
-
-  This will also cull very long triangles which fall between
-  multiple samples.
-  */
-  return !(
-      (
-          ((minBB.x & SUBPIXEL_MASK) > SUBPIXEL_SAMPLES/2)
-      &&  ((maxBB.x - ((minBB.x & ~SUBPIXEL_MASK) + SUBPIXEL_SAMPLES/2)) < (SUBPIXEL_SAMPLES - 1)))
-  || (
-          ((minBB.y & SUBPIXEL_MASK) > SUBPIXEL_SAMPLES/2)
-      &&  ((maxBB.y - ((minBB.y & ~SUBPIXEL_MASK) + SUBPIXEL_SAMPLES/2)) < (SUBPIXEL_SAMPLES - 1))));
+// Multi-view ranges are laid end to end, so offsets into the index buffer can overflow when the views' budgets are huge
+uint AddSaturate(uint a, uint b)
+{
+  return b > 0xFFFFFFFFu - a ? 0xFFFFFFFFu : a + b;
 }
 
 // Returns true if the triangle is visible
-// https://www.slideshare.net/gwihlidal/optimizing-the-graphics-pipeline-with-compute-gdc-2016
 bool CullTriangle(Meshlet meshlet, uint localId)
 {
   // Skip if no culling flags are enabled
-  if ((perFrameUniformsBuffers[globalUniformsIndex].flags & (CULL_PRIMITIVE_BACKFACE | CULL_PRIMITIVE_FRUSTUM | CULL_PRIMITIVE_SMALL | CULL_PRIMITIVE_VSM)) == 0)
+  if (!IsCullFlagEnabled(CULL_PRIMITIVE_BACKFACE | CULL_PRIMITIVE_FRUSTUM | CULL_PRIMITIVE_SMALL | CULL_PRIMITIVE_VSM))
   {
     return true;
   }
@@ -110,76 +72,15 @@ bool CullTriangle(Meshlet meshlet, uint localId)
   const vec4 posClip1 = sh_mvp * vec4(position1, 1.0);
   const vec4 posClip2 = sh_mvp * vec4(position2, 1.0);
 
-  // Backfacing and zero-area culling
-  // https://redirect.cs.umbc.edu/~olano/papers/2dh-tri/
-  // This is equivalent to the HLSL code that was ported, except the mat3 is transposed.
-  // However, the determinant of a matrix and its transpose are the same, so this is fine.
-  if ((perFrameUniformsBuffers[globalUniformsIndex].flags & CULL_PRIMITIVE_BACKFACE) != 0)
-  {
-    // TODO: Figure out why this only works when culling triangles with POSITIVE area (by its determinant).
-    // VK_FRONT_FACE_COUNTER_CLOCKWISE specifies that a triangle with positive area is considered front-facing.
-    // Hardware backface culling works as expected, which means something is wrong here, possibly with the
-    // order in which indices are loaded.
-    const float det = determinant(mat3(posClip0.xyw, posClip1.xyw, posClip2.xyw));
-    if (det >= 0)
-    {
-      return false;
-    }
-  }
-
-  const vec3 posNdc0 = posClip0.xyz / posClip0.w;
-  const vec3 posNdc1 = posClip1.xyz / posClip1.w;
-  const vec3 posNdc2 = posClip2.xyz / posClip2.w;
-  
-  const vec2 bboxNdcMin = min(posNdc0.xy, min(posNdc1.xy, posNdc2.xy));
-  const vec2 bboxNdcMax = max(posNdc0.xy, max(posNdc1.xy, posNdc2.xy));
-
-  const bool allBehind = posNdc0.z < 0 && posNdc1.z < 0 && posNdc2.z < 0;
-  if (allBehind)
+  vec2 bboxNdcMin;
+  vec2 bboxNdcMax;
+  bool boundsValid;
+  if (!CullTriangleClipSpace(posClip0, posClip1, posClip2, d_currentView.viewport.zw, bboxNdcMin, bboxNdcMax, boundsValid))
   {
     return false;
   }
   
-  const bool anyBehind = posNdc0.z < 0 || posNdc1.z < 0 || posNdc2.z < 0;
-  if (anyBehind)
-  {
-    return true;
-  }
-
-  // Frustum culling
-  if ((d_perFrameUniforms.flags & CULL_PRIMITIVE_FRUSTUM) != 0)
-  {
-    if (!RectIntersectRect(bboxNdcMin, bboxNdcMax, vec2(-1.0), vec2(1.0)))
-    {
-      return false;
-    }
-  }
-  
-  // if (currentView.type == VIEW_TYPE_MAIN)
-  // {
-  //   DebugRect rect;
-  //   rect.minOffset = Vec2ToPacked(bboxNdcMin * 0.5 + 0.5);
-  //   rect.maxOffset = Vec2ToPacked(bboxNdcMax * 0.5 + 0.5);
-  //   const float GOLDEN_CONJ = 0.6180339887498948482045868343656;
-  //   vec4 color = vec4(2.0 * hsv_to_rgb(vec3(float(primitiveId) * GOLDEN_CONJ, 0.875, 0.85)), 1.0);
-  //   rect.color = Vec4ToPacked(color);
-  //   rect.depth = posNdc0.z;
-  //   TryPushDebugRect(rect);
-  // }
-
-  // Small primitive culling
-  if ((d_perFrameUniforms.flags & CULL_PRIMITIVE_SMALL) != 0)
-  {
-    const vec2 posUv0 = posNdc0.xy * 0.5 + 0.5;
-    const vec2 posUv1 = posNdc1.xy * 0.5 + 0.5;
-    const vec2 posUv2 = posNdc2.xy * 0.5 + 0.5;
-    if (!CullSmallPrimitive(vec2[3](posUv0, posUv1, posUv2), d_currentView.viewport.zw))
-    {
-      return false;
-    }
-  }
-  
-  if ((d_perFrameUniforms.flags & CULL_PRIMITIVE_VSM) != 0)
+  if (boundsValid && IsCullFlagEnabled(CULL_PRIMITIVE_VSM))
   {
      if (d_currentView.type == VIEW_TYPE_VIRTUAL)
      {
@@ -188,6 +89,13 @@ bool CullTriangle(Meshlet meshlet, uint localId)
          return false;
        }
      }
+     else if (d_currentView.type == VIEW_TYPE_VIRTUAL_LOCAL)
+     {
+       if (!CullQuadVsmLocal(bboxNdcMin * 0.5 + 0.5, bboxNdcMax * 0.5 + 0.5, d_currentView.virtualTableIndex, d_currentView.virtualTableLevel))
+       {
+         return false;
+       }
+     }
   }
 
   return true;
@@ -196,7 +104,23 @@ bool CullTriangle(Meshlet meshlet, uint localId)
 layout(local_size_x = MAX_PRIMITIVES) in;
 void main()
 {
-  const uint meshletInstanceId = d_visibleMeshlets.indices[gl_WorkGroupID.x];
+#ifdef CULL_MULTI_VIEW
+  // The views' workgroups are laid end to end, and there are few views, so the last one starting at or before this workgroup is found by a scan
+  multiViewId = 0;
+  while (multiViewId + 1 < viewCount && d_multiViewCull.firstWorkgroups[multiViewId + 1] <= gl_WorkGroupID.x)
+  {
+    multiViewId++;
+  }
+
+  // Each view has its own draw command and range of the visible list
+  const uint commandIndex = multiViewId;
+  const uint visibleMeshletId = multiViewId * d_perFrameUniforms.meshletCount + gl_WorkGroupID.x - d_multiViewCull.firstWorkgroups[multiViewId];
+#else
+  const uint commandIndex = cullPhase == CULL_PHASE_LATE ? 1 : 0;
+  // Meshlets made visible by the late phase are stored after those of the early phase
+  const uint visibleMeshletId = commandIndex == 1 ? d_cullTrianglesDispatch[0].groupCountX + gl_WorkGroupID.x : gl_WorkGroupID.x;
+#endif
+  const uint meshletInstanceId = d_visibleMeshlets.indices[visibleMeshletId];
   const MeshletInstance meshletInstance = d_meshletInstances[meshletInstanceId];
   const uint meshletId = meshletInstance.meshletId;
   const Meshlet meshlet = d_meshlets[meshletId];
@@ -227,19 +151,42 @@ void main()
 
   if (localId == 0)
   {
-    sh_baseIndex = atomicAdd(d_indirectCommand.indexCount, sh_primitivesPassed * 3);
+    const uint requestedIndexCount = sh_primitivesPassed * 3;
+    // Each phase's command starts where the previous phase's indices end. Multi-view commands start where MultiViewPrefixSum.comp put them
+    const uint firstIndex = d_indirectCommands[commandIndex].firstIndex;
+#ifdef CULL_MULTI_VIEW
+    // The view's budget counts every primitive of its visible meshlets, so its indices never reach the next view's
+    sh_baseIndex = AddSaturate(firstIndex, atomicAdd(d_multiViewCull.requestedIndexCounts[commandIndex], requestedIndexCount));
+#else
+    sh_baseIndex = atomicAdd(d_triangleCullFeedback.viewRequestedIndexCount, requestedIndexCount);
+#endif
+    const uint requestedEnd = AddSaturate(sh_baseIndex, requestedIndexCount);
+    atomicMax(d_triangleCullFeedback.frameMaxRequestedIndexCount, requestedEnd);
+
+    // Triangles that don't fit in the index buffer are dropped. The host grows the buffer after it sees the feedback.
+    // A view may start beyond the end of the buffer, in which case it draws nothing
+    const uint capacity = d_indexBuffer.data.length() / 3 * 3;
+    atomicMax(d_indirectCommands[commandIndex].indexCount, min(requestedEnd, max(capacity, firstIndex)) - firstIndex);
+
+    const uint writtenIndexCount = min(requestedEnd, max(capacity, sh_baseIndex)) - sh_baseIndex;
+    if (writtenIndexCount < requestedIndexCount)
+    {
+      atomicAdd(d_triangleCullFeedback.droppedIndexCount, requestedIndexCount - writtenIndexCount);
+    }
   }
 
   barrier();
 
   if (primitivePassed)
   {
-    const uint indexOffset = sh_baseIndex + activePrimitiveId * 3;
-    if (indexOffset + 2 < d_indexBuffer.data.length())
+    // Compared without adding to the base index, which may be saturated
+    const uint capacity = d_indexBuffer.data.length() / 3 * 3;
+    if (sh_baseIndex < capacity && activePrimitiveId * 3 < capacity - sh_baseIndex)
     {
-      d_indexBuffer.data[indexOffset + 0] = (gl_WorkGroupID.x << MESHLET_PRIMITIVE_BITS) | ((primitiveId + 0) & MESHLET_PRIMITIVE_MASK);
-      d_indexBuffer.data[indexOffset + 1] = (gl_WorkGroupID.x << MESHLET_PRIMITIVE_BITS) | ((primitiveId + 1) & MESHLET_PRIMITIVE_MASK);
-      d_indexBuffer.data[indexOffset + 2] = (gl_WorkGroupID.x << MESHLET_PRIMITIVE_BITS) | ((primitiveId + 2) & MESHLET_PRIMITIVE_MASK);
+      const uint indexOffset = sh_baseIndex + activePrimitiveId * 3;
+      d_indexBuffer.data[indexOffset + 0] = (visibleMeshletId << MESHLET_PRIMITIVE_BITS) | ((primitiveId + 0) & MESHLET_PRIMITIVE_MASK);
+      d_indexBuffer.data[indexOffset + 1] = (visibleMeshletId << MESHLET_PRIMITIVE_BITS) | ((primitiveId + 1) & MESHLET_PRIMITIVE_MASK);
+      d_indexBuffer.data[indexOffset + 2] = (visibleMeshletId << MESHLET_PRIMITIVE_BITS) | ((primitiveId + 2) & MESHLET_PRIMITIVE_MASK);
     }
   }
 }
\ No newline at end of file
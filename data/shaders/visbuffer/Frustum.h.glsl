@@ -0,0 +1,46 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "VisbufferCommon.h.glsl"
+
+bool IsAABBInsidePlane(in vec3 center, in vec3 extent, in vec4 plane)
+{
+  const vec3 normal = plane.xyz;
+  const float radius = dot(extent, abs(normal));
+  return (dot(normal, center) - plane.w) >= -radius;
+}
+
+// Conservatively tests an object space AABB against the view's frustum planes
+bool IsObjectAabbInFrustum(vec3 aabbMin, vec3 aabbMax, mat4 transform, View view)
+{
+  const vec3 aabbCenter = (aabbMin + aabbMax) / 2.0;
+  const vec3 aabbExtent = aabbMax - aabbCenter;
+  const vec3 worldAabbCenter = vec3(transform * vec4(aabbCenter, 1.0));
+  const vec3 right = vec3(transform[0]) * aabbExtent.x;
+  const vec3 up = vec3(transform[1]) * aabbExtent.y;
+  const vec3 forward = vec3(-transform[2]) * aabbExtent.z;
+
+  const vec3 worldExtent = vec3(
+    abs(dot(vec3(1.0, 0.0, 0.0), right)) +
+    abs(dot(vec3(1.0, 0.0, 0.0), up)) +
+    abs(dot(vec3(1.0, 0.0, 0.0), forward)),
+
+    abs(dot(vec3(0.0, 1.0, 0.0), right)) +
+    abs(dot(vec3(0.0, 1.0, 0.0), up)) +
+    abs(dot(vec3(0.0, 1.0, 0.0), forward)),
+
+    abs(dot(vec3(0.0, 0.0, 1.0), right)) +
+    abs(dot(vec3(0.0, 0.0, 1.0), up)) +
+    abs(dot(vec3(0.0, 0.0, 1.0), forward)));
+  for (uint i = 0; i < 6; ++i)
+  {
+    if (!IsAABBInsidePlane(worldAabbCenter, worldExtent, view.frustumPlanes[i]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#endif // FRUSTUM_H
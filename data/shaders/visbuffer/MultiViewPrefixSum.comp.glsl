@@ -0,0 +1,28 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+
+#define VISBUFFER_NO_PUSH_CONSTANTS
+#include "CullMeshlets.h.glsl"
+#include "VisbufferCommon.h.glsl"
+
+// Lays the views of a multi-view cull end to end, both in the triangle cull's workgroups and in the index buffer.
+// There are at most MAX_MULTI_VIEWS views, so one invocation sums them
+layout (local_size_x = 1) in;
+void main()
+{
+  uint firstWorkgroup = 0;
+  uint firstIndex = 0;
+  for (uint viewId = 0; viewId < viewCount; viewId++)
+  {
+    d_multiViewCull.firstWorkgroups[viewId] = firstWorkgroup;
+    d_indirectCommands[viewId].firstIndex = firstIndex;
+    firstWorkgroup += d_multiViewCull.visibleMeshletCounts[viewId];
+    // Saturate so views past the end of the index buffer stay past it, instead of wrapping around onto earlier views
+    const uint indexBudget = d_multiViewCull.indexBudgets[viewId];
+    firstIndex = indexBudget > 0xFFFFFFFFu - firstIndex ? 0xFFFFFFFFu : firstIndex + indexBudget;
+  }
+
+  d_multiViewCull.groupCountX = firstWorkgroup;
+  d_multiViewCull.groupCountY = 1;
+  d_multiViewCull.groupCountZ = 1;
+}
@@ -0,0 +1,137 @@
+#ifndef TRIANGLE_CULLING_H
+#define TRIANGLE_CULLING_H
+
+#include "../Math.h.glsl"
+#include "../GlobalUniforms.h.glsl"
+
+// Shared by CullTriangles.comp and Visbuffer.mesh, which cull the same triangles with the same tests
+
+// Taken from:
+// https://github.com/GPUOpen-Effects/GeometryFX/blob/master/amd_geometryfx/src/Shaders/AMD_GeometryFX_Filtering.hlsl
+// Parameters: vertices in UV space, viewport extent
+bool CullSmallPrimitive(vec2 vertices[3], vec2 viewportExtent)
+{
+  const uint SUBPIXEL_BITS = 8;
+  const uint SUBPIXEL_MASK = 0xFF;
+  const uint SUBPIXEL_SAMPLES = 1 << SUBPIXEL_BITS;
+  /**
+  Computing this in float-point is not precise enough
+  We switch to a 23.8 representation here which should match the
+  HW subpixel resolution.
+  We use a 8-bit wide guard-band to avoid clipping. If
+  a triangle is outside the guard-band, it will be ignored.
+
+  That is, the actual viewport supported here is 31 bit, one bit is
+  unused, and the guard band is 1 << 23 bit large (8388608 pixels)
+  */
+
+  ivec2 minBB = ivec2(1 << 30, 1 << 30);
+  ivec2 maxBB = ivec2(-(1 << 30), -(1 << 30));
+
+  for (uint i = 0; i < 3; ++i)
+  {
+    vec2 screenSpacePositionFP = vertices[i].xy * viewportExtent;
+    // Check if we would overflow after conversion
+    if ( screenSpacePositionFP.x < -(1 << 23)
+      || screenSpacePositionFP.x >  (1 << 23)
+      || screenSpacePositionFP.y < -(1 << 23)
+      || screenSpacePositionFP.y >  (1 << 23))
+    {
+      return true;
+    }
+
+    ivec2 screenSpacePosition = ivec2(screenSpacePositionFP * SUBPIXEL_SAMPLES);
+    minBB = min(screenSpacePosition, minBB);
+    maxBB = max(screenSpacePosition, maxBB);
+  }
+
+  /**
+  Test is:
+
+  Is the minimum of the bounding box right or above the sample
+  point and is the width less than the pixel width in samples in
+  one direction.
+
+  This will also cull very long triangles which fall between
+  multiple samples.
+  */
+  return !(
+      (
+          ((minBB.x & SUBPIXEL_MASK) > SUBPIXEL_SAMPLES/2)
+      &&  ((maxBB.x - ((minBB.x & ~SUBPIXEL_MASK) + SUBPIXEL_SAMPLES/2)) < (SUBPIXEL_SAMPLES - 1)))
+  || (
+          ((minBB.y & SUBPIXEL_MASK) > SUBPIXEL_SAMPLES/2)
+      &&  ((maxBB.y - ((minBB.y & ~SUBPIXEL_MASK) + SUBPIXEL_SAMPLES/2)) < (SUBPIXEL_SAMPLES - 1))));
+}
+
+// Backface, frustum, and small primitive tests on a triangle's clip space vertices. Returns true if the triangle is visible.
+// The NDC bounds are only valid if boundsValid is true, which is when the triangle is visible and entirely in front of the near plane
+// https://www.slideshare.net/gwihlidal/optimizing-the-graphics-pipeline-with-compute-gdc-2016
+bool CullTriangleClipSpace(vec4 posClip0, vec4 posClip1, vec4 posClip2, vec2 viewportExtent, out vec2 bboxNdcMin, out vec2 bboxNdcMax, out bool boundsValid)
+{
+  bboxNdcMin = vec2(0);
+  bboxNdcMax = vec2(0);
+  boundsValid = false;
+
+  // Backfacing and zero-area culling
+  // https://redirect.cs.umbc.edu/~olano/papers/2dh-tri/
+  // This is equivalent to the HLSL code that was ported, except the mat3 is transposed.
+  // However, the determinant of a matrix and its transpose are the same, so this is fine.
+  if (IsCullFlagEnabled(CULL_PRIMITIVE_BACKFACE))
+  {
+    // TODO: Figure out why this only works when culling triangles with POSITIVE area (by its determinant).
+    // VK_FRONT_FACE_COUNTER_CLOCKWISE specifies that a triangle with positive area is considered front-facing.
+    // Hardware backface culling works as expected, which means something is wrong here, possibly with the
+    // order in which indices are loaded.
+    const float det = determinant(mat3(posClip0.xyw, posClip1.xyw, posClip2.xyw));
+    if (det >= 0)
+    {
+      return false;
+    }
+  }
+
+  const vec3 posNdc0 = posClip0.xyz / posClip0.w;
+  const vec3 posNdc1 = posClip1.xyz / posClip1.w;
+  const vec3 posNdc2 = posClip2.xyz / posClip2.w;
+  
+  bboxNdcMin = min(posNdc0.xy, min(posNdc1.xy, posNdc2.xy));
+  bboxNdcMax = max(posNdc0.xy, max(posNdc1.xy, posNdc2.xy));
+
+  const bool allBehind = posNdc0.z < 0 && posNdc1.z < 0 && posNdc2.z < 0;
+  if (allBehind)
+  {
+    return false;
+  }
+  
+  const bool anyBehind = posNdc0.z < 0 || posNdc1.z < 0 || posNdc2.z < 0;
+  if (anyBehind)
+  {
+    return true;
+  }
+
+  // Frustum culling
+  if (IsCullFlagEnabled(CULL_PRIMITIVE_FRUSTUM))
+  {
+    if (!RectIntersectRect(bboxNdcMin, bboxNdcMax, vec2(-1.0), vec2(1.0)))
+    {
+      return false;
+    }
+  }
+
+  // Small primitive culling
+  if (IsCullFlagEnabled(CULL_PRIMITIVE_SMALL))
+  {
+    const vec2 posUv0 = posNdc0.xy * 0.5 + 0.5;
+    const vec2 posUv1 = posNdc1.xy * 0.5 + 0.5;
+    const vec2 posUv2 = posNdc2.xy * 0.5 + 0.5;
+    if (!CullSmallPrimitive(vec2[3](posUv0, posUv1, posUv2), viewportExtent))
+    {
+      return false;
+    }
+  }
+
+  boundsValid = true;
+  return true;
+}
+
+#endif // TRIANGLE_CULLING_H
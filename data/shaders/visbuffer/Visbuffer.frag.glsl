@@ -1,15 +1,25 @@
 #version 460 core
 #extension GL_GOOGLE_include_directive : enable
+#ifdef VISBUFFER_MESH_SHADER
+#extension GL_EXT_mesh_shader : require
+#endif
 //#extension GL_ARB_bindless_texture : require
 #include "VisbufferCommon.h.glsl"
 #include "../Math.h.glsl"
 #include "../Hash.h.glsl"
 
+// Visbuffer.mesh outputs the IDs per primitive rather than per vertex
+#ifdef VISBUFFER_MESH_SHADER
+layout (location = 0) perprimitiveEXT in flat uint i_visibleMeshletId;
+layout (location = 1) perprimitiveEXT in flat uint i_primitiveId;
+layout (location = 4) perprimitiveEXT in flat uint i_materialId;
+#else
 layout (location = 0) in flat uint i_visibleMeshletId;
 layout (location = 1) in flat uint i_primitiveId;
+layout (location = 4) in flat uint i_materialId;
+#endif
 layout (location = 2) in vec2 i_uv;
 layout (location = 3) in vec3 i_objectSpacePos;
-layout (location = 4) in flat uint i_materialId;
 
 layout (location = 0) out uint o_pixel;
 
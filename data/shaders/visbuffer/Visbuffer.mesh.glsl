@@ -0,0 +1,79 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : enable
+#extension GL_EXT_mesh_shader : require
+#define CULL_MESHLETS_NO_PUSH_CONSTANTS
+#include "CullMeshlets.h.glsl"
+#include "VisbufferCommon.h.glsl"
+#include "TriangleCulling.h.glsl"
+
+// Draws one visible meshlet per workgroup straight from the meshlet data, replacing CullTriangles.comp and the index buffer it fills.
+// Triangles that fail the culling tests are discarded with gl_CullPrimitiveEXT
+layout(local_size_x = MAX_PRIMITIVES) in;
+layout(triangles, max_vertices = MAX_INDICES, max_primitives = MAX_PRIMITIVES) out;
+
+layout (location = 0) perprimitiveEXT out flat uint o_visibleMeshletId[];
+layout (location = 1) perprimitiveEXT out flat uint o_primitiveId[];
+layout (location = 2) out vec2 o_uv[];
+layout (location = 3) out vec3 o_objectSpacePos[];
+layout (location = 4) perprimitiveEXT out flat uint o_materialId[];
+
+shared vec4 sh_clipPositions[MAX_INDICES];
+
+void main()
+{
+  const uint phaseIndex = cullPhase == CULL_PHASE_LATE ? 1 : 0;
+  // Meshlets made visible by the late phase are stored after those of the early phase
+  const uint visibleMeshletId = phaseIndex == 1 ? d_cullTrianglesDispatch[0].groupCountX + gl_WorkGroupID.x : gl_WorkGroupID.x;
+  const uint meshletInstanceId = d_visibleMeshlets.indices[visibleMeshletId];
+  const MeshletInstance meshletInstance = d_meshletInstances[meshletInstanceId];
+  const Meshlet meshlet = d_meshlets[meshletInstance.meshletId];
+  const uint localId = gl_LocalInvocationIndex;
+
+  SetMeshOutputsEXT(meshlet.indexCount, meshlet.primitiveCount);
+
+  const mat4 transform = d_transforms[meshletInstance.instanceId].modelCurrent;
+
+  if (localId < meshlet.indexCount)
+  {
+    const uint index = d_indices[meshlet.indexOffset + localId];
+    const Vertex vertex = d_vertices[meshlet.vertexOffset + index];
+    const vec3 position = PackedToVec3(vertex.position);
+    const vec4 posClip = d_perFrameUniforms.viewProj * transform * vec4(position, 1.0);
+
+    gl_MeshVerticesEXT[localId].gl_Position = posClip;
+    o_uv[localId] = PackedToVec2(vertex.uv);
+    o_objectSpacePos[localId] = position;
+    sh_clipPositions[localId] = posClip;
+  }
+
+  barrier();
+
+  if (localId < meshlet.primitiveCount)
+  {
+    const uint primitiveId = localId * 3;
+    const uint primitive0 = uint(d_primitives[meshlet.primitiveOffset + primitiveId + 0]);
+    const uint primitive1 = uint(d_primitives[meshlet.primitiveOffset + primitiveId + 1]);
+    const uint primitive2 = uint(d_primitives[meshlet.primitiveOffset + primitiveId + 2]);
+
+    bool isVisible = true;
+    if (IsCullFlagEnabled(CULL_PRIMITIVE_BACKFACE | CULL_PRIMITIVE_FRUSTUM | CULL_PRIMITIVE_SMALL))
+    {
+      vec2 bboxNdcMin;
+      vec2 bboxNdcMax;
+      bool boundsValid;
+      isVisible = CullTriangleClipSpace(sh_clipPositions[primitive0],
+        sh_clipPositions[primitive1],
+        sh_clipPositions[primitive2],
+        d_currentView.viewport.zw,
+        bboxNdcMin,
+        bboxNdcMax,
+        boundsValid);
+    }
+
+    gl_PrimitiveTriangleIndicesEXT[localId] = uvec3(primitive0, primitive1, primitive2);
+    gl_MeshPrimitivesEXT[localId].gl_CullPrimitiveEXT = !isVisible;
+    o_visibleMeshletId[localId] = visibleMeshletId;
+    o_primitiveId[localId] = localId;
+    o_materialId[localId] = meshletInstance.materialId;
+  }
+}
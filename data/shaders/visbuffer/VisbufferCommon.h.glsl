@@ -27,6 +27,7 @@
 
 #define VIEW_TYPE_MAIN    (0)
 #define VIEW_TYPE_VIRTUAL (1)
+#define VIEW_TYPE_VIRTUAL_LOCAL (2)
 
 struct Vertex
 {
@@ -54,6 +55,15 @@ struct MeshletInstance
   uint materialId;
 };
 
+struct GpuMeshInstance
+{
+  PackedVec3 aabbMin;
+  uint meshletInstanceOffset;
+  PackedVec3 aabbMax;
+  uint meshletCount;
+  uint instanceId;
+};
+
 struct View
 {
   mat4 oldProj;
@@ -68,7 +78,8 @@ struct View
   vec4 viewport;
   uint type;
   uint virtualTableIndex;
-  uvec2 _padding;
+  uint virtualTableLevel; // VIEW_TYPE_VIRTUAL_LOCAL only
+  uint _padding;
 };
 
 struct GpuMaterial
@@ -109,7 +120,7 @@ FVOG_DECLARE_ARGUMENTS(VisbufferPushConstants)
   FVOG_UINT32 hzbSamplerIndex;
   FVOG_UINT32 cullTrianglesDispatchIndex;
 
-  // CullMeshlets.comp, CullTriangles.comp, all vertex shaders
+  // CullMeshlets.comp, CullTriangles.comp, all vertex and mesh shaders
   FVOG_UINT32 visibleMeshletsIndex;
 
   // CullTriangles.comp
@@ -124,6 +135,9 @@ FVOG_DECLARE_ARGUMENTS(VisbufferPushConstants)
   // Debug
   FVOG_UINT32 debugAabbBufferIndex;
   FVOG_UINT32 debugRectBufferIndex;
+
+  // Visbuffer.mesh. One of the CULL_PHASE_* values
+  FVOG_UINT32 cullPhase;
 };
 #endif
 
@@ -182,13 +196,21 @@ FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly TransformBuffer)
 
 #define d_transforms TransformBuffers[transformsIndex].transforms
 
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly MeshInstancesBuffer)
+{
+  GpuMeshInstance instances[];
+}MeshInstancesBuffers[];
+
+#define d_meshInstances MeshInstancesBuffers[meshInstancesIndex].instances
+
 //layout (std430, binding = 6) restrict buffer IndirectDrawCommand
 FVOG_DECLARE_STORAGE_BUFFERS(restrict IndirectDrawCommand)
 {
-  DrawElementsIndirectCommand indirectCommand;
+  // The late culling phase draws with the second command. Other phases only use the first
+  DrawElementsIndirectCommand indirectCommands[];
 }IndirectDrawCommands[];
 
-#define d_indirectCommand IndirectDrawCommands[indirectDrawIndex].indirectCommand
+#define d_indirectCommands IndirectDrawCommands[indirectDrawIndex].indirectCommands
 
 //layout (std140, binding = 7) restrict readonly buffer MaterialBuffer
 FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly MaterialBuffer)
@@ -206,6 +228,14 @@ FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly ViewBuffer)
 
 #define d_currentView ViewBuffers[viewIndex].currentView
 
+// Views that are culled together by the CULL_MULTI_VIEW variants of the cull shaders
+FVOG_DECLARE_STORAGE_BUFFERS(restrict readonly ViewArrayBuffer)
+{
+  View views[];
+}ViewArrayBuffers[];
+
+#define d_views ViewArrayBuffers[viewIndex].views
+
 FVOG_DECLARE_STORAGE_BUFFERS(restrict MeshletVisbilityBuffer)
 {
   uint indices[];
@@ -213,4 +243,31 @@ FVOG_DECLARE_STORAGE_BUFFERS(restrict MeshletVisbilityBuffer)
 
 #define d_visibleMeshlets visibleMeshletsBuffers[visibleMeshletsIndex]
 
+struct CullTrianglesDispatchParams
+{
+  uint groupCountX;
+  uint groupCountY;
+  uint groupCountZ;
+};
+
+// Indexed like d_indirectCommands. Meshlets made visible by the late culling phase are stored after those of the early phase
+FVOG_DECLARE_STORAGE_BUFFERS(restrict CullTrianglesDispatchBuffer)
+{
+  CullTrianglesDispatchParams phases[];
+} cullTrianglesDispatchBuffers[];
+
+#define d_cullTrianglesDispatch cullTrianglesDispatchBuffers[cullTrianglesDispatchIndex].phases
+
+// Written by CullInstances.comp. The header is the indirect dispatch of CullMeshlets.comp, which culls one chunk per workgroup
+FVOG_DECLARE_STORAGE_BUFFERS(restrict MeshletCullChunksBuffer)
+{
+  uint groupCountX;
+  uint groupCountY;
+  uint groupCountZ;
+  uint _padding;
+  uvec2 chunks[]; // First meshlet instance, meshlet instance count
+} meshletCullChunksBuffers[];
+
+#define d_meshletCullChunks meshletCullChunksBuffers[meshletCullChunksIndex]
+
 #endif // VISBUFFER_COMMON_H
\ No newline at end of file
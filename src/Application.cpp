@@ -14,6 +14,7 @@
 #include "Fvog/Rendering2.h"
 #include "Fvog/detail/Common.h"
 #include "Fvog/detail/ApiToEnum2.h"
+#include "PCG.h"
 
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -25,13 +26,20 @@
 #include <tracy/Tracy.hpp>
 #include <tracy/TracyVulkan.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bit>
+#include <chrono>
 #include <exception>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <filesystem>
+#include <mutex>
 #include <thread>
+#include <unordered_set>
+#include <utility>
 
 #ifdef TRACY_ENABLE
 #include <cstdlib>
@@ -220,9 +228,12 @@ static auto MakeVkbSwapchain(const vkb::Device& device,
 }
 
 Application::Application(const CreateInfo& createInfo)
-  : presentMode(createInfo.presentMode)
+  : presentMode(createInfo.presentMode),
+    framesInFlight(createInfo.framesInFlight)
 {
   ZoneScoped;
+  Fvog::SetShaderProfile(createInfo.shaderProfile);
+
   {
     ZoneScopedN("Initialize GLFW");
     if (!glfwInit())
@@ -340,7 +351,9 @@ Application::Application(const CreateInfo& createInfo)
   // device
   {
     ZoneScopedN("Create Device");
-    device_.emplace(instance_, surface);
+    device_.emplace(instance_, surface, framesInFlight);
+    framesInFlight = device_->FramesInFlight(); // Clamped
+    device_->batchDescriptorWrites_ = createInfo.batchDescriptorWrites;
   }
   
   // swapchain
@@ -374,6 +387,21 @@ Application::Application(const CreateInfo& createInfo)
                                                  vkGetPhysicalDeviceCalibrateableTimeDomainsEXT,
                                                  vkGetCalibratedTimestampsEXT);
 
+  // Zones on different queues overlap, so they need separate contexts
+  if (device_->HasAsyncComputeQueue())
+  {
+    tracyVkAsyncComputeContext_ = TracyVkContextHostCalibrated(device_->physicalDevice_,
+                                                               device_->device_,
+                                                               vkResetQueryPool,
+                                                               vkGetPhysicalDeviceCalibrateableTimeDomainsEXT,
+                                                               vkGetCalibratedTimestampsEXT);
+    TracyVkContextName(tracyVkAsyncComputeContext_, "Async Compute", 13);
+  }
+  else
+  {
+    tracyVkAsyncComputeContext_ = tracyVkContext_;
+  }
+
   // Initialize ImGui and a backend for it.
   // Because we allow the GLFW backend to install callbacks, it will automatically call our own that we provided.
   ImGui::CreateContext();
@@ -400,7 +428,8 @@ Application::Application(const CreateInfo& createInfo)
     .Queue = device_->graphicsQueue_,
     .DescriptorPool = imguiDescriptorPool_,
     .MinImageCount = swapchain_.image_count,
-    .ImageCount = swapchain_.image_count,
+    // ImGui's vertex and index buffers are a ring of ImageCount, so it must cover every frame that can be in flight
+    .ImageCount = std::max(swapchain_.image_count, Fvog::Device::maxFramesInFlight),
     .CheckVkResultFn = Fvog::detail::CheckVkResult,
   };
 
@@ -420,6 +449,10 @@ Application::~Application()
 
   vkDestroyDescriptorPool(device_->device_, imguiDescriptorPool_, nullptr);
 
+  if (tracyVkAsyncComputeContext_ != tracyVkContext_)
+  {
+    DestroyVkContext(tracyVkAsyncComputeContext_);
+  }
   DestroyVkContext(tracyVkContext_);
 
   vkb::destroy_swapchain(swapchain_);
@@ -442,12 +475,14 @@ void Application::Draw()
   auto& currentFrameData = device_->GetCurrentFrameData();
 
   {
-    ZoneScopedN("vkWaitSemaphores (graphics queue timeline)");
+    ZoneScopedN("vkWaitSemaphores (graphics and compute queue timelines)");
+    const auto semaphores = std::array{device_->graphicsQueueTimelineSemaphore_, device_->computeQueueTimelineSemaphore_};
+    const auto values = std::array{currentFrameData.renderTimelineSemaphoreWaitValue, currentFrameData.computeTimelineSemaphoreWaitValue};
     vkWaitSemaphores(device_->device_, Fvog::detail::Address(VkSemaphoreWaitInfo{
       .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
-      .semaphoreCount = 1,
-      .pSemaphores = &device_->graphicsQueueTimelineSemaphore_,
-      .pValues = &currentFrameData.renderTimelineSemaphoreWaitValue,
+      .semaphoreCount = static_cast<uint32_t>(semaphores.size()),
+      .pSemaphores = semaphores.data(),
+      .pValues = values.data(),
     }), UINT64_MAX);
   }
 
@@ -480,13 +515,9 @@ void Application::Draw()
     }
   }
 
+  device_->ResetFrameCommandPools();
   auto commandBuffer = currentFrameData.commandBuffer;
 
-  {
-    ZoneScopedN("vkResetCommandPool");
-    Fvog::detail::CheckVkResult(vkResetCommandPool(device_->device_, currentFrameData.commandPool, 0));
-  }
-
   {
     ZoneScopedN("vkBeginCommandBuffer");
     Fvog::detail::CheckVkResult(vkBeginCommandBuffer(commandBuffer, Fvog::detail::Address(VkCommandBufferBeginInfo{
@@ -495,7 +526,8 @@ void Application::Draw()
     })));
   }
 
-  auto ctx = Fvog::Context(*device_, commandBuffer);
+  // Take ownership of resources from uploads that have finished. Unfinished ones are picked up in a later frame so we never wait on them
+  device_->AddFrameWait(device_->transferQueueTimelineSemaphore_, device_->AcquireUploadedResources(commandBuffer, true), VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
 
   {
     ZoneScopedN("Begin ImGui frame");
@@ -505,16 +537,17 @@ void Application::Draw()
   }
 
   {
-    {
-      TracyVkZone(tracyVkContext_, commandBuffer, "OnRender");
-      OnRender(dtDraw, commandBuffer, swapchainImageIndex);
-    }
+    // No GPU zone around OnRender, as it may submit the command buffer partway through and continue in another
+    OnRender(dtDraw, commandBuffer, swapchainImageIndex);
+    commandBuffer = currentFrameData.commandBuffer;
     {
       TracyVkZone(tracyVkContext_, commandBuffer, "OnGui");
       OnGui(dtDraw, commandBuffer);
     }
   }
 
+  auto ctx = Fvog::Context(*device_, commandBuffer);
+
   // Render ImGui
   // A frame marker is inserted to distinguish ImGui rendering from the application's in a debugger.
   {
@@ -549,6 +582,10 @@ void Application::Draw()
 
   {
     TracyVkCollect(tracyVkContext_, commandBuffer);
+    if (tracyVkAsyncComputeContext_ != tracyVkContext_)
+    {
+      TracyVkCollect(tracyVkAsyncComputeContext_, commandBuffer);
+    }
 
     {
       ZoneScopedN("End Recording");
@@ -557,6 +594,16 @@ void Application::Draw()
     
     {
       ZoneScopedN("Submit");
+      device_->FlushDescriptorWrites();
+
+      // Waits added during the frame (uploads, async compute) that an earlier split submission hasn't already consumed
+      auto queueSubmitWaitSemaphores = std::exchange(currentFrameData.graphicsWaits, {});
+      queueSubmitWaitSemaphores.emplace_back(VkSemaphoreSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = currentFrameData.swapchainSemaphore,
+        .stageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      });
+
       const auto queueSubmitSignalSemaphores = std::array{
         VkSemaphoreSubmitInfo{
           .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
@@ -570,17 +617,14 @@ void Application::Draw()
           .stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
         }};
 
+      auto queueLock = std::lock_guard{device_->graphicsQueueMutex_};
       Fvog::detail::CheckVkResult(vkQueueSubmit2(
         device_->graphicsQueue_,
         1,
         Fvog::detail::Address(VkSubmitInfo2{
           .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-          .waitSemaphoreInfoCount = 1,
-          .pWaitSemaphoreInfos = Fvog::detail::Address(VkSemaphoreSubmitInfo{
-            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-            .semaphore = currentFrameData.swapchainSemaphore,
-            .stageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-          }),
+          .waitSemaphoreInfoCount = static_cast<uint32_t>(queueSubmitWaitSemaphores.size()),
+          .pWaitSemaphoreInfos = queueSubmitWaitSemaphores.data(),
           .commandBufferInfoCount = 1,
           .pCommandBufferInfos = Fvog::detail::Address(VkCommandBufferSubmitInfo{
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
@@ -597,6 +641,7 @@ void Application::Draw()
 
     {
       ZoneScopedN("Present");
+      auto queueLock = std::lock_guard{device_->graphicsQueueMutex_};
       if (auto presentResult = vkQueuePresentKHR(device_->graphicsQueue_, Fvog::detail::Address(VkPresentInfoKHR{
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
@@ -627,6 +672,39 @@ void Application::Run()
   // Inform the user that the renderer is done loading
   glfwRequestWindowAttention(window);
 
+  // glfwGetTime counts from glfwInit, so this covers everything loaded before the first frame.
+  // Run twice to compare cold caches with warm ones (delete the cache files to make them cold again)
+  const auto shaderCacheStats = Fvog::GetShaderCacheStats();
+  printf("Startup took %.0f ms, %u pipelines took %.0f ms summed over threads (%s pipeline cache), SPIR-V cache: %u hits, %u misses\n",
+    glfwGetTime() * 1000.0,
+    device_->pipelineCreationCount_.load(),
+    static_cast<double>(device_->pipelineCreationNanoseconds_.load()) / 1'000'000.0,
+    device_->pipelineCacheInitialBytes_ > 0 ? "warm" : "cold",
+    shaderCacheStats.hits,
+    shaderCacheStats.misses);
+
+  // Compare profiles with a cold SPIR-V cache, or the compile time only covers misses
+  const auto shaderStats = Fvog::GetShaderStats();
+  const bool isReleaseProfile = Fvog::GetShaderProfile() == Fvog::ShaderProfile::RELEASE;
+#ifndef FROGRENDER_SHADER_OPTIMIZER
+  const char* optimizerNote = isReleaseProfile ? ", unoptimized because FROGRENDER_SHADER_OPTIMIZER is off" : "";
+#else
+  const char* optimizerNote = "";
+#endif
+  printf("%u shader modules (%s profile%s): %.1f KB of SPIR-V, %.0f ms compiling summed over threads\n",
+    shaderStats.modules,
+    isReleaseProfile ? "release" : "debug",
+    optimizerNote,
+    static_cast<double>(shaderStats.spirvBytes) / 1000.0,
+    shaderStats.compileMs);
+
+  // Scene import registers a descriptor for every texture view, so this is dominated by it. Compare with batchDescriptorWrites off
+  printf("%u descriptor writes in %u vkUpdateDescriptorSets calls took %.2f ms (%s)\n",
+    device_->descriptorWriteCount_.load(),
+    device_->descriptorUpdateCount_.load(),
+    static_cast<double>(device_->descriptorUpdateNanoseconds_.load()) / 1'000'000.0,
+    device_->batchDescriptorWrites_ ? "batched" : "unbatched");
+
   // The main loop.
   double prevFrame = glfwGetTime();
   while (!glfwWindowShouldClose(window))
@@ -655,6 +733,13 @@ void Application::Run()
       shouldRemakeSwapchainNextFrame = false;
     }
 
+    if (framesInFlight != device_->FramesInFlight())
+    {
+      device_->SetFramesInFlight(framesInFlight);
+      framesInFlight = device_->FramesInFlight(); // Clamped
+      OnFramesInFlightChanged(framesInFlight);
+    }
+
     // Close the app if the user presses Escape.
     if (glfwGetKey(window, GLFW_KEY_ESCAPE))
     {
@@ -725,11 +810,215 @@ void Application::Run()
 
     if (windowFramebufferWidth > 0 && windowFramebufferHeight > 0)
     {
+      if (framesInFlightBenchmark_)
+      {
+        AdvanceFramesInFlightBenchmark(curFrame);
+      }
+      if (resourceStressTest_)
+      {
+        AdvanceResourceStressTest();
+      }
       Draw();
     }
   }
 }
 
+void Application::StartFramesInFlightBenchmark()
+{
+  printf("Benchmarking 1 to %u frames in flight, %u frames each. Latency is from the start of a frame on the CPU until its GPU work completes\n",
+    Fvog::Device::maxFramesInFlight,
+    FramesInFlightBenchmark::measuredFrames);
+  framesInFlightBenchmark_ = FramesInFlightBenchmark{.restoreFramesInFlight = framesInFlight};
+  framesInFlight = 1;
+}
+
+void Application::AdvanceFramesInFlightBenchmark(double frameStartTime)
+{
+  ZoneScoped;
+  auto& benchmark = *framesInFlightBenchmark_;
+  const auto now = glfwGetTime();
+
+  // Completion is only observed once per frame, so latencies are rounded up to the next frame's start
+  auto completedFrame = uint64_t{};
+  vkGetSemaphoreCounterValue(device_->device_, device_->graphicsQueueTimelineSemaphore_, &completedFrame);
+  while (!benchmark.pendingFrames.empty() && benchmark.pendingFrames.front().first <= completedFrame)
+  {
+    benchmark.latencySum += now - benchmark.pendingFrames.front().second;
+    benchmark.latencyCount++;
+    benchmark.pendingFrames.pop_front();
+  }
+
+  if (benchmark.frame == FramesInFlightBenchmark::warmupFrames)
+  {
+    benchmark.measureStartTime = now;
+  }
+
+  if (benchmark.frame == FramesInFlightBenchmark::warmupFrames + FramesInFlightBenchmark::measuredFrames)
+  {
+    const auto frameMs = (now - benchmark.measureStartTime) * 1000.0 / FramesInFlightBenchmark::measuredFrames;
+    printf("%u frames in flight: %.2f ms per frame (%.0f FPS), %.2f ms average latency\n",
+      device_->FramesInFlight(),
+      frameMs,
+      1000.0 / frameMs,
+      benchmark.latencySum * 1000.0 / std::max(1u, benchmark.latencyCount));
+
+    // The next setting is applied at the start of the next frame
+    if (device_->FramesInFlight() == Fvog::Device::maxFramesInFlight)
+    {
+      framesInFlight = benchmark.restoreFramesInFlight;
+      framesInFlightBenchmark_.reset();
+      return;
+    }
+    framesInFlight = device_->FramesInFlight() + 1;
+    benchmark = {.restoreFramesInFlight = benchmark.restoreFramesInFlight};
+    return;
+  }
+
+  // Draw increments the frame number before signaling it on the graphics timeline
+  if (benchmark.frame >= FramesInFlightBenchmark::warmupFrames)
+  {
+    benchmark.pendingFrames.emplace_back(device_->frameNumber + 1, frameStartTime);
+  }
+  benchmark.frame++;
+}
+
+void Application::StartResourceStressTest(uint32_t threadCount, uint32_t iterationsPerThread)
+{
+  ZoneScoped;
+  auto& device = *device_;
+
+  // Resources from this frame's deletions or earlier may still be freed, so the baseline only counts resources that are still live or pending
+  auto test = ResourceStressTest{
+    .checkFrame                       = device.frameNumber + device.FramesInFlight() + 1,
+    .baselineDebugBytes               = device.GetMemoryUsage(Fvog::MemoryCategory::DEBUG).allocatedBytes,
+    .baselineDebugAllocations         = device.GetMemoryUsage(Fvog::MemoryCategory::DEBUG).allocationCount,
+    .baselineStorageBufferDescriptors = device.storageBufferDescriptorAllocator.NumAllocated(),
+    .baselineStorageImageDescriptors  = device.storageImageDescriptorAllocator.NumAllocated(),
+    .baselineSampledImageDescriptors  = device.sampledImageDescriptorAllocator.NumAllocated(),
+  };
+
+  struct Resources
+  {
+    std::optional<Fvog::Buffer> buffer;
+    std::optional<Fvog::Texture> texture;
+  };
+
+  // Descriptor indices of live resources, keyed by type in the upper bits
+  auto liveIndices = std::unordered_set<uint64_t>();
+  auto liveIndicesMutex = std::mutex();
+  auto duplicateIndices = std::atomic<uint32_t>();
+  auto handles = [](Resources& resources)
+  {
+    return std::array{
+      resources.buffer->GetResourceHandle(),
+      resources.texture->ImageView().GetSampledResourceHandle(),
+      resources.texture->ImageView().GetStorageResourceHandle(),
+    };
+  };
+  auto key = [](Fvog::Device::DescriptorInfo::ResourceHandle handle) { return (uint64_t(handle.type) << 32) | handle.index; };
+
+  // Resources waiting for some thread to destroy them
+  auto handoff = std::vector<Resources>();
+  auto handoffMutex = std::mutex();
+
+  const auto start = std::chrono::steady_clock::now();
+  auto threads = std::vector<std::jthread>();
+  for (uint32_t t = 0; t < threadCount; t++)
+  {
+    threads.emplace_back([&, t]
+    {
+      auto rng = PCG::Hash(t + 1);
+      for (uint32_t i = 0; i < iterationsPerThread; i++)
+      {
+        auto resources = Resources{
+          .buffer = Fvog::Buffer(device, {.size = PCG::RandU32(rng) % 65536 + 4, .category = Fvog::MemoryCategory::DEBUG}, "Stress Test Buffer"),
+          .texture = Fvog::Texture(device,
+            {
+              .viewType = VK_IMAGE_VIEW_TYPE_2D,
+              .format   = Fvog::Format::R8G8B8A8_UNORM,
+              .extent   = {PCG::RandU32(rng) % 64 + 1, PCG::RandU32(rng) % 64 + 1, 1},
+              .usage    = Fvog::TextureUsage::GENERAL,
+              .category = Fvog::MemoryCategory::DEBUG,
+            },
+            "Stress Test Texture"),
+        };
+
+        {
+          auto lock = std::lock_guard{liveIndicesMutex};
+          for (auto handle : handles(resources))
+          {
+            if (!liveIndices.insert(key(handle)).second)
+            {
+              duplicateIndices++;
+            }
+          }
+        }
+
+        // Destroy a random resource, probably created by another thread
+        auto victim = Resources{};
+        {
+          auto lock = std::lock_guard{handoffMutex};
+          handoff.emplace_back(std::move(resources));
+          std::swap(handoff[PCG::RandU32(rng) % handoff.size()], handoff.back());
+          victim = std::move(handoff.back());
+          handoff.pop_back();
+        }
+
+        {
+          auto lock = std::lock_guard{liveIndicesMutex};
+          for (auto handle : handles(victim))
+          {
+            liveIndices.erase(key(handle));
+          }
+        }
+      }
+    });
+  }
+  threads.clear();
+  const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  handoff.clear();
+
+  printf("Resource stress test: %u threads created and destroyed %u buffers and %u textures in %.1f ms. %u descriptor indices were held by two live resources\n",
+    threadCount,
+    threadCount * iterationsPerThread,
+    threadCount * iterationsPerThread,
+    seconds * 1000,
+    duplicateIndices.load());
+  resourceStressTest_ = test;
+}
+
+void Application::AdvanceResourceStressTest()
+{
+  ZoneScoped;
+  const auto& test = *resourceStressTest_;
+  // Draw frees the resources of frames that have retired before it records the next one
+  if (device_->frameNumber < test.checkFrame)
+  {
+    return;
+  }
+
+  const auto debugUsage = device_->GetMemoryUsage(Fvog::MemoryCategory::DEBUG);
+  const auto storageBuffers = device_->storageBufferDescriptorAllocator.NumAllocated();
+  const auto storageImages = device_->storageImageDescriptorAllocator.NumAllocated();
+  const auto sampledImages = device_->sampledImageDescriptorAllocator.NumAllocated();
+  const bool leaked = debugUsage.allocatedBytes > test.baselineDebugBytes || debugUsage.allocationCount > test.baselineDebugAllocations ||
+                      storageBuffers > test.baselineStorageBufferDescriptors || storageImages > test.baselineStorageImageDescriptors ||
+                      sampledImages > test.baselineSampledImageDescriptors;
+  printf("Resource stress test: %s. DEBUG memory %llu -> %llu bytes in %llu -> %llu allocations. Descriptors in use: storage buffers %u -> %u, storage images %u -> %u, sampled images %u -> %u\n",
+    leaked ? "LEAKED" : "nothing leaked",
+    (unsigned long long)test.baselineDebugBytes,
+    (unsigned long long)debugUsage.allocatedBytes,
+    (unsigned long long)test.baselineDebugAllocations,
+    (unsigned long long)debugUsage.allocationCount,
+    test.baselineStorageBufferDescriptors,
+    storageBuffers,
+    test.baselineStorageImageDescriptors,
+    storageImages,
+    test.baselineSampledImageDescriptors,
+    sampledImages);
+  resourceStressTest_.reset();
+}
+
 void Application::RemakeSwapchain([[maybe_unused]] uint32_t newWidth, [[maybe_unused]] uint32_t newHeight)
 {
   ZoneScoped;
@@ -1,8 +1,10 @@
 #pragma once
 #include "Fvog/Device.h"
+#include "Fvog/Shader2.h"
 #include <VkBootstrap.h>
 
 #include <cstddef>
+#include <deque>
 #include <filesystem>
 #include <memory>
 #include <string_view>
@@ -67,6 +69,16 @@ public:
     bool maximize = false;
     bool decorate = true;
     VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    // Frames the CPU may record ahead of the GPU, from 1 to Fvog::Device::maxFramesInFlight
+    uint32_t framesInFlight = 2;
+    // Queue descriptor writes and make them in one call per submission instead of one call each
+    bool batchDescriptorWrites = true;
+    // Debug builds keep shader debug info so they can be debugged in RenderDoc
+#ifdef NDEBUG
+    Fvog::ShaderProfile shaderProfile = Fvog::ShaderProfile::RELEASE;
+#else
+    Fvog::ShaderProfile shaderProfile = Fvog::ShaderProfile::DEBUG;
+#endif
   };
 
   // TODO: An easy way to load shaders should probably be a part of Fwog
@@ -86,6 +98,8 @@ public:
 protected:
   // Create swapchain size-dependent resources
   virtual void OnFramebufferResize([[maybe_unused]] uint32_t newWidth, [[maybe_unused]] uint32_t newHeight){}
+  // Resize per-frame resources. Called between frames while the device is idle
+  virtual void OnFramesInFlightChanged([[maybe_unused]] uint32_t framesInFlight){}
   virtual void OnUpdate([[maybe_unused]] double dt){}
   virtual void OnRender(
     [[maybe_unused]] double dt,
@@ -110,6 +124,8 @@ protected:
   float maxDisplayNits = 200.0f;
 
   tracy::VkCtx* tracyVkContext_{};
+  // Same as tracyVkContext_ if the device has no async compute queue
+  tracy::VkCtx* tracyVkAsyncComputeContext_{};
   GLFWwindow* window;
   View mainCamera{};
   float cursorSensitivity = 0.0025f;
@@ -126,16 +142,65 @@ protected:
   bool shouldRemakeSwapchainNextFrame = false;
   VkPresentModeKHR presentMode;
   uint32_t numSwapchainImages = 3;
+  // Changing this from UI is deferred until next frame, as the device must be idle
+  uint32_t framesInFlight;
+
+  // Renders a fixed number of frames with each number of frames in flight, then prints their average frame time and latency.
+  // Use a present mode other than FIFO, or every setting will be limited by the refresh rate
+  void StartFramesInFlightBenchmark();
+  [[nodiscard]] bool IsBenchmarkingFramesInFlight() const noexcept
+  {
+    return framesInFlightBenchmark_.has_value();
+  }
+
+  // Creates and destroys buffers and textures from several threads at once, handing resources between threads so they are often
+  // destroyed on a thread other than the one that created them, and checks that no descriptor index is held by two live resources.
+  // Once the frames that destroyed them have retired, checks that their memory and descriptor indices were freed. Prints the results to the console
+  void StartResourceStressTest(uint32_t threadCount = 8, uint32_t iterationsPerThread = 1000);
+  [[nodiscard]] bool IsStressTestingResources() const noexcept
+  {
+    return resourceStressTest_.has_value();
+  }
 
 private:
   friend class ApplicationAccess;
 
   void RemakeSwapchain(uint32_t newWidth, uint32_t newHeight);
   void Draw();
+  void AdvanceFramesInFlightBenchmark(double frameStartTime);
+  void AdvanceResourceStressTest();
   double timeOfLastDraw = 0;
 
   glm::dvec2 cursorFrameOffset{};
   bool cursorJustEnteredWindow = true;
   bool graveHeldLastFrame = false;
   bool swapchainOk = true;
+
+  struct FramesInFlightBenchmark
+  {
+    static constexpr uint32_t warmupFrames = 60;
+    static constexpr uint32_t measuredFrames = 600;
+
+    uint32_t restoreFramesInFlight{};
+    uint32_t frame{};
+    double measureStartTime{};
+    double latencySum{};
+    uint32_t latencyCount{};
+    // Frame numbers and CPU start times of measured frames whose GPU work hasn't been seen to complete
+    std::deque<std::pair<uint64_t, double>> pendingFrames;
+  };
+  std::optional<FramesInFlightBenchmark> framesInFlightBenchmark_;
+
+  struct ResourceStressTest
+  {
+    // The leak check runs once this frame begins, when every frame that destroyed a resource has retired
+    uint64_t checkFrame{};
+    // Taken before the test. Its resources are the only ones in the DEBUG category that come and go
+    uint64_t baselineDebugBytes{};
+    uint64_t baselineDebugAllocations{};
+    uint32_t baselineStorageBufferDescriptors{};
+    uint32_t baselineStorageImageDescriptors{};
+    uint32_t baselineSampledImageDescriptors{};
+  };
+  std::optional<ResourceStressTest> resourceStressTest_;
 };
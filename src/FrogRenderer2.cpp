@@ -23,15 +23,25 @@ using namespace Fvog::detail;
 #include <tracy/Tracy.hpp>
 #include <tracy/TracyVulkan.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
 #include <memory_resource>
 
 #define CONCAT_HELPER(x, y) x##y
 #define CONCAT(x, y)        CONCAT_HELPER(x, y)
 
-#define TIME_SCOPE_GPU(statGroup, statEnum, commandBuffer) \
+#define TIME_SCOPE_GPU_ON(tracyContext, statGroup, statEnum, commandBuffer) \
   stats[(int)(statGroup)][statEnum].Measure();   \
   const auto CONCAT(gpu_timer_, __LINE__) = stats[(int)(statGroup)][statEnum].MakeScopedTimer(commandBuffer); \
-  TracyVkZoneTransient(tracyVkContext_, CONCAT(asdf, __LINE__), commandBuffer, statGroups[(int)(statGroup)].statNames[statEnum], true) 
+  TracyVkZoneTransient(tracyContext, CONCAT(asdf, __LINE__), commandBuffer, statGroups[(int)(statGroup)].statNames[statEnum].c_str(), true) 
+
+#define TIME_SCOPE_GPU(statGroup, statEnum, commandBuffer) TIME_SCOPE_GPU_ON(tracyVkContext_, statGroup, statEnum, commandBuffer)
+
+// For passes that run on the async compute queue
+#define TIME_SCOPE_GPU_ASYNC(statGroup, statEnum, commandBuffer) TIME_SCOPE_GPU_ON(tracyVkAsyncComputeContext_, statGroup, statEnum, commandBuffer)
 
 static Fvog::Texture LoadTonyMcMapfaceTexture(Fvog::Device& device)
 {
@@ -57,17 +67,13 @@ static Fvog::Texture LoadTonyMcMapfaceTexture(Fvog::Device& device)
     },
     "Tony McMapface LUT");
 
-  for (uint32_t i = 0; i < dim; i++)
-  {
-    texture.UpdateImageSLOW({
-      .level       = 0,
-      .offset      = {0, 0, i},
-      .extent      = {dim, dim, 1},
-      .data        = pixels + (i * 4 * dim * dim),
-      .rowLength   = 0,
-      .imageHeight = 0,
-    });
-  }
+  // The column of slices is already laid out as a tightly packed volume, so it can be uploaded at once
+  texture.UpdateImageSLOW({
+    .level  = 0,
+    .offset = {0, 0, 0},
+    .extent = {dim, dim, dim},
+    .data   = pixels,
+  });
 
   stbi_image_free(pixels);
   return texture;
@@ -136,82 +142,159 @@ static std::vector<Debug::Line> GenerateFrustumWireframe(const glm::mat4& invVie
   return GenerateSubfrustumWireframe(invViewProj, color, near, far, 0, 1, 0, 1);
 }
 
+FrogRenderer2::PipelineBuilds FrogRenderer2::StartPipelineBuilds()
+{
+  ZoneScoped;
+  auto& device = *device_;
+  auto& pool = pipelineThreadPool;
+  const auto swapchainFormat = Fvog::detail::VkToFormat(swapchainFormat_.format);
+
+  // Render target formats are spans, so they are created inside the jobs to outlive the pipeline constructors
+  return {
+    .cullMeshlets = pool.Submit([&device] { return Pipelines2::CullMeshlets(device); }),
+    .cullTriangles = pool.Submit([&device] { return Pipelines2::CullTriangles(device); }),
+    .cullInstances = pool.Submit([&device] { return Pipelines2::CullInstances(device); }),
+    .cullInstancesMultiView = pool.Submit([&device] { return Pipelines2::CullInstancesMultiView(device); }),
+    .cullMeshletsMultiView = pool.Submit([&device] { return Pipelines2::CullMeshletsMultiView(device); }),
+    .multiViewPrefixSum = pool.Submit([&device] { return Pipelines2::MultiViewPrefixSum(device); }),
+    .cullTrianglesMultiView = pool.Submit([&device] { return Pipelines2::CullTrianglesMultiView(device); }),
+    .hzbCopy = pool.Submit([&device] { return Pipelines2::HzbCopy(device); }),
+    .hzbReduce = pool.Submit([&device] { return Pipelines2::HzbReduce(device); }),
+    .visbuffer = pool.Submit([&device] {
+      return Pipelines2::Visbuffer(device,
+        {
+          .colorAttachmentFormats = {{Frame::visbufferFormat}},
+          .depthAttachmentFormat  = Frame::gDepthFormat,
+        });
+    }),
+    .visbufferMesh = pool.Submit([&device]() -> std::optional<Fvog::GraphicsPipeline> {
+      if (!device.supportsMeshShaders_)
+      {
+        return std::nullopt;
+      }
+      return Pipelines2::VisbufferMesh(device,
+        {
+          .colorAttachmentFormats = {{Frame::visbufferFormat}},
+          .depthAttachmentFormat  = Frame::gDepthFormat,
+        });
+    }),
+    .visbufferResolve = pool.Submit([&device] {
+      return Pipelines2::VisbufferResolve(device,
+        {
+          .colorAttachmentFormats = {{
+            Frame::gAlbedoFormat,
+            Frame::gMetallicRoughnessAoFormat,
+            Frame::gNormalAndFaceNormalFormat,
+            Frame::gSmoothVertexNormalFormat,
+            Frame::gEmissionFormat,
+            Frame::gMotionFormat,
+          }},
+        });
+    }),
+    .shading = pool.Submit([&device] { return Pipelines2::Shading(device, {.colorAttachmentFormats = {{Frame::colorHdrRenderResFormat}},}); }),
+    .tonemap = pool.Submit([&device] { return Pipelines2::Tonemap(device); }),
+    .debugTexture = pool.Submit([&device, swapchainFormat] { return Pipelines2::DebugTexture(device, {.colorAttachmentFormats = {{swapchainFormat}},}); }),
+    .debugLines = pool.Submit([&device] {
+      return Pipelines2::DebugLines(device,
+        {
+          .colorAttachmentFormats = {{Frame::colorHdrRenderResFormat, Frame::gReactiveMaskFormat}},
+          .depthAttachmentFormat = Frame::gDepthFormat,
+        });
+    }),
+    .debugAabbs = pool.Submit([&device] {
+      return Pipelines2::DebugAabbs(device,
+        {
+          .colorAttachmentFormats = {{Frame::colorHdrRenderResFormat, Frame::gReactiveMaskFormat}},
+          .depthAttachmentFormat = Frame::gDepthFormat,
+        });
+    }),
+    .debugRects = pool.Submit([&device] {
+      return Pipelines2::DebugRects(device,
+        {
+          .colorAttachmentFormats = {{Frame::colorHdrRenderResFormat, Frame::gReactiveMaskFormat}},
+          .depthAttachmentFormat = Frame::gDepthFormat,
+        });
+    }),
+    .calibrateHdr = pool.Submit([&device] { return Pipelines2::CalibrateHdr(device); }),
+    .vsmShadow = pool.Submit([&device] {
+      return Pipelines2::ShadowVsm(device,
+        {
+#if VSM_USE_TEMP_ZBUFFER
+          .depthAttachmentFormat = Fvog::Format::D32_SFLOAT,
+#endif
+        });
+    }),
+    .viewerVsmPageTables = pool.Submit([&device] { return Pipelines2::ViewerVsm(device, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}}); }),
+    .viewerVsmPhysicalPages = pool.Submit([&device] { return Pipelines2::ViewerVsmPhysicalPages(device, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}}); }),
+    .viewerVsmBitmaskHzb = pool.Submit([&device] { return Pipelines2::ViewerVsmBitmaskHzb(device, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}}); }),
+    .viewerVsmPhysicalPagesOverdraw = pool.Submit([&device] { return Pipelines2::ViewerVsmPhysicalPagesOverdraw(device, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}}); }),
+    .bloom = Techniques::Bloom::StartPipelineBuilds(device, pool),
+    .autoExposure = Techniques::AutoExposure::StartPipelineBuilds(device, pool),
+    .vsm = Techniques::VirtualShadowMaps::Context::StartPipelineBuilds(device, pool),
+    .lightClusters = Techniques::LightClusters::StartPipelineBuilds(device, pool),
+    .lightBvh = Techniques::LightBvh::StartPipelineBuilds(device, pool),
+  };
+}
+
 FrogRenderer2::FrogRenderer2(const Application::CreateInfo& createInfo)
   : Application(createInfo),
     // Create constant-size buffers
     globalUniformsBuffer(*device_, 1, "Global Uniforms"),
     shadingUniformsBuffer(*device_, 1, "Shading Uniforms"),
     shadowUniformsBuffer(*device_, 1, "Shadow Uniforms"),
-    geometryBuffer(*device_, 1'000'000'000, "Geometry Buffer"),
-    meshletInstancesBuffer(*device_, 100'000'000 * sizeof(Render::MeshletInstance), "Meshlet Instances Buffer"),
+    geometryBuffer(*device_, 1'000'000'000, "Geometry Buffer", Fvog::MemoryCategory::GEOMETRY),
+    meshletInstancesBuffer(*device_, 100'000'000 * sizeof(Render::MeshletInstance), "Meshlet Instances Buffer", Fvog::MemoryCategory::MESHLET_INSTANCES),
     lightsBuffer(*device_, 1'000 * sizeof(GpuLight), "Light Buffer"),
     // Create the pipelines used in the application
-    cullMeshletsPipeline(Pipelines2::CullMeshlets(*device_)),
-    cullTrianglesPipeline(Pipelines2::CullTriangles(*device_)),
-    hzbCopyPipeline(Pipelines2::HzbCopy(*device_)),
-    hzbReducePipeline(Pipelines2::HzbReduce(*device_)),
-    visbufferPipeline(Pipelines2::Visbuffer(*device_,
-      {
-        .colorAttachmentFormats = {{Frame::visbufferFormat}},
-        .depthAttachmentFormat  = Frame::gDepthFormat,
-      })),
-    visbufferResolvePipeline(Pipelines2::VisbufferResolve(*device_,
-      {
-        .colorAttachmentFormats = {{
-          Frame::gAlbedoFormat,
-          Frame::gMetallicRoughnessAoFormat,
-          Frame::gNormalAndFaceNormalFormat,
-          Frame::gSmoothVertexNormalFormat,
-          Frame::gEmissionFormat,
-          Frame::gMotionFormat,
-        }},
-      })),
-    shadingPipeline(Pipelines2::Shading(*device_, {.colorAttachmentFormats = {{Frame::colorHdrRenderResFormat}},})),
-    tonemapPipeline(Pipelines2::Tonemap(*device_)),
-    debugTexturePipeline(Pipelines2::DebugTexture(*device_, {.colorAttachmentFormats = {{Fvog::detail::VkToFormat(swapchainFormat_.format)}},})),
-    debugLinesPipeline(Pipelines2::DebugLines(*device_,
-      {
-        .colorAttachmentFormats = {{Frame::colorHdrRenderResFormat, Frame::gReactiveMaskFormat}},
-        .depthAttachmentFormat = Frame::gDepthFormat,
-      })),
-    debugAabbsPipeline(Pipelines2::DebugAabbs(*device_,
-      {
-        .colorAttachmentFormats = {{Frame::colorHdrRenderResFormat, Frame::gReactiveMaskFormat}},
-        .depthAttachmentFormat = Frame::gDepthFormat,
-      })),
-    debugRectsPipeline(Pipelines2::DebugRects(*device_,
-      {
-        .colorAttachmentFormats = {{Frame::colorHdrRenderResFormat, Frame::gReactiveMaskFormat}},
-        .depthAttachmentFormat = Frame::gDepthFormat,
-      })),
+    pipelineBuilds(StartPipelineBuilds()),
+    cullMeshletsPipeline(pipelineBuilds.cullMeshlets.get()),
+    cullTrianglesPipeline(pipelineBuilds.cullTriangles.get()),
+    cullInstancesPipeline(pipelineBuilds.cullInstances.get()),
+    cullInstancesMultiViewPipeline(pipelineBuilds.cullInstancesMultiView.get()),
+    cullMeshletsMultiViewPipeline(pipelineBuilds.cullMeshletsMultiView.get()),
+    multiViewPrefixSumPipeline(pipelineBuilds.multiViewPrefixSum.get()),
+    cullTrianglesMultiViewPipeline(pipelineBuilds.cullTrianglesMultiView.get()),
+    hzbCopyPipeline(pipelineBuilds.hzbCopy.get()),
+    hzbReducePipeline(pipelineBuilds.hzbReduce.get()),
+    visbufferPipeline(pipelineBuilds.visbuffer.get()),
+    visbufferMeshPipeline(pipelineBuilds.visbufferMesh.get()),
+    visbufferResolvePipeline(pipelineBuilds.visbufferResolve.get()),
+    shadingPipeline(pipelineBuilds.shading.get()),
+    tonemapPipeline(pipelineBuilds.tonemap.get()),
+    debugTexturePipeline(pipelineBuilds.debugTexture.get()),
+    debugLinesPipeline(pipelineBuilds.debugLines.get()),
+    debugAabbsPipeline(pipelineBuilds.debugAabbs.get()),
+    debugRectsPipeline(pipelineBuilds.debugRects.get()),
     tonemapUniformBuffer(*device_, 1, "Tonemap Uniforms"),
     tonyMcMapfaceLut(LoadTonyMcMapfaceTexture(*device_)),
     calibrateHdrTexture(Fvog::CreateTexture2D(*device_, {2, 2}, Fvog::Format::A2R10G10B10_UNORM, Fvog::TextureUsage::GENERAL, "HDR Calibration Texture")),
-    calibrateHdrPipeline(Pipelines2::CalibrateHdr(*device_)),
-    bloom(*device_),
-    autoExposure(*device_),
-    exposureBuffer(*device_, {}, "Exposure"),
+    calibrateHdrPipeline(pipelineBuilds.calibrateHdr.get()),
+    renderGraph(*device_),
+    bloom(*device_, std::move(pipelineBuilds.bloom)),
+    autoExposure(*device_, std::move(pipelineBuilds.autoExposure)),
+    exposureBuffer(*device_, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Exposure"),
+    lightClusters(*device_, std::move(pipelineBuilds.lightClusters)),
+    lightBvh(*device_, std::move(pipelineBuilds.lightBvh)),
     vsmContext(*device_, {
-      .maxVsms = 64,
+      .maxVsms = 128, // Sun clipmaps and up to six views for each local light
       .pageSize = {Techniques::VirtualShadowMaps::pageSize, Techniques::VirtualShadowMaps::pageSize},
       .numPages = 1024,
-    }),
+    }, std::move(pipelineBuilds.vsm)),
     vsmSun({
       .context = vsmContext,
       .virtualExtent = Techniques::VirtualShadowMaps::maxExtent,
-      .numClipmaps = 10,
+      .numClipmaps = vsmSunClipmaps,
     }),
-    vsmShadowPipeline(Pipelines2::ShadowVsm(*device_,
-      {
-#if VSM_USE_TEMP_ZBUFFER
-        .depthAttachmentFormat = Fvog::Format::D32_SFLOAT,
-#endif
-      })),
-    vsmShadowUniformBuffer(*device_),
-    viewerVsmPageTablesPipeline(Pipelines2::ViewerVsm(*device_, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}})),
-    viewerVsmPhysicalPagesPipeline(Pipelines2::ViewerVsmPhysicalPages(*device_, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}})),
-    viewerVsmBitmaskHzbPipeline(Pipelines2::ViewerVsmBitmaskHzb(*device_, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}})),
-    viewerVsmPhysicalPagesOverdrawPipeline(Pipelines2::ViewerVsmPhysicalPagesOverdraw(*device_, {.colorAttachmentFormats = {{viewerOutputTextureFormat}}})),
+    vsmShadowPipeline(pipelineBuilds.vsmShadow.get()),
+    vsmShadowUniformBuffer(*device_, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}),
+    vsmLocalLights({
+      .context = vsmContext,
+      .maxLights = vsmMaxLocalLights,
+    }),
+    viewerVsmPageTablesPipeline(pipelineBuilds.viewerVsmPageTables.get()),
+    viewerVsmPhysicalPagesPipeline(pipelineBuilds.viewerVsmPhysicalPages.get()),
+    viewerVsmBitmaskHzbPipeline(pipelineBuilds.viewerVsmBitmaskHzb.get()),
+    viewerVsmPhysicalPagesOverdrawPipeline(pipelineBuilds.viewerVsmPhysicalPagesOverdraw.get()),
     nearestSampler(*device_,
       {
         .magFilter    = VK_FILTER_NEAREST,
@@ -256,6 +339,10 @@ FrogRenderer2::FrogRenderer2(const Application::CreateInfo& createInfo)
 {
   ZoneScoped;
 
+  // Start building the culling permutations for the default flags so they're usually ready by the first frame
+  (void)SelectCullMeshletsPipeline();
+  (void)SelectCullTrianglesPipeline();
+
   int x = 0;
   int y = 0;
   const auto noise = stbi_load("textures/bluenoise32.png", &x, &y, nullptr, 4);
@@ -296,13 +383,24 @@ FrogRenderer2::FrogRenderer2(const Application::CreateInfo& createInfo)
     std::pmr::set_default_resource(oldResource);
   }
 
-  meshletIndirectCommand = Fvog::TypedBuffer<Fvog::DrawIndexedIndirectCommand>(*device_, {}, "Meshlet Indirect Command");
-  cullTrianglesDispatchParams = Fvog::TypedBuffer<Fvog::DispatchIndirectCommand>(*device_, {}, "Cull Triangles Dispatch Params");
-  viewBuffer = Fvog::TypedBuffer<ViewParams>(*device_, {}, "View Data");
+  meshletIndirectCommand = Fvog::TypedBuffer<Fvog::DrawIndexedIndirectCommand>(*device_, {.count = 2, .flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Meshlet Indirect Command");
+  cullTrianglesDispatchParams = Fvog::TypedBuffer<Fvog::DispatchIndirectCommand>(*device_, {.count = 2, .flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Cull Triangles Dispatch Params");
+  meshInstancesBuffer = Fvog::TypedBuffer<Render::GpuMeshInstance>(*device_, {.category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Mesh Instances");
+  meshletCullChunksBuffer = Fvog::Buffer(*device_, {.size = 16 + sizeof(glm::uvec2), .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Meshlet Cull Chunks");
+  triangleCullFeedbackBuffer = Fvog::TypedBuffer<TriangleCullFeedback>(*device_, {.category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Triangle Cull Feedback");
+  CreateTriangleCullFeedbackReadbacks(device_->FramesInFlight());
+  viewBuffer = Fvog::TypedBuffer<ViewParams>(*device_, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "View Data");
+  multiViewsBuffer = Fvog::TypedBuffer<ViewParams>(*device_, {.count = maxMultiViews, .flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Multi-View Data");
+  for (uint32_t i = 0; i < maxMultiViews; i++)
+  {
+    multiViewBuffers.emplace_back(*device_, Fvog::TypedBufferCreateInfo{.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Multi-View Data " + std::to_string(i));
+  }
+  multiViewIndirectCommands = Fvog::TypedBuffer<Fvog::DrawIndexedIndirectCommand>(*device_, {.count = maxMultiViews, .flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Multi-View Indirect Commands");
+  multiViewCullParams = Fvog::TypedBuffer<MultiViewCullParams>(*device_, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Multi-View Cull Params");
 
-  debugGpuAabbsBuffer = Fvog::Buffer(*device_, {sizeof(Fvog::DrawIndirectCommand) + sizeof(Debug::Aabb) * 100'000}, "Debug GPU AABBs");
+  debugGpuAabbsBuffer = Fvog::Buffer(*device_, {.size = sizeof(Fvog::DrawIndirectCommand) + sizeof(Debug::Aabb) * 100'000, .category = Fvog::MemoryCategory::DEBUG}, "Debug GPU AABBs");
 
-  debugGpuRectsBuffer = Fvog::Buffer(*device_, {sizeof(Fvog::DrawIndirectCommand) + sizeof(Debug::Rect) * 100'000}, "Debug GPU Rects");
+  debugGpuRectsBuffer = Fvog::Buffer(*device_, {.size = sizeof(Fvog::DrawIndirectCommand) + sizeof(Debug::Rect) * 100'000, .category = Fvog::MemoryCategory::DEBUG}, "Debug GPU Rects");
 
   device_->ImmediateSubmit(
     [this](VkCommandBuffer commandBuffer)
@@ -328,13 +426,14 @@ FrogRenderer2::FrogRenderer2(const Application::CreateInfo& createInfo)
       ctx.TeenyBufferUpdate(*debugGpuRectsBuffer, rectCommand);
       
       exposureBuffer.FillData(commandBuffer, {.data = std::bit_cast<uint32_t>(1.0f)});
-      cullTrianglesDispatchParams->UpdateDataExpensive(commandBuffer, Fvog::DispatchIndirectCommand{0, 1, 1});
+      const Fvog::DispatchIndirectCommand cullTrianglesDispatches[] = {{0, 1, 1}, {0, 1, 1}};
+      cullTrianglesDispatchParams->UpdateDataExpensive(commandBuffer, std::span(cullTrianglesDispatches));
     });
 
   stats.resize(std::size(statGroups));
   for (size_t i = 0; i < std::size(statGroups); i++)
   {
-    for (auto statName : statGroups[i].statNames)
+    for (const auto& statName : statGroups[i].statNames)
     {
       stats[i].emplace_back(*device_, statName);
     }
@@ -370,6 +469,27 @@ FrogRenderer2::~FrogRenderer2()
 #endif
 }
 
+void FrogRenderer2::CreateTriangleCullFeedbackReadbacks(uint32_t count)
+{
+  triangleCullFeedbackReadbacks.clear();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    auto& readback = triangleCullFeedbackReadbacks.emplace_back(
+      Fvog::TypedBuffer<TriangleCullFeedback>(*device_,
+        {.flag = Fvog::BufferFlagThingy::MAP_RANDOM_ACCESS | Fvog::BufferFlagThingy::NO_DESCRIPTOR, .category = Fvog::MemoryCategory::STAGING},
+        "Triangle Cull Feedback Readback " + std::to_string(i)));
+    *readback.buffer.GetMappedMemory() = {};
+  }
+}
+
+void FrogRenderer2::OnFramesInFlightChanged(uint32_t framesInFlight)
+{
+  ZoneScoped;
+  // The readbacks are only valid for the slot mapping they were written with. Starting from zero requests means the
+  // instanced meshlet buffer keeps its size until new feedback arrives
+  CreateTriangleCullFeedbackReadbacks(framesInFlight);
+}
+
 void FrogRenderer2::OnFramebufferResize([[maybe_unused]] uint32_t newWidth, [[maybe_unused]] uint32_t newHeight)
 {
   ZoneScoped;
@@ -436,8 +556,35 @@ void FrogRenderer2::OnFramebufferResize([[maybe_unused]] uint32_t newWidth, [[ma
   //constexpr auto usageDepthFlags = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
   constexpr auto usage = Fvog::TextureUsage::ATTACHMENT_READ_ONLY;
 
+  // Textures that are only live during part of the frame share memory.
+  // Passes are listed in execution order. Every transient texture is discarded when it's first used in a frame
+  enum TransientPass : uint32_t
+  {
+    VISBUFFER,
+    RESOLVE_VISBUFFER,
+    SHADE_DEFERRED,
+    FORWARD_AND_DEBUG,
+    UPSCALE,
+    BLOOM,
+    TONEMAP,
+  };
+
+  const auto renderResExtent = Fvog::Extent3D{renderInternalWidth, renderInternalHeight, 1};
+  const auto windowResExtent = Fvog::Extent3D{newWidth, newHeight, 1};
+  const Fvog::TransientTextureHeap::TextureDesc transientTextures[] = {
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::visbufferFormat, .extent = renderResExtent, .usage = usage}, VISBUFFER, RESOLVE_VISBUFFER, "visbuffer"},
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::gSmoothVertexNormalFormat, .extent = renderResExtent, .usage = usage}, RESOLVE_VISBUFFER, SHADE_DEFERRED, "gSmoothVertexNormal"},
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::gMotionFormat, .extent = renderResExtent, .usage = usage}, RESOLVE_VISBUFFER, UPSCALE, "gMotion"},
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::gReactiveMaskFormat, .extent = renderResExtent}, FORWARD_AND_DEBUG, UPSCALE, "Reactive Mask"},
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::colorHdrRenderResFormat, .extent = renderResExtent}, SHADE_DEFERRED, TONEMAP, "colorHdrRenderRes"},
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::colorHdrWindowResFormat, .extent = windowResExtent}, UPSCALE, TONEMAP, "colorHdrWindowRes"},
+    {{.viewType = VK_IMAGE_VIEW_TYPE_2D, .format = Frame::colorHdrBloomScratchBufferFormat, .extent = {newWidth / 2, newHeight / 2, 1}, .mipLevels = 8}, BLOOM, BLOOM, "colorHdrBloomScratchBuffer"},
+  };
+
+  frame.transientTextureHeap = Fvog::TransientTextureHeap(*device_, transientTextures, "Transient Render Targets");
+
   // Visibility buffer textures
-  frame.visbuffer = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::visbufferFormat, usage, "visbuffer");
+  frame.visbuffer = frame.transientTextureHeap->CreateTexture(0);
 
   {
     const uint32_t hzbWidth = Math::PreviousPower2(renderInternalWidth);
@@ -457,18 +604,18 @@ void FrogRenderer2::OnFramebufferResize([[maybe_unused]] uint32_t newWidth, [[ma
   frame.gAlbedo = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gAlbedoFormat, usage, "gAlbedo");
   frame.gMetallicRoughnessAo = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gMetallicRoughnessAoFormat, usage, "gMetallicRoughnessAo");
   frame.gNormalAndFaceNormal = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gNormalAndFaceNormalFormat, usage, "gNormalAndFaceNormal");
-  frame.gSmoothVertexNormal = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gSmoothVertexNormalFormat, usage, "gSmoothVertexNormal");
+  frame.gSmoothVertexNormal = frame.transientTextureHeap->CreateTexture(1);
   frame.gEmission = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gEmissionFormat, usage, "gEmission");
   frame.gDepth = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gDepthFormat, usage, "gDepth");
-  frame.gMotion = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gMotionFormat, usage, "gMotion");
+  frame.gMotion = frame.transientTextureHeap->CreateTexture(2);
   frame.gNormaAndFaceNormallPrev = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gNormalAndFaceNormalFormat, usage, "gNormaAndFaceNormallPrev");
   frame.gDepthPrev = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gDepthPrevFormat, usage, "gDepthPrev");
   // The reamining are general so they can be written to in postprocessing passes via compute
-  frame.colorHdrRenderRes = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::colorHdrRenderResFormat, Fvog::TextureUsage::GENERAL, "colorHdrRenderRes");
-  frame.colorHdrWindowRes = Fvog::CreateTexture2D(*device_, {newWidth, newHeight}, Frame::colorHdrWindowResFormat, Fvog::TextureUsage::GENERAL, "colorHdrWindowRes");
-  frame.colorHdrBloomScratchBuffer = Fvog::CreateTexture2DMip(*device_, {newWidth / 2, newHeight / 2}, Frame::colorHdrBloomScratchBufferFormat, 8, Fvog::TextureUsage::GENERAL, "colorHdrBloomScratchBuffer");
+  frame.colorHdrRenderRes = frame.transientTextureHeap->CreateTexture(4);
+  frame.colorHdrWindowRes = frame.transientTextureHeap->CreateTexture(5);
+  frame.colorHdrBloomScratchBuffer = frame.transientTextureHeap->CreateTexture(6);
   frame.colorLdrWindowRes = Fvog::CreateTexture2D(*device_, {newWidth, newHeight}, Frame::colorLdrWindowResFormat, Fvog::TextureUsage::GENERAL, "colorLdrWindowRes");
-  frame.gReactiveMask = Fvog::CreateTexture2D(*device_, {renderInternalWidth, renderInternalHeight}, Frame::gReactiveMaskFormat, Fvog::TextureUsage::GENERAL, "Reactive Mask");
+  frame.gReactiveMask = frame.transientTextureHeap->CreateTexture(3);
 
   // Create debug views with alpha swizzle set to one so they can be seen in ImGui
   frame.gAlbedoSwizzled = frame.gAlbedo->CreateSwizzleView({.a = VK_COMPONENT_SWIZZLE_ONE});
@@ -518,35 +665,139 @@ void FrogRenderer2::OnUpdate([[maybe_unused]] double dt)
   }
 }
 
-void FrogRenderer2::CullMeshletsForView(VkCommandBuffer commandBuffer, const ViewParams& view, Fvog::Buffer& visibleMeshletIds, std::string_view name)
+void FrogRenderer2::ResizeInstancedMeshletBufferFromFeedback()
 {
   ZoneScoped;
-  TracyVkZoneTransient(tracyVkContext_, tracyProfileVar, commandBuffer, name.data(), true);
-  auto ctx = Fvog::Context(*device_, commandBuffer);
-  auto marker = ctx.MakeScopedDebugMarker(name.data(), {.5f, .5f, 1.0f, 1.0f});
 
-  ctx.Barrier();
-  ctx.TeenyBufferUpdate(*viewBuffer, view);
-  
-  ctx.TeenyBufferUpdate(*meshletIndirectCommand,
-    Fvog::DrawIndexedIndirectCommand{
-      .indexCount    = 0,
-      .instanceCount = 1,
-      .firstIndex    = 0,
-      .vertexOffset  = 0,
-      .firstInstance = 0,
-    });
+  // Small enough to not matter, but large enough that a typical scene never has to grow it
+  constexpr uint32_t minIndices = 3 * 1'000'000;
 
-  // Clear groupCountX
-  cullTrianglesDispatchParams->FillData(commandBuffer, {.size = sizeof(uint32_t)});
+  // Shrink only after the buffer has been much larger than necessary for a while, so the size doesn't thrash when the camera moves
+  constexpr uint32_t shrinkFrameThreshold = 240;
 
-  ctx.Barrier();
-  
-  ctx.BindComputePipeline(cullMeshletsPipeline);
+  // Soft cap of 1 billion indices should prevent oversubscribing memory (on my system) when loading huge scenes.
+  // This limit should be OK as it only limits post-culling geometry.
+  // Multi-view culls lay their clipmaps' ranges end to end, so the worst case is every clipmap seeing every meshlet
+  const auto maxViewIndices = uint64_t(NumMeshletInstances()) * Utility::maxMeshletPrimitives * 3;
+  const auto maxIndices     = static_cast<uint32_t>(glm::clamp<uint64_t>(maxViewIndices * std::max(1u, vsmSun.NumClipmaps()), 3, 999'999'999));
+
+  // This slot was last written FramesInFlight() frames ago, so that frame has retired
+  auto& readback = triangleCullFeedbackReadbacks[device_->frameNumber % triangleCullFeedbackReadbacks.size()];
+  readback.buffer.InvalidateMappedMemory();
+  const auto& feedback = *readback.buffer.GetMappedMemory();
+  const auto requested = feedback.frameMaxRequestedIndexCount;
+
+  auto& stats = instancedMeshletBufferStats;
+  stats.requested = requested;
+  stats.clamped = feedback.droppedIndexCount;
+  if (stats.clamped > 0)
+  {
+    stats.framesClamped++;
+  }
+
+  const auto capacity = instancedMeshletBuffer ? instancedMeshletBuffer->Size() : 0;
+  stats.framesUnderused = requested < capacity / 4 ? stats.framesUnderused + 1 : 0;
+
+  // Leave headroom so a slowly-growing view doesn't cause a realloc every frame
+  const auto targetCapacity = static_cast<uint32_t>(glm::clamp<uint64_t>(uint64_t(requested) + requested / 2, minIndices, maxIndices)) / 3 * 3;
+  const bool grow = !instancedMeshletBuffer || (requested > capacity && capacity < maxIndices);
+  const bool shrink = stats.framesUnderused >= shrinkFrameThreshold && targetCapacity < capacity;
+  if (grow || shrink || capacity > maxIndices)
+  {
+    // The old buffer is destroyed once the frames that are still using it have retired
+    instancedMeshletBuffer = Fvog::TypedBuffer<uint32_t>(*device_, {.count = targetCapacity, .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Instanced Meshlets");
+    stats.framesUnderused = 0;
+  }
+  stats.capacity = instancedMeshletBuffer->Size();
+}
+
+void FrogRenderer2::DeclareCullMeshletsResources(Fvog::RenderGraph::PassBuilder& pass, Fvog::Buffer& visibleMeshletIds)
+{
+  constexpr auto transfer = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  constexpr auto compute  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  constexpr auto storageReadWrite = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+  pass.Read(globalUniformsBuffer.GetDeviceBuffer(), compute)
+    .Read(meshletInstancesBuffer.GetBuffer(), compute)
+    .Read(geometryBuffer.GetBuffer(), compute)
+    .Read(vsmContext.uniformBuffer_, compute)
+    .Read(vsmSun.clipmapUniformsBuffer_, compute)
+    .Read(vsmContext.pageTables_, compute)
+    .Read(vsmContext.vsmBitmaskHzb_, compute)
+    .Read(*frame.hzb, compute)
+    .Read(*meshInstancesBuffer, compute)
+    // Reset at the start of the pass, then written by culling
+    .Access(*viewBuffer, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_READ_BIT)
+    .Access(*meshletIndirectCommand, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite)
+    .Access(*cullTrianglesDispatchParams,
+      transfer | compute | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT)
+    .Access(*triangleCullFeedbackBuffer, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite)
+    .Access(*meshletCullChunksBuffer,
+      transfer | compute | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT)
+    .ReadWrite(visibleMeshletIds, compute)
+    .Write(*instancedMeshletBuffer, compute)
+    .ReadWrite(*debugGpuAabbsBuffer, compute)
+    .ReadWrite(*debugGpuRectsBuffer, compute);
+}
+
+Fvog::ComputePipeline& FrogRenderer2::CullPermutations::Select(Fvog::detail::ThreadPool& pool, uint32_t key, Fvog::ComputePipeline& generic, std::function<Fvog::ComputePipeline()> build)
+{
+  auto lock = std::lock_guard{mutex};
+  if (auto it = built.find(key); it != built.end())
+  {
+    return it->second;
+  }
+
+  auto it = building.find(key);
+  if (it == building.end())
+  {
+    building.emplace(key, pool.Submit(std::move(build)));
+    return generic;
+  }
+
+  if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    return generic;
+  }
+
+  auto pipeline = it->second.get();
+  building.erase(it);
+  return built.emplace(key, std::move(pipeline)).first->second;
+}
+
+Fvog::ComputePipeline& FrogRenderer2::SelectCullMeshletsPipeline()
+{
+  // Debug drawing is only compiled into the permutation that's used while its output is shown
+  const auto cullFlags = globalUniforms.flags & cullMeshletFlagsMask;
+  const bool debugDrawing = drawDebugAabbs || drawDebugRects;
+  const auto key = cullFlags | (debugDrawing ? 1u << 31 : 0u);
+  return cullMeshletsPermutations.Select(pipelineThreadPool, key, cullMeshletsPipeline, [&device = *device_, cullFlags, debugDrawing]
+  {
+    return Pipelines2::CullMeshlets(device, cullFlags, debugDrawing);
+  });
+}
+
+Fvog::ComputePipeline& FrogRenderer2::SelectCullTrianglesPipeline()
+{
+  const auto cullFlags = globalUniforms.flags & cullPrimitiveFlagsMask;
+  return cullTrianglesPermutations.Select(pipelineThreadPool, cullFlags, cullTrianglesPipeline, [&device = *device_, cullFlags]
+  {
+    return Pipelines2::CullTriangles(device, cullFlags);
+  });
+}
 
+bool FrogRenderer2::UseMeshShaders() const
+{
+  return useMeshShaders && visbufferMeshPipeline.has_value();
+}
+
+CullMeshletsPushConstants FrogRenderer2::MakeCullMeshletsPushConstants(Fvog::Buffer& visibleMeshletIds, uint32_t cullPhase)
+{
   auto vsmPushConstants = vsmContext.GetPushConstants();
 
-  auto visbufferPushConstants = CullMeshletsPushConstants{
+  return CullMeshletsPushConstants{
     .globalUniformsIndex   = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
     .meshletInstancesIndex = meshletInstancesBuffer.GetResourceHandle().index,
     .meshletDataIndex      = geometryBuffer.GetResourceHandle().index,
@@ -565,26 +816,201 @@ void FrogRenderer2::CullMeshletsForView(VkCommandBuffer commandBuffer, const Vie
     .hzbSamplerIndex            = hzbSampler.GetResourceHandle().index,
     .cullTrianglesDispatchIndex = cullTrianglesDispatchParams->GetResourceHandle().index,
     .visibleMeshletsIndex       = visibleMeshletIds.GetResourceHandle().index,
+    .cullPhase                  = cullPhase,
+    .meshletVisibilityIndex     = meshletVisibilityBits->GetResourceHandle().index,
+    .meshInstancesIndex         = meshInstancesBuffer->GetResourceHandle().index,
+    .meshletCullChunksIndex     = meshletCullChunksBuffer->GetResourceHandle().index,
     .debugAabbBufferIndex       = debugGpuAabbsBuffer->GetResourceHandle().index,
     .debugRectBufferIndex       = debugGpuRectsBuffer->GetResourceHandle().index,
   };
+}
+
+void FrogRenderer2::CullMeshletsForView(VkCommandBuffer commandBuffer,
+  const ViewParams& view,
+  Fvog::Buffer& visibleMeshletIds,
+  std::string_view name,
+  uint32_t cullPhase)
+{
+  ZoneScoped;
+  TracyVkZoneTransient(tracyVkContext_, tracyProfileVar, commandBuffer, name.data(), true);
+  auto ctx = Fvog::Context(*device_, commandBuffer);
+
+  ctx.TeenyBufferUpdate(*viewBuffer, view);
+
+  // The late phase appends to what the early phase produced
+  if (cullPhase != CULL_PHASE_LATE)
+  {
+    constexpr auto emptyDraw = Fvog::DrawIndexedIndirectCommand{
+      .indexCount    = 0,
+      .instanceCount = 1,
+      .firstIndex    = 0,
+      .vertexOffset  = 0,
+      .firstInstance = 0,
+    };
+    ctx.TeenyBufferUpdate(*meshletIndirectCommand, std::array{emptyDraw, emptyDraw});
+
+    const auto emptyDispatch = Fvog::DispatchIndirectCommand{0, 1, 1};
+    ctx.TeenyBufferUpdate(*cullTrianglesDispatchParams, std::array{emptyDispatch, emptyDispatch});
+    ctx.TeenyBufferUpdate(*meshletCullChunksBuffer, emptyDispatch);
+    triangleCullFeedbackBuffer->FillData(commandBuffer, {.offset = offsetof(TriangleCullFeedback, viewRequestedIndexCount), .size = sizeof(uint32_t)});
+  }
+
+  ctx.Barrier({
+    .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+  });
+
+  auto visbufferPushConstants = MakeCullMeshletsPushConstants(visibleMeshletIds, cullPhase);
   ctx.SetPushConstants(visbufferPushConstants);
-  
-  ctx.DispatchInvocations(NumMeshletInstances(), 1, 1);
-  
-  ctx.Barrier();
-  
-  ctx.BindComputePipeline(cullTrianglesPipeline);
-  visbufferPushConstants.meshletPrimitivesIndex = geometryBuffer.GetResourceHandle().index;
-  visbufferPushConstants.meshletVerticesIndex   = geometryBuffer.GetResourceHandle().index;
-  visbufferPushConstants.meshletIndicesIndex    = geometryBuffer.GetResourceHandle().index;
-  visbufferPushConstants.indexBufferIndex       = instancedMeshletBuffer->GetResourceHandle().index;
+
+  // Whole meshes are culled first, so meshlets of meshes that are entirely outside the view are never visited.
+  // The late phase reuses the early phase's chunks
+  if (cullPhase != CULL_PHASE_LATE)
+  {
+    ctx.BindComputePipeline(cullInstancesPipeline);
+    ctx.DispatchInvocations(numMeshInstances, 1, 1);
+
+    ctx.Barrier({
+      .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+    });
+  }
+
+  ctx.BindComputePipeline(SelectCullMeshletsPipeline());
+  ctx.DispatchIndirect(*meshletCullChunksBuffer);
+
+  // Only the main view is culled in phases. With mesh shaders, its triangles are culled as they are drawn
+  if (cullPhase != CULL_PHASE_SINGLE && UseMeshShaders())
+  {
+    return;
+  }
+
+  // Triangle culling is dispatched indirectly and reads the visible meshlets
+  ctx.Barrier({
+    .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+  });
+
+  ctx.BindComputePipeline(SelectCullTrianglesPipeline());
+  visbufferPushConstants.meshletPrimitivesIndex    = geometryBuffer.GetResourceHandle().index;
+  visbufferPushConstants.meshletVerticesIndex      = geometryBuffer.GetResourceHandle().index;
+  visbufferPushConstants.meshletIndicesIndex       = geometryBuffer.GetResourceHandle().index;
+  visbufferPushConstants.indexBufferIndex          = instancedMeshletBuffer->GetResourceHandle().index;
+  visbufferPushConstants.triangleCullFeedbackIndex = triangleCullFeedbackBuffer->GetResourceHandle().index;
   ctx.SetPushConstants(visbufferPushConstants);
 
-  ctx.DispatchIndirect(cullTrianglesDispatchParams.value());
+  const auto phaseIndex = cullPhase == CULL_PHASE_LATE ? 1u : 0u;
+  ctx.DispatchIndirect(cullTrianglesDispatchParams.value(), phaseIndex * sizeof(Fvog::DispatchIndirectCommand));
+}
 
-  //Fwog::MemoryBarrier(Fwog::MemoryBarrierBit::SHADER_STORAGE_BIT | Fwog::MemoryBarrierBit::INDEX_BUFFER_BIT | Fwog::MemoryBarrierBit::COMMAND_BUFFER_BIT);
-  ctx.Barrier();
+void FrogRenderer2::DeclareCullMeshletsMultiViewResources(Fvog::RenderGraph::PassBuilder& pass)
+{
+  constexpr auto transfer = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  constexpr auto compute  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  constexpr auto storageReadWrite = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+  pass.Read(globalUniformsBuffer.GetDeviceBuffer(), compute)
+    .Read(meshletInstancesBuffer.GetBuffer(), compute)
+    .Read(geometryBuffer.GetBuffer(), compute)
+    .Read(vsmContext.uniformBuffer_, compute)
+    .Read(vsmSun.clipmapUniformsBuffer_, compute)
+    .Read(vsmContext.pageTables_, compute)
+    .Read(vsmContext.vsmBitmaskHzb_, compute)
+    .Read(*meshInstancesBuffer, compute)
+    .Access(*multiViewsBuffer, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_READ_BIT)
+    .Access(*multiViewIndirectCommands, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite)
+    .Access(*multiViewCullParams,
+      transfer | compute | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT)
+    .Access(*triangleCullFeedbackBuffer, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite)
+    .Access(*meshletCullChunksBuffer,
+      transfer | compute | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT)
+    .ReadWrite(*multiViewVisibleMeshletIds, compute)
+    .Write(*instancedMeshletBuffer, compute);
+
+  for (auto& multiViewBuffer : multiViewBuffers)
+  {
+    pass.Access(multiViewBuffer, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_READ_BIT);
+  }
+}
+
+void FrogRenderer2::CullMeshletsMultiView(VkCommandBuffer commandBuffer, std::span<const ViewParams> views, std::string_view name)
+{
+  ZoneScoped;
+  TracyVkZoneTransient(tracyVkContext_, tracyProfileVar, commandBuffer, name.data(), true);
+  assert(views.size() <= maxMultiViews);
+  auto ctx = Fvog::Context(*device_, commandBuffer);
+
+  const auto viewCount = static_cast<uint32_t>(views.size());
+  ctx.TeenyBufferUpdate(*multiViewsBuffer, Fvog::TriviallyCopyableByteSpan(views));
+  for (uint32_t i = 0; i < viewCount; i++)
+  {
+    ctx.TeenyBufferUpdate(multiViewBuffers[i], views[i]);
+  }
+
+  constexpr auto emptyDraw = Fvog::DrawIndexedIndirectCommand{
+    .indexCount    = 0,
+    .instanceCount = 1,
+    .firstIndex    = 0,
+    .vertexOffset  = 0,
+    .firstInstance = 0,
+  };
+  auto emptyDraws = std::array<Fvog::DrawIndexedIndirectCommand, maxMultiViews>{};
+  emptyDraws.fill(emptyDraw);
+  ctx.TeenyBufferUpdate(*multiViewIndirectCommands, emptyDraws);
+  ctx.TeenyBufferUpdate(*meshletCullChunksBuffer, Fvog::DispatchIndirectCommand{0, 1, 1});
+  multiViewCullParams->FillData(commandBuffer);
+
+  ctx.Barrier({
+    .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+  });
+
+  auto pushConstants = MakeCullMeshletsPushConstants(*multiViewVisibleMeshletIds, CULL_PHASE_SINGLE);
+  pushConstants.viewIndex                  = multiViewsBuffer->GetResourceHandle().index;
+  pushConstants.indirectDrawIndex          = multiViewIndirectCommands->GetResourceHandle().index;
+  pushConstants.cullTrianglesDispatchIndex = multiViewCullParams->GetResourceHandle().index;
+  pushConstants.viewCount                  = viewCount;
+  pushConstants.meshletPrimitivesIndex     = geometryBuffer.GetResourceHandle().index;
+  pushConstants.meshletVerticesIndex       = geometryBuffer.GetResourceHandle().index;
+  pushConstants.meshletIndicesIndex        = geometryBuffer.GetResourceHandle().index;
+  pushConstants.indexBufferIndex           = instancedMeshletBuffer->GetResourceHandle().index;
+  pushConstants.triangleCullFeedbackIndex  = triangleCullFeedbackBuffer->GetResourceHandle().index;
+  ctx.SetPushConstants(pushConstants);
+
+  constexpr auto computeBarrier = Fvog::GlobalBarrier{
+    .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+  };
+
+  // Meshes are kept if any view sees them, then each of their meshlets is tested against every view
+  ctx.BindComputePipeline(cullInstancesMultiViewPipeline);
+  ctx.DispatchInvocations(numMeshInstances, 1, 1);
+  ctx.Barrier(computeBarrier);
+
+  ctx.BindComputePipeline(cullMeshletsMultiViewPipeline);
+  ctx.DispatchIndirect(*meshletCullChunksBuffer);
+  ctx.Barrier(computeBarrier);
+
+  // Gives each view a range of the index buffer as large as its visible meshlets could fill, so the triangles of every view
+  // are culled by one dispatch. The ranges leave gaps where triangles are culled, which the index buffer grows to fit
+  ctx.BindComputePipeline(multiViewPrefixSumPipeline);
+  ctx.Dispatch(1, 1, 1);
+  ctx.Barrier(computeBarrier);
+
+  ctx.BindComputePipeline(cullTrianglesMultiViewPipeline);
+  ctx.DispatchIndirect(*multiViewCullParams);
 }
 
 void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer commandBuffer, uint32_t swapchainImageIndex)
@@ -608,13 +1034,12 @@ void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer command
     shadingUniforms.random = {PCG::RandFloat(state), PCG::RandFloat(state)};
   }
 
-  auto ctx = Fvog::Context(*device_, commandBuffer);
-
   const auto baseBias = fsr2Enable ? log2(float(renderInternalWidth) / float(renderOutputWidth)) - 1.0f : 0.0f;
   const float fsr2LodBias = std::round(baseBias * 100) / 100;
 
   {
     ZoneScopedN("Update GPU Buffers");
+    auto ctx = Fvog::Context(*device_, commandBuffer);
     auto marker = ctx.MakeScopedDebugMarker("Update Buffers");
 
     auto actualTonemapUniforms = tonemapUniforms;
@@ -641,7 +1066,6 @@ void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer command
       actualVsmUniforms.lodBias += fsr2LodBias + 1.0f; // +1 to cancel "AA" factor and avoid too much negative bias (this should bring shadow detail to approx. pixel-scale)
     }
     vsmContext.UpdateUniforms(commandBuffer, actualVsmUniforms);
-    ctx.Barrier();
   }
 
   FlushUpdatedSceneData(commandBuffer);
@@ -649,23 +1073,34 @@ void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer command
   // A few of these buffers are really slow to create (2-3ms) and destroy every frame (large ones hit vkAllocateMemory), so
   // this scheme is still not ideal as e.g. adding geometry every frame will cause reallocs.
   // The current scheme works fine when the scene is mostly static.
+  ResizeInstancedMeshletBufferFromFeedback();
+  triangleCullFeedbackBuffer->FillData(commandBuffer);
 
-  // Soft cap of 1 billion indices should prevent oversubscribing memory (on my system) when loading huge scenes.
-  // This limit should be OK as it only limits post-culling geometry.
-  const auto maxIndices = glm::min(1'000'000'000u, NumMeshletInstances() * Utility::maxMeshletPrimitives * 3);
-  if (!instancedMeshletBuffer || instancedMeshletBuffer->Size() < maxIndices)
+  if (!persistentVisibleMeshletIds || persistentVisibleMeshletIds->Size() < NumMeshletInstances())
   {
-    instancedMeshletBuffer = Fvog::TypedBuffer<uint32_t>(*device_, {.count = maxIndices}, "Instanced Meshlets");
+    persistentVisibleMeshletIds = Fvog::TypedBuffer<uint32_t>(*device_, {.count = std::max(1u, NumMeshletInstances()), .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Persistent Visible Meshlet IDs");
   }
 
-  if (!persistentVisibleMeshletIds || persistentVisibleMeshletIds->Size() < NumMeshletInstances())
+  if (!transientVisibleMeshletIds || transientVisibleMeshletIds->Size() < NumMeshletInstances())
   {
-    persistentVisibleMeshletIds = Fvog::TypedBuffer<uint32_t>(*device_, {.count = std::max(1u, NumMeshletInstances())}, "Persistent Visible Meshlet IDs");
+    transientVisibleMeshletIds = Fvog::TypedBuffer<uint32_t>(*device_, {.count = std::max(1u, NumMeshletInstances()), .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Transient Visible Meshlet IDs");
   }
 
-  if (!transientVisibleMeshletIds || transientVisibleMeshletIds->Size() < NumMeshletInstances())
+  // The clipmaps' visible lists are laid end to end, so together they must fit in the meshlet ID bits of the index buffer
+  // (MESHLET_ID_BITS). Scenes too large for that cull each clipmap on its own
+  constexpr uint64_t maxVisibleMeshletIds = 1u << 24;
+  const auto multiViewVisibleMeshletCount = uint64_t(NumMeshletInstances()) * vsmSun.NumClipmaps();
+  const bool cullClipmapsTogether = multiViewVisibleMeshletCount <= maxVisibleMeshletIds;
+  if (cullClipmapsTogether && (!multiViewVisibleMeshletIds || multiViewVisibleMeshletIds->Size() < multiViewVisibleMeshletCount))
+  {
+    multiViewVisibleMeshletIds = Fvog::TypedBuffer<uint32_t>(*device_, {.count = std::max(1u, uint32_t(multiViewVisibleMeshletCount)), .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Multi-View Visible Meshlet IDs");
+  }
+
+  // Meshlets start out invisible, so the late phase draws everything that passes culling on the first frame
+  if (const auto visibilityWords = std::max(1u, (NumMeshletInstances() + 31) / 32); !meshletVisibilityBits || meshletVisibilityBits->Size() < visibilityWords)
   {
-    transientVisibleMeshletIds = Fvog::TypedBuffer<uint32_t>(*device_, {.count = std::max(1u, NumMeshletInstances())}, "Transient Visible Meshlet IDs");
+    meshletVisibilityBits = Fvog::TypedBuffer<uint32_t>(*device_, {.count = visibilityWords, .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Meshlet Visibility Bits");
+    meshletVisibilityBits->FillData(commandBuffer);
   }
 
   // Clear debug buffers
@@ -751,6 +1186,8 @@ void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer command
   Math::MakeFrustumPlanes(viewProjUnjittered, mainView.frustumPlanes);
   debugMainViewProj = viewProjUnjittered;
 
+  vsmLocalLights.Update(commandBuffer, SelectVsmLocalLights(mainView), NumLights());
+
   globalUniforms.viewProjUnjittered = viewProjUnjittered;
   globalUniforms.viewProj           = viewProj;
   globalUniforms.invViewProj        = glm::inverse(globalUniforms.viewProj);
@@ -758,6 +1195,7 @@ void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer command
   globalUniforms.invProj            = glm::inverse(globalUniforms.proj);
   globalUniforms.cameraPos          = glm::vec4(mainCamera.position, 0.0);
   globalUniforms.meshletCount       = NumMeshletInstances();
+  globalUniforms.meshInstanceCount  = numMeshInstances;
   // globalUniforms.maxIndices = static_cast<uint32_t>(scene.primitives.size() * 3);
   globalUniforms.maxIndices             = 0; // TODO: This doesn't seem to be used for anything.
   globalUniforms.bindlessSamplerLodBias = fsr2LodBias;
@@ -768,525 +1206,933 @@ void FrogRenderer2::OnRender([[maybe_unused]] double dt, VkCommandBuffer command
   
   shadingUniformsBuffer.UpdateData(commandBuffer, shadingUniforms);
 
-  ctx.Barrier();
-  
+  if (!debugLines.empty())
   {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eCullMeshletsMain, commandBuffer);
-    CullMeshletsForView(commandBuffer, mainView, persistentVisibleMeshletIds.value(), "Cull Meshlets Main");
+    if (!lineVertexBuffer || lineVertexBuffer->Size() < debugLines.size() * sizeof(Debug::Line))
+    {
+      lineVertexBuffer.emplace(*device_, (uint32_t)debugLines.size(), "Debug Lines");
+    }
+    lineVertexBuffer->UpdateData(commandBuffer, debugLines);
   }
 
-  ctx.ImageBarrierDiscard(*frame.visbuffer, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.gDepth,    VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
+  // Everything above is an upload. The passes below are recorded when the graph executes, so the resources they
+  // access are synchronized by the graph. Locals they capture by reference must outlive renderGraph.Execute
+  constexpr auto compute  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  constexpr auto vertex   = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT;
+  constexpr auto fragment = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+  constexpr auto indirect = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
 
-  auto visbufferAttachment = Fvog::RenderColorAttachment{
-    .texture = frame.visbuffer->ImageView(),
-    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-    .clearValue = {~0u, ~0u, ~0u, ~0u},
-  };
-  auto visbufferDepthAttachment = Fvog::RenderDepthStencilAttachment{
-    .texture = frame.gDepth->ImageView(),
-    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-    .clearValue = {.depth = FAR_DEPTH},
+  // Meshlet instances, meshlet data, transforms, and materials are all read through these
+  auto readScene = [this](Fvog::RenderGraph::PassBuilder& pass, VkPipelineStageFlags2 stages) -> Fvog::RenderGraph::PassBuilder&
+  {
+    return pass.Read(globalUniformsBuffer.GetDeviceBuffer(), stages).Read(meshletInstancesBuffer.GetBuffer(), stages).Read(geometryBuffer.GetBuffer(), stages);
   };
 
-  ctx.BeginRendering({
-    .name = "Main Visbuffer Pass",
-    .colorAttachments = {&visbufferAttachment, 1},
-    .depthAttachment = visbufferDepthAttachment,
-  });
+  // Draws the output of one phase of main view culling. The early phase clears the attachments and the late phase draws on top
+  auto drawMainVisbuffer = [&](VkCommandBuffer cmd, VkAttachmentLoadOp loadOp, uint32_t cullPhase)
   {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eRenderVisbufferMain, commandBuffer);
-    ctx.BindGraphicsPipeline(visbufferPipeline);
-    auto visbufferArguments = VisbufferPushConstants{
-      .globalUniformsIndex    = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      .meshletInstancesIndex  = meshletInstancesBuffer.GetResourceHandle().index,
-      .meshletDataIndex       = geometryBuffer.GetResourceHandle().index,
-      .meshletPrimitivesIndex = geometryBuffer.GetResourceHandle().index,
-      .meshletVerticesIndex   = geometryBuffer.GetResourceHandle().index,
-      .meshletIndicesIndex    = geometryBuffer.GetResourceHandle().index,
-      .transformsIndex        = geometryBuffer.GetResourceHandle().index,
-      .indirectDrawIndex      = meshletIndirectCommand->GetResourceHandle().index,
-      .materialsIndex         = geometryBuffer.GetResourceHandle().index,
-      .viewIndex              = viewBuffer->GetResourceHandle().index,
-      .visibleMeshletsIndex   = persistentVisibleMeshletIds->GetResourceHandle().index,
+    auto ctx = Fvog::Context(*device_, cmd);
+    auto visbufferAttachment = Fvog::RenderColorAttachment{
+      .texture = frame.visbuffer->ImageView(),
+      .loadOp = loadOp,
+      .clearValue = {~0u, ~0u, ~0u, ~0u},
+    };
+    auto visbufferDepthAttachment = Fvog::RenderDepthStencilAttachment{
+      .texture = frame.gDepth->ImageView(),
+      .loadOp = loadOp,
+      .clearValue = {.depth = FAR_DEPTH},
     };
-    ctx.SetPushConstants(visbufferArguments);
-    ctx.BindIndexBuffer(*instancedMeshletBuffer, 0, VK_INDEX_TYPE_UINT32);
-    ctx.DrawIndexedIndirect(*meshletIndirectCommand, 0, 1, 0);
-  }
-  ctx.EndRendering();
-
-  ctx.Barrier();
-
-  // VSMs
-  {
-    const auto debugMarker = ctx.MakeScopedDebugMarker("Virtual Shadow Maps");
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eVsm, commandBuffer);
 
+    ctx.BeginRendering({
+      .name = "Main Visbuffer Pass",
+      .colorAttachments = {&visbufferAttachment, 1},
+      .depthAttachment = visbufferDepthAttachment,
+    });
     {
-      TIME_SCOPE_GPU(StatGroup::eVsm, eVsmResetPageVisibility, commandBuffer);
-      vsmContext.ResetPageVisibility(commandBuffer);
-    }
-    {
-      TIME_SCOPE_GPU(StatGroup::eVsm, eVsmMarkVisiblePages, commandBuffer);
-      vsmSun.MarkVisiblePages(commandBuffer, frame.gDepth.value(), globalUniformsBuffer.GetDeviceBuffer());
+      const auto phaseIndex = cullPhase == CULL_PHASE_LATE ? 1u : 0u;
+      auto visbufferArguments = VisbufferPushConstants{
+        .globalUniformsIndex    = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+        .meshletInstancesIndex  = meshletInstancesBuffer.GetResourceHandle().index,
+        .meshletDataIndex       = geometryBuffer.GetResourceHandle().index,
+        .meshletPrimitivesIndex = geometryBuffer.GetResourceHandle().index,
+        .meshletVerticesIndex   = geometryBuffer.GetResourceHandle().index,
+        .meshletIndicesIndex    = geometryBuffer.GetResourceHandle().index,
+        .transformsIndex        = geometryBuffer.GetResourceHandle().index,
+        .indirectDrawIndex      = meshletIndirectCommand->GetResourceHandle().index,
+        .materialsIndex         = geometryBuffer.GetResourceHandle().index,
+        .viewIndex              = viewBuffer->GetResourceHandle().index,
+        .visibleMeshletsIndex   = persistentVisibleMeshletIds->GetResourceHandle().index,
+      };
+
+      if (UseMeshShaders())
+      {
+        // One mesh workgroup per visible meshlet, sized by the same command that would have dispatched CullTriangles.comp
+        ctx.BindGraphicsPipeline(*visbufferMeshPipeline);
+        visbufferArguments.cullTrianglesDispatchIndex = cullTrianglesDispatchParams->GetResourceHandle().index;
+        visbufferArguments.cullPhase                  = cullPhase;
+        ctx.SetPushConstants(visbufferArguments);
+        ctx.DrawMeshTasksIndirect(*cullTrianglesDispatchParams, phaseIndex * sizeof(Fvog::DispatchIndirectCommand), 1, 0);
+      }
+      else
+      {
+        ctx.BindGraphicsPipeline(visbufferPipeline);
+        ctx.SetPushConstants(visbufferArguments);
+        ctx.BindIndexBuffer(*instancedMeshletBuffer, 0, VK_INDEX_TYPE_UINT32);
+        ctx.DrawIndexedIndirect(*meshletIndirectCommand, phaseIndex * sizeof(Fvog::DrawIndexedIndirectCommand), 1, 0);
+      }
     }
+    ctx.EndRendering();
+  };
+
+  auto declareMainVisbufferResources = [&](Fvog::RenderGraph::PassBuilder& pass, VkAttachmentLoadOp loadOp)
+  {
+    if (UseMeshShaders())
     {
-      TIME_SCOPE_GPU(StatGroup::eVsm, eVsmFreeNonVisiblePages, commandBuffer);
-      vsmContext.FreeNonVisiblePages(commandBuffer);
+      constexpr auto mesh = VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+      readScene(pass, mesh | fragment)
+        .Read(*viewBuffer, mesh)
+        .Read(*persistentVisibleMeshletIds, mesh | fragment)
+        .Read(*cullTrianglesDispatchParams, indirect | mesh, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT);
     }
+    else
     {
-      TIME_SCOPE_GPU(StatGroup::eVsm, eVsmAllocatePages, commandBuffer);
-      vsmContext.AllocateRequestedPages(commandBuffer);
+      readScene(pass, vertex | fragment)
+        .Read(*viewBuffer, vertex)
+        .Read(*persistentVisibleMeshletIds, vertex | fragment)
+        .Read(*meshletIndirectCommand, indirect | vertex, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT)
+        .Read(*instancedMeshletBuffer, VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT);
     }
+    pass.ColorAttachment(*frame.visbuffer, loadOp).DepthAttachment(*frame.gDepth, loadOp);
+  };
+
+  // Meshlets that were visible last frame are drawn first. Their depth is a good occluder for everything else
+  renderGraph.AddPass("Cull Meshlets Main",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      TIME_SCOPE_GPU(StatGroup::eVsm, eVsmGenerateHpb, commandBuffer);
-      vsmSun.GenerateBitmaskHzb(commandBuffer);
-    }
+      DeclareCullMeshletsResources(pass, *persistentVisibleMeshletIds);
+      pass.ReadWrite(*meshletVisibilityBits, compute);
+    },
+    [&](VkCommandBuffer cmd)
     {
-      TIME_SCOPE_GPU(StatGroup::eVsm, eVsmClearDirtyPages, commandBuffer);
-      vsmContext.ClearDirtyPages(commandBuffer);
-    }
-
-    TIME_SCOPE_GPU(StatGroup::eVsm, eVsmRenderDirtyPages, commandBuffer);
+      TIME_SCOPE_GPU(StatGroup::eMainGpu, eCullMeshletsMain, cmd);
+      CullMeshletsForView(cmd, mainView, persistentVisibleMeshletIds.value(), "Cull Meshlets Main", CULL_PHASE_EARLY);
+    });
 
-    // Sun VSMs
-    for (uint32_t i = 0; i < vsmSun.NumClipmaps(); i++)
+  renderGraph.AddPass("Main Visbuffer Pass",
+    [&](Fvog::RenderGraph::PassBuilder& pass) { declareMainVisbufferResources(pass, VK_ATTACHMENT_LOAD_OP_CLEAR); },
+    [&](VkCommandBuffer cmd)
     {
-      TracyVkZone(tracyVkContext_, commandBuffer, "Render Clipmap")
-      auto sunCurrentClipmapView = ViewParams{
-        .oldViewProj = vsmSun.GetProjections()[i] * vsmSun.GetViewMatrices()[i],
-        .proj = vsmSun.GetProjections()[i],
-        .view = vsmSun.GetViewMatrices()[i],
-        .viewProj = vsmSun.GetProjections()[i] * vsmSun.GetViewMatrices()[i],
-        .viewProjStableForVsmOnly = vsmSun.GetProjections()[i] * vsmSun.GetStableViewMatrix(),
-        .cameraPos = {}, // unused
-        .viewport = {0.f, 0.f, vsmSun.GetExtent().width, vsmSun.GetExtent().height},
-        .type = ViewType::VIRTUAL,
-        .virtualTableIndex = vsmSun.GetClipmapTableIndices()[i],
-      };
-      Math::MakeFrustumPlanes(sunCurrentClipmapView.viewProj, sunCurrentClipmapView.frustumPlanes);
-
-      CullMeshletsForView(commandBuffer, sunCurrentClipmapView, transientVisibleMeshletIds.value(), "Cull Sun VSM Meshlets, View " + std::to_string(i));
-
-      const auto vsmExtent = Fvog::Extent2D{Techniques::VirtualShadowMaps::maxExtent, Techniques::VirtualShadowMaps::maxExtent};
-      ctx.Barrier();
-
-  #if VSM_USE_TEMP_ZBUFFER
-      ctx.ImageBarrier(vsmTempDepthStencil.value(), VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-      auto vsmDepthAttachment = Fvog::RenderDepthStencilAttachment{
-        .texture    = vsmTempDepthStencil.value().ImageView(),
-        .loadOp     = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .clearValue = {.depth = 1},
-      };
-  #endif
-      ctx.BeginRendering({
-        .name = "Render Clipmap",
-        .viewport = VkViewport{0, 0, (float)vsmExtent.width, (float)vsmExtent.height, 0, 1},
-#if VSM_USE_TEMP_ZBUFFER
-        .depthAttachment = vsmDepthAttachment,
-#endif
-      });
-      
-      ctx.BindGraphicsPipeline(vsmShadowPipeline);
-
-      auto pushConstants                       = vsmContext.GetPushConstants();
-      pushConstants.meshletInstancesIndex      = meshletInstancesBuffer.GetResourceHandle().index;
-      pushConstants.meshletDataIndex           = geometryBuffer.GetResourceHandle().index;
-      pushConstants.meshletPrimitivesIndex     = geometryBuffer.GetResourceHandle().index;
-      pushConstants.meshletVerticesIndex       = geometryBuffer.GetResourceHandle().index;
-      pushConstants.meshletIndicesIndex        = geometryBuffer.GetResourceHandle().index;
-      pushConstants.transformsIndex            = geometryBuffer.GetResourceHandle().index;
-      pushConstants.globalUniformsIndex        = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index;
-      pushConstants.viewIndex                  = viewBuffer->GetResourceHandle().index;
-      pushConstants.materialsIndex             = geometryBuffer.GetResourceHandle().index;
-      pushConstants.materialSamplerIndex       = materialSampler.GetResourceHandle().index;
-      pushConstants.clipmapLod                 = vsmSun.GetClipmapTableIndices()[i];
-      pushConstants.clipmapUniformsBufferIndex = vsmSun.clipmapUniformsBuffer_.GetResourceHandle().index;
-      pushConstants.visibleMeshletsIndex       = transientVisibleMeshletIds->GetResourceHandle().index;
-
-      ctx.BindIndexBuffer(*instancedMeshletBuffer, 0, VK_INDEX_TYPE_UINT32);
-      
-      ctx.SetPushConstants(pushConstants);
-      ctx.DrawIndexedIndirect(*meshletIndirectCommand, 0, 1, 0);
-      ctx.EndRendering();
-    }
-  }
-
-  // TODO: remove when descriptor indexing sync validation does not give false positives
-  ctx.Barrier();
-  
-  ctx.ImageBarrier(*frame.gDepth, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+      TIME_SCOPE_GPU(StatGroup::eMainGpu, eRenderVisbufferMain, cmd);
+      drawMainVisbuffer(cmd, VK_ATTACHMENT_LOAD_OP_CLEAR, CULL_PHASE_EARLY);
+    });
 
+  // The late phase tests every meshlet against this HZB, so meshlets that were disoccluded this frame are drawn without a frame of delay
   if (generateHizBuffer)
   {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eHzb, commandBuffer);
-    {
-      auto marker = ctx.MakeScopedDebugMarker("HZB Build Pass", {.5f, .5f, 1.0f, 1.0f});
-      ctx.SetPushConstants(HzbCopyPushConstants{
-        .hzbIndex = frame.hzb->ImageView().GetStorageResourceHandle().index,
-        .depthIndex = frame.gDepth->ImageView().GetSampledResourceHandle().index,
-        .depthSamplerIndex = hzbSampler.GetResourceHandle().index,
-      });
-
-      ctx.BindComputePipeline(hzbCopyPipeline);
-      uint32_t hzbCurrentWidth = frame.hzb->GetCreateInfo().extent.width;
-      uint32_t hzbCurrentHeight = frame.hzb->GetCreateInfo().extent.height;
-      const uint32_t hzbLevels = frame.hzb->GetCreateInfo().mipLevels;
-      ctx.Dispatch((hzbCurrentWidth + 15) / 16, (hzbCurrentHeight + 15) / 16, 1);
-
-      // Sync val complains about WAR for colorLdrWindowRes in the next dispatch, even though it's definitely not accessed
-      ctx.Barrier();
-
-      ctx.BindComputePipeline(hzbReducePipeline);
-      for (uint32_t level = 1; level < hzbLevels; ++level)
+    renderGraph.AddPass("HZB Build Pass",
+      [&](Fvog::RenderGraph::PassBuilder& pass) { pass.Read(*frame.gDepth, compute).Write(*frame.hzb, compute, true); },
+      [&](VkCommandBuffer cmd)
       {
-        ctx.ImageBarrier(*frame.hzb, VK_IMAGE_LAYOUT_GENERAL);
-        auto& prevHzbView = frame.hzb->CreateSingleMipView(level - 1, "prevHzbMip");
-        auto& curHzbView = frame.hzb->CreateSingleMipView(level, "curHzbMip");
-
-        ctx.SetPushConstants(HzbReducePushConstants{
-          .prevHzbIndex = prevHzbView.GetStorageResourceHandle().index,
-          .curHzbIndex = curHzbView.GetStorageResourceHandle().index,
+        TIME_SCOPE_GPU(StatGroup::eMainGpu, eHzb, cmd);
+        auto ctx = Fvog::Context(*device_, cmd);
+        // Each level is reduced from the previous one
+        constexpr auto hzbLevelBarrier = Fvog::GlobalBarrier{
+          .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+          .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+          .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+          .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        };
+
+        ctx.SetPushConstants(HzbCopyPushConstants{
+          .hzbIndex = frame.hzb->ImageView().GetStorageResourceHandle().index,
+          .depthIndex = frame.gDepth->ImageView().GetSampledResourceHandle().index,
+          .depthSamplerIndex = hzbSampler.GetResourceHandle().index,
         });
 
-        hzbCurrentWidth = std::max(1u, hzbCurrentWidth >> 1);
-        hzbCurrentHeight = std::max(1u, hzbCurrentHeight >> 1);
+        ctx.BindComputePipeline(hzbCopyPipeline);
+        uint32_t hzbCurrentWidth = frame.hzb->GetCreateInfo().extent.width;
+        uint32_t hzbCurrentHeight = frame.hzb->GetCreateInfo().extent.height;
+        const uint32_t hzbLevels = frame.hzb->GetCreateInfo().mipLevels;
         ctx.Dispatch((hzbCurrentWidth + 15) / 16, (hzbCurrentHeight + 15) / 16, 1);
-      }
-      ctx.ImageBarrier(*frame.hzb, VK_IMAGE_LAYOUT_GENERAL);
-    }
-  }
-  else
+
+        ctx.BindComputePipeline(hzbReducePipeline);
+        for (uint32_t level = 1; level < hzbLevels; ++level)
+        {
+          ctx.Barrier(hzbLevelBarrier);
+          auto& prevHzbView = frame.hzb->CreateSingleMipView(level - 1, "prevHzbMip");
+          auto& curHzbView = frame.hzb->CreateSingleMipView(level, "curHzbMip");
+
+          ctx.SetPushConstants(HzbReducePushConstants{
+            .prevHzbIndex = prevHzbView.GetStorageResourceHandle().index,
+            .curHzbIndex = curHzbView.GetStorageResourceHandle().index,
+          });
+
+          hzbCurrentWidth = std::max(1u, hzbCurrentWidth >> 1);
+          hzbCurrentHeight = std::max(1u, hzbCurrentHeight >> 1);
+          ctx.Dispatch((hzbCurrentWidth + 15) / 16, (hzbCurrentHeight + 15) / 16, 1);
+        }
+      });
+  }
+  else
   {
-    const uint32_t hzbLevels = frame.hzb->GetCreateInfo().mipLevels;
-    for (uint32_t level = 0; level < hzbLevels; level++)
-    {
-      constexpr float farDepth = FAR_DEPTH;
-      
-      ctx.ClearTexture(*frame.hzb, {.color = {farDepth}, .baseMipLevel = level});
-    }
+    renderGraph.AddPass("Clear HZB",
+      [&](Fvog::RenderGraph::PassBuilder& pass) { pass.Access(*frame.hzb, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true); },
+      [&](VkCommandBuffer cmd)
+      {
+        auto ctx = Fvog::Context(*device_, cmd);
+        const uint32_t hzbLevels = frame.hzb->GetCreateInfo().mipLevels;
+        for (uint32_t level = 0; level < hzbLevels; level++)
+        {
+          constexpr float farDepth = FAR_DEPTH;
+
+          ctx.ClearTexture(*frame.hzb, {.color = {farDepth}, .baseMipLevel = level});
+        }
+      });
   }
 
-  ctx.Barrier();
-  ctx.ImageBarrierDiscard(*frame.gAlbedo,              VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.gNormalAndFaceNormal, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrier       (*frame.gDepth,               VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.gSmoothVertexNormal,  VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.gEmission,            VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.gMetallicRoughnessAo, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.gMotion,              VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-
-  Fvog::RenderColorAttachment gBufferAttachments[] = {
+  renderGraph.AddPass("Cull Meshlets Main Late",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      .texture = frame.gAlbedo->ImageView(),
-      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE
+      DeclareCullMeshletsResources(pass, *persistentVisibleMeshletIds);
+      pass.ReadWrite(*meshletVisibilityBits, compute);
     },
+    [&](VkCommandBuffer cmd)
     {
-      .texture = frame.gMetallicRoughnessAo->ImageView(),
-      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-    },
+      TIME_SCOPE_GPU(StatGroup::eMainGpu, eCullMeshletsMainLate, cmd);
+      CullMeshletsForView(cmd, mainView, persistentVisibleMeshletIds.value(), "Cull Meshlets Main Late", CULL_PHASE_LATE);
+    });
+
+  renderGraph.AddPass("Main Visbuffer Pass Late",
+    [&](Fvog::RenderGraph::PassBuilder& pass) { declareMainVisbufferResources(pass, VK_ATTACHMENT_LOAD_OP_LOAD); },
+    [&](VkCommandBuffer cmd)
     {
-      .texture = frame.gNormalAndFaceNormal->ImageView(),
-      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-    },
+      TIME_SCOPE_GPU(StatGroup::eMainGpu, eRenderVisbufferMainLate, cmd);
+      drawMainVisbuffer(cmd, VK_ATTACHMENT_LOAD_OP_LOAD, CULL_PHASE_LATE);
+    });
+
+  // The BVH persists between frames, so it's only built when lights are added or removed, and refit when they change
+  if (useLightBvh && (lightBvhNeedsBuild || lightBvhNeedsRefit))
+  {
+    lightBvh.Reserve(NumLights());
+    renderGraph.AddPass("Build Light BVH",
+      [&](Fvog::RenderGraph::PassBuilder& pass)
+      {
+        constexpr auto transfer = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+        constexpr auto storageReadWrite = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        pass.AsyncCompute()
+          .Read(lightsBuffer.GetBuffer(), compute)
+          .ReadWrite(lightBvh.GetKeysBuffer(), compute)
+          .ReadWrite(lightBvh.GetNodesBuffer(), compute)
+          .Access(lightBvh.GetRefitCountersBuffer(), transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite)
+          .Access(lightBvh.GetSceneBoundsBuffer(), transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite);
+      },
+      [&, build = lightBvhNeedsBuild](VkCommandBuffer cmd)
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eMainGpu, eBuildLightBvh, cmd);
+        if (build)
+        {
+          lightBvh.Build(cmd, lightsBuffer.GetBuffer(), NumLights());
+        }
+        else
+        {
+          lightBvh.Refit(cmd, lightsBuffer.GetBuffer(), NumLights());
+        }
+      });
+    lightBvhNeedsBuild = false;
+    lightBvhNeedsRefit = false;
+  }
+
+  // Only depends on the camera and lights, so it overlaps with the passes before shading. Local light VSMs use the clusters to find visible pages
+  renderGraph.AddPass("Assign Lights to Clusters",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      .texture = frame.gSmoothVertexNormal->ImageView(),
-      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      constexpr auto transfer = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+      constexpr auto storageReadWrite = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+      pass.AsyncCompute()
+        .Read(lightsBuffer.GetBuffer(), compute)
+        .Access(lightClusters.GetUniformsBuffer(), transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT)
+        .Access(lightClusters.GetClustersBuffer(), compute, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT)
+        .Access(lightClusters.GetLightIndicesBuffer(), transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | storageReadWrite);
+      if (useLightBvh)
+      {
+        pass.Read(lightBvh.GetNodesBuffer(), compute);
+      }
     },
+    [&](VkCommandBuffer cmd)
+    {
+      TIME_SCOPE_GPU_ASYNC(StatGroup::eMainGpu, eAssignLightsToClusters, cmd);
+      lightClusters.Assign(cmd, GetLightClusterAssignParams());
+    });
+
+  // VSMs
+  // The bookkeeping passes only depend on each other, so they're recorded as one pass that synchronizes itself.
+  // It runs on the async compute queue alongside visbuffer resolve, and only the shadow passes wait for it
+  renderGraph.AddPass("VSM Bookkeeping",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      .texture = frame.gEmission->ImageView(),
-      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      constexpr auto transfer = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+      pass.AsyncCompute()
+        .Read(*frame.gDepth, compute)
+        .Read(globalUniformsBuffer.GetDeviceBuffer(), compute)
+        .Read(vsmContext.uniformBuffer_, compute)
+        .Read(vsmSun.clipmapUniformsBuffer_, compute)
+        .Read(vsmContext.dirtyBounds_, compute)
+        .Read(lightsBuffer.GetBuffer(), compute)
+        .Read(lightClusters.GetUniformsBuffer(), compute)
+        .Read(lightClusters.GetClustersBuffer(), compute)
+        .Read(lightClusters.GetLightIndicesBuffer(), compute)
+        .Read(vsmLocalLights.viewsBuffer_, compute)
+        .Read(vsmLocalLights.lightViewsBuffer_, compute)
+        .ReadWrite(vsmContext.pageTables_, compute)
+        .Access(vsmContext.physicalPages_, compute, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL)
+        .Write(vsmContext.vsmBitmaskHzb_, compute, true)
+        .Access(vsmContext.pagesToClear_, transfer | compute, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+#if VSM_RENDER_OVERDRAW
+      pass.Access(vsmContext.physicalPagesOverdrawHeatmap_, transfer, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+#endif
     },
+    [&](VkCommandBuffer cmd)
+    {
+      stats[(int)StatGroup::eMainGpu][eVsm].Begin(cmd);
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmResetPageVisibility, cmd);
+        vsmContext.ResetPageVisibility(cmd);
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmMarkVisiblePages, cmd);
+        vsmSun.MarkVisiblePages(cmd, frame.gDepth.value(), globalUniformsBuffer.GetDeviceBuffer());
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmMarkVisibleLocalPages, cmd);
+        vsmLocalLights.MarkVisiblePages(cmd, {
+          .gDepth = frame.gDepth.value(),
+          .globalUniforms = globalUniformsBuffer.GetDeviceBuffer(),
+          .lights = lightsBuffer.GetBuffer(),
+          .lightClusterUniforms = lightClusters.GetUniformsBuffer(),
+          .lightClusters = lightClusters.GetClustersBuffer(),
+          .lightIndices = lightClusters.GetLightIndicesBuffer(),
+        });
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmFreeNonVisiblePages, cmd);
+        vsmContext.FreeNonVisiblePages(cmd);
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmAllocatePages, cmd);
+        vsmContext.AllocateRequestedPages(cmd);
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmMarkDirtyBounds, cmd);
+        vsmSun.MarkDirtyBounds(cmd);
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmGenerateHpb, cmd);
+        vsmSun.GenerateBitmaskHzb(cmd);
+      }
+      {
+        TIME_SCOPE_GPU_ASYNC(StatGroup::eVsm, eVsmClearDirtyPages, cmd);
+        vsmContext.ClearDirtyPages(cmd);
+      }
+    });
+
+  renderGraph.AddPass("Resolve Visbuffer Pass",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      .texture = frame.gMotion->ImageView(),
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .clearValue = {0.f, 0.f, 0.f, 0.f},
+      readScene(pass, fragment)
+        .Read(*persistentVisibleMeshletIds, fragment)
+        .Read(*frame.visbuffer, fragment)
+        .ColorAttachment(*frame.gAlbedo, VK_ATTACHMENT_LOAD_OP_DONT_CARE)
+        .ColorAttachment(*frame.gMetallicRoughnessAo, VK_ATTACHMENT_LOAD_OP_DONT_CARE)
+        .ColorAttachment(*frame.gNormalAndFaceNormal, VK_ATTACHMENT_LOAD_OP_DONT_CARE)
+        .ColorAttachment(*frame.gSmoothVertexNormal, VK_ATTACHMENT_LOAD_OP_DONT_CARE)
+        .ColorAttachment(*frame.gEmission, VK_ATTACHMENT_LOAD_OP_DONT_CARE)
+        .ColorAttachment(*frame.gMotion, VK_ATTACHMENT_LOAD_OP_CLEAR);
     },
-  };
+    [&](VkCommandBuffer cmd)
+    {
+      auto ctx = Fvog::Context(*device_, cmd);
+      Fvog::RenderColorAttachment gBufferAttachments[] = {
+        {
+          .texture = frame.gAlbedo->ImageView(),
+          .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE
+        },
+        {
+          .texture = frame.gMetallicRoughnessAo->ImageView(),
+          .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        },
+        {
+          .texture = frame.gNormalAndFaceNormal->ImageView(),
+          .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        },
+        {
+          .texture = frame.gSmoothVertexNormal->ImageView(),
+          .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        },
+        {
+          .texture = frame.gEmission->ImageView(),
+          .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        },
+        {
+          .texture = frame.gMotion->ImageView(),
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .clearValue = {0.f, 0.f, 0.f, 0.f},
+        },
+      };
 
-  ctx.BeginRendering({
-    .name = "Resolve Visbuffer Pass",
-    .colorAttachments = gBufferAttachments,
-  });
+      ctx.BeginRendering({
+        .name = "Resolve Visbuffer Pass",
+        .colorAttachments = gBufferAttachments,
+      });
 
-  {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eResolveVisbuffer, commandBuffer);
-    ctx.BindGraphicsPipeline(visbufferResolvePipeline);
-    
-    auto pushConstants = VisbufferPushConstants{
-      .globalUniformsIndex    = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      .meshletInstancesIndex  = meshletInstancesBuffer.GetResourceHandle().index,
-      .meshletDataIndex       = geometryBuffer.GetResourceHandle().index,
-      .meshletPrimitivesIndex = geometryBuffer.GetResourceHandle().index,
-      .meshletVerticesIndex   = geometryBuffer.GetResourceHandle().index,
-      .meshletIndicesIndex    = geometryBuffer.GetResourceHandle().index,
-      .transformsIndex        = geometryBuffer.GetResourceHandle().index,
-      .materialsIndex         = geometryBuffer.GetResourceHandle().index,
-      .visibleMeshletsIndex   = persistentVisibleMeshletIds->GetResourceHandle().index,
-      .materialSamplerIndex   = materialSampler.GetResourceHandle().index,
-
-      .visbufferIndex       = frame.visbuffer->ImageView().GetSampledResourceHandle().index,
-    };
+      {
+        TIME_SCOPE_GPU(StatGroup::eMainGpu, eResolveVisbuffer, cmd);
+        ctx.BindGraphicsPipeline(visbufferResolvePipeline);
+
+        auto pushConstants = VisbufferPushConstants{
+          .globalUniformsIndex    = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+          .meshletInstancesIndex  = meshletInstancesBuffer.GetResourceHandle().index,
+          .meshletDataIndex       = geometryBuffer.GetResourceHandle().index,
+          .meshletPrimitivesIndex = geometryBuffer.GetResourceHandle().index,
+          .meshletVerticesIndex   = geometryBuffer.GetResourceHandle().index,
+          .meshletIndicesIndex    = geometryBuffer.GetResourceHandle().index,
+          .transformsIndex        = geometryBuffer.GetResourceHandle().index,
+          .materialsIndex         = geometryBuffer.GetResourceHandle().index,
+          .visibleMeshletsIndex   = persistentVisibleMeshletIds->GetResourceHandle().index,
+          .materialSamplerIndex   = materialSampler.GetResourceHandle().index,
+
+          .visbufferIndex       = frame.visbuffer->ImageView().GetSampledResourceHandle().index,
+        };
+
+        ctx.SetPushConstants(pushConstants);
+        ctx.Draw(3, 1, 0, 0);
+      }
 
-    ctx.SetPushConstants(pushConstants);
-    ctx.Draw(3, 1, 0, 0);
-  }
+      ctx.EndRendering();
+    });
 
-  ctx.EndRendering();
+  // Sun VSMs
+  // Clipmaps are culled and rendered in parallel, so the timers spanning them are started and stopped by passes of their own
+  renderGraph.AddPass("Begin Clipmap Timers",
+    [&](Fvog::RenderGraph::PassBuilder& pass) { pass.SideEffects(); },
+    [&](VkCommandBuffer cmd) { stats[(int)StatGroup::eVsm][eVsmRenderDirtyPages].Begin(cmd); });
+
+  // Draws the triangles in a culled VSM view's indirect command into its dirty pages. clipmapLod is only used by sun clipmaps, and timer may be null
+  auto addVsmRenderPass = [&](const char* renderName,
+                            Fvog::Buffer& view,
+                            Fvog::Buffer& visibleMeshletIds,
+                            Fvog::Buffer& indirectCommands,
+                            uint32_t commandIndex,
+                            Fvog::Extent2D vsmExtent,
+                            uint32_t clipmapLod,
+                            StatInfo* timer)
+  {
+    renderGraph.AddPass(renderName,
+      [&](Fvog::RenderGraph::PassBuilder& pass)
+      {
+        readScene(pass.Parallel(), vertex | fragment)
+          .Read(view, vertex | fragment)
+          .Read(visibleMeshletIds, vertex | fragment)
+          .Read(indirectCommands, indirect | vertex, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT)
+          .Read(*instancedMeshletBuffer, VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT)
+          .Read(vsmContext.uniformBuffer_, vertex | fragment)
+          .Read(vsmSun.clipmapUniformsBuffer_, vertex | fragment)
+          .Read(vsmContext.pageTables_, fragment)
+          // Depth is resolved with atomics on the physical pages
+          .ReadWrite(vsmContext.physicalPages_, fragment);
+#if VSM_RENDER_OVERDRAW
+        pass.ReadWrite(vsmContext.physicalPagesOverdrawHeatmap_, fragment);
+#endif
+#if VSM_USE_TEMP_ZBUFFER
+        pass.DepthAttachment(vsmTempDepthStencil.value(), VK_ATTACHMENT_LOAD_OP_CLEAR);
+#endif
+      },
+      [&, renderName, vsmExtent, clipmapLod, commandIndex, timer, viewPtr = &view, visibleMeshletIdsPtr = &visibleMeshletIds, indirectCommandsPtr = &indirectCommands](VkCommandBuffer cmd)
+      {
+        TracyVkZoneTransient(tracyVkContext_, tracyZone, cmd, renderName, true);
+        auto ctx = Fvog::Context(*device_, cmd);
+        if (timer)
+        {
+          timer->Begin(cmd);
+        }
 
-  ctx.ImageBarrier(*frame.gAlbedo,                  VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-  ctx.ImageBarrier(*frame.gNormalAndFaceNormal,     VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-  ctx.ImageBarrier(*frame.gDepth,                   VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-  ctx.ImageBarrier(*frame.gSmoothVertexNormal,      VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-  ctx.ImageBarrier(*frame.gEmission,                VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-  ctx.ImageBarrier(*frame.gMetallicRoughnessAo,     VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-  ctx.ImageBarrierDiscard(*frame.colorHdrRenderRes, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
+  #if VSM_USE_TEMP_ZBUFFER
+        auto vsmDepthAttachment = Fvog::RenderDepthStencilAttachment{
+          .texture    = vsmTempDepthStencil.value().ImageView(),
+          .loadOp     = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .clearValue = {.depth = 1},
+        };
+  #endif
+        ctx.BeginRendering({
+          .name = renderName,
+          .viewport = VkViewport{0, 0, (float)vsmExtent.width, (float)vsmExtent.height, 0, 1},
+#if VSM_USE_TEMP_ZBUFFER
+          .depthAttachment = vsmDepthAttachment,
+#endif
+        });
 
-  // shading pass (full screen tri)
-  auto shadingColorAttachment = Fvog::RenderColorAttachment{
-    .texture = frame.colorHdrRenderRes->ImageView(),
-    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-    .clearValue = {.1f, .3f, .5f, 0.0f},
+        ctx.BindGraphicsPipeline(vsmShadowPipeline);
+
+        auto pushConstants                       = vsmContext.GetPushConstants();
+        pushConstants.meshletInstancesIndex      = meshletInstancesBuffer.GetResourceHandle().index;
+        pushConstants.meshletDataIndex           = geometryBuffer.GetResourceHandle().index;
+        pushConstants.meshletPrimitivesIndex     = geometryBuffer.GetResourceHandle().index;
+        pushConstants.meshletVerticesIndex       = geometryBuffer.GetResourceHandle().index;
+        pushConstants.meshletIndicesIndex        = geometryBuffer.GetResourceHandle().index;
+        pushConstants.transformsIndex            = geometryBuffer.GetResourceHandle().index;
+        pushConstants.globalUniformsIndex        = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index;
+        pushConstants.viewIndex                  = viewPtr->GetResourceHandle().index;
+        pushConstants.materialsIndex             = geometryBuffer.GetResourceHandle().index;
+        pushConstants.materialSamplerIndex       = materialSampler.GetResourceHandle().index;
+        pushConstants.clipmapLod                 = clipmapLod;
+        pushConstants.clipmapUniformsBufferIndex = vsmSun.clipmapUniformsBuffer_.GetResourceHandle().index;
+        pushConstants.visibleMeshletsIndex       = visibleMeshletIdsPtr->GetResourceHandle().index;
+
+        ctx.BindIndexBuffer(*instancedMeshletBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+        ctx.SetPushConstants(pushConstants);
+        ctx.DrawIndexedIndirect(*indirectCommandsPtr, commandIndex * sizeof(Fvog::DrawIndexedIndirectCommand), 1, 0);
+        ctx.EndRendering();
+
+        if (timer)
+        {
+          timer->End(cmd);
+        }
+      });
   };
-  ctx.BeginRendering({
-    .name = "Shading",
-    .colorAttachments = {&shadingColorAttachment, 1},
-  });
-  {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eShadeOpaque, commandBuffer);
-
-    // Certain VSM push constants are used by the shading pass
-    auto vsmPushConstants = vsmContext.GetPushConstants();
-    ctx.BindGraphicsPipeline(shadingPipeline);
-    ctx.SetPushConstants(ShadingPushConstants{
-      .globalUniformsIndex  = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      .shadingUniformsIndex = shadingUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      .shadowUniformsIndex  = shadowUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      .lightBufferIndex     = lightsBuffer.GetResourceHandle().index,
-
-      .gAlbedoIndex              = frame.gAlbedo->ImageView().GetSampledResourceHandle().index,
-      .gNormalAndFaceNormalIndex = frame.gNormalAndFaceNormal->ImageView().GetSampledResourceHandle().index,
-      .gDepthIndex               = frame.gDepth->ImageView().GetSampledResourceHandle().index,
-      .gSmoothVertexNormalIndex  = frame.gSmoothVertexNormal->ImageView().GetSampledResourceHandle().index,
-      .gEmissionIndex            = frame.gEmission->ImageView().GetSampledResourceHandle().index,
-      .gMetallicRoughnessAoIndex = frame.gMetallicRoughnessAo->ImageView().GetSampledResourceHandle().index,
-
-      .pageTablesIndex            = vsmPushConstants.pageTablesIndex,
-      .physicalPagesIndex         = vsmPushConstants.physicalPagesIndex,
-      .vsmBitmaskHzbIndex         = vsmPushConstants.vsmBitmaskHzbIndex,
-      .vsmUniformsBufferIndex     = vsmPushConstants.vsmUniformsBufferIndex,
-      .dirtyPageListBufferIndex   = vsmPushConstants.dirtyPageListBufferIndex,
-      .clipmapUniformsBufferIndex = vsmSun.clipmapUniformsBuffer_.GetResourceHandle().index,
-      .nearestSamplerIndex        = vsmPushConstants.nearestSamplerIndex,
-
-      .physicalPagesOverdrawIndex = vsmPushConstants.physicalPagesOverdrawIndex,
-    });
 
-    ctx.Draw(3, 1, 0, 0);
-  }
-  ctx.EndRendering();
+  // Culls the meshlets of a VSM view on its own, then draws them
+  auto addVsmViewPasses = [&](const ViewParams& vsmView, std::string cullName, const char* renderName, Fvog::Extent2D vsmExtent, uint32_t clipmapLod, StatInfo* timer)
+  {
+    renderGraph.AddPass(cullName,
+      [&](Fvog::RenderGraph::PassBuilder& pass) { DeclareCullMeshletsResources(pass.Parallel(), *transientVisibleMeshletIds); },
+      [&, vsmView, cullName](VkCommandBuffer cmd)
+      {
+        CullMeshletsForView(cmd, vsmView, transientVisibleMeshletIds.value(), cullName);
+      });
 
-  // After shading, we render debug geometry
-  auto debugDepthAttachment = Fvog::RenderDepthStencilAttachment{
-    .texture = frame.gDepth->ImageView(),
-    .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+    addVsmRenderPass(renderName, *viewBuffer, *transientVisibleMeshletIds, *meshletIndirectCommand, 0, vsmExtent, clipmapLod, timer);
   };
 
-  auto colorAttachments = std::vector<Fvog::RenderColorAttachment>{};
-  colorAttachments.emplace_back(frame.colorHdrRenderRes->ImageView(), VK_ATTACHMENT_LOAD_OP_LOAD);
-  colorAttachments.emplace_back(frame.gReactiveMask->ImageView(), VK_ATTACHMENT_LOAD_OP_CLEAR, Fvog::ClearColorValue{0.0f});
+  auto sunClipmapViews = std::vector<ViewParams>();
+  for (uint32_t i = 0; i < vsmSun.NumClipmaps(); i++)
+  {
+    auto sunCurrentClipmapView = ViewParams{
+      .oldViewProj = vsmSun.GetProjections()[i] * vsmSun.GetViewMatrices()[i],
+      .proj = vsmSun.GetProjections()[i],
+      .view = vsmSun.GetViewMatrices()[i],
+      .viewProj = vsmSun.GetProjections()[i] * vsmSun.GetViewMatrices()[i],
+      .viewProjStableForVsmOnly = vsmSun.GetProjections()[i] * vsmSun.GetStableViewMatrix(),
+      .cameraPos = {}, // unused
+      .viewport = {0.f, 0.f, vsmSun.GetExtent().width, vsmSun.GetExtent().height},
+      .type = ViewType::VIRTUAL,
+      .virtualTableIndex = vsmSun.GetClipmapTableIndices()[i],
+    };
+    Math::MakeFrustumPlanes(sunCurrentClipmapView.viewProj, sunCurrentClipmapView.frustumPlanes);
+    sunClipmapViews.push_back(sunCurrentClipmapView);
+  }
 
-  ctx.ImageBarrierDiscard(*frame.gReactiveMask, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrier(*frame.gDepth, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-  ctx.ImageBarrier(*frame.colorHdrRenderRes, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
+  auto clipmapTimer = [&](uint32_t clipmap) -> StatInfo* { return &stats[(int)StatGroup::eVsm][eVsmRenderClipmap0 + clipmap]; };
 
-  if (!debugLines.empty())
+  if (cullClipmapsTogether)
   {
-    if (!lineVertexBuffer || lineVertexBuffer->Size() < debugLines.size() * sizeof(Debug::Line))
+    // Each clipmap is drawn from its own command and range of the index buffer, so the draws don't wait on each other
+    renderGraph.AddPass("Cull Sun VSM Clipmaps",
+      [&](Fvog::RenderGraph::PassBuilder& pass) { DeclareCullMeshletsMultiViewResources(pass.Parallel()); },
+      [&, sunClipmapViews](VkCommandBuffer cmd)
+      {
+        TIME_SCOPE_GPU(StatGroup::eVsm, eVsmCullClipmaps, cmd);
+        CullMeshletsMultiView(cmd, sunClipmapViews, "Cull Sun VSM Clipmaps");
+      });
+
+    for (uint32_t i = 0; i < vsmSun.NumClipmaps(); i++)
     {
-      lineVertexBuffer.emplace(*device_, (uint32_t)debugLines.size(), "Debug Lines");
+      addVsmRenderPass("Render Clipmap",
+        multiViewBuffers[i],
+        *multiViewVisibleMeshletIds,
+        *multiViewIndirectCommands,
+        i,
+        vsmSun.GetExtent(),
+        vsmSun.GetClipmapTableIndices()[i],
+        clipmapTimer(i));
     }
-    lineVertexBuffer->UpdateData(commandBuffer, debugLines);
   }
-
-  ctx.BeginRendering({
-    .name = "Debug Geometry",
-    .colorAttachments = colorAttachments,
-    .depthAttachment = debugDepthAttachment,
-  });
+  else
   {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eDebugGeometry, commandBuffer);
-    //  Lines
-    if (!debugLines.empty())
+    for (uint32_t i = 0; i < vsmSun.NumClipmaps(); i++)
     {
-      ctx.BindGraphicsPipeline(debugLinesPipeline);
-      ctx.SetPushConstants(DebugLinesPushConstants{
-        .vertexBufferIndex   = lineVertexBuffer->GetDeviceBuffer().GetResourceHandle().index,
-        .globalUniformsIndex = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      });
-      ctx.Draw(uint32_t(debugLines.size() * 2), 1, 0, 0);
+      addVsmViewPasses(sunClipmapViews[i], "Cull Sun VSM Meshlets, View " + std::to_string(i), "Render Clipmap", vsmSun.GetExtent(), vsmSun.GetClipmapTableIndices()[i], clipmapTimer(i));
     }
+  }
+
+  // Local light views only cover the part of their layer that their LOD level uses, so they are drawn with a smaller viewport
+  const auto localViews = vsmLocalLights.GetViews();
+  for (uint32_t i = 0; i < localViews.size(); i++)
+  {
+    const auto& localView = localViews[i];
+    const auto localExtent = Techniques::VirtualShadowMaps::LocalLightVirtualShadowMaps::GetExtent(localView.tableLevel);
+    auto localLightView = ViewParams{
+      .oldViewProj = localView.viewProj,
+      .viewProj = localView.viewProj,
+      .viewProjStableForVsmOnly = localView.viewProj,
+      .cameraPos = {}, // unused
+      .viewport = {0.f, 0.f, localExtent.width, localExtent.height},
+      .type = ViewType::VIRTUAL_LOCAL,
+      .virtualTableIndex = localView.tableIndex,
+      .virtualTableLevel = localView.tableLevel,
+    };
+    Math::MakeFrustumPlanes(localLightView.viewProj, localLightView.frustumPlanes);
+
+    addVsmViewPasses(localLightView, "Cull Local Light VSM Meshlets, View " + std::to_string(i), "Render Local Light VSM", localExtent, 0, nullptr);
+  }
+
+  renderGraph.AddPass("End Clipmap Timers",
+    [&](Fvog::RenderGraph::PassBuilder& pass) { pass.SideEffects(); },
+    [&](VkCommandBuffer cmd)
+    {
+      stats[(int)StatGroup::eVsm][eVsmRenderDirtyPages].End(cmd);
+      stats[(int)StatGroup::eMainGpu][eVsm].End(cmd);
+    });
 
-    //// GPU-generated geometry past here
-    //Fwog::MemoryBarrier(Fwog::MemoryBarrierBit::COMMAND_BUFFER_BIT | Fwog::MemoryBarrierBit::SHADER_STORAGE_BIT);
+  // Every view has been culled, so the feedback is complete. It's read on the host when this frame's slot comes around again
+  auto& triangleCullFeedbackReadback = triangleCullFeedbackReadbacks[device_->frameNumber % triangleCullFeedbackReadbacks.size()];
+  renderGraph.AddPass("Read Back Triangle Cull Feedback",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
+    {
+      pass.Read(*triangleCullFeedbackBuffer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT)
+        .Write(triangleCullFeedbackReadback.buffer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    },
+    [&](VkCommandBuffer cmd)
+    {
+      Fvog::Context(*device_, cmd).CopyBuffer(*triangleCullFeedbackBuffer, triangleCullFeedbackReadback.buffer, {.size = sizeof(TriangleCullFeedback)});
+    });
+  renderGraph.Export(triangleCullFeedbackReadback.buffer, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
 
-    // AABBs
-    if (drawDebugAabbs)
+  // shading pass (full screen tri)
+  renderGraph.AddPass("Shading",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      ctx.BindGraphicsPipeline(debugAabbsPipeline);
-      ctx.SetPushConstants(DebugAabbArguments{
-        .globalUniformsIndex = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
-        .debugAabbBufferIndex = debugGpuAabbsBuffer->GetResourceHandle().index,
+      pass.Read(globalUniformsBuffer.GetDeviceBuffer(), fragment)
+        .Read(shadingUniformsBuffer.GetDeviceBuffer(), fragment)
+        .Read(shadowUniformsBuffer.GetDeviceBuffer(), fragment)
+        .Read(lightsBuffer.GetBuffer(), fragment)
+        .Read(lightClusters.GetUniformsBuffer(), fragment)
+        .Read(lightClusters.GetClustersBuffer(), fragment)
+        .Read(lightClusters.GetLightIndicesBuffer(), fragment)
+        .Read(*frame.gAlbedo, fragment)
+        .Read(*frame.gNormalAndFaceNormal, fragment)
+        .Read(*frame.gDepth, fragment)
+        .Read(*frame.gSmoothVertexNormal, fragment)
+        .Read(*frame.gEmission, fragment)
+        .Read(*frame.gMetallicRoughnessAo, fragment)
+        .Read(vsmContext.pageTables_, fragment)
+        .Read(vsmContext.physicalPages_, fragment)
+        .Read(vsmContext.vsmBitmaskHzb_, fragment)
+        .Read(vsmContext.physicalPagesOverdrawHeatmap_, fragment)
+        .Read(vsmContext.uniformBuffer_, fragment)
+        .Read(vsmContext.pagesToClear_, fragment)
+        .Read(vsmSun.clipmapUniformsBuffer_, fragment)
+        .Read(vsmLocalLights.viewsBuffer_, fragment)
+        .Read(vsmLocalLights.lightViewsBuffer_, fragment)
+        .ColorAttachment(*frame.colorHdrRenderRes, VK_ATTACHMENT_LOAD_OP_CLEAR);
+    },
+    [&](VkCommandBuffer cmd)
+    {
+      auto ctx = Fvog::Context(*device_, cmd);
+      auto shadingColorAttachment = Fvog::RenderColorAttachment{
+        .texture = frame.colorHdrRenderRes->ImageView(),
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .clearValue = {.1f, .3f, .5f, 0.0f},
+      };
+      ctx.BeginRendering({
+        .name = "Shading",
+        .colorAttachments = {&shadingColorAttachment, 1},
       });
-      ctx.DrawIndirect(debugGpuAabbsBuffer.value(), 0, 1, 0);
-    }
+      {
+        TIME_SCOPE_GPU(StatGroup::eMainGpu, eShadeOpaque, cmd);
+
+        // Certain VSM push constants are used by the shading pass
+        auto vsmPushConstants = vsmContext.GetPushConstants();
+        ctx.BindGraphicsPipeline(shadingPipeline);
+        ctx.SetPushConstants(ShadingPushConstants{
+          .globalUniformsIndex  = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+          .shadingUniformsIndex = shadingUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+          .shadowUniformsIndex  = shadowUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+          .lightBufferIndex     = lightsBuffer.GetResourceHandle().index,
+
+          .gAlbedoIndex              = frame.gAlbedo->ImageView().GetSampledResourceHandle().index,
+          .gNormalAndFaceNormalIndex = frame.gNormalAndFaceNormal->ImageView().GetSampledResourceHandle().index,
+          .gDepthIndex               = frame.gDepth->ImageView().GetSampledResourceHandle().index,
+          .gSmoothVertexNormalIndex  = frame.gSmoothVertexNormal->ImageView().GetSampledResourceHandle().index,
+          .gEmissionIndex            = frame.gEmission->ImageView().GetSampledResourceHandle().index,
+          .gMetallicRoughnessAoIndex = frame.gMetallicRoughnessAo->ImageView().GetSampledResourceHandle().index,
+
+          .pageTablesIndex            = vsmPushConstants.pageTablesIndex,
+          .physicalPagesIndex         = vsmPushConstants.physicalPagesIndex,
+          .vsmBitmaskHzbIndex         = vsmPushConstants.vsmBitmaskHzbIndex,
+          .vsmUniformsBufferIndex     = vsmPushConstants.vsmUniformsBufferIndex,
+          .dirtyPageListBufferIndex   = vsmPushConstants.dirtyPageListBufferIndex,
+          .clipmapUniformsBufferIndex = vsmSun.clipmapUniformsBuffer_.GetResourceHandle().index,
+          .nearestSamplerIndex        = vsmPushConstants.nearestSamplerIndex,
+
+          .physicalPagesOverdrawIndex = vsmPushConstants.physicalPagesOverdrawIndex,
+
+          .lightClusterUniformsIndex = lightClusters.GetUniformsBuffer().GetResourceHandle().index,
+          .lightClustersIndex        = lightClusters.GetClustersBuffer().GetResourceHandle().index,
+          .lightIndicesIndex         = lightClusters.GetLightIndicesBuffer().GetResourceHandle().index,
+
+          .vsmLocalViewsIndex      = vsmLocalLights.viewsBuffer_.GetResourceHandle().index,
+          .vsmLocalLightViewsIndex = vsmLocalLights.lightViewsBuffer_.GetResourceHandle().index,
+        });
 
-    // Rects
-    if (drawDebugRects)
+        ctx.Draw(3, 1, 0, 0);
+      }
+      ctx.EndRendering();
+    });
+
+  // After shading, we render debug geometry
+  renderGraph.AddPass("Debug Geometry",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
     {
-      ctx.BindGraphicsPipeline(debugRectsPipeline);
-      ctx.SetPushConstants(DebugRectArguments{
-        .debugRectBufferIndex = debugGpuRectsBuffer->GetResourceHandle().index,
+      pass.Read(globalUniformsBuffer.GetDeviceBuffer(), vertex)
+        .Read(*debugGpuAabbsBuffer, indirect | vertex, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT)
+        .Read(*debugGpuRectsBuffer, indirect | vertex, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT)
+        .ColorAttachment(*frame.colorHdrRenderRes)
+        .ColorAttachment(*frame.gReactiveMask, VK_ATTACHMENT_LOAD_OP_CLEAR)
+        .DepthAttachment(*frame.gDepth);
+      if (!debugLines.empty())
+      {
+        pass.Read(lineVertexBuffer->GetDeviceBuffer(), vertex);
+      }
+    },
+    [&](VkCommandBuffer cmd)
+    {
+      auto ctx = Fvog::Context(*device_, cmd);
+      auto debugDepthAttachment = Fvog::RenderDepthStencilAttachment{
+        .texture = frame.gDepth->ImageView(),
+        .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+      };
+
+      auto colorAttachments = std::vector<Fvog::RenderColorAttachment>{};
+      colorAttachments.emplace_back(frame.colorHdrRenderRes->ImageView(), VK_ATTACHMENT_LOAD_OP_LOAD);
+      colorAttachments.emplace_back(frame.gReactiveMask->ImageView(), VK_ATTACHMENT_LOAD_OP_CLEAR, Fvog::ClearColorValue{0.0f});
+
+      ctx.BeginRendering({
+        .name = "Debug Geometry",
+        .colorAttachments = colorAttachments,
+        .depthAttachment = debugDepthAttachment,
       });
-      ctx.DrawIndirect(debugGpuRectsBuffer.value(), 0, 1, 0);
-    }
-  }
-  ctx.EndRendering();
+      {
+        TIME_SCOPE_GPU(StatGroup::eMainGpu, eDebugGeometry, cmd);
+        //  Lines
+        if (!debugLines.empty())
+        {
+          ctx.BindGraphicsPipeline(debugLinesPipeline);
+          ctx.SetPushConstants(DebugLinesPushConstants{
+            .vertexBufferIndex   = lineVertexBuffer->GetDeviceBuffer().GetResourceHandle().index,
+            .globalUniformsIndex = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+          });
+          ctx.Draw(uint32_t(debugLines.size() * 2), 1, 0, 0);
+        }
 
-  {
-    ctx.ImageBarrier(frame.colorHdrRenderRes.value(), VK_IMAGE_LAYOUT_GENERAL);
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eAutoExposure, commandBuffer);
-    autoExposure.Apply(commandBuffer, {
-      .image = frame.colorHdrRenderRes.value(),
-      .exposureBuffer = exposureBuffer,
-      .deltaTime = static_cast<float>(dt),
-      .adjustmentSpeed = autoExposureAdjustmentSpeed,
-      .targetLuminance = autoExposureTargetLuminance,
-      .logMinLuminance = autoExposureLogMinLuminance,
-      .logMaxLuminance = autoExposureLogMaxLuminance,
+        // AABBs
+        if (drawDebugAabbs)
+        {
+          ctx.BindGraphicsPipeline(debugAabbsPipeline);
+          ctx.SetPushConstants(DebugAabbArguments{
+            .globalUniformsIndex = globalUniformsBuffer.GetDeviceBuffer().GetResourceHandle().index,
+            .debugAabbBufferIndex = debugGpuAabbsBuffer->GetResourceHandle().index,
+          });
+          ctx.DrawIndirect(debugGpuAabbsBuffer.value(), 0, 1, 0);
+        }
+
+        // Rects
+        if (drawDebugRects)
+        {
+          ctx.BindGraphicsPipeline(debugRectsPipeline);
+          ctx.SetPushConstants(DebugRectArguments{
+            .debugRectBufferIndex = debugGpuRectsBuffer->GetResourceHandle().index,
+          });
+          ctx.DrawIndirect(debugGpuRectsBuffer.value(), 0, 1, 0);
+        }
+      }
+      ctx.EndRendering();
+    });
+
+  // Overlaps with upscaling. colorHdrRenderRes is transient, but nothing is placed over it until tonemapping is done
+  renderGraph.AddPass("Auto Exposure",
+    [&](Fvog::RenderGraph::PassBuilder& pass) { pass.AsyncCompute().Read(*frame.colorHdrRenderRes, compute).ReadWrite(exposureBuffer, compute); },
+    [&](VkCommandBuffer cmd)
+    {
+      TIME_SCOPE_GPU_ASYNC(StatGroup::eMainGpu, eAutoExposure, cmd);
+      autoExposure.Apply(cmd, {
+        .image = frame.colorHdrRenderRes.value(),
+        .exposureBuffer = exposureBuffer,
+        .deltaTime = static_cast<float>(dt),
+        .adjustmentSpeed = autoExposureAdjustmentSpeed,
+        .targetLuminance = autoExposureTargetLuminance,
+        .logMinLuminance = autoExposureLogMinLuminance,
+        .logMaxLuminance = autoExposureLogMaxLuminance,
+      });
     });
-  }
 
 #ifdef FROGRENDER_FSR2_ENABLE
   if (fsr2Enable)
   {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eFsr2, commandBuffer);
-    //static Fwog::TimerQueryAsync timer(5);
-    //if (auto t = timer.PopTimestamp())
-    //{
-    //  fsr2Performance = *t / 10e5;
-    //}
-    //Fwog::TimerScoped scopedTimer(timer);
-    
-    auto marker = ctx.MakeScopedDebugMarker("FSR 2");
-
-    ctx.ImageBarrier(*frame.colorHdrRenderRes, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    ctx.ImageBarrier(*frame.gDepth, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    ctx.ImageBarrier(*frame.gMotion, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    ctx.ImageBarrier(*frame.gReactiveMask, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    ctx.ImageBarrierDiscard(*frame.colorHdrWindowRes, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL); // This nonsense transition is needed for FSR2
-
-    float jitterX{};
-    float jitterY{};
-    ffxFsr2GetJitterOffset(&jitterX, &jitterY, (int32_t)device_->frameNumber, ffxFsr2GetJitterPhaseCount(renderInternalWidth, renderOutputWidth));
-
-    FfxFsr2DispatchDescription dispatchDesc{
-      .commandList = ffxGetCommandListVK(commandBuffer),
-      .color = ffxGetTextureResourceVK(&fsr2Context,
-                                       frame.colorHdrRenderRes->Image(),
-                                       frame.colorHdrRenderRes->ImageView(),
-                                       renderInternalWidth,
-                                       renderInternalHeight,
-                                       Fvog::detail::FormatToVk(frame.colorHdrRenderRes->GetCreateInfo().format)),
-      .depth = ffxGetTextureResourceVK(&fsr2Context,
-                                       frame.gDepth->Image(),
-                                       frame.gDepth->ImageView(),
-                                       renderInternalWidth,
-                                       renderInternalHeight,
-                                       Fvog::detail::FormatToVk(frame.gDepth->GetCreateInfo().format)),
-      .motionVectors = ffxGetTextureResourceVK(&fsr2Context,
-                                               frame.gMotion->Image(),
-                                               frame.gMotion->ImageView(),
-                                               renderInternalWidth,
-                                               renderInternalHeight,
-                                               Fvog::detail::FormatToVk(frame.gMotion->GetCreateInfo().format)),
-      .exposure = {},
-      .reactive = ffxGetTextureResourceVK(&fsr2Context,
-                                          frame.gReactiveMask->Image(),
-                                          frame.gReactiveMask->ImageView(),
-                                          renderInternalWidth,
-                                          renderInternalHeight,
-                                          Fvog::detail::FormatToVk(frame.gReactiveMask->GetCreateInfo().format)),
-      .transparencyAndComposition = {},
-      .output = ffxGetTextureResourceVK(&fsr2Context,
-                                        frame.colorHdrWindowRes->Image(),
-                                        frame.colorHdrWindowRes->ImageView(),
-                                        renderOutputWidth,
-                                        renderOutputHeight,
-                                        Fvog::detail::FormatToVk(frame.colorHdrWindowRes->GetCreateInfo().format)),
-      .jitterOffset = {jitterX, jitterY},
-      .motionVectorScale = {float(renderInternalWidth), float(renderInternalHeight)},
-      .renderSize = {renderInternalWidth, renderInternalHeight},
-      .enableSharpening = fsr2Sharpness != 0,
-      .sharpness = fsr2Sharpness,
-      .frameTimeDelta = static_cast<float>(dt * 1000.0),
-      .preExposure = 1,
-      .reset = false,
-      .cameraNear = std::numeric_limits<float>::max(),
-      .cameraFar = cameraNearPlane,
-      .cameraFovAngleVertical = cameraFovyRadians,
-      .viewSpaceToMetersFactor = 1,
-    };
-
-    if (auto err = ffxFsr2ContextDispatch(&fsr2Context, &dispatchDesc); err != FFX_OK)
-    {
-      printf("FSR 2 error: %d\n", err);
-    }
+    renderGraph.AddPass("FSR 2",
+      [&](Fvog::RenderGraph::PassBuilder& pass)
+      {
+        constexpr auto sampled = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+        pass.Access(*frame.colorHdrRenderRes, compute, sampled, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+          .Access(*frame.gDepth, compute, sampled, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+          .Access(*frame.gMotion, compute, sampled, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+          .Access(*frame.gReactiveMask, compute, sampled, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+          // This nonsense transition is needed for FSR2, which transitions the output to GENERAL itself
+          .Access(*frame.colorHdrWindowRes, compute, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true);
+      },
+      [&](VkCommandBuffer cmd)
+      {
+        TIME_SCOPE_GPU(StatGroup::eMainGpu, eFsr2, cmd);
+        //static Fwog::TimerQueryAsync timer(5);
+        //if (auto t = timer.PopTimestamp())
+        //{
+        //  fsr2Performance = *t / 10e5;
+        //}
+        //Fwog::TimerScoped scopedTimer(timer);
+
+        float jitterX{};
+        float jitterY{};
+        ffxFsr2GetJitterOffset(&jitterX, &jitterY, (int32_t)device_->frameNumber, ffxFsr2GetJitterPhaseCount(renderInternalWidth, renderOutputWidth));
+
+        FfxFsr2DispatchDescription dispatchDesc{
+          .commandList = ffxGetCommandListVK(cmd),
+          .color = ffxGetTextureResourceVK(&fsr2Context,
+                                           frame.colorHdrRenderRes->Image(),
+                                           frame.colorHdrRenderRes->ImageView(),
+                                           renderInternalWidth,
+                                           renderInternalHeight,
+                                           Fvog::detail::FormatToVk(frame.colorHdrRenderRes->GetCreateInfo().format)),
+          .depth = ffxGetTextureResourceVK(&fsr2Context,
+                                           frame.gDepth->Image(),
+                                           frame.gDepth->ImageView(),
+                                           renderInternalWidth,
+                                           renderInternalHeight,
+                                           Fvog::detail::FormatToVk(frame.gDepth->GetCreateInfo().format)),
+          .motionVectors = ffxGetTextureResourceVK(&fsr2Context,
+                                                   frame.gMotion->Image(),
+                                                   frame.gMotion->ImageView(),
+                                                   renderInternalWidth,
+                                                   renderInternalHeight,
+                                                   Fvog::detail::FormatToVk(frame.gMotion->GetCreateInfo().format)),
+          .exposure = {},
+          .reactive = ffxGetTextureResourceVK(&fsr2Context,
+                                              frame.gReactiveMask->Image(),
+                                              frame.gReactiveMask->ImageView(),
+                                              renderInternalWidth,
+                                              renderInternalHeight,
+                                              Fvog::detail::FormatToVk(frame.gReactiveMask->GetCreateInfo().format)),
+          .transparencyAndComposition = {},
+          .output = ffxGetTextureResourceVK(&fsr2Context,
+                                            frame.colorHdrWindowRes->Image(),
+                                            frame.colorHdrWindowRes->ImageView(),
+                                            renderOutputWidth,
+                                            renderOutputHeight,
+                                            Fvog::detail::FormatToVk(frame.colorHdrWindowRes->GetCreateInfo().format)),
+          .jitterOffset = {jitterX, jitterY},
+          .motionVectorScale = {float(renderInternalWidth), float(renderInternalHeight)},
+          .renderSize = {renderInternalWidth, renderInternalHeight},
+          .enableSharpening = fsr2Sharpness != 0,
+          .sharpness = fsr2Sharpness,
+          .frameTimeDelta = static_cast<float>(dt * 1000.0),
+          .preExposure = 1,
+          .reset = false,
+          .cameraNear = std::numeric_limits<float>::max(),
+          .cameraFar = cameraNearPlane,
+          .cameraFovAngleVertical = cameraFovyRadians,
+          .viewSpaceToMetersFactor = 1,
+        };
+
+        if (auto err = ffxFsr2ContextDispatch(&fsr2Context, &dispatchDesc); err != FFX_OK)
+        {
+          printf("FSR 2 error: %d\n", err);
+        }
 
-    // Re-apply states that application assumes
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, device_->defaultPipelineLayout, 0, 1, &device_->descriptorSet_, 0, nullptr);
-    *frame.colorHdrWindowRes->currentLayout = VK_IMAGE_LAYOUT_GENERAL;
+        // Re-apply states that application assumes
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, device_->defaultPipelineLayout, 0, 1, &device_->descriptorSet_, 0, nullptr);
+        *frame.colorHdrWindowRes->currentLayout = VK_IMAGE_LAYOUT_GENERAL;
+      });
   }
 #endif
 
+  auto& sceneColor = fsr2Enable ? frame.colorHdrWindowRes.value() : frame.colorHdrRenderRes.value();
+
   if (bloomEnable)
   {
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eBloom, commandBuffer);
-    bloom.Apply(commandBuffer, {
-      .target = fsr2Enable ? frame.colorHdrWindowRes.value() : frame.colorHdrRenderRes.value(),
-      .scratchTexture = frame.colorHdrBloomScratchBuffer.value(),
-      .passes = bloomPasses,
-      .strength = bloomStrength,
-      .width = bloomWidth,
-      .useLowPassFilterOnFirstPass = bloomUseLowPassFilter,
-    });
+    renderGraph.AddPass("Bloom",
+      [&](Fvog::RenderGraph::PassBuilder& pass) { pass.ReadWrite(sceneColor, compute).Write(*frame.colorHdrBloomScratchBuffer, compute, true); },
+      [&](VkCommandBuffer cmd)
+      {
+        TIME_SCOPE_GPU(StatGroup::eMainGpu, eBloom, cmd);
+        bloom.Apply(cmd, {
+          .target = sceneColor,
+          .scratchTexture = frame.colorHdrBloomScratchBuffer.value(),
+          .passes = bloomPasses,
+          .strength = bloomStrength,
+          .width = bloomWidth,
+          .useLowPassFilterOnFirstPass = bloomUseLowPassFilter,
+        });
+      });
   }
-  
-  {
-    auto marker = ctx.MakeScopedDebugMarker("Postprocessing", {.5f, .5f, 1.0f, 1.0f});
-
-    ctx.Barrier();
-    ctx.ImageBarrierDiscard(*frame.colorLdrWindowRes, VK_IMAGE_LAYOUT_GENERAL);
-
-    TIME_SCOPE_GPU(StatGroup::eMainGpu, eResolveImage, commandBuffer);
 
-    ctx.BindComputePipeline(tonemapPipeline);
-    ctx.SetPushConstants(TonemapArguments{
-      .sceneColorIndex = (fsr2Enable ? frame.colorHdrWindowRes.value() : frame.colorHdrRenderRes.value()).ImageView().GetSampledResourceHandle().index,
-      .noiseIndex = noiseTexture->ImageView().GetSampledResourceHandle().index,
-      .nearestSamplerIndex = nearestSampler.GetResourceHandle().index,
-      .linearClampSamplerIndex = linearClampSampler.GetResourceHandle().index,
-      .exposureIndex = exposureBuffer.GetResourceHandle().index,
-      .tonemapUniformsIndex = tonemapUniformBuffer.GetDeviceBuffer().GetResourceHandle().index,
-      .outputImageIndex = frame.colorLdrWindowRes->ImageView().GetStorageResourceHandle().index,
-      .tonyMcMapfaceIndex = tonyMcMapfaceLut.ImageView().GetSampledResourceHandle().index,
+  renderGraph.AddPass("Postprocessing",
+    [&](Fvog::RenderGraph::PassBuilder& pass)
+    {
+      pass.Read(sceneColor, compute)
+        .Read(*noiseTexture, compute)
+        .Read(tonyMcMapfaceLut, compute)
+        .Read(exposureBuffer, compute)
+        .Read(tonemapUniformBuffer.GetDeviceBuffer(), compute)
+        .Write(*frame.colorLdrWindowRes, compute, true);
+    },
+    [&](VkCommandBuffer cmd)
+    {
+      TIME_SCOPE_GPU(StatGroup::eMainGpu, eResolveImage, cmd);
+      auto ctx = Fvog::Context(*device_, cmd);
+
+      ctx.BindComputePipeline(tonemapPipeline);
+      ctx.SetPushConstants(TonemapArguments{
+        .sceneColorIndex = sceneColor.ImageView().GetSampledResourceHandle().index,
+        .noiseIndex = noiseTexture->ImageView().GetSampledResourceHandle().index,
+        .nearestSamplerIndex = nearestSampler.GetResourceHandle().index,
+        .linearClampSamplerIndex = linearClampSampler.GetResourceHandle().index,
+        .exposureIndex = exposureBuffer.GetResourceHandle().index,
+        .tonemapUniformsIndex = tonemapUniformBuffer.GetDeviceBuffer().GetResourceHandle().index,
+        .outputImageIndex = frame.colorLdrWindowRes->ImageView().GetStorageResourceHandle().index,
+        .tonyMcMapfaceIndex = tonyMcMapfaceLut.ImageView().GetSampledResourceHandle().index,
+      });
+      ctx.DispatchInvocations(frame.colorLdrWindowRes.value().GetCreateInfo().extent);
     });
-    ctx.DispatchInvocations(frame.colorLdrWindowRes.value().GetCreateInfo().extent);
-    ctx.ImageBarrier(*frame.colorLdrWindowRes, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+
+  // Read after the graph by the swapchain copy, the GUI, or the next frame
+  renderGraph.Export(*frame.colorLdrWindowRes, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL, fragment, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+  renderGraph.Export(*frame.gAlbedo, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+  renderGraph.Export(*frame.gNormalAndFaceNormal, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+  renderGraph.Export(*frame.gMetallicRoughnessAo, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+  renderGraph.Export(*frame.gEmission, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+  renderGraph.Export(*frame.gDepth, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+  renderGraph.Export(*frame.hzb, VK_IMAGE_LAYOUT_GENERAL);
+  renderGraph.Export(exposureBuffer);
+  renderGraph.Export(vsmContext.pageTables_, VK_IMAGE_LAYOUT_GENERAL);
+  renderGraph.Export(vsmContext.physicalPages_, VK_IMAGE_LAYOUT_GENERAL);
+  renderGraph.Export(vsmContext.vsmBitmaskHzb_, VK_IMAGE_LAYOUT_GENERAL);
+  renderGraph.Export(vsmContext.physicalPagesOverdrawHeatmap_, VK_IMAGE_LAYOUT_GENERAL);
+
+  commandBuffer = renderGraph.Execute(commandBuffer);
+  if (parallelRecordingBenchmark)
+  {
+    AdvanceParallelRecordingBenchmark();
   }
 
-  ctx.Barrier(); // Appease sync val
+  auto ctx = Fvog::Context(*device_, commandBuffer);
   ctx.ImageBarrier(swapchainImages_[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
 
   // GUI is not rendered, draw directly to screen instead
@@ -1364,11 +2210,15 @@ Render::MeshGeometryID FrogRenderer2::RegisterMeshGeometry(MeshGeometryInfo mesh
   const auto baseVertex = verticesAlloc.GetOffset() / sizeof(Render::Vertex);
   const auto baseIndex = indicesAlloc.GetOffset() / sizeof(Render::index_t);
   const auto basePrimitive = primitivesAlloc.GetOffset() / sizeof(Render::primitive_t);
+  auto aabbMin = glm::vec3(std::numeric_limits<float>::max());
+  auto aabbMax = glm::vec3(std::numeric_limits<float>::lowest());
   for (auto& meshlet : meshGeometry.meshlets)
   {
     meshlet.vertexOffset += (uint32_t)baseVertex;
     meshlet.indexOffset += (uint32_t)baseIndex;
     meshlet.primitiveOffset += (uint32_t)basePrimitive;
+    aabbMin = glm::min(aabbMin, glm::vec3(meshlet.aabbMin[0], meshlet.aabbMin[1], meshlet.aabbMin[2]));
+    aabbMax = glm::max(aabbMax, glm::vec3(meshlet.aabbMax[0], meshlet.aabbMax[1], meshlet.aabbMax[2]));
   }
 
   std::memcpy(geometryBuffer.GetMappedMemory() + meshletAlloc.GetOffset(), meshGeometry.meshlets.data(), meshletAlloc.GetSize());
@@ -1383,6 +2233,8 @@ Render::MeshGeometryID FrogRenderer2::RegisterMeshGeometry(MeshGeometryInfo mesh
       .verticesAlloc   = std::move(verticesAlloc),
       .indicesAlloc    = std::move(indicesAlloc),
       .primitivesAlloc = std::move(primitivesAlloc),
+      .aabbMin         = aabbMin,
+      .aabbMax         = aabbMax,
   });
   return {myId};
 }
@@ -1480,10 +2332,22 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
 
   auto marker = ctx.MakeScopedDebugMarker("Flush updated scene data");
 
+  // Casters that moved, appeared, or disappeared. The shadow pages they cover are redrawn with every caster over them,
+  // including static ones, and every other page stays cached
+  auto vsmDirtyBounds = std::vector<VsmDirtyBounds>();
+  auto pushVsmDirtyBounds = [&vsmDirtyBounds](const Scene::Aabb& bounds)
+  {
+    vsmDirtyBounds.push_back({.boundsMin = bounds.min, .boundsMax = bounds.max});
+  };
+
   // Deleted meshes
   for (auto id : deletedMeshes)
   {
     auto it = meshAllocations.find(id);
+    if (it->second.worldBounds)
+    {
+      pushVsmDirtyBounds(*it->second.worldBounds);
+    }
     meshletInstancesBuffer.Free(it->second.meshletInstancesAlloc, commandBuffer);
     meshAllocations.erase(it);
   }
@@ -1503,7 +2367,8 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
   for (const auto& [id, meshInstance] : spawnedMeshes)
   {
     auto [meshGeometryId, materialId] = meshInstanceInfos.at(meshInstance.id);
-    const auto& meshletsAlloc         = meshGeometryAllocations.at(meshGeometryId.id).meshletsAlloc;
+    const auto& meshGeometryAlloc     = meshGeometryAllocations.at(meshGeometryId.id);
+    const auto& meshletsAlloc         = meshGeometryAlloc.meshletsAlloc;
     const auto& materialAlloc         = materialAllocations.at(materialId.id).materialAlloc;
 
     const auto meshletInstanceCount = meshletsAlloc.GetSize() / sizeof(Render::Meshlet);
@@ -1527,6 +2392,14 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
       MeshAllocs{
         .meshletInstancesAlloc = meshletInstancesAlloc,
         .instanceAlloc         = std::move(instanceAlloc),
+        .gpuMeshInstance =
+          {
+            .aabbMin               = {meshGeometryAlloc.aabbMin.x, meshGeometryAlloc.aabbMin.y, meshGeometryAlloc.aabbMin.z},
+            .meshletInstanceOffset = uint32_t(meshletInstancesAlloc.offset / sizeof(Render::MeshletInstance)),
+            .aabbMax               = {meshGeometryAlloc.aabbMax.x, meshGeometryAlloc.aabbMax.y, meshGeometryAlloc.aabbMax.z},
+            .meshletCount          = uint32_t(meshletInstanceCount),
+            .instanceId            = uint32_t(instanceIndex),
+          },
       });
   }
   
@@ -1534,30 +2407,29 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
   // TODO: This should be a scatter-write compute shader
   if (!meshletInstancesUploads.empty())
   {
-    auto uploadBuffer = Fvog::TypedBuffer<Render::MeshletInstance>(*device_,
-      {
-        .count = (uint32_t)meshletInstances.size(),
-        .flag  = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE | Fvog::BufferFlagThingy::NO_DESCRIPTOR,
-      },
-      "Meshlet Upload Staging Buffer");
-
-    std::memcpy(uploadBuffer.GetMappedMemory(), meshletInstances.data(), meshletInstances.size() * sizeof(Render::MeshletInstance));
+    const auto upload = device_->stagingAllocator_->Allocate(meshletInstances.size() * sizeof(Render::MeshletInstance), alignof(Render::MeshletInstance));
+    std::memcpy(upload.data, meshletInstances.data(), meshletInstances.size() * sizeof(Render::MeshletInstance));
 
     for (auto [srcOffset, dstOffset, size] : meshletInstancesUploads)
     {
-      ctx.CopyBuffer(uploadBuffer, meshletInstancesBuffer.GetBuffer(), {
-        .srcOffset = srcOffset,
+      ctx.CopyBuffer(*upload.buffer, meshletInstancesBuffer.GetBuffer(), {
+        .srcOffset = upload.offset + srcOffset,
         .dstOffset = dstOffset,
         .size = size,
       });
     }
   }
 
+  if (!spawnedMeshes.empty() || !deletedMeshes.empty())
+  {
+    UploadMeshInstances(commandBuffer);
+  }
+
   // Spawn lights
   for (const auto& [id, gpuLight] : spawnedLights)
   {
-    const auto lightAlloc = lightsBuffer.Allocate(sizeof(GpuLight));
-    lightAllocations.emplace(id, LightAlloc{.lightAlloc = lightAlloc});
+    const auto lightAlloc = lightsBuffer.Allocate(sizeof(GpuLight), commandBuffer);
+    lightAllocations.emplace(id, LightAlloc{.lightAlloc = lightAlloc, .light = gpuLight});
     ctx.TeenyBufferUpdate(lightsBuffer.GetBuffer(), gpuLight, lightAlloc.offset);
   }
 
@@ -1565,8 +2437,28 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
   for (auto id : deletedLights)
   {
     auto it = lightAllocations.find(id);
+    const auto freedOffset = it->second.lightAlloc.offset;
     lightsBuffer.Free(it->second.lightAlloc, commandBuffer);
     lightAllocations.erase(it);
+
+    // Freeing moved the last light into the hole
+    for (auto& [otherId, alloc] : lightAllocations)
+    {
+      if (alloc.lightAlloc.offset == lightsBuffer.GetCurrentSize())
+      {
+        alloc.lightAlloc.offset = freedOffset;
+        break;
+      }
+    }
+  }
+
+  if (!spawnedLights.empty() || !deletedLights.empty())
+  {
+    lightBvhNeedsBuild = true;
+  }
+  else if (!modifiedLights.empty())
+  {
+    lightBvhNeedsRefit = true;
   }
 
   ctx.Barrier();
@@ -1574,15 +2466,39 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
   // Update mesh uniforms
   for (const auto& [id, uniforms] : modifiedMeshUniforms)
   {
-    const auto offset = meshAllocations.at(id).instanceAlloc.GetOffset();
+    auto& meshAlloc   = meshAllocations.at(id);
+    const auto offset = meshAlloc.instanceAlloc.GetOffset();
     assert(offset % sizeof(uniforms) == 0);
     ctx.TeenyBufferUpdate(geometryBuffer.GetBuffer(), uniforms, offset);
+
+    const auto& instance = meshAlloc.gpuMeshInstance;
+    const auto objectBounds = Scene::Aabb{
+      .min = {instance.aabbMin[0], instance.aabbMin[1], instance.aabbMin[2]},
+      .max = {instance.aabbMax[0], instance.aabbMax[1], instance.aabbMax[2]},
+    };
+    const auto worldBounds = Scene::TransformAabb(uniforms.modelCurrent, objectBounds);
+    const auto& oldBounds  = meshAlloc.worldBounds;
+    if (oldBounds && oldBounds->min == worldBounds.min && oldBounds->max == worldBounds.max)
+    {
+      continue;
+    }
+
+    if (oldBounds)
+    {
+      pushVsmDirtyBounds(*oldBounds);
+    }
+    pushVsmDirtyBounds(worldBounds);
+    meshAlloc.worldBounds = worldBounds;
   }
 
+  vsmContext.UpdateDirtyBounds(commandBuffer, vsmDirtyBounds);
+
   // Update lights
   for (const auto& [id, light] : modifiedLights)
   {
-    const auto offset = lightAllocations.at(id).lightAlloc.offset;
+    auto& lightAlloc = lightAllocations.at(id);
+    lightAlloc.light = light;
+    const auto offset = lightAlloc.lightAlloc.offset;
     assert(offset % sizeof(light) == 0);
     ctx.TeenyBufferUpdate(lightsBuffer.GetBuffer(), light, offset);
   }
@@ -1604,3 +2520,197 @@ void FrogRenderer2::FlushUpdatedSceneData(VkCommandBuffer commandBuffer)
   deletedLights.clear();
   spawnedLights.clear();
 }
+
+void FrogRenderer2::UploadMeshInstances(VkCommandBuffer commandBuffer)
+{
+  ZoneScoped;
+  auto meshInstances = std::vector<Render::GpuMeshInstance>();
+  meshInstances.reserve(meshAllocations.size());
+  size_t chunkCount = 0;
+  for (const auto& [id, meshAlloc] : meshAllocations)
+  {
+    meshInstances.emplace_back(meshAlloc.gpuMeshInstance);
+    chunkCount += (meshAlloc.gpuMeshInstance.meshletCount + MESHLET_CULL_CHUNK_SIZE - 1) / MESHLET_CULL_CHUNK_SIZE;
+  }
+
+  numMeshInstances = static_cast<uint32_t>(meshInstances.size());
+  if (meshInstances.empty())
+  {
+    return;
+  }
+
+  if (!meshInstancesBuffer || meshInstancesBuffer->Size() < meshInstances.size())
+  {
+    meshInstancesBuffer = Fvog::TypedBuffer<Render::GpuMeshInstance>(*device_, {.count = static_cast<uint32_t>(meshInstances.size()), .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Mesh Instances");
+  }
+  meshInstancesBuffer->UpdateDataExpensive(commandBuffer, std::span<const Render::GpuMeshInstance>(meshInstances));
+
+  // The header is a DispatchIndirectCommand padded to 16 bytes
+  const auto chunksSize = 16 + chunkCount * sizeof(glm::uvec2);
+  if (!meshletCullChunksBuffer || meshletCullChunksBuffer->SizeBytes() < chunksSize)
+  {
+    meshletCullChunksBuffer = Fvog::Buffer(*device_, {.size = chunksSize, .category = Fvog::MemoryCategory::MESHLET_INSTANCES}, "Meshlet Cull Chunks");
+  }
+}
+
+std::vector<Techniques::VirtualShadowMaps::LocalLightVirtualShadowMaps::ShadowedLight> FrogRenderer2::SelectVsmLocalLights(const ViewParams& mainView) const
+{
+  ZoneScoped;
+  namespace Vsm = Techniques::VirtualShadowMaps;
+
+  auto shadowedLights = std::vector<Vsm::LocalLightVirtualShadowMaps::ShadowedLight>();
+  if (!vsmLocalLightsEnable)
+  {
+    return shadowedLights;
+  }
+
+  // Pixels covered by a unit-sized object one unit from the camera
+  const auto pixelsPerUnit = static_cast<float>(renderInternalHeight) / (2.0f * std::tan(cameraFovyRadians / 2.0f));
+
+  auto candidates = std::vector<std::pair<float, Vsm::LocalLightVirtualShadowMaps::ShadowedLight>>();
+  for (const auto& [id, alloc] : lightAllocations)
+  {
+    const auto& light = alloc.light;
+    if (light.type != LIGHT_TYPE_POINT && light.type != LIGHT_TYPE_SPOT)
+    {
+      continue;
+    }
+
+    // Lights with infinite range are always considered visible and as large as the screen
+    const auto range    = std::isfinite(light.range) && light.range > 0 ? light.range : std::numeric_limits<float>::infinity();
+    const auto isInView = std::ranges::all_of(mainView.frustumPlanes, [&](const glm::vec4& plane) { return glm::dot(glm::vec3(plane), light.position) - plane.w >= -range; });
+    if (!isInView)
+    {
+      continue;
+    }
+
+    // The shadow map only needs about as many texels across as the light covers pixels on screen
+    const auto distance   = glm::distance(mainCamera.position, light.position);
+    const auto diameterPx = distance <= range ? std::numeric_limits<float>::infinity() : 2.0f * range / distance * pixelsPerUnit;
+    const auto lod        = std::floor(std::log2(float(Vsm::maxExtent) / diameterPx) + vsmUniforms.lodBias);
+    const auto level      = static_cast<uint32_t>(std::clamp(lod, 0.0f, float(Vsm::pageTableMipLevels - 1)));
+
+    candidates.emplace_back(diameterPx,
+      Vsm::LocalLightVirtualShadowMaps::ShadowedLight{
+        .id         = id,
+        .lightIndex = static_cast<uint32_t>(alloc.lightAlloc.offset / sizeof(GpuLight)),
+        .light      = light,
+        .level      = level,
+      });
+  }
+
+  // Larger lights first, since their shadows are the most noticeable
+  const auto count = std::min<size_t>(candidates.size(), std::min(vsmLocalLightBudget, vsmMaxLocalLights));
+  std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  for (size_t i = 0; i < count; i++)
+  {
+    shadowedLights.push_back(candidates[i].second);
+  }
+
+  return shadowedLights;
+}
+
+Techniques::LightClusters::AssignParams FrogRenderer2::GetLightClusterAssignParams()
+{
+  return {
+    .view = mainCamera.GetViewMatrix(),
+    .invProj = globalUniforms.invProj,
+    .nearDepth = lightClusterNearDepth,
+    .farDepth = lightClusterFarDepth,
+    .lightBuffer = lightsBuffer.GetBuffer(),
+    .numLights = NumLights(),
+    .lightBvhNodes = useLightBvh ? &lightBvh.GetNodesBuffer() : nullptr,
+  };
+}
+
+void FrogRenderer2::ValidateLightClusters()
+{
+  ZoneScoped;
+  const auto result = lightClusters.Validate(GetLightClusterAssignParams());
+  printf("Light clusters: %u lights, %u indices. %u mismatched clusters (%u missing lights, %u extra lights), %u truncated clusters\n",
+    NumLights(),
+    result.gpuIndices,
+    result.mismatchedClusters,
+    result.missingLights,
+    result.extraLights,
+    result.truncatedClusters);
+}
+
+void FrogRenderer2::StartParallelRecordingBenchmark()
+{
+  printf("Benchmarking parallel recording with %u sun clipmaps and %zu local light views, %u rounds of %u frames. The first round records serially\n",
+    vsmSun.NumClipmaps(),
+    vsmLocalLights.GetViews().size(),
+    ParallelRecordingBenchmark::rounds,
+    ParallelRecordingBenchmark::measuredFrames);
+  parallelRecordingBenchmark = ParallelRecordingBenchmark{.restoreParallelRecording = renderGraph.parallelRecording};
+  renderGraph.parallelRecording = false;
+}
+
+void FrogRenderer2::AdvanceParallelRecordingBenchmark()
+{
+  ZoneScoped;
+  auto& benchmark = *parallelRecordingBenchmark;
+  const auto& graphStats = renderGraph.GetStats();
+
+  if (benchmark.frame >= ParallelRecordingBenchmark::warmupFrames)
+  {
+    benchmark.recordMsSum += graphStats.recordMs;
+    benchmark.barrierBatchSum += graphStats.barrierBatches;
+  }
+
+  if (++benchmark.frame < ParallelRecordingBenchmark::warmupFrames + ParallelRecordingBenchmark::measuredFrames)
+  {
+    return;
+  }
+
+  printf("Parallel recording %s: %.3f ms to record %u passes (%u on worker threads), %.1f barrier batches\n",
+    renderGraph.parallelRecording ? "on " : "off",
+    benchmark.recordMsSum / ParallelRecordingBenchmark::measuredFrames,
+    graphStats.passes,
+    graphStats.parallelPasses,
+    static_cast<double>(benchmark.barrierBatchSum) / ParallelRecordingBenchmark::measuredFrames);
+
+  // The next setting is used by the next frame's graph
+  if (++benchmark.round == ParallelRecordingBenchmark::rounds)
+  {
+    renderGraph.parallelRecording = benchmark.restoreParallelRecording;
+    parallelRecordingBenchmark.reset();
+    return;
+  }
+  renderGraph.parallelRecording = !renderGraph.parallelRecording;
+  benchmark = {.restoreParallelRecording = benchmark.restoreParallelRecording, .round = benchmark.round};
+}
+
+void FrogRenderer2::BenchmarkLightBvh()
+{
+  ZoneScoped;
+  constexpr uint32_t iterations = 10;
+  for (uint32_t numLights : {1'000u, 10'000u, 100'000u})
+  {
+    // Lights are spread through a box around the camera that grows with their count, so their density stays the same
+    const float halfExtent = 2.0f * std::cbrt(static_cast<float>(numLights));
+    auto lights            = std::vector<GpuLight>(numLights);
+    uint32_t rng           = numLights;
+    for (auto& light : lights)
+    {
+      light.type           = PCG::RandFloat(rng) < 0.75f ? LIGHT_TYPE_POINT : LIGHT_TYPE_SPOT;
+      light.color          = {PCG::RandFloat(rng), PCG::RandFloat(rng), PCG::RandFloat(rng)};
+      light.direction      = {0, -1, 0};
+      light.intensity      = PCG::RandFloat(rng, 1, 100);
+      light.position       = mainCamera.position + glm::vec3{PCG::RandFloat(rng, -halfExtent, halfExtent), PCG::RandFloat(rng, -halfExtent, halfExtent), PCG::RandFloat(rng, -halfExtent, halfExtent)};
+      light.range          = PCG::RandFloat(rng, 1, 5);
+      light.innerConeAngle = 0.3f;
+      light.outerConeAngle = 0.5f;
+    }
+
+    const auto result = lightBvh.Benchmark(lights, iterations);
+    printf("Light BVH over %u lights: GPU build %.3f ms (%.1f M lights/s), GPU refit %.3f ms. %u nodes differ between the GPU and CPU builds\n",
+      numLights,
+      result.gpuBuildMs,
+      numLights / result.gpuBuildMs / 1000,
+      result.gpuRefitMs,
+      result.mismatchedNodes);
+  }
+}
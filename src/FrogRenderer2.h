@@ -6,6 +6,8 @@
 #include "techniques/Bloom.h"
 #include "techniques/AutoExposure.h"
 #include "techniques/VirtualShadowMaps.h"
+#include "techniques/LightClusters.h"
+#include "techniques/LightBvh.h"
 
 #ifdef FROGRENDER_FSR2_ENABLE
   #include "src/ffx-fsr2-api/ffx_fsr2.h"
@@ -14,17 +16,26 @@
 
 #include "Fvog/Texture2.h"
 #include "Fvog/Buffer2.h"
+#include "Fvog/TransientTextureHeap2.h"
+#include "Fvog/RenderGraph2.h"
 #include "Fvog/Pipeline2.h"
 #include "Fvog/Timer2.h"
+#include "Fvog/detail/ThreadPool2.h"
 
 #include "shaders/Resources.h.glsl"
 #include "shaders/ShadeDeferredPbr.h.glsl"
+#include "shaders/visbuffer/CullMeshlets.h.glsl"
 #include "shaders/post/TonemapAndDither.shared.h"
 
+#include <functional>
+#include <future>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 #include <span>
+#include <string>
 #include <memory_resource>
+#include <mutex>
 
 // TODO: these structs should come from shared headers rather than copying them
 FVOG_DECLARE_ARGUMENTS(VisbufferPushConstants)
@@ -61,6 +72,9 @@ FVOG_DECLARE_ARGUMENTS(VisbufferPushConstants)
   // Debug
   FVOG_UINT32 debugAabbBufferIndex;
   FVOG_UINT32 debugRectBufferIndex;
+
+  // Visbuffer.mesh. One of the CULL_PHASE_* values
+  FVOG_UINT32 cullPhase;
 };
 
 FVOG_DECLARE_ARGUMENTS(HzbCopyPushConstants)
@@ -184,6 +198,7 @@ private:
   struct ViewParams;
 
   void OnFramebufferResize(uint32_t newWidth, uint32_t newHeight) override;
+  void OnFramesInFlightChanged(uint32_t framesInFlight) override;
   void OnUpdate(double dt) override;
   void OnRender(double dt, VkCommandBuffer commandBuffer, uint32_t swapchainImageIndex) override;
   void OnGui(double dt, VkCommandBuffer commandBuffer) override;
@@ -198,12 +213,31 @@ private:
   void GuiDrawViewer(VkCommandBuffer commandBuffer);
   void GuiDrawMaterialsArray(VkCommandBuffer commandBuffer);
   void GuiDrawPerfWindow(VkCommandBuffer commandBuffer);
+  void GuiDrawMemoryWindow(VkCommandBuffer commandBuffer);
   void GuiDrawSceneGraph(VkCommandBuffer commandBuffer);
   void GuiDrawSceneGraphHelper(Scene::Node* node);
   void GuiDrawComponentEditor(VkCommandBuffer commandBuffer);
   void GuiDrawHdrWindow(VkCommandBuffer commandBuffer);
 
-  void CullMeshletsForView(VkCommandBuffer commandBuffer, const ViewParams& view, Fvog::Buffer& visibleMeshletIds, std::string_view name = "Cull Meshlet Pass");
+  // Declares the resources that CullMeshletsForView accesses in a render graph pass
+  void DeclareCullMeshletsResources(Fvog::RenderGraph::PassBuilder& pass, Fvog::Buffer& visibleMeshletIds);
+  // cullPhase is one of the CULL_PHASE_* values. The late phase continues the early phase's output, so the two must be recorded in order for the same view
+  void CullMeshletsForView(VkCommandBuffer commandBuffer,
+    const ViewParams& view,
+    Fvog::Buffer& visibleMeshletIds,
+    std::string_view name = "Cull Meshlet Pass",
+    uint32_t cullPhase = CULL_PHASE_SINGLE);
+  // Declares the resources that CullMeshletsMultiView accesses in a render graph pass
+  void DeclareCullMeshletsMultiViewResources(Fvog::RenderGraph::PassBuilder& pass);
+  // Culls instances, meshlets, and triangles against all views with one dispatch each, so the cost of the barriers doesn't grow with the views.
+  // View i's visible meshlets start at i * NumMeshletInstances() in multiViewVisibleMeshletIds and it is drawn with the
+  // i-th command of multiViewIndirectCommands. Only VSM views are supported
+  void CullMeshletsMultiView(VkCommandBuffer commandBuffer, std::span<const ViewParams> views, std::string_view name);
+  [[nodiscard]] CullMeshletsPushConstants MakeCullMeshletsPushConstants(Fvog::Buffer& visibleMeshletIds, uint32_t cullPhase);
+  // Culling kernels specialized for the current flags (and debug drawing), or the generic ones if those aren't built yet
+  [[nodiscard]] Fvog::ComputePipeline& SelectCullMeshletsPipeline();
+  [[nodiscard]] Fvog::ComputePipeline& SelectCullTrianglesPipeline();
+  [[nodiscard]] bool UseMeshShaders() const;
 
   enum class GlobalFlags : uint32_t
   {
@@ -216,6 +250,11 @@ private:
     USE_HASHED_TRANSPARENCY = 1 << 6,
   };
 
+  // The flags that each culling kernel can be specialized for
+  static constexpr uint32_t cullMeshletFlagsMask = (uint32_t)GlobalFlags::CULL_MESHLET_FRUSTUM | (uint32_t)GlobalFlags::CULL_MESHLET_HIZ;
+  static constexpr uint32_t cullPrimitiveFlagsMask = (uint32_t)GlobalFlags::CULL_PRIMITIVE_BACKFACE | (uint32_t)GlobalFlags::CULL_PRIMITIVE_FRUSTUM |
+                                                     (uint32_t)GlobalFlags::CULL_PRIMITIVE_SMALL | (uint32_t)GlobalFlags::CULL_PRIMITIVE_VSM;
+
   struct GlobalUniforms
   {
     glm::mat4 viewProj;
@@ -238,13 +277,15 @@ private:
     | (uint32_t)GlobalFlags::USE_HASHED_TRANSPARENCY
       ;
     float alphaHashScale = 1.0;
-    uint32_t _padding[3];
+    uint32_t meshInstanceCount;
+    uint32_t _padding[2];
   };
 
   enum class ViewType : uint32_t
   {
-    MAIN    = 0,
-    VIRTUAL = 1,
+    MAIN          = 0,
+    VIRTUAL       = 1,
+    VIRTUAL_LOCAL = 2,
   };
 
   struct ViewParams
@@ -261,7 +302,8 @@ private:
     glm::vec4 viewport;
     ViewType type = ViewType::MAIN;
     glm::uint virtualTableIndex;
-    glm::uvec2 _padding;
+    glm::uint virtualTableLevel; // VIRTUAL_LOCAL only
+    glm::uint _padding;
   };
 
   // scene parameters
@@ -278,6 +320,8 @@ private:
 
   // Debugging stuff
   bool generateHizBuffer = true;
+  // The main view is drawn with Visbuffer.mesh instead of CullTriangles.comp and an indexed draw. Ignored if mesh shaders are unsupported
+  bool useMeshShaders = true;
   bool drawDebugAabbs = false;
   bool drawDebugRects = false;
   int fakeLag = 0;
@@ -296,6 +340,9 @@ private:
     // Resources tied to the output resolution
   struct Frame
   {
+    // Backs the textures that are only live during part of the frame
+    std::optional<Fvog::TransientTextureHeap> transientTextureHeap;
+
     // Main view visbuffer
     std::optional<Fvog::Texture> visbuffer;
     constexpr static Fvog::Format visbufferFormat = Fvog::Format::R32_UINT;
@@ -365,17 +412,23 @@ private:
     Fvog::ManagedBuffer::Alloc verticesAlloc;
     Fvog::ManagedBuffer::Alloc indicesAlloc;
     Fvog::ManagedBuffer::Alloc primitivesAlloc;
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
   };
 
   struct MeshAllocs
   {
     Fvog::ContiguousManagedBuffer::Alloc meshletInstancesAlloc;
     Fvog::ManagedBuffer::Alloc instanceAlloc;
+    Render::GpuMeshInstance gpuMeshInstance;
+    // Set by the first uniform update. Invalidates the shadow pages under the mesh when it moves or is deleted
+    std::optional<Scene::Aabb> worldBounds;
   };
 
   struct LightAlloc
   {
     Fvog::ContiguousManagedBuffer::Alloc lightAlloc;
+    GpuLight light; // Host copy, used to pick which lights are shadowed
   };
 
   struct MaterialAlloc
@@ -416,13 +469,51 @@ private:
   std::vector<uint64_t> deletedLights;
 
   void FlushUpdatedSceneData(VkCommandBuffer commandBuffer);
+
+  // One per spawned mesh, rebuilt when meshes are spawned or deleted
+  std::optional<Fvog::TypedBuffer<Render::GpuMeshInstance>> meshInstancesBuffer;
+  uint32_t numMeshInstances = 0;
+  // Chunks of meshlets whose meshes passed instance culling, preceded by the indirect dispatch that culls them.
+  // Sized for every chunk of every mesh
+  std::optional<Fvog::Buffer> meshletCullChunksBuffer;
+  void UploadMeshInstances(VkCommandBuffer commandBuffer);
   
   std::optional<Fvog::TypedBuffer<ViewParams>> viewBuffer;
   // Output
+  // One command per culling phase
   std::optional<Fvog::TypedBuffer<Fvog::DrawIndexedIndirectCommand>> meshletIndirectCommand;
   std::optional<Fvog::TypedBuffer<uint32_t>> instancedMeshletBuffer;
+
+  // Triangle culling reports how many indices it wanted to write. The reports are copied to a ring of host-visible buffers
+  // and read back once the frame that wrote them has retired, so instancedMeshletBuffer can be sized from what is actually visible
+  // instead of the worst case.
+  std::optional<Fvog::TypedBuffer<TriangleCullFeedback>> triangleCullFeedbackBuffer;
+  struct TriangleCullFeedbackReadback
+  {
+    Fvog::TypedBuffer<TriangleCullFeedback> buffer;
+  };
+  // One per frame in flight
+  std::vector<TriangleCullFeedbackReadback> triangleCullFeedbackReadbacks;
+  void CreateTriangleCullFeedbackReadbacks(uint32_t count);
+  void ResizeInstancedMeshletBufferFromFeedback();
+
+  struct InstancedMeshletBufferStats
+  {
+    uint32_t capacity{};          // Current size of the index buffer
+    uint32_t requested{};         // Largest end of the indices requested by any view, as of the most recent readback
+    uint32_t clamped{};           // Indices that were dropped because they didn't fit, including views that started past the end, as of the most recent readback
+    uint64_t framesClamped{};     // Number of frames in which any indices were dropped
+    uint32_t framesUnderused{};   // Consecutive frames in which the buffer was much larger than necessary
+  };
+  InstancedMeshletBufferStats instancedMeshletBufferStats;
+
+  // One dispatch per culling phase
   std::optional<Fvog::TypedBuffer<Fvog::DispatchIndirectCommand>> cullTrianglesDispatchParams;
 
+  // One bit per meshlet instance, set if the meshlet passed culling in the main view's late phase last frame.
+  // Only those meshlets are drawn by the early phase
+  std::optional<Fvog::TypedBuffer<uint32_t>> meshletVisibilityBits;
+
   // These buffers serve two purposes:
   // First, they store the IDs of meshlet instances that passed meshlet culling.
   // Second, they allow us to remap the range 0-2^24 to meshlet instances that may
@@ -431,11 +522,80 @@ private:
   std::optional<Fvog::TypedBuffer<uint32_t>> persistentVisibleMeshletIds; // For when the data needs to be retrieved later (i.e. it is stored in the visbuffer)
   std::optional<Fvog::TypedBuffer<uint32_t>> transientVisibleMeshletIds;  // For shadows or forward passes
 
+  // Outputs of CullMeshletsMultiView, which culls the sun's clipmaps together. multiViewsBuffer holds every view for culling,
+  // while drawing reads the single view in multiViewBuffers[i]
+  static constexpr uint32_t maxMultiViews = Techniques::VirtualShadowMaps::MAX_CLIPMAPS;
+  static_assert(maxMultiViews <= MAX_MULTI_VIEWS);
+  std::optional<Fvog::TypedBuffer<ViewParams>> multiViewsBuffer;
+  std::vector<Fvog::TypedBuffer<ViewParams>> multiViewBuffers;
+  std::optional<Fvog::TypedBuffer<Fvog::DrawIndexedIndirectCommand>> multiViewIndirectCommands;
+  std::optional<Fvog::TypedBuffer<MultiViewCullParams>> multiViewCullParams;
+  std::optional<Fvog::TypedBuffer<uint32_t>> multiViewVisibleMeshletIds;
+
+  // Every pipeline (including those owned by techniques) is submitted to the pool before any is awaited.
+  // The members below are initialized from these futures in declaration order, so the constructor only blocks on builds that are still running
+  Fvog::detail::ThreadPool pipelineThreadPool{0, "Pipeline Builder"};
+  struct PipelineBuilds
+  {
+    std::future<Fvog::ComputePipeline> cullMeshlets;
+    std::future<Fvog::ComputePipeline> cullTriangles;
+    std::future<Fvog::ComputePipeline> cullInstances;
+    std::future<Fvog::ComputePipeline> cullInstancesMultiView;
+    std::future<Fvog::ComputePipeline> cullMeshletsMultiView;
+    std::future<Fvog::ComputePipeline> multiViewPrefixSum;
+    std::future<Fvog::ComputePipeline> cullTrianglesMultiView;
+    std::future<Fvog::ComputePipeline> hzbCopy;
+    std::future<Fvog::ComputePipeline> hzbReduce;
+    std::future<Fvog::GraphicsPipeline> visbuffer;
+    std::future<std::optional<Fvog::GraphicsPipeline>> visbufferMesh;
+    std::future<Fvog::GraphicsPipeline> visbufferResolve;
+    std::future<Fvog::GraphicsPipeline> shading;
+    std::future<Fvog::ComputePipeline> tonemap;
+    std::future<Fvog::GraphicsPipeline> debugTexture;
+    std::future<Fvog::GraphicsPipeline> debugLines;
+    std::future<Fvog::GraphicsPipeline> debugAabbs;
+    std::future<Fvog::GraphicsPipeline> debugRects;
+    std::future<Fvog::ComputePipeline> calibrateHdr;
+    std::future<Fvog::GraphicsPipeline> vsmShadow;
+    std::future<Fvog::GraphicsPipeline> viewerVsmPageTables;
+    std::future<Fvog::GraphicsPipeline> viewerVsmPhysicalPages;
+    std::future<Fvog::GraphicsPipeline> viewerVsmBitmaskHzb;
+    std::future<Fvog::GraphicsPipeline> viewerVsmPhysicalPagesOverdraw;
+    Techniques::Bloom::PipelineBuilds bloom;
+    Techniques::AutoExposure::PipelineBuilds autoExposure;
+    Techniques::VirtualShadowMaps::Context::PipelineBuilds vsm;
+    Techniques::LightClusters::PipelineBuilds lightClusters;
+    Techniques::LightBvh::PipelineBuilds lightBvh;
+  };
+  [[nodiscard]] PipelineBuilds StartPipelineBuilds();
+  PipelineBuilds pipelineBuilds;
+
+  // Generic culling kernels that read the flags at runtime
   Fvog::ComputePipeline cullMeshletsPipeline;
   Fvog::ComputePipeline cullTrianglesPipeline;
+
+  // Culling kernels with the flags compiled in, keyed by those flags. Permutations are built on pipelineThreadPool the first time their key is selected
+  struct CullPermutations
+  {
+    // Returns the permutation for key if it's built. Otherwise, starts building it and returns generic. Passes may be recorded in parallel, so this locks
+    Fvog::ComputePipeline& Select(Fvog::detail::ThreadPool& pool, uint32_t key, Fvog::ComputePipeline& generic, std::function<Fvog::ComputePipeline()> build);
+
+    std::unordered_map<uint32_t, std::future<Fvog::ComputePipeline>> building;
+    std::unordered_map<uint32_t, Fvog::ComputePipeline> built;
+    std::mutex mutex;
+  };
+  CullPermutations cullMeshletsPermutations;
+  CullPermutations cullTrianglesPermutations;
+  Fvog::ComputePipeline cullInstancesPipeline;
+  Fvog::ComputePipeline cullInstancesMultiViewPipeline;
+  Fvog::ComputePipeline cullMeshletsMultiViewPipeline;
+  Fvog::ComputePipeline multiViewPrefixSumPipeline;
+  Fvog::ComputePipeline cullTrianglesMultiViewPipeline;
   Fvog::ComputePipeline hzbCopyPipeline;
   Fvog::ComputePipeline hzbReducePipeline;
   Fvog::GraphicsPipeline visbufferPipeline;
+  // Empty if the device doesn't support mesh shaders
+  std::optional<Fvog::GraphicsPipeline> visbufferMeshPipeline;
   Fvog::GraphicsPipeline visbufferResolvePipeline;
   Fvog::GraphicsPipeline shadingPipeline;
   Fvog::ComputePipeline tonemapPipeline;
@@ -487,6 +647,27 @@ private:
   float magnifierZoom = 4;
   glm::vec2 magnifierLastCursorPos = {400, 400};
 
+  // Rebuilt every frame
+  Fvog::RenderGraph renderGraph;
+
+  // Alternates the graph's parallel recording off and on for several rounds of frames,
+  // and prints the average time spent recording the graph in each round to the console
+  void StartParallelRecordingBenchmark();
+  void AdvanceParallelRecordingBenchmark();
+  struct ParallelRecordingBenchmark
+  {
+    static constexpr uint32_t rounds = 4;
+    static constexpr uint32_t warmupFrames = 30;
+    static constexpr uint32_t measuredFrames = 300;
+
+    bool restoreParallelRecording{};
+    uint32_t round{};
+    uint32_t frame{};
+    double recordMsSum{};
+    uint64_t barrierBatchSum{};
+  };
+  std::optional<ParallelRecordingBenchmark> parallelRecordingBenchmark;
+
   // Bloom
   Techniques::Bloom bloom;
   bool bloomEnable = true;
@@ -504,12 +685,31 @@ private:
   float autoExposureTargetLuminance = 0.2140f;
   float autoExposureAdjustmentSpeed = 1.0f;
 
+  // Clustered light culling
+  Techniques::LightClusters lightClusters;
+  float lightClusterNearDepth = 1.0f;
+  float lightClusterFarDepth = 500.0f;
+  [[nodiscard]] Techniques::LightClusters::AssignParams GetLightClusterAssignParams();
+  // Compares the light clusters that the GPU makes for the current view to a CPU reference and prints the results to the console
+  void ValidateLightClusters();
+
+  // Light BVH, which clusters are assigned from when enabled
+  Techniques::LightBvh lightBvh;
+  bool useLightBvh = true;
+  // Set when lights are added or removed, or when they only change
+  bool lightBvhNeedsBuild = true;
+  bool lightBvhNeedsRefit = false;
+  // Times builds and refits of the light BVH over random lights and prints the results to the console
+  void BenchmarkLightBvh();
+
   // Camera
   float cameraNearPlane = 0.075f;
   float cameraFovyRadians = glm::radians(70.0f);
 
   // VSM
   Techniques::VirtualShadowMaps::Context vsmContext;
+  // Each clipmap has its own render timer in the VSM stat group
+  static constexpr uint32_t vsmSunClipmaps = 10;
   Techniques::VirtualShadowMaps::DirectionalVirtualShadowMap vsmSun;
   Fvog::GraphicsPipeline vsmShadowPipeline;
   Fvog::TypedBuffer<uint32_t> vsmShadowUniformBuffer;
@@ -518,6 +718,14 @@ private:
   float vsmFirstClipmapWidth = 10.0f;
   float vsmDirectionalProjectionZLength = 100.0f;
 
+  // Point and spot lights that cast shadows, chosen by their size on screen
+  static constexpr uint32_t vsmMaxLocalLights = 16;
+  Techniques::VirtualShadowMaps::LocalLightVirtualShadowMaps vsmLocalLights;
+  bool vsmLocalLightsEnable = true;
+  uint32_t vsmLocalLightBudget = 8;
+  // Picks the lights in the main view that cover the most pixels and the LOD level of each
+  [[nodiscard]] std::vector<Techniques::VirtualShadowMaps::LocalLightVirtualShadowMaps::ShadowedLight> SelectVsmLocalLights(const ViewParams& mainView) const;
+
   // Texture viewer
   struct ViewerUniforms
   {
@@ -600,7 +808,7 @@ private:
   struct StatGroupInfo
   {
     const char* groupName;
-    std::vector<const char*> statNames;
+    std::vector<std::string> statNames;
   };
 
   const static inline StatGroupInfo statGroups[] = {
@@ -610,9 +818,13 @@ private:
        "Frame",
        "Cull Meshlets Main",
        "Render Visbuffer Main",
+       "Cull Meshlets Main Late",
+       "Render Visbuffer Main Late",
        "Virtual Shadow Maps",
        "Build Hi-Z Buffer",
        "Resolve Visibility Buffer",
+       "Build Light BVH",
+       "Assign Lights to Clusters",
        "Shade Opaque",
        "Debug Geometry",
        "Auto Exposure",
@@ -622,15 +834,27 @@ private:
      }},
     {
       "Virtual Shadow Maps",
+     []
      {
-       "VSM Reset Page Visibility",
-       "VSM Mark Visible Pages",
-       "VSM Free Non-Visible Pages",
-       "VSM Allocate Pages",
-       "VSM Generate HPB",
-       "VSM Clear Pages",
-       "VSM Render Pages",
-     }},
+       auto names = std::vector<std::string>{
+         "VSM Reset Page Visibility",
+         "VSM Mark Visible Pages",
+         "VSM Mark Visible Local Pages",
+         "VSM Free Non-Visible Pages",
+         "VSM Allocate Pages",
+         "VSM Mark Dirty Bounds",
+         "VSM Generate HPB",
+         "VSM Clear Pages",
+         "VSM Render Pages",
+         "VSM Cull Clipmaps",
+       };
+       // One per clipmap the sun can have, so changing the clipmap count never runs out of timers
+       for (uint32_t i = 0; i < Techniques::VirtualShadowMaps::MAX_CLIPMAPS; i++)
+       {
+         names.push_back("VSM Render Clipmap " + std::to_string(i));
+       }
+       return names;
+     }()},
   };
 
   // static_assert((int)StatGroup::eCount == std::extent_v<decltype(statGroupNames)>);
@@ -640,9 +864,13 @@ private:
     eFrame = 0,
     eCullMeshletsMain,
     eRenderVisbufferMain,
+    eCullMeshletsMainLate,
+    eRenderVisbufferMainLate,
     eVsm,
     eHzb,
     eResolveVisbuffer,
+    eBuildLightBvh,
+    eAssignLightsToClusters,
     eShadeOpaque,
     eDebugGeometry,
     eAutoExposure,
@@ -655,11 +883,16 @@ private:
   {
     eVsmResetPageVisibility,
     eVsmMarkVisiblePages,
+    eVsmMarkVisibleLocalPages,
     eVsmFreeNonVisiblePages,
     eVsmAllocatePages,
+    eVsmMarkDirtyBounds,
     eVsmGenerateHpb,
     eVsmClearDirtyPages,
     eVsmRenderDirtyPages,
+    eVsmCullClipmaps,
+    // One per sun clipmap, up to MAX_CLIPMAPS
+    eVsmRenderClipmap0,
   };
 
   // static_assert(eStatCount == std::extent_v<decltype(statNames)>);
@@ -667,7 +900,7 @@ private:
   struct StatInfo
   {
     explicit StatInfo(Fvog::Device& device, std::string name)
-      : timer(device, Fvog::Device::frameOverlap, std::move(name))
+      : timer(device, Fvog::Device::maxFramesInFlight, std::move(name))
     {
     }
 
@@ -695,6 +928,18 @@ private:
       return Fvog::TimerScoped(timer, commandBuffer);
     }
 
+    // For work that spans several render graph passes. Every Begin must be matched by an End in the same frame
+    void Begin(VkCommandBuffer commandBuffer)
+    {
+      Measure();
+      timer.BeginZone(commandBuffer);
+    }
+
+    void End(VkCommandBuffer commandBuffer)
+    {
+      timer.EndZone(commandBuffer);
+    }
+
     // std::string name;
     ScrollingBuffer<double> timings;
     double movingAverage                        = 0;
@@ -9,8 +9,11 @@
 
 #include <tracy/Tracy.hpp>
 
+#include <algorithm>
 #include <bit>
+#include <cassert>
 #include <cstddef>
+#include <string>
 #include <utility>
 
 namespace Fvog
@@ -24,6 +27,20 @@ namespace Fvog
     ZoneScoped;
     ZoneNamed(_, true);
     ZoneNameV(_, name_.data(), name_.size());
+
+    if (createInfo.flag & BufferFlagThingy::SUBALLOCATE)
+    {
+      assert(!(createInfo.flag & (BufferFlagThingy::MAP_SEQUENTIAL_WRITE | BufferFlagThingy::MAP_RANDOM_ACCESS | BufferFlagThingy::MAP_SEQUENTIAL_WRITE_DEVICE)));
+      poolRange_ = device_->smallBufferPool_->Allocate(std::max(createInfo.size, VkDeviceSize(1)));
+      buffer_ = poolRange_->buffer;
+      deviceAddress_ = poolRange_->deviceAddress;
+      if (!(createInfo.flag & BufferFlagThingy::NO_DESCRIPTOR))
+      {
+        descriptorInfo_ = device_->AllocateStorageBufferDescriptor(buffer_, poolRange_->offset, poolRange_->size);
+      }
+      return;
+    }
+
     // The only usages that have a practical perf implication on modern desktop hardware are *_DESCRIPTOR_BUFFER_BIT
     constexpr auto usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
@@ -79,6 +96,7 @@ namespace Fvog
     }));
 
     mappedMemory_ = allocationInfo.pMappedData;
+    device_->TrackAllocation(createInfo.category, allocationInfo.size);
     
     deviceAddress_ = vkGetBufferDeviceAddress(device_->device_, Address(VkBufferDeviceAddressInfo{
       .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
@@ -93,9 +111,25 @@ namespace Fvog
 
   Buffer::~Buffer()
   {
-    if (buffer_ != VK_NULL_HANDLE)
+    if (poolRange_)
+    {
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.generic.emplace_back(
+        [pool = device_->smallBufferPool_.get(), range = *poolRange_, frameOfLastUse = device_->frameNumber.load()](uint64_t value) -> bool {
+          if (value >= frameOfLastUse)
+          {
+            pool->Free(range);
+            return true;
+          }
+          return false;
+        });
+    }
+    else if (buffer_ != VK_NULL_HANDLE)
     {
-      device_->bufferDeletionQueue_.emplace_back(device_->frameNumber, allocation_, buffer_, std::move(name_));
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.buffers.emplace_back(device_->frameNumber, allocation_, buffer_, std::move(name_), createInfo_.category);
     }
   }
 
@@ -107,7 +141,8 @@ namespace Fvog
       mappedMemory_(std::exchange(old.mappedMemory_, nullptr)),
       deviceAddress_(std::exchange(old.deviceAddress_, 0)),
       descriptorInfo_(std::move(old.descriptorInfo_)),
-      name_(std::move(old.name_))
+      name_(std::move(old.name_)),
+      poolRange_(std::exchange(old.poolRange_, std::nullopt))
   {
   }
 
@@ -122,16 +157,27 @@ namespace Fvog
   void Buffer::UpdateDataExpensive(VkCommandBuffer commandBuffer, TriviallyCopyableByteSpan data, VkDeviceSize destOffsetBytes)
   {
     ZoneScoped;
-    auto stagingBuffer = Buffer(*device_, {.size = data.size_bytes(), .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE | BufferFlagThingy::NO_DESCRIPTOR}, "Staging Buffer (UpdateDataExpensive)");
-    UpdateDataGeneric(commandBuffer, data, destOffsetBytes, stagingBuffer, *this);
+    UpdateDataGeneric(commandBuffer, data, destOffsetBytes, device_->stagingAllocator_->Allocate(data.size_bytes()), *this);
   }
 
   void Buffer::FillData(VkCommandBuffer commandBuffer, const BufferFillInfo& clear)
   {
-    vkCmdFillBuffer(commandBuffer, buffer_, clear.offset, clear.size, clear.data);
+    auto size = clear.size;
+    // VK_WHOLE_SIZE would reach the end of the pool's buffer, so fill up to the end of this one instead (rounded down to a multiple of 4, as VK_WHOLE_SIZE is)
+    if (poolRange_ && size == VK_WHOLE_SIZE)
+    {
+      size = (createInfo_.size - clear.offset) & ~VkDeviceSize(3);
+    }
+    vkCmdFillBuffer(commandBuffer, buffer_, Offset() + clear.offset, size, clear.data);
+  }
+
+  void Buffer::InvalidateMappedMemory()
+  {
+    assert(mappedMemory_);
+    CheckVkResult(vmaInvalidateAllocation(device_->allocator_, allocation_, 0, VK_WHOLE_SIZE));
   }
 
-  void Buffer::UpdateDataGeneric(VkCommandBuffer commandBuffer, TriviallyCopyableByteSpan data, VkDeviceSize destOffsetBytes, Buffer& stagingBuffer, Buffer& deviceBuffer)
+  void Buffer::UpdateDataGeneric(VkCommandBuffer commandBuffer, TriviallyCopyableByteSpan data, VkDeviceSize destOffsetBytes, const StagingAllocation& staging, Buffer& deviceBuffer)
   {
     ZoneScoped;
     ZoneNamed(_, true);
@@ -150,19 +196,18 @@ namespace Fvog
     }));
 
     // Overwrite some memory in a host-visible buffer, then copy it to the device buffer when the command buffer executes
-    assert(data.size_bytes() <= stagingBuffer.GetCreateInfo().size);
-    void* ptr = stagingBuffer.GetMappedMemory();
-    memcpy(ptr, data.data(), data.size_bytes());
+    assert(staging.offset + data.size_bytes() <= staging.buffer->GetCreateInfo().size);
+    memcpy(staging.data, data.data(), data.size_bytes());
 
     vkCmdCopyBuffer2(commandBuffer, detail::Address(VkCopyBufferInfo2{
       .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
-      .srcBuffer = stagingBuffer.Handle(),
+      .srcBuffer = staging.buffer->Handle(),
       .dstBuffer = deviceBuffer.Handle(),
       .regionCount = 1,
       .pRegions = detail::Address(VkBufferCopy2{
         .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
-        .srcOffset = 0,
-        .dstOffset = destOffsetBytes,
+        .srcOffset = staging.offset,
+        .dstOffset = deviceBuffer.Offset() + destOffsetBytes,
         .size = data.size_bytes(),
       }),
     }));
@@ -181,15 +226,189 @@ namespace Fvog
     }));
   }
 
+  StagingAllocator::StagingAllocator(Device& device, VkDeviceSize frameArenaSize)
+    : device_(&device),
+      frameArenaSize_(frameArenaSize)
+  {
+  }
+
+  StagingAllocation StagingAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment)
+  {
+    ZoneScoped;
+    assert(std::has_single_bit(alignment));
+    auto lock = std::lock_guard{mutex_};
+
+    // The number of frames in flight only changes while the device is idle, so every arena can be remapped
+    if (frameArenas_.size() != device_->FramesInFlight())
+    {
+      frameArenas_.resize(device_->FramesInFlight());
+    }
+
+    const auto frameNumber = device_->frameNumber.load();
+    auto& arena = frameArenas_[frameNumber % frameArenas_.size()];
+    if (!arena.buffer)
+    {
+      arena.buffer.emplace(*device_, BufferCreateInfo{.size = frameArenaSize_, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE | BufferFlagThingy::NO_DESCRIPTOR, .category = MemoryCategory::STAGING}, "Frame Staging Arena");
+    }
+
+    // The first allocation of a frame reclaims the arena. The frame that last used it has retired, as the frame's commands can't be recorded until then
+    if (arena.frameNumber != frameNumber)
+    {
+      arena.frameNumber = frameNumber;
+      arena.offset = 0;
+      arena.overflowBuffers.clear();
+      if (arena.overflowBytes > 0)
+      {
+        const auto newSize = std::bit_ceil(arena.buffer->SizeBytes() + arena.overflowBytes);
+        arena.buffer.emplace(*device_, BufferCreateInfo{.size = newSize, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE | BufferFlagThingy::NO_DESCRIPTOR, .category = MemoryCategory::STAGING}, "Frame Staging Arena");
+        arena.overflowBytes = 0;
+      }
+    }
+
+    const auto offset = (arena.offset + alignment - 1) & ~(alignment - 1);
+    if (offset + size <= arena.buffer->SizeBytes())
+    {
+      arena.offset = offset + size;
+      return {&*arena.buffer, offset, static_cast<std::byte*>(arena.buffer->GetMappedMemory()) + offset};
+    }
+
+    arena.overflowBytes += size;
+    auto& buffer = arena.overflowBuffers.emplace_back(*device_, BufferCreateInfo{.size = size, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE | BufferFlagThingy::NO_DESCRIPTOR, .category = MemoryCategory::STAGING}, "Frame Staging Arena (overflow)");
+    return {&buffer, 0, static_cast<std::byte*>(buffer.GetMappedMemory())};
+  }
+
+  Buffer StagingAllocator::AcquireBuffer(VkDeviceSize size)
+  {
+    ZoneScoped;
+    {
+      auto lock = std::lock_guard{mutex_};
+      // Take the smallest free buffer that fits
+      auto best = freeBuffers_.end();
+      for (auto it = freeBuffers_.begin(); it != freeBuffers_.end(); ++it)
+      {
+        if (it->SizeBytes() >= size && (best == freeBuffers_.end() || it->SizeBytes() < best->SizeBytes()))
+        {
+          best = it;
+        }
+      }
+
+      if (best != freeBuffers_.end())
+      {
+        auto buffer = std::move(*best);
+        freeBuffers_.erase(best);
+        return buffer;
+      }
+    }
+
+    // Round up so buffers are more likely to be reused by later uploads of a similar size
+    return Buffer(*device_, {.size = std::bit_ceil(std::max(size, VkDeviceSize(64 * 1024))), .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE | BufferFlagThingy::NO_DESCRIPTOR, .category = MemoryCategory::STAGING}, "Pooled Staging Buffer");
+  }
+
+  void StagingAllocator::ReleaseBuffer(Buffer&& buffer)
+  {
+    constexpr size_t maxFreeBuffers = 8;
+    auto lock = std::lock_guard{mutex_};
+    if (freeBuffers_.size() >= maxFreeBuffers)
+    {
+      // Evict the smallest buffer, as big ones are the most expensive to recreate
+      auto smallest = std::ranges::min_element(freeBuffers_, {}, [](const Buffer& b) { return b.SizeBytes(); });
+      if (smallest->SizeBytes() >= buffer.SizeBytes())
+      {
+        return;
+      }
+      freeBuffers_.erase(smallest);
+    }
+    freeBuffers_.emplace_back(std::move(buffer));
+  }
+
+  SmallBufferPool::SmallBufferPool(Device& device, VkDeviceSize chunkSize)
+    : device_(&device),
+      chunkSize_(chunkSize),
+      // Offsets of every range must be valid for storage and uniform buffer descriptors, as well as for indirect and index buffer commands
+      alignment_(std::max({
+        device.physicalDevice_.properties.limits.minStorageBufferOffsetAlignment,
+        device.physicalDevice_.properties.limits.minUniformBufferOffsetAlignment,
+        VkDeviceSize(16),
+      }))
+  {
+  }
+
+  SmallBufferPool::~SmallBufferPool()
+  {
+    for (auto& chunk : chunks_)
+    {
+      vmaDestroyVirtualBlock(chunk.block);
+    }
+  }
+
+  BufferPoolRange SmallBufferPool::Allocate(VkDeviceSize size)
+  {
+    ZoneScoped;
+    auto lock = std::lock_guard{mutex_};
+
+    const auto allocationInfo = VmaVirtualAllocationCreateInfo{
+      .size = size,
+      .alignment = alignment_,
+    };
+
+    auto makeRange = [&](Chunk& chunk, VmaVirtualAllocation allocation, VkDeviceSize offset)
+    {
+      device_->TrackSuballocation(MemoryCategory::UNCATEGORIZED, size);
+      return BufferPoolRange{
+        .buffer = chunk.buffer.Handle(),
+        .offset = offset,
+        .size = size,
+        .deviceAddress = chunk.buffer.GetDeviceAddress() + offset,
+        .block = chunk.block,
+        .allocation = allocation,
+      };
+    };
+
+    for (auto& chunk : chunks_)
+    {
+      auto allocation = VmaVirtualAllocation{};
+      auto offset = VkDeviceSize{};
+      if (vmaVirtualAllocate(chunk.block, &allocationInfo, &allocation, &offset) == VK_SUCCESS)
+      {
+        return makeRange(chunk, allocation, offset);
+      }
+    }
+
+    const auto newChunkSize = std::max(chunkSize_, size);
+    auto block = VmaVirtualBlock{};
+    detail::CheckVkResult(vmaCreateVirtualBlock(detail::Address(VmaVirtualBlockCreateInfo{
+      .size = newChunkSize,
+    }), &block));
+    auto& chunk = chunks_.emplace_back(Chunk{
+      .buffer = Buffer(*device_, {.size = newChunkSize, .flag = BufferFlagThingy::NO_DESCRIPTOR}, "Small Buffer Pool " + std::to_string(chunks_.size())),
+      .block = block,
+    });
+
+    auto allocation = VmaVirtualAllocation{};
+    auto offset = VkDeviceSize{};
+    detail::CheckVkResult(vmaVirtualAllocate(chunk.block, &allocationInfo, &allocation, &offset));
+    return makeRange(chunk, allocation, offset);
+  }
+
+  void SmallBufferPool::Free(const BufferPoolRange& range)
+  {
+    auto lock = std::lock_guard{mutex_};
+    vmaVirtualFree(range.block, range.allocation);
+    device_->UntrackSuballocation(MemoryCategory::UNCATEGORIZED, range.size);
+  }
+
   ManagedBuffer::Alloc::~Alloc()
   {
     if (allocator_ && allocation_)
     {
-      device_->genericDeletionQueue_.emplace_back(
-        [allocator = allocator_, allocation = allocation_, frameOfLastUse = device_->frameNumber](uint64_t value) -> bool {
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.generic.emplace_back(
+        [device = device_, allocator = allocator_, allocation = allocation_, size = size_, category = category_, frameOfLastUse = device_->frameNumber.load()](uint64_t value) -> bool {
           if (value >= frameOfLastUse)
           {
             vmaVirtualFree(allocator, allocation);
+            device->UntrackSuballocation(category, size);
             return true;
           }
           return false;
@@ -202,7 +421,8 @@ namespace Fvog
       allocator_(std::exchange(old.allocator_, nullptr)),
       allocation_(std::exchange(old.allocation_, nullptr)),
       offset_(std::exchange(old.offset_, 0)),
-      size_(std::exchange(old.size_, 0))
+      size_(std::exchange(old.size_, 0)),
+      category_(old.category_)
   {
   }
 
@@ -226,9 +446,10 @@ namespace Fvog
 
   // TODO: Instances of this buffer will probably be huge (>256MB), so the map flag will require ReBAR on the user's system.
   // An upload system using staging buffers and buffer copies should be used instead.
-  ManagedBuffer::ManagedBuffer(Device& device, size_t bufferSize, std::string name)
+  ManagedBuffer::ManagedBuffer(Device& device, size_t bufferSize, std::string name, MemoryCategory category)
     : device_(&device),
-      buffer_(device, {.size = bufferSize, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE_DEVICE}, std::move(name))
+      buffer_(device, {.size = bufferSize, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE_DEVICE, .category = category}, std::move(name)),
+      category_(category)
   {
     detail::CheckVkResult(vmaCreateVirtualBlock(detail::Address(VmaVirtualBlockCreateInfo{
       .size = bufferSize,
@@ -243,7 +464,8 @@ namespace Fvog
   ManagedBuffer::ManagedBuffer(ManagedBuffer&& old) noexcept
     : device_(std::exchange(old.device_, nullptr)),
       buffer_(std::move(old.buffer_)),
-      allocator(std::exchange(old.allocator, nullptr))
+      allocator(std::exchange(old.allocator, nullptr)),
+      category_(old.category_)
   {
   }
 
@@ -280,13 +502,16 @@ namespace Fvog
     offset += offsetAmount;
     size -= offsetAmount;
     assert(offset % alignment == 0);
-    return Alloc(*device_, allocator, allocation, offset, size);
+    device_->TrackSuballocation(category_, size);
+    return Alloc(*device_, allocator, allocation, offset, size, category_);
   }
 
-  ContiguousManagedBuffer::ContiguousManagedBuffer(Device& device, size_t bufferSize, std::string name)
+  ContiguousManagedBuffer::ContiguousManagedBuffer(Device& device, size_t bufferSize, std::string name, MemoryCategory category)
     : device_(&device),
-      buffer_(device, {.size = bufferSize}, std::move(name)),
-      currentSize_(0)
+      buffer_(device, {.size = bufferSize, .category = category}, name),
+      currentSize_(0),
+      category_(category),
+      name_(std::move(name))
   {
   }
 
@@ -297,9 +522,28 @@ namespace Fvog
     const auto alloc = Alloc{currentSize_, size};
 
     currentSize_ += size;
+    device_->TrackSuballocation(category_, size);
     return alloc;
   }
 
+  ContiguousManagedBuffer::Alloc ContiguousManagedBuffer::Allocate(size_t size, VkCommandBuffer commandBuffer)
+  {
+    if (currentSize_ + size > buffer_.SizeBytes())
+    {
+      auto newBuffer = Buffer(*device_, {.size = std::max(buffer_.SizeBytes() * 2, currentSize_ + size), .category = category_}, name_);
+      if (currentSize_ > 0)
+      {
+        auto ctx = Context(*device_, commandBuffer);
+        ctx.Barrier();
+        ctx.CopyBuffer(buffer_, newBuffer, {.size = currentSize_});
+        ctx.Barrier();
+      }
+      buffer_ = std::move(newBuffer);
+    }
+
+    return Allocate(size);
+  }
+
   void ContiguousManagedBuffer::Free(Alloc allocation, VkCommandBuffer commandBuffer)
   {
     // Copy allocation.size bytes from the end of buffer_ to freed allocation, then pop.
@@ -312,5 +556,6 @@ namespace Fvog
     });
 
     currentSize_ -= allocation.size;
+    device_->UntrackSuballocation(category_, allocation.size);
   }
 } // namespace Fvog
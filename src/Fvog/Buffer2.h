@@ -9,6 +9,8 @@
 #include <string_view>
 #include <optional>
 #include <cstddef>
+#include <mutex>
+#include <vector>
 
 namespace Fvog
 {
@@ -19,7 +21,10 @@ namespace Fvog
     MAP_SEQUENTIAL_WRITE        = 1,
     MAP_RANDOM_ACCESS           = 2,
     MAP_SEQUENTIAL_WRITE_DEVICE = 4,
-    NO_DESCRIPTOR               = 8
+    NO_DESCRIPTOR               = 8,
+    // Carve the buffer out of the device's SmallBufferPool instead of giving it a VkBuffer and memory of its own.
+    // For small, device-local buffers. Can't be combined with the MAP_* flags
+    SUBALLOCATE                 = 16,
   };
   FVOG_DECLARE_FLAG_TYPE(BufferFlags, BufferFlagThingy, uint32_t);
 
@@ -28,6 +33,28 @@ namespace Fvog
     // Size in bytes
     VkDeviceSize size{};
     BufferFlags flag{};
+    MemoryCategory category{};
+  };
+
+  class Buffer;
+
+  // A range of host-visible memory in a staging buffer
+  struct StagingAllocation
+  {
+    Buffer* buffer{};
+    VkDeviceSize offset{};
+    std::byte* data{};
+  };
+
+  // A range of one of a SmallBufferPool's buffers
+  struct BufferPoolRange
+  {
+    VkBuffer buffer{};
+    VkDeviceSize offset{};
+    VkDeviceSize size{};
+    VkDeviceAddress deviceAddress{};
+    VmaVirtualBlock block{};
+    VmaVirtualAllocation allocation{};
   };
 
   struct BufferFillInfo
@@ -48,11 +75,18 @@ namespace Fvog
     Buffer(Buffer&&) noexcept;
     Buffer& operator=(Buffer&&) noexcept;
 
+    // Suballocated buffers share their handle with others, so commands using it must add Offset()
     [[nodiscard]] VkBuffer Handle() const noexcept
     {
       return buffer_;
     }
 
+    // Where the buffer starts in Handle()
+    [[nodiscard]] VkDeviceSize Offset() const noexcept
+    {
+      return poolRange_ ? poolRange_->offset : 0;
+    }
+
     [[nodiscard]] void* GetMappedMemory() const noexcept
     {
       return mappedMemory_;
@@ -77,6 +111,9 @@ namespace Fvog
 
     void FillData(VkCommandBuffer commandBuffer, const BufferFillInfo& clear = {});
 
+    // Makes device writes visible to the mapped pointer. Only needed before reading memory that the device wrote to
+    void InvalidateMappedMemory();
+
     Device::DescriptorInfo::ResourceHandle GetResourceHandle()
     {
       return descriptorInfo_.value().GpuResource();
@@ -96,17 +133,20 @@ namespace Fvog
     VkDeviceAddress deviceAddress_{};
     std::optional<Device::DescriptorInfo> descriptorInfo_;
     std::string name_;
+    // Only set for buffers created with BufferFlagThingy::SUBALLOCATE
+    std::optional<BufferPoolRange> poolRange_;
 
     template<typename T>
     friend class NDeviceBuffer;
 
-    static void UpdateDataGeneric(VkCommandBuffer commandBuffer, TriviallyCopyableByteSpan data, VkDeviceSize destOffsetBytes, Buffer& stagingBuffer, Buffer& deviceBuffer);
+    static void UpdateDataGeneric(VkCommandBuffer commandBuffer, TriviallyCopyableByteSpan data, VkDeviceSize destOffsetBytes, const StagingAllocation& staging, Buffer& deviceBuffer);
   };
 
   struct TypedBufferCreateInfo
   {
     uint32_t count{1};
     BufferFlags flag{};
+    MemoryCategory category{};
   };
   
   template<typename T = std::byte>
@@ -115,7 +155,7 @@ namespace Fvog
   {
   public:
     explicit TypedBuffer(Device& device, const TypedBufferCreateInfo& createInfo = {}, std::string name = {})
-      : Buffer(device, {.size = createInfo.count * sizeof(T), .flag = createInfo.flag}, std::move(name))
+      : Buffer(device, {.size = createInfo.count * sizeof(T), .flag = createInfo.flag, .category = createInfo.category}, std::move(name))
     {
       //assert(createInfo.count > 0);
     }
@@ -131,7 +171,7 @@ namespace Fvog
       return static_cast<T*>(mappedMemory_);
     }
 
-    // UpdateDataExpensive CAN be called multiple times per frame, but each time it allocates a new buffer
+    // UpdateDataExpensive CAN be called multiple times per frame, but each time it consumes memory from the frame's staging arena
     void UpdateDataExpensive(VkCommandBuffer commandBuffer, std::span<const T> data, VkDeviceSize destOffsetBytes = 0)
     {
       Buffer::UpdateDataExpensive(commandBuffer, data, destOffsetBytes);
@@ -145,7 +185,74 @@ namespace Fvog
   private:
   };
 
-  // Consists of N staging buffers for upload and one device buffer
+  // Suballocates host-visible memory for uploads to avoid creating a buffer for each one.
+  // Thread-safe.
+  class StagingAllocator
+  {
+  public:
+    explicit StagingAllocator(Device& device, VkDeviceSize frameArenaSize = 4 * 1024 * 1024);
+
+    // Linearly allocates memory from the current frame's arena. The memory is reclaimed once the frame's
+    // timeline value retires, so it must only be read by commands recorded during this frame (or by ImmediateSubmit)
+    [[nodiscard]] StagingAllocation Allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+    // For uploads that don't belong to a frame, such as those on the transfer queue.
+    // The buffer must not be released until the GPU is done reading it
+    [[nodiscard]] Buffer AcquireBuffer(VkDeviceSize size);
+    void ReleaseBuffer(Buffer&& buffer);
+
+  private:
+    struct FrameArena
+    {
+      std::optional<Buffer> buffer;
+      VkDeviceSize offset{};
+      uint64_t frameNumber{};
+      // Allocations that didn't fit in the arena. The arena grows to fit them on the next reset
+      std::vector<Buffer> overflowBuffers;
+      VkDeviceSize overflowBytes{};
+    };
+
+    Device* device_;
+    VkDeviceSize frameArenaSize_;
+    std::mutex mutex_;
+    // One per frame in flight, created on first use
+    std::vector<FrameArena> frameArenas_;
+    std::vector<Buffer> freeBuffers_;
+  };
+
+  // Suballocates small, device-local buffers from a few big ones, so that each doesn't need its own VkBuffer and memory.
+  // Buffers created with BufferFlagThingy::SUBALLOCATE come from here. Thread-safe.
+  class SmallBufferPool
+  {
+  public:
+    explicit SmallBufferPool(Device& device, VkDeviceSize chunkSize = 1024 * 1024);
+    ~SmallBufferPool();
+
+    SmallBufferPool(const SmallBufferPool&) = delete;
+    SmallBufferPool& operator=(const SmallBufferPool&) = delete;
+    SmallBufferPool(SmallBufferPool&&) = delete;
+    SmallBufferPool& operator=(SmallBufferPool&&) = delete;
+
+    // Ranges are aligned for use as storage or uniform buffer descriptors. A range bigger than a chunk gets a chunk of its own
+    [[nodiscard]] BufferPoolRange Allocate(VkDeviceSize size);
+    // Frees the range immediately, so the GPU must be done with it
+    void Free(const BufferPoolRange& range);
+
+  private:
+    struct Chunk
+    {
+      Buffer buffer;
+      VmaVirtualBlock block{};
+    };
+
+    Device* device_;
+    VkDeviceSize chunkSize_;
+    VkDeviceSize alignment_;
+    std::mutex mutex_;
+    std::vector<Chunk> chunks_;
+  };
+
+  // Consists of one device buffer, which is updated through the current frame's staging arena
   // Use for buffers that need to be uploaded every frame
   template<typename T = std::byte>
     //requires std::is_trivially_copyable_v<T>
@@ -155,10 +262,6 @@ namespace Fvog
     explicit NDeviceBuffer(Device& device, uint32_t count = 1, std::string name = {})
     : deviceBuffer_(device, TypedBufferCreateInfo{.count = count}, std::move(name))
     {
-      for (auto& buffer : hostStagingBuffers_)
-      {
-        buffer = TypedBuffer<T>(device, TypedBufferCreateInfo{.count = count, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE}, name + std::string(" (host)"));
-      }
     }
 
     // Number of elements of T that this buffer could hold
@@ -190,12 +293,10 @@ namespace Fvog
       {
         return;
       }
-      auto& stagingBuffer = *hostStagingBuffers_[deviceBuffer_.device_->frameNumber % Device::frameOverlap];
-      stagingBuffer.UpdateDataGeneric(commandBuffer, data, destOffsetBytes, stagingBuffer, deviceBuffer_);
+      const auto staging = deviceBuffer_.device_->stagingAllocator_->Allocate(data.size_bytes());
+      Buffer::UpdateDataGeneric(commandBuffer, data, destOffsetBytes, staging, deviceBuffer_);
     }
 
-    // Use optional as a hacky way to allow for deferred initialization.
-    std::optional<TypedBuffer<T>> hostStagingBuffers_[Device::frameOverlap];
     TypedBuffer<T> deviceBuffer_;
   };
 
@@ -206,8 +307,8 @@ namespace Fvog
     class Alloc
     {
     public:
-      explicit Alloc(Device& device, VmaVirtualBlock allocator, VmaVirtualAllocation allocation, size_t offset, size_t size)
-        : device_(&device), allocator_(allocator), allocation_(allocation), offset_(offset), size_(size)
+      explicit Alloc(Device& device, VmaVirtualBlock allocator, VmaVirtualAllocation allocation, size_t offset, size_t size, MemoryCategory category)
+        : device_(&device), allocator_(allocator), allocation_(allocation), offset_(offset), size_(size), category_(category)
       {
       }
       ~Alloc();
@@ -228,9 +329,10 @@ namespace Fvog
       VmaVirtualAllocation allocation_;
       size_t offset_;
       size_t size_;
+      MemoryCategory category_;
     };
 
-    explicit ManagedBuffer(Device& device, size_t bufferSize, std::string name = {});
+    explicit ManagedBuffer(Device& device, size_t bufferSize, std::string name = {}, MemoryCategory category = {});
     ~ManagedBuffer();
 
     ManagedBuffer(const ManagedBuffer&) = delete;
@@ -259,6 +361,7 @@ namespace Fvog
     Device* device_;
     Buffer buffer_;
     VmaVirtualBlock allocator{};
+    MemoryCategory category_;
   };
 
   // Stores data contiguously, but without stable order, in a tightly packed array.
@@ -273,9 +376,13 @@ namespace Fvog
       size_t size;
     };
 
-    explicit ContiguousManagedBuffer(Device& device, size_t bufferSize, std::string name = {});
+    explicit ContiguousManagedBuffer(Device& device, size_t bufferSize, std::string name = {}, MemoryCategory category = {});
 
     [[nodiscard]] Alloc Allocate(size_t size);
+    // Grows the buffer if the allocation doesn't fit. The contents are copied to a new buffer, so the buffer's handle and resource handle change.
+    // The old buffer is destroyed once the frames that are still using it have retired
+    [[nodiscard]] Alloc Allocate(size_t size, VkCommandBuffer commandBuffer);
+    // Moves the last allocation of the same size into the freed one
     void Free(Alloc allocation, VkCommandBuffer commandBuffer);
 
     [[nodiscard]] Buffer& GetBuffer() noexcept
@@ -297,5 +404,7 @@ namespace Fvog
     Fvog::Device* device_;
     Buffer buffer_;
     size_t currentSize_ = 0;
+    MemoryCategory category_;
+    std::string name_;
   };
 }
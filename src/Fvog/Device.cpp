@@ -1,4 +1,5 @@
 #include "Device.h"
+#include "Buffer2.h"
 #include "detail/Common.h"
 #include "detail/SamplerCache2.h"
 
@@ -8,9 +9,21 @@
 
 #include <tracy/Tracy.hpp>
 
+#include <algorithm>
+#include <cassert>
 #include <cstdio>
 #include <array>
-#include <ranges>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace Fvog
 {
@@ -40,6 +53,34 @@ namespace Fvog
 
     constexpr auto deviceTracyHeapName = "GPU usage (Vulkan)";
 
+    std::atomic<uint64_t> nextDeviceId{1};
+
+    // The calling thread's deletion staging lists on each device it has destroyed resources of
+    struct ThreadDeletionStaging
+    {
+      uint64_t deviceId{};
+      std::shared_ptr<Device::DeletionStaging> staging;
+    };
+
+    struct ThreadDeletionStagings
+    {
+      ThreadDeletionStagings() = default;
+      ThreadDeletionStagings(const ThreadDeletionStagings&) = delete;
+      ThreadDeletionStagings& operator=(const ThreadDeletionStagings&) = delete;
+
+      // Threads such as the workers of a finished job come and go, so the devices must not keep their lists forever
+      ~ThreadDeletionStagings()
+      {
+        for (auto& [deviceId, staging] : stagings)
+        {
+          staging->threadExited = true;
+        }
+      }
+
+      std::vector<ThreadDeletionStaging> stagings;
+    };
+    thread_local ThreadDeletionStagings threadDeletionStagings;
+
     void VKAPI_CALL DeviceAllocCallback([[maybe_unused]] VmaAllocator VMA_NOT_NULL allocator,
       [[maybe_unused]] uint32_t memoryType,
       VkDeviceMemory VMA_NOT_NULL_NON_DISPATCHABLE memory,
@@ -57,11 +98,135 @@ namespace Fvog
     {
       TracyFreeN(memory, deviceTracyHeapName);
     }
+
+    VkCommandBuffer GetFrameCommandBuffer(VkDevice device,
+      VkCommandPool commandPool,
+      std::vector<VkCommandBuffer>& commandBuffers,
+      uint32_t& used,
+      VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+    {
+      using namespace detail;
+      if (used == commandBuffers.size())
+      {
+        CheckVkResult(vkAllocateCommandBuffers(device, Address(VkCommandBufferAllocateInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+          .commandPool = commandPool,
+          .level = level,
+          .commandBufferCount = 1,
+        }), &commandBuffers.emplace_back()));
+      }
+
+      return commandBuffers[used++];
+    }
+
+    // Precedes the driver's data in the pipeline cache file. The driver's own header has no driver version or UUID,
+    // and we'd rather not hand a cache from another driver to vkCreatePipelineCache
+    struct PipelineCacheFileHeader
+    {
+      static constexpr uint32_t expectedMagic = 0x50434647; // "FGCP"
+
+      uint32_t magic{};
+      uint32_t vendorID{};
+      uint32_t deviceID{};
+      uint32_t driverVersion{};
+      uint8_t driverUUID[VK_UUID_SIZE]{};
+      uint64_t dataSize{};
+    };
+
+    PipelineCacheFileHeader MakePipelineCacheFileHeader(VkPhysicalDevice physicalDevice, uint64_t dataSize)
+    {
+      auto idProperties = VkPhysicalDeviceIDProperties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+      };
+      auto properties = VkPhysicalDeviceProperties2{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &idProperties,
+      };
+      vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+      auto header = PipelineCacheFileHeader{
+        .magic = PipelineCacheFileHeader::expectedMagic,
+        .vendorID = properties.properties.vendorID,
+        .deviceID = properties.properties.deviceID,
+        .driverVersion = properties.properties.driverVersion,
+        .dataSize = dataSize,
+      };
+      std::memcpy(header.driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+      return header;
+    }
+
+    // Returns an empty vector if the file doesn't exist or wasn't made by this device and driver
+    std::vector<std::byte> LoadPipelineCacheData(const std::filesystem::path& path, VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties)
+    {
+      auto file = std::ifstream(path, std::ios::in | std::ios::binary);
+      if (!file)
+      {
+        return {};
+      }
+
+      auto fileHeader = PipelineCacheFileHeader{};
+      if (!file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader)))
+      {
+        return {};
+      }
+
+      const auto expectedHeader = MakePipelineCacheFileHeader(physicalDevice, fileHeader.dataSize);
+      if (fileHeader.magic != expectedHeader.magic ||
+          fileHeader.vendorID != expectedHeader.vendorID ||
+          fileHeader.deviceID != expectedHeader.deviceID ||
+          fileHeader.driverVersion != expectedHeader.driverVersion ||
+          std::memcmp(fileHeader.driverUUID, expectedHeader.driverUUID, VK_UUID_SIZE) != 0 ||
+          fileHeader.dataSize < sizeof(VkPipelineCacheHeaderVersionOne))
+      {
+        return {};
+      }
+
+      auto data = std::vector<std::byte>(fileHeader.dataSize);
+      if (!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size())))
+      {
+        return {};
+      }
+
+      // Also check the driver's header, in case the file was written by something other than SavePipelineCacheData
+      auto driverHeader = VkPipelineCacheHeaderVersionOne{};
+      std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+      if (driverHeader.headerSize < sizeof(driverHeader) ||
+          driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+          driverHeader.vendorID != properties.vendorID ||
+          driverHeader.deviceID != properties.deviceID ||
+          std::memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+      {
+        return {};
+      }
+
+      return data;
+    }
+
+    void SavePipelineCacheData(const std::filesystem::path& path, VkPhysicalDevice physicalDevice, std::span<const std::byte> data)
+    {
+      // Write to a temporary file first so a crash while saving can't leave a truncated cache behind
+      auto tempPath = path;
+      tempPath += ".tmp";
+      {
+        auto file = std::ofstream(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        const auto header = MakePipelineCacheFileHeader(physicalDevice, data.size());
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!file)
+        {
+          return;
+        }
+      }
+
+      auto errorCode = std::error_code{};
+      std::filesystem::rename(tempPath, path, errorCode);
+    }
   }
 
-  Device::Device(vkb::Instance& instance, VkSurfaceKHR surface)
+  Device::Device(vkb::Instance& instance, VkSurfaceKHR surface, uint32_t framesInFlight)
     : instance_(instance),
       surface_(surface),
+      deviceId_(nextDeviceId.fetch_add(1, std::memory_order_relaxed)),
       samplerCache_(std::make_unique<detail::SamplerCache>(this))
   {
     using namespace detail;
@@ -153,32 +318,82 @@ namespace Fvog
       })
       .select()
       .value();
+
+    // Lets VMA query the actual budget instead of estimating it
+    hasMemoryBudgetExtension_ = physicalDevice_.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // The features are queried first, as the extension alone doesn't guarantee both shader stages
+    auto meshShaderFeatures = VkPhysicalDeviceMeshShaderFeaturesEXT{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT};
+    vkGetPhysicalDeviceFeatures2(physicalDevice_.physical_device, Address(VkPhysicalDeviceFeatures2{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &meshShaderFeatures,
+    }));
+    supportsMeshShaders_ = meshShaderFeatures.taskShader && meshShaderFeatures.meshShader &&
+      physicalDevice_.enable_extension_if_present(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    meshShaderFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+      .taskShader = VK_TRUE,
+      .meshShader = VK_TRUE,
+    };
     
-    device_ = vkb::DeviceBuilder{physicalDevice_}.build().value();
+    // One queue per family, except that we ask for a second queue in the graphics family for async compute.
+    // Compute-only families are not used for it, as every resource shared with the graphics queue would then need a queue family ownership transfer
+    const auto queueFamilies = physicalDevice_.get_queue_families();
+    auto queueDescriptions = std::vector<vkb::CustomQueueDescription>();
+    auto graphicsFamilyIndex = std::optional<uint32_t>();
+    for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilies.size()); i++)
+    {
+      auto queueCount = 1u;
+      if (!graphicsFamilyIndex && (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+      {
+        graphicsFamilyIndex = i;
+        queueCount = std::min(2u, queueFamilies[i].queueCount);
+      }
+      queueDescriptions.emplace_back(i, std::vector<float>(queueCount, 1.0f));
+    }
+
+    auto deviceBuilder = vkb::DeviceBuilder{physicalDevice_};
+    deviceBuilder.custom_queue_setup(queueDescriptions);
+    if (supportsMeshShaders_)
+    {
+      deviceBuilder.add_pNext(&meshShaderFeatures);
+    }
+    device_ = deviceBuilder.build().value();
     graphicsQueue_ = device_.get_queue(vkb::QueueType::graphics).value();
     graphicsQueueFamilyIndex_ = device_.get_queue_index(vkb::QueueType::graphics).value();
+    assert(graphicsQueueFamilyIndex_ == graphicsFamilyIndex);
 
-    // Per-frame swapchain sync, command pools, and command buffers
-    for (auto& frame : frameData)
+    if (queueFamilies[graphicsQueueFamilyIndex_].queueCount > 1)
     {
-      CheckVkResult(vkCreateCommandPool(device_, Address(VkCommandPoolCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .queueFamilyIndex = graphicsQueueFamilyIndex_,
-      }), nullptr, &frame.commandPool));
-
-      CheckVkResult(vkAllocateCommandBuffers(device_, Address(VkCommandBufferAllocateInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = frame.commandPool,
-        .commandBufferCount = 1,
-      }), &frame.commandBuffer));
+      vkGetDeviceQueue(device_, graphicsQueueFamilyIndex_, 1, &computeQueue_);
+    }
+    else
+    {
+      computeQueue_ = graphicsQueue_;
+    }
 
-      CheckVkResult(vkCreateSemaphore(device_, Address(VkSemaphoreCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-      }), nullptr, &frame.swapchainSemaphore));
+    // Prefer a transfer-only family (usually backed by a copy engine), then any family without graphics
+    if (auto dedicatedTransferQueue = device_.get_dedicated_queue(vkb::QueueType::transfer))
+    {
+      transferQueue_ = dedicatedTransferQueue.value();
+      transferQueueFamilyIndex_ = device_.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    }
+    else if (auto separateTransferQueue = device_.get_queue(vkb::QueueType::transfer))
+    {
+      transferQueue_ = separateTransferQueue.value();
+      transferQueueFamilyIndex_ = device_.get_queue_index(vkb::QueueType::transfer).value();
+    }
+    else
+    {
+      transferQueue_ = graphicsQueue_;
+      transferQueueFamilyIndex_ = graphicsQueueFamilyIndex_;
+    }
 
-      CheckVkResult(vkCreateSemaphore(device_, Address(VkSemaphoreCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-      }), nullptr, &frame.renderSemaphore));
+    // Per-frame swapchain sync, command pools, and command buffers
+    frameData.resize(std::clamp(framesInFlight, 1u, maxFramesInFlight));
+    for (auto& frame : frameData)
+    {
+      CreateFrameData(frame);
     }
 
     // Immediate submit stuff (subject to change)
@@ -194,18 +409,31 @@ namespace Fvog
       .commandBufferCount = 1,
     }), &immediateSubmitCommandBuffer_));
 
+    CheckVkResult(vkCreateCommandPool(device_, Address(VkCommandPoolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = transferQueueFamilyIndex_,
+    }), nullptr, &uploadCommandPool_));
+
     // Queue timeline semaphores
-    CheckVkResult(vkCreateSemaphore(device_, Address(VkSemaphoreCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-      .pNext = Address(VkSemaphoreTypeCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
-        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
-        .initialValue = 0,
-      }),
-    }), nullptr, &graphicsQueueTimelineSemaphore_));
+    for (auto* semaphore : {&graphicsQueueTimelineSemaphore_,
+           &graphicsQueueSplitTimelineSemaphore_,
+           &computeQueueTimelineSemaphore_,
+           &transferQueueTimelineSemaphore_,
+           &immediateSubmitTimelineSemaphore_})
+    {
+      CheckVkResult(vkCreateSemaphore(device_, Address(VkSemaphoreCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = Address(VkSemaphoreTypeCreateInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+          .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+          .initialValue = 0,
+        }),
+      }), nullptr, semaphore));
+    }
     
     vmaCreateAllocator(Address(VmaAllocatorCreateInfo{
-      .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+      .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT | (hasMemoryBudgetExtension_ ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u),
       .physicalDevice = physicalDevice_,
       .device = device_,
       .pDeviceMemoryCallbacks = Address(VmaDeviceMemoryCallbacks{
@@ -314,6 +542,20 @@ namespace Fvog
         }),
         nullptr,
         &defaultPipelineLayout));
+
+    {
+      ZoneScopedN("Load Pipeline Cache");
+      const auto initialData = LoadPipelineCacheData(pipelineCachePath, physicalDevice_, physicalDevice_.properties);
+      CheckVkResult(vkCreatePipelineCache(device_, Address(VkPipelineCacheCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = initialData.size(),
+        .pInitialData = initialData.data(),
+      }), nullptr, &pipelineCache_));
+      pipelineCacheInitialBytes_ = initialData.size();
+    }
+
+    stagingAllocator_ = std::make_unique<StagingAllocator>(*this);
+    smallBufferPool_ = std::make_unique<SmallBufferPool>(*this);
   }
   
   Device::~Device()
@@ -321,22 +563,60 @@ namespace Fvog
     ZoneScoped;
     detail::CheckVkResult(vkDeviceWaitIdle(device_));
 
-    FreeUnusedResources();
+    stagingAllocator_.reset();
+
+    // Generic deletions may free resources that stage more deletions, so this repeats until nothing is left.
+    // The device is idle, so every resource can be freed
+    for (bool empty = false; !empty;)
+    {
+      FreeResourcesLastUsedBy(std::numeric_limits<uint64_t>::max());
+
+      {
+        auto lock = std::lock_guard{deletionQueueMutex_};
+        DrainDeletionStagingLocked();
+        empty = bufferDeletionQueue_.empty() && imageDeletionQueue_.empty() && imageViewDeletionQueue_.empty() && descriptorDeletionQueue_.empty() &&
+                genericDeletionQueue_.empty();
+      }
+
+      // Every suballocated buffer has returned its range by now, so the pool's own buffers can be destroyed too
+      if (empty && smallBufferPool_)
+      {
+        smallBufferPool_.reset();
+        empty = false;
+      }
+    }
+
+    {
+      ZoneScopedN("Save Pipeline Cache");
+      size_t dataSize{};
+      detail::CheckVkResult(vkGetPipelineCacheData(device_, pipelineCache_, &dataSize, nullptr));
+      auto data = std::vector<std::byte>(dataSize);
+      // VK_INCOMPLETE is possible if the cache grew between the calls, in which case the data is still valid, just not everything
+      if (vkGetPipelineCacheData(device_, pipelineCache_, &dataSize, data.data()) >= VK_SUCCESS)
+      {
+        data.resize(dataSize);
+        SavePipelineCacheData(pipelineCachePath, physicalDevice_, data);
+      }
+    }
+    vkDestroyPipelineCache(device_, pipelineCache_, nullptr);
 
     vkDestroyPipelineLayout(device_, defaultPipelineLayout, nullptr);
     vkDestroyDescriptorSetLayout(device_, descriptorSetLayout_, nullptr);
     vkDestroyDescriptorPool(device_, descriptorPool_, nullptr);
 
     vkDestroyCommandPool(device_, immediateSubmitCommandPool_, nullptr);
+    vkDestroyCommandPool(device_, uploadCommandPool_, nullptr);
 
-    for (const auto& frame : frameData)
+    for (auto& frame : frameData)
     {
-      vkDestroyCommandPool(device_, frame.commandPool, nullptr);
-      vkDestroySemaphore(device_, frame.renderSemaphore, nullptr);
-      vkDestroySemaphore(device_, frame.swapchainSemaphore, nullptr);
+      DestroyFrameData(frame);
     }
 
     vkDestroySemaphore(device_, graphicsQueueTimelineSemaphore_, nullptr);
+    vkDestroySemaphore(device_, graphicsQueueSplitTimelineSemaphore_, nullptr);
+    vkDestroySemaphore(device_, computeQueueTimelineSemaphore_, nullptr);
+    vkDestroySemaphore(device_, transferQueueTimelineSemaphore_, nullptr);
+    vkDestroySemaphore(device_, immediateSubmitTimelineSemaphore_, nullptr);
     
     vmaDestroyAllocator(allocator_);
 
@@ -344,16 +624,99 @@ namespace Fvog
     vkb::destroy_device(device_);
   }
 
-  void Device::ImmediateSubmit(const std::function<void(VkCommandBuffer)>& function) const
+  void Device::SetFramesInFlight(uint32_t count)
+  {
+    ZoneScoped;
+    count = std::clamp(count, 1u, maxFramesInFlight);
+    if (count == FramesInFlight())
+    {
+      return;
+    }
+
+    {
+      ZoneScopedN("Device Wait Idle");
+      vkDeviceWaitIdle(device_);
+    }
+
+    // Every slot has retired, so new slots can start at the latest values that any slot waited for
+    auto renderWaitValue = uint64_t{};
+    auto computeWaitValue = uint64_t{};
+    for (const auto& frame : frameData)
+    {
+      renderWaitValue = std::max(renderWaitValue, frame.renderTimelineSemaphoreWaitValue);
+      computeWaitValue = std::max(computeWaitValue, frame.computeTimelineSemaphoreWaitValue);
+    }
+    while (FramesInFlight() > count)
+    {
+      DestroyFrameData(frameData.back());
+      frameData.pop_back();
+    }
+    while (FramesInFlight() < count)
+    {
+      auto& frame = frameData.emplace_back();
+      CreateFrameData(frame);
+      frame.renderTimelineSemaphoreWaitValue = renderWaitValue;
+      frame.computeTimelineSemaphoreWaitValue = computeWaitValue;
+    }
+  }
+
+  void Device::CreateFrameData(PerFrameData& frame)
+  {
+    using namespace detail;
+    CheckVkResult(vkCreateCommandPool(device_, Address(VkCommandPoolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = graphicsQueueFamilyIndex_,
+    }), nullptr, &frame.commandPool));
+
+    CheckVkResult(vkAllocateCommandBuffers(device_, Address(VkCommandBufferAllocateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = frame.commandPool,
+      .commandBufferCount = 1,
+    }), &frame.commandBuffer));
+    frame.graphicsCommandBuffers.push_back(frame.commandBuffer);
+    frame.graphicsCommandBuffersUsed = 1;
+
+    CheckVkResult(vkCreateCommandPool(device_, Address(VkCommandPoolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = graphicsQueueFamilyIndex_,
+    }), nullptr, &frame.computeCommandPool));
+
+    CheckVkResult(vkCreateSemaphore(device_, Address(VkSemaphoreCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    }), nullptr, &frame.swapchainSemaphore));
+
+    CheckVkResult(vkCreateSemaphore(device_, Address(VkSemaphoreCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    }), nullptr, &frame.renderSemaphore));
+  }
+
+  void Device::DestroyFrameData(PerFrameData& frame)
+  {
+    vkDestroyCommandPool(device_, frame.commandPool, nullptr);
+    vkDestroyCommandPool(device_, frame.computeCommandPool, nullptr);
+    for (const auto& workerPool : frame.workerCommandPools)
+    {
+      vkDestroyCommandPool(device_, workerPool->commandPool, nullptr);
+    }
+    vkDestroySemaphore(device_, frame.renderSemaphore, nullptr);
+    vkDestroySemaphore(device_, frame.swapchainSemaphore, nullptr);
+    frame = {};
+  }
+
+  void Device::ImmediateSubmit(const std::function<void(VkCommandBuffer)>& function)
   {
     ZoneScoped;
     using namespace detail;
+    auto lock = std::lock_guard{immediateSubmitMutex_};
     CheckVkResult(vkResetCommandBuffer(immediateSubmitCommandBuffer_, 0));
     CheckVkResult(vkBeginCommandBuffer(immediateSubmitCommandBuffer_, Address(VkCommandBufferBeginInfo{
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     })));
 
+    // We are going to block anyway, so acquire every upload (even unfinished ones) in case the function uses one
+    const auto transferWaitValue = AcquireUploadedResources(immediateSubmitCommandBuffer_, false);
+
     function(immediateSubmitCommandBuffer_);
 
     vkCmdPipelineBarrier2(immediateSubmitCommandBuffer_, Address(VkDependencyInfo{
@@ -369,18 +732,426 @@ namespace Fvog
     }));
 
     CheckVkResult(vkEndCommandBuffer(immediateSubmitCommandBuffer_));
+    FlushDescriptorWrites();
+
+    const auto signalValue = ++immediateSubmitTimelineValue_;
+
+    {
+      auto queueLock = std::lock_guard{graphicsQueueMutex_};
+      CheckVkResult(vkQueueSubmit2(graphicsQueue_, 1, Address(VkSubmitInfo2{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = 1,
+        .pWaitSemaphoreInfos = Address(VkSemaphoreSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+          .semaphore = transferQueueTimelineSemaphore_,
+          .value = transferWaitValue,
+          .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        }),
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = Address(VkCommandBufferSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+          .commandBuffer = immediateSubmitCommandBuffer_,
+        }),
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = Address(VkSemaphoreSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+          .semaphore = immediateSubmitTimelineSemaphore_,
+          .value = signalValue,
+          .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        }),
+      }), VK_NULL_HANDLE));
+    }
+
+    // Only wait for our own work instead of idling the whole queue
+    CheckVkResult(vkWaitSemaphores(device_, Address(VkSemaphoreWaitInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &immediateSubmitTimelineSemaphore_,
+      .pValues = &signalValue,
+    }), UINT64_MAX));
+  }
+
+  void Device::ResetFrameCommandPools()
+  {
+    ZoneScoped;
+    using namespace detail;
+    auto& frame = GetCurrentFrameData();
+    CheckVkResult(vkResetCommandPool(device_, frame.commandPool, 0));
+    CheckVkResult(vkResetCommandPool(device_, frame.computeCommandPool, 0));
+    frame.commandBuffer = frame.graphicsCommandBuffers.front();
+    frame.graphicsCommandBuffersUsed = 1;
+    frame.computeCommandBuffersUsed = 0;
+    frame.graphicsWaits.clear();
+
+    for (auto& workerPool : frame.workerCommandPools)
+    {
+      CheckVkResult(vkResetCommandPool(device_, workerPool->commandPool, 0));
+      workerPool->commandBuffersUsed = 0;
+    }
+  }
+
+  void Device::AddFrameWait(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags2 stages)
+  {
+    GetCurrentFrameData().graphicsWaits.emplace_back(VkSemaphoreSubmitInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = semaphore,
+      .value = value,
+      .stageMask = stages,
+    });
+  }
+
+  uint64_t Device::SplitFrameCommandBuffer()
+  {
+    ZoneScoped;
+    using namespace detail;
+    auto& frame = GetCurrentFrameData();
+    CheckVkResult(vkEndCommandBuffer(frame.commandBuffer));
+    FlushDescriptorWrites();
+
+    const auto signalValue = ++graphicsSplitTimelineValue_;
+
+    {
+      auto queueLock = std::lock_guard{graphicsQueueMutex_};
+      CheckVkResult(vkQueueSubmit2(graphicsQueue_, 1, Address(VkSubmitInfo2{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = static_cast<uint32_t>(frame.graphicsWaits.size()),
+        .pWaitSemaphoreInfos = frame.graphicsWaits.data(),
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = Address(VkCommandBufferSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+          .commandBuffer = frame.commandBuffer,
+        }),
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = Address(VkSemaphoreSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+          .semaphore = graphicsQueueSplitTimelineSemaphore_,
+          .value = signalValue,
+          .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        }),
+      }), VK_NULL_HANDLE));
+    }
+
+    frame.graphicsWaits.clear();
+    frame.commandBuffer = GetFrameCommandBuffer(device_, frame.commandPool, frame.graphicsCommandBuffers, frame.graphicsCommandBuffersUsed);
+    CheckVkResult(vkBeginCommandBuffer(frame.commandBuffer, Address(VkCommandBufferBeginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    })));
+
+    // Bindings don't carry over from the previous command buffer
+    for (auto bindPoint : {VK_PIPELINE_BIND_POINT_GRAPHICS, VK_PIPELINE_BIND_POINT_COMPUTE})
+    {
+      vkCmdBindDescriptorSets(frame.commandBuffer, bindPoint, defaultPipelineLayout, 0, 1, &descriptorSet_, 0, nullptr);
+    }
+
+    return signalValue;
+  }
+
+  VkCommandBuffer Device::BeginFrameComputeCommandBuffer()
+  {
+    ZoneScoped;
+    using namespace detail;
+    auto& frame = GetCurrentFrameData();
+    auto commandBuffer = GetFrameCommandBuffer(device_, frame.computeCommandPool, frame.computeCommandBuffers, frame.computeCommandBuffersUsed);
+    CheckVkResult(vkBeginCommandBuffer(commandBuffer, Address(VkCommandBufferBeginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    })));
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, defaultPipelineLayout, 0, 1, &descriptorSet_, 0, nullptr);
+    return commandBuffer;
+  }
+
+  VkCommandBuffer Device::BeginFrameSecondaryCommandBuffer()
+  {
+    ZoneScoped;
+    using namespace detail;
+    auto& frame = GetCurrentFrameData();
+    auto* workerPool = static_cast<PerFrameData::WorkerCommandPool*>(nullptr);
 
-    vkQueueSubmit2(graphicsQueue_, 1, Address(VkSubmitInfo2{
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-      .commandBufferInfoCount = 1,
-      .pCommandBufferInfos = Address(VkCommandBufferSubmitInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
-        .commandBuffer = immediateSubmitCommandBuffer_,
+    {
+      auto lock = std::lock_guard{workerCommandPoolsMutex_};
+      const auto thread = std::this_thread::get_id();
+      auto it = std::ranges::find_if(frame.workerCommandPools, [thread](const auto& pool) { return pool->thread == thread; });
+      if (it == frame.workerCommandPools.end())
+      {
+        auto& newPool = frame.workerCommandPools.emplace_back(std::make_unique<PerFrameData::WorkerCommandPool>());
+        newPool->thread = thread;
+        CheckVkResult(vkCreateCommandPool(device_, Address(VkCommandPoolCreateInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+          .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+          .queueFamilyIndex = graphicsQueueFamilyIndex_,
+        }), nullptr, &newPool->commandPool));
+        it = frame.workerCommandPools.end() - 1;
+      }
+      workerPool = it->get();
+    }
+
+    // Only this thread uses the pool, so the rest happens without the lock
+    auto commandBuffer = GetFrameCommandBuffer(device_,
+      workerPool->commandPool,
+      workerPool->commandBuffers,
+      workerPool->commandBuffersUsed,
+      VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    CheckVkResult(vkBeginCommandBuffer(commandBuffer, Address(VkCommandBufferBeginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = Address(VkCommandBufferInheritanceInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
       }),
-    }), VK_NULL_HANDLE);
+    })));
+
+    for (auto bindPoint : {VK_PIPELINE_BIND_POINT_GRAPHICS, VK_PIPELINE_BIND_POINT_COMPUTE})
+    {
+      vkCmdBindDescriptorSets(commandBuffer, bindPoint, defaultPipelineLayout, 0, 1, &descriptorSet_, 0, nullptr);
+    }
+
+    return commandBuffer;
+  }
+
+  uint64_t Device::SubmitFrameComputeCommandBuffer(VkCommandBuffer commandBuffer, std::span<const VkSemaphoreSubmitInfo> waits)
+  {
+    ZoneScoped;
+    using namespace detail;
+    CheckVkResult(vkEndCommandBuffer(commandBuffer));
+    FlushDescriptorWrites();
+
+    const auto signalValue = ++computeTimelineValue_;
+
+    {
+      // The compute queue may be the graphics queue
+      auto queueLock = std::lock_guard{graphicsQueueMutex_};
+      CheckVkResult(vkQueueSubmit2(computeQueue_, 1, Address(VkSubmitInfo2{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = static_cast<uint32_t>(waits.size()),
+        .pWaitSemaphoreInfos = waits.data(),
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = Address(VkCommandBufferSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+          .commandBuffer = commandBuffer,
+        }),
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = Address(VkSemaphoreSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+          .semaphore = computeQueueTimelineSemaphore_,
+          .value = signalValue,
+          .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        }),
+      }), VK_NULL_HANDLE));
+    }
+
+    GetCurrentFrameData().computeTimelineSemaphoreWaitValue = signalValue;
+    return signalValue;
+  }
+
+  uint64_t Device::Upload(const std::function<void(VkCommandBuffer)>& function, std::span<const UploadOwnershipTransfer> ownershipTransfers)
+  {
+    ZoneScoped;
+    using namespace detail;
+    auto lock = std::lock_guard{uploadMutex_};
+
+    // Recycle command buffers of uploads that have finished
+    auto completedValue = uint64_t{};
+    CheckVkResult(vkGetSemaphoreCounterValue(device_, transferQueueTimelineSemaphore_, &completedValue));
+    while (!inFlightUploads_.empty() && inFlightUploads_.front().uploadValue <= completedValue)
+    {
+      freeUploadCommandBuffers_.push_back(inFlightUploads_.front().commandBuffer);
+      inFlightUploads_.pop_front();
+    }
+
+    auto commandBuffer = VkCommandBuffer{};
+    if (freeUploadCommandBuffers_.empty())
+    {
+      CheckVkResult(vkAllocateCommandBuffers(device_, Address(VkCommandBufferAllocateInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = uploadCommandPool_,
+        .commandBufferCount = 1,
+      }), &commandBuffer));
+    }
+    else
+    {
+      commandBuffer = freeUploadCommandBuffers_.back();
+      freeUploadCommandBuffers_.pop_back();
+      CheckVkResult(vkResetCommandBuffer(commandBuffer, 0));
+    }
+
+    CheckVkResult(vkBeginCommandBuffer(commandBuffer, Address(VkCommandBufferBeginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    })));
+
+    function(commandBuffer);
+
+    const auto uploadValue = ++uploadTimelineValue_;
+
+    // Release ownership of written resources to the graphics queue family. The matching acquire is recorded by AcquireUploadedResources
+    if (HasDedicatedTransferQueue() && !ownershipTransfers.empty())
+    {
+      auto bufferBarriers = std::vector<VkBufferMemoryBarrier2>();
+      auto imageBarriers = std::vector<VkImageMemoryBarrier2>();
+      for (const auto& transfer : ownershipTransfers)
+      {
+        if (transfer.buffer != VK_NULL_HANDLE)
+        {
+          bufferBarriers.push_back({
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .srcQueueFamilyIndex = transferQueueFamilyIndex_,
+            .dstQueueFamilyIndex = graphicsQueueFamilyIndex_,
+            .buffer = transfer.buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+          });
+        }
+
+        if (transfer.image != VK_NULL_HANDLE)
+        {
+          imageBarriers.push_back({
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .oldLayout = transfer.layout,
+            .newLayout = transfer.layout,
+            .srcQueueFamilyIndex = transferQueueFamilyIndex_,
+            .dstQueueFamilyIndex = graphicsQueueFamilyIndex_,
+            .image = transfer.image,
+            .subresourceRange = {
+              .aspectMask = transfer.aspectMask,
+              .levelCount = VK_REMAINING_MIP_LEVELS,
+              .layerCount = VK_REMAINING_ARRAY_LAYERS,
+            },
+          });
+        }
+
+        pendingOwnershipAcquires_.emplace_back(uploadValue, transfer);
+      }
+
+      vkCmdPipelineBarrier2(commandBuffer, Address(VkDependencyInfo{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size()),
+        .pBufferMemoryBarriers = bufferBarriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size()),
+        .pImageMemoryBarriers = imageBarriers.data(),
+      }));
+    }
+
+    CheckVkResult(vkEndCommandBuffer(commandBuffer));
+
+    {
+      // Without a dedicated transfer queue, we share the graphics queue and therefore its lock
+      auto queueLock = std::unique_lock{graphicsQueueMutex_, std::defer_lock};
+      if (!HasDedicatedTransferQueue())
+      {
+        queueLock.lock();
+      }
+
+      CheckVkResult(vkQueueSubmit2(transferQueue_, 1, Address(VkSubmitInfo2{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = Address(VkCommandBufferSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+          .commandBuffer = commandBuffer,
+        }),
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = Address(VkSemaphoreSubmitInfo{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+          .semaphore = transferQueueTimelineSemaphore_,
+          .value = uploadValue,
+          .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        }),
+      }), VK_NULL_HANDLE));
+    }
+
+    inFlightUploads_.emplace_back(uploadValue, commandBuffer);
+
+    return uploadValue;
+  }
+
+  bool Device::IsUploadComplete(uint64_t uploadValue) const
+  {
+    auto completedValue = uint64_t{};
+    detail::CheckVkResult(vkGetSemaphoreCounterValue(device_, transferQueueTimelineSemaphore_, &completedValue));
+    return completedValue >= uploadValue;
+  }
+
+  void Device::WaitForUpload(uint64_t uploadValue) const
+  {
+    ZoneScoped;
+    detail::CheckVkResult(vkWaitSemaphores(device_, detail::Address(VkSemaphoreWaitInfo{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &transferQueueTimelineSemaphore_,
+      .pValues = &uploadValue,
+    }), UINT64_MAX));
+  }
+
+  uint64_t Device::AcquireUploadedResources(VkCommandBuffer commandBuffer, bool onlyCompleted)
+  {
+    ZoneScoped;
+    auto lock = std::lock_guard{uploadMutex_};
+
+    auto completedValue = uploadTimelineValue_;
+    if (onlyCompleted)
+    {
+      detail::CheckVkResult(vkGetSemaphoreCounterValue(device_, transferQueueTimelineSemaphore_, &completedValue));
+    }
+
+    auto bufferBarriers = std::vector<VkBufferMemoryBarrier2>();
+    auto imageBarriers = std::vector<VkImageMemoryBarrier2>();
+
+    // Acquires are enqueued in upload order, so we can stop at the first one that is still executing
+    while (!pendingOwnershipAcquires_.empty() && pendingOwnershipAcquires_.front().uploadValue <= completedValue)
+    {
+      const auto& transfer = pendingOwnershipAcquires_.front().transfer;
+      if (transfer.buffer != VK_NULL_HANDLE)
+      {
+        bufferBarriers.push_back({
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+          .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+          .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+          .srcQueueFamilyIndex = transferQueueFamilyIndex_,
+          .dstQueueFamilyIndex = graphicsQueueFamilyIndex_,
+          .buffer = transfer.buffer,
+          .offset = 0,
+          .size = VK_WHOLE_SIZE,
+        });
+      }
+
+      if (transfer.image != VK_NULL_HANDLE)
+      {
+        imageBarriers.push_back({
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+          .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+          .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+          .oldLayout = transfer.layout,
+          .newLayout = transfer.layout,
+          .srcQueueFamilyIndex = transferQueueFamilyIndex_,
+          .dstQueueFamilyIndex = graphicsQueueFamilyIndex_,
+          .image = transfer.image,
+          .subresourceRange = {
+            .aspectMask = transfer.aspectMask,
+            .levelCount = VK_REMAINING_MIP_LEVELS,
+            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+          },
+        });
+      }
+
+      pendingOwnershipAcquires_.pop_front();
+    }
 
-    // TODO: Horrible sin
-    CheckVkResult(vkQueueWaitIdle(graphicsQueue_));
+    if (!bufferBarriers.empty() || !imageBarriers.empty())
+    {
+      vkCmdPipelineBarrier2(commandBuffer, detail::Address(VkDependencyInfo{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size()),
+        .pBufferMemoryBarriers = bufferBarriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size()),
+        .pImageMemoryBarriers = imageBarriers.data(),
+      }));
+    }
+
+    // Waiting on an already-signaled value is free, and it makes the transfer queue's writes visible to the graphics queue
+    return completedValue;
   }
 
   void Device::FreeUnusedResources()
@@ -393,6 +1164,18 @@ namespace Fvog
       value = GetCurrentFrameData().renderTimelineSemaphoreWaitValue;
     }
 
+    FreeResourcesLastUsedBy(value);
+  }
+
+  void Device::FreeResourcesLastUsedBy(uint64_t value)
+  {
+    ZoneScoped;
+    // Resources may be destroyed below, so their descriptors must be written before then
+    FlushDescriptorWrites();
+
+    auto lock = std::unique_lock{deletionQueueMutex_};
+    DrainDeletionStagingLocked();
+
     {
       ZoneScopedN("Free unused buffers");
       std::erase_if(bufferDeletionQueue_,
@@ -408,6 +1191,7 @@ namespace Fvog
             auto size = snprintf(buffer, std::size(buffer), "Size: %.1f %s", double(info.size) / divisor, postfix);
             ZoneText(buffer, size);
             ZoneName(bufferAlloc.name.c_str(), bufferAlloc.name.size());
+            UntrackAllocation(bufferAlloc.category, info.size);
             vmaDestroyBuffer(allocator_, bufferAlloc.buffer, bufferAlloc.allocation);
             return true;
           }
@@ -423,7 +1207,12 @@ namespace Fvog
           {
             ZoneScopedN("vmaDestroyImage");
             VmaAllocationInfo info{};
-            vmaGetAllocationInfo(allocator_, imageAlloc.allocation, &info);
+            // Images placed in externally-owned memory have no allocation of their own
+            if (imageAlloc.allocation)
+            {
+              vmaGetAllocationInfo(allocator_, imageAlloc.allocation, &info);
+              UntrackAllocation(imageAlloc.category, info.size);
+            }
             auto [postfix, divisor] = BytesToPostfixAndDivisor(info.size);
             char buffer[128]{};
             auto size = snprintf(buffer, std::size(buffer), "Size: %.1f %s", double(info.size) / divisor, postfix);
@@ -473,10 +1262,55 @@ namespace Fvog
     }
     {
       ZoneScopedN("Free generic");
-      std::erase_if(genericDeletionQueue_, [this, value](auto& fn) { return fn(value); });
+      // Callbacks may own resources whose destructors stage more deletions, which are picked up by the next call.
+      // The callbacks are run without holding the lock, as they may also free resources that call back into the device
+      auto genericDeletionQueue = std::exchange(genericDeletionQueue_, {});
+      lock.unlock();
+      std::erase_if(genericDeletionQueue, [value](auto& fn) { return fn(value); });
+      lock.lock();
+      genericDeletionQueue_.insert(genericDeletionQueue_.begin(), std::make_move_iterator(genericDeletionQueue.begin()), std::make_move_iterator(genericDeletionQueue.end()));
     }
   }
 
+  Device::DeletionStaging& Device::GetThreadDeletionStaging()
+  {
+    for (const auto& [id, staging] : threadDeletionStagings.stagings)
+    {
+      if (id == deviceId_)
+      {
+        return *staging;
+      }
+    }
+
+    auto lock = std::lock_guard{deletionStagingsMutex_};
+    const auto& staging = deletionStagings_.emplace_back(std::make_shared<DeletionStaging>());
+    threadDeletionStagings.stagings.push_back({deviceId_, staging});
+    return *staging;
+  }
+
+  void Device::DrainDeletionStagingLocked()
+  {
+    ZoneScoped;
+    auto stagingsLock = std::lock_guard{deletionStagingsMutex_};
+    std::erase_if(deletionStagings_, [this](const std::shared_ptr<DeletionStaging>& staging)
+    {
+      // Read before draining, so whatever the thread staged before it exited is drained below
+      const bool threadExited = staging->threadExited;
+      auto lock = std::lock_guard{staging->mutex};
+      std::ranges::move(staging->buffers, std::back_inserter(bufferDeletionQueue_));
+      std::ranges::move(staging->images, std::back_inserter(imageDeletionQueue_));
+      std::ranges::move(staging->imageViews, std::back_inserter(imageViewDeletionQueue_));
+      std::ranges::move(staging->descriptors, std::back_inserter(descriptorDeletionQueue_));
+      std::ranges::move(staging->generic, std::back_inserter(genericDeletionQueue_));
+      staging->buffers.clear();
+      staging->images.clear();
+      staging->imageViews.clear();
+      staging->descriptors.clear();
+      staging->generic.clear();
+      return threadExited;
+    });
+  }
+
   Device::DescriptorInfo::DescriptorInfo(DescriptorInfo&& old) noexcept
     : device_(std::exchange(old.device_, nullptr)),
       handle_(std::exchange(old.handle_, {}))
@@ -495,28 +1329,27 @@ namespace Fvog
   {
     if (handle_.type != ResourceType::INVALID)
     {
-      device_->descriptorDeletionQueue_.emplace_back(device_->frameNumber, handle_);
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.descriptors.emplace_back(device_->frameNumber, handle_);
     }
   }
 
-  Device::DescriptorInfo Device::AllocateStorageBufferDescriptor(VkBuffer buffer)
+  Device::DescriptorInfo Device::AllocateStorageBufferDescriptor(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
   {
     ZoneScoped;
     const auto myIdx = storageBufferDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(device_, 1, detail::Address(VkWriteDescriptorSet{
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSet_,
-      .dstBinding = storageBufferBinding,
-      .dstArrayElement = myIdx,
-      .descriptorCount = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      .pBufferInfo = detail::Address(VkDescriptorBufferInfo{
+    QueueDescriptorWrite({
+      .binding = storageBufferBinding,
+      .arrayElement = myIdx,
+      .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .bufferInfo = {
         .buffer = buffer,
-        .offset = 0,
-        .range = VK_WHOLE_SIZE,
-      }),
-    }), 0, nullptr);
+        .offset = offset,
+        .range = range,
+      },
+    });
 
     return DescriptorInfo{
       *this,
@@ -531,19 +1364,16 @@ namespace Fvog
     ZoneScoped;
     const auto myIdx = combinedImageSamplerDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(device_, 1, detail::Address(VkWriteDescriptorSet{
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSet_,
-      .dstBinding = combinedImageSamplerBinding,
-      .dstArrayElement = myIdx,
-      .descriptorCount = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      .pImageInfo = detail::Address(VkDescriptorImageInfo{
+    QueueDescriptorWrite({
+      .binding = combinedImageSamplerBinding,
+      .arrayElement = myIdx,
+      .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .imageInfo = {
         .sampler = sampler,
         .imageView = imageView,
         .imageLayout = imageLayout,
-      })
-    }), 0, nullptr);
+      },
+    });
 
     return DescriptorInfo{
       *this,
@@ -558,18 +1388,15 @@ namespace Fvog
     ZoneScoped;
     const auto myIdx = storageImageDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(device_, 1, detail::Address(VkWriteDescriptorSet{
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSet_,
-      .dstBinding = storageImageBinding,
-      .dstArrayElement = myIdx,
-      .descriptorCount = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-      .pImageInfo = detail::Address(VkDescriptorImageInfo{
+    QueueDescriptorWrite({
+      .binding = storageImageBinding,
+      .arrayElement = myIdx,
+      .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .imageInfo = {
         .imageView = imageView,
         .imageLayout = imageLayout,
-      })
-    }), 0, nullptr);
+      },
+    });
 
     return DescriptorInfo{
       *this,
@@ -584,18 +1411,15 @@ namespace Fvog
     ZoneScoped;
     const auto myIdx = sampledImageDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(device_, 1, detail::Address(VkWriteDescriptorSet{
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSet_,
-      .dstBinding = sampledImageBinding,
-      .dstArrayElement = myIdx,
-      .descriptorCount = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-      .pImageInfo = detail::Address(VkDescriptorImageInfo{
+    QueueDescriptorWrite({
+      .binding = sampledImageBinding,
+      .arrayElement = myIdx,
+      .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+      .imageInfo = {
         .imageView = imageView,
         .imageLayout = imageLayout,
-      })
-    }), 0, nullptr);
+      },
+    });
 
     return DescriptorInfo{
       *this,
@@ -610,17 +1434,14 @@ namespace Fvog
     ZoneScoped;
     const auto myIdx = samplerDescriptorAllocator.Allocate();
 
-    vkUpdateDescriptorSets(device_, 1, detail::Address(VkWriteDescriptorSet{
-      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSet_,
-      .dstBinding = samplerBinding,
-      .dstArrayElement = myIdx,
-      .descriptorCount = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
-      .pImageInfo = detail::Address(VkDescriptorImageInfo{
+    QueueDescriptorWrite({
+      .binding = samplerBinding,
+      .arrayElement = myIdx,
+      .type = VK_DESCRIPTOR_TYPE_SAMPLER,
+      .imageInfo = {
         .sampler = sampler,
-      })
-    }), 0, nullptr);
+      },
+    });
 
     return DescriptorInfo{
       *this,
@@ -630,23 +1451,234 @@ namespace Fvog
       }};
   }
 
+  void Device::QueueDescriptorWrite(const PendingDescriptorWrite& write)
+  {
+    auto lock = std::lock_guard{descriptorSetMutex_};
+    pendingDescriptorWrites_.push_back(write);
+    if (!batchDescriptorWrites_)
+    {
+      FlushDescriptorWritesLocked();
+    }
+  }
+
+  void Device::FlushDescriptorWrites()
+  {
+    auto lock = std::lock_guard{descriptorSetMutex_};
+    FlushDescriptorWritesLocked();
+  }
+
+  void Device::FlushDescriptorWritesLocked()
+  {
+    if (pendingDescriptorWrites_.empty())
+    {
+      return;
+    }
+
+    ZoneScoped;
+    const auto start = std::chrono::steady_clock::now();
+
+    auto writes = std::vector<VkWriteDescriptorSet>();
+    writes.reserve(pendingDescriptorWrites_.size());
+    for (const auto& pending : pendingDescriptorWrites_)
+    {
+      const bool isBuffer = pending.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes.push_back({
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet_,
+        .dstBinding = pending.binding,
+        .dstArrayElement = pending.arrayElement,
+        .descriptorCount = 1,
+        .descriptorType = pending.type,
+        .pImageInfo = isBuffer ? nullptr : &pending.imageInfo,
+        .pBufferInfo = isBuffer ? &pending.bufferInfo : nullptr,
+      });
+    }
+
+    // Writes are in the order they were queued, so if an index was freed and reused before flushing, its latest write wins
+    vkUpdateDescriptorSets(device_, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    pendingDescriptorWrites_.clear();
+
+    descriptorWriteCount_ += static_cast<uint32_t>(writes.size());
+    descriptorUpdateCount_++;
+    descriptorUpdateNanoseconds_ += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  const char* MemoryCategoryToString(MemoryCategory category)
+  {
+    switch (category)
+    {
+    case MemoryCategory::UNCATEGORIZED: return "Uncategorized";
+    case MemoryCategory::GEOMETRY: return "Geometry";
+    case MemoryCategory::MESHLET_INSTANCES: return "Meshlet Instances";
+    case MemoryCategory::TEXTURES: return "Textures";
+    case MemoryCategory::RENDER_TARGETS: return "Render Targets";
+    case MemoryCategory::VSM_PHYSICAL_PAGES: return "VSM Physical Pages";
+    case MemoryCategory::STAGING: return "Staging";
+    case MemoryCategory::DEBUG: return "Debug";
+    case MemoryCategory::COUNT:
+    default: assert(0); return "";
+    }
+  }
+
+  void Device::TrackAllocation(MemoryCategory category, VkDeviceSize bytes)
+  {
+    auto& counters = memoryCategoryCounters_[static_cast<size_t>(category)];
+    counters.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    counters.allocationCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Device::UntrackAllocation(MemoryCategory category, VkDeviceSize bytes)
+  {
+    auto& counters = memoryCategoryCounters_[static_cast<size_t>(category)];
+    counters.allocatedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    counters.allocationCount.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void Device::TrackSuballocation(MemoryCategory category, VkDeviceSize bytes)
+  {
+    memoryCategoryCounters_[static_cast<size_t>(category)].suballocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void Device::UntrackSuballocation(MemoryCategory category, VkDeviceSize bytes)
+  {
+    memoryCategoryCounters_[static_cast<size_t>(category)].suballocatedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  Device::MemoryCategoryUsage Device::GetMemoryUsage(MemoryCategory category) const
+  {
+    const auto& counters = memoryCategoryCounters_[static_cast<size_t>(category)];
+    return {
+      .allocatedBytes = counters.allocatedBytes.load(std::memory_order_relaxed),
+      .allocationCount = counters.allocationCount.load(std::memory_order_relaxed),
+      .suballocatedBytes = counters.suballocatedBytes.load(std::memory_order_relaxed),
+    };
+  }
+
+  Device::MemoryBudget Device::GetDeviceLocalMemoryBudget() const
+  {
+    // Search for the first heap with DEVICE_LOCAL_BIT.
+    // This could totally fail and report e.g. a host-visible BAR heap, but existing systems seem to put the normal device-local heap first anyway.
+    const auto& memoryProperties = physicalDevice_.memory_properties;
+    uint32_t deviceHeapIndex = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+      if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+      {
+        deviceHeapIndex = i;
+        break;
+      }
+    }
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS]{};
+    vmaGetHeapBudgets(allocator_, budgets);
+    return {
+      .usageBytes = budgets[deviceHeapIndex].usage,
+      .budgetBytes = budgets[deviceHeapIndex].budget,
+    };
+  }
+
+  bool Device::IsNearMemoryBudget(double fractionOfBudget) const
+  {
+    const auto budget = GetDeviceLocalMemoryBudget();
+    return double(budget.usageBytes) >= fractionOfBudget * double(budget.budgetBytes);
+  }
+
+  std::string Device::GetMemoryReportJson() const
+  {
+    ZoneScoped;
+    const auto budget = GetDeviceLocalMemoryBudget();
+
+    auto json = std::string();
+    char buffer[256]{};
+    snprintf(buffer,
+      std::size(buffer),
+      "{\n  \"deviceLocalUsageBytes\": %llu,\n  \"deviceLocalBudgetBytes\": %llu,\n  \"memoryBudgetExtension\": %s,\n  \"categories\": {\n",
+      (unsigned long long)budget.usageBytes,
+      (unsigned long long)budget.budgetBytes,
+      hasMemoryBudgetExtension_ ? "true" : "false");
+    json += buffer;
+
+    for (size_t i = 0; i < static_cast<size_t>(MemoryCategory::COUNT); i++)
+    {
+      const auto usage = GetMemoryUsage(static_cast<MemoryCategory>(i));
+      snprintf(buffer,
+        std::size(buffer),
+        "    \"%s\": { \"allocatedBytes\": %llu, \"allocationCount\": %llu, \"suballocatedBytes\": %llu }%s\n",
+        MemoryCategoryToString(static_cast<MemoryCategory>(i)),
+        (unsigned long long)usage.allocatedBytes,
+        (unsigned long long)usage.allocationCount,
+        (unsigned long long)usage.suballocatedBytes,
+        i + 1 < static_cast<size_t>(MemoryCategory::COUNT) ? "," : "");
+      json += buffer;
+    }
+
+    json += "  }\n}\n";
+    return json;
+  }
+
   Device::IndexAllocator::IndexAllocator(uint32_t numIndices)
+    : numIndices_(numIndices),
+      numWords_((numIndices + 63) / 64),
+      words_(std::make_unique<std::atomic<uint64_t>[]>(numWords_))
   {
-    for (auto i : std::ranges::reverse_view(std::views::iota(uint32_t(0), numIndices)))
+    for (uint32_t i = 0; i < numWords_; i++)
     {
-      freeSlots_.push(i);
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Permanently occupy the bits past the end so they are never handed out
+    if (const auto tail = numIndices % 64; tail != 0)
+    {
+      words_[numWords_ - 1].store(~uint64_t(0) << tail, std::memory_order_relaxed);
     }
   }
 
   uint32_t Device::IndexAllocator::Allocate()
   {
-    const auto index = freeSlots_.top();
-    freeSlots_.pop();
-    return index;
+    const auto start = searchStart_.load(std::memory_order_relaxed);
+    for (uint32_t n = 0; n < numWords_; n++)
+    {
+      const auto wordIndex = (start + n) % numWords_;
+      auto& word = words_[wordIndex];
+      auto bits = word.load(std::memory_order_relaxed);
+      while (bits != ~uint64_t(0))
+      {
+        const auto bit = std::countr_one(bits);
+        if (word.compare_exchange_weak(bits, bits | (uint64_t(1) << bit), std::memory_order_acquire, std::memory_order_relaxed))
+        {
+          searchStart_.store(wordIndex, std::memory_order_relaxed);
+          return wordIndex * 64 + static_cast<uint32_t>(bit);
+        }
+      }
+    }
+
+    throw std::runtime_error("Out of descriptor indices");
+  }
+
+  uint32_t Device::IndexAllocator::NumAllocated() const
+  {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < numWords_; i++)
+    {
+      count += static_cast<uint32_t>(std::popcount(words_[i].load(std::memory_order_relaxed)));
+    }
+
+    // Minus the permanently occupied bits past the end
+    return count - (numWords_ * 64 - numIndices_);
   }
 
   void Device::IndexAllocator::Free(uint32_t index)
   {
-    freeSlots_.push(index);
+    assert(index < numIndices_);
+    const auto wordIndex = index / 64;
+    [[maybe_unused]] const auto old = words_[wordIndex].fetch_and(~(uint64_t(1) << (index % 64)), std::memory_order_release);
+    assert(old & (uint64_t(1) << (index % 64)) && "Double free of descriptor index");
+
+    // Freed slots are likely to be reused soon, so steer the next search toward them
+    auto start = searchStart_.load(std::memory_order_relaxed);
+    if (wordIndex < start)
+    {
+      searchStart_.compare_exchange_strong(start, wordIndex, std::memory_order_relaxed);
+    }
   }
 } // namespace Fvog
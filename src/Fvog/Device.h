@@ -4,11 +4,15 @@
 
 #include <VkBootstrap.h>
 
+#include <atomic>
 #include <deque>
 #include <functional>
-#include <stack>
+#include <mutex>
+#include <span>
 #include <string>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <vk_mem_alloc.h>
 
@@ -24,10 +28,30 @@ namespace Fvog
     class SamplerCache;
   }
 
+  class StagingAllocator;
+  class SmallBufferPool;
+
+  // What a resource's memory is used for. Only affects accounting
+  enum class MemoryCategory : uint32_t
+  {
+    UNCATEGORIZED,
+    GEOMETRY,
+    MESHLET_INSTANCES,
+    TEXTURES,
+    RENDER_TARGETS,
+    VSM_PHYSICAL_PAGES,
+    STAGING,
+    DEBUG,
+
+    COUNT,
+  };
+
+  [[nodiscard]] const char* MemoryCategoryToString(MemoryCategory category);
+
   class Device
   {
   public:
-    Device(vkb::Instance& instance, VkSurfaceKHR surface);
+    Device(vkb::Instance& instance, VkSurfaceKHR surface, uint32_t framesInFlight = 2);
     ~Device();
 
     Device(const Device&) = delete;
@@ -39,26 +63,62 @@ namespace Fvog
     // Everything is public :(
   //private:
     // Things that shouldn't be in this class, but are because I'm lazy:
-    constexpr static uint32_t frameOverlap = 2;
+    // The number of frames that the CPU may record ahead of the GPU can be changed at runtime, up to this many.
+    // More frames in flight absorb CPU spikes at the cost of latency
+    constexpr static uint32_t maxFramesInFlight = 4;
 
     struct PerFrameData
     {
       VkCommandPool commandPool;
+      // The graphics command buffer being recorded. Changes when the frame's graphics work is split into several submissions
       VkCommandBuffer commandBuffer;
       uint64_t renderTimelineSemaphoreWaitValue{};
       VkSemaphore swapchainSemaphore;
       VkSemaphore renderSemaphore;
+
+      // Semaphores that the frame's next graphics submission waits on
+      std::vector<VkSemaphoreSubmitInfo> graphicsWaits;
+      // Command buffers are allocated on demand and reused when the frame comes around again
+      std::vector<VkCommandBuffer> graphicsCommandBuffers;
+      uint32_t graphicsCommandBuffersUsed{};
+      VkCommandPool computeCommandPool;
+      std::vector<VkCommandBuffer> computeCommandBuffers;
+      uint32_t computeCommandBuffersUsed{};
+      uint64_t computeTimelineSemaphoreWaitValue{};
+
+      // Secondary command buffers recorded on worker threads. Each thread that has recorded in this frame slot gets its own pool
+      struct WorkerCommandPool
+      {
+        std::thread::id thread;
+        VkCommandPool commandPool{};
+        std::vector<VkCommandBuffer> commandBuffers;
+        uint32_t commandBuffersUsed{};
+      };
+      std::vector<std::unique_ptr<WorkerCommandPool>> workerCommandPools;
     };
 
-    PerFrameData frameData[frameOverlap]{};
+    // One per frame in flight. Per-frame resources elsewhere are indexed by frameNumber % FramesInFlight() and resized when it changes
+    std::vector<PerFrameData> frameData;
 
-    uint64_t frameNumber{};
+    // Atomic so resources can be destroyed (and their frame of last use recorded) on worker threads
+    std::atomic<uint64_t> frameNumber{};
 
     PerFrameData& GetCurrentFrameData()
     {
-      return frameData[frameNumber % frameOverlap];
+      return frameData[frameNumber % frameData.size()];
+    }
+
+    [[nodiscard]] uint32_t FramesInFlight() const noexcept
+    {
+      return static_cast<uint32_t>(frameData.size());
     }
 
+    // Clamped to [1, maxFramesInFlight]. Waits for the device to be idle, so every frame slot has retired and can be
+    // remapped. Must be called between frames
+    void SetFramesInFlight(uint32_t count);
+    void CreateFrameData(PerFrameData& frame);
+    void DestroyFrameData(PerFrameData& frame);
+
     vkb::Instance& instance_;
     VkSurfaceKHR surface_; // Not owned
 
@@ -70,12 +130,97 @@ namespace Fvog
     // Immediate submit stuff
     VkCommandPool immediateSubmitCommandPool_{};
     VkCommandBuffer immediateSubmitCommandBuffer_{};
-    // TODO: maybe this should return a u64 representing a timeline semaphore value that can be waited on
-    void ImmediateSubmit(const std::function<void(VkCommandBuffer)>& function) const;
+    VkSemaphore immediateSubmitTimelineSemaphore_{};
+    uint64_t immediateSubmitTimelineValue_{};
+    std::mutex immediateSubmitMutex_;
+    // Blocks until the submitted commands complete. Prefer Upload for anything that only copies data
+    void ImmediateSubmit(const std::function<void(VkCommandBuffer)>& function);
+
+    // Upload stuff
+    // A resource written by an upload that must be handed from the transfer queue family to the graphics queue family.
+    // Images must be in the given layout by the end of the upload, as no layout transition is performed during the transfer.
+    struct UploadOwnershipTransfer
+    {
+      VkBuffer buffer{};
+      VkImage image{};
+      VkImageLayout layout{};
+      VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    };
+
+    // Submits commands to the transfer queue without waiting for them to complete.
+    // Returns the value transferQueueTimelineSemaphore_ will reach once the commands complete.
+    // Resources listed in ownershipTransfers are acquired by the graphics queue in the first frame (or immediate submit)
+    // recorded after the upload completes, and must not be accessed on the graphics queue before then.
+    [[nodiscard]] uint64_t Upload(const std::function<void(VkCommandBuffer)>& function, std::span<const UploadOwnershipTransfer> ownershipTransfers = {});
+    [[nodiscard]] bool IsUploadComplete(uint64_t uploadValue) const;
+    void WaitForUpload(uint64_t uploadValue) const;
+
+    // Records acquire barriers for uploaded resources that were released by the transfer queue.
+    // If onlyCompleted is true, uploads that are still executing are left for a later call so the caller never has to wait on them.
+    // Returns the transfer timeline value that the submission containing commandBuffer must wait on.
+    [[nodiscard]] uint64_t AcquireUploadedResources(VkCommandBuffer commandBuffer, bool onlyCompleted);
+
+    // Keeps an object (typically a staging buffer) alive until an upload has completed.
+    template<class T>
+    void DestroyAfterUpload(uint64_t uploadValue, T&& object)
+    {
+      auto& staging = GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.generic.emplace_back(
+        [this, uploadValue, keepAlive = std::make_shared<std::remove_cvref_t<T>>(std::forward<T>(object))](uint64_t) -> bool
+        {
+          return IsUploadComplete(uploadValue);
+        });
+    }
 
     void FreeUnusedResources();
 
+    // Memory accounting
+    struct MemoryCategoryUsage
+    {
+      // Memory backing resources of this category
+      uint64_t allocatedBytes{};
+      uint64_t allocationCount{};
+      // Memory handed out by suballocators (e.g., ManagedBuffer) whose backing buffer is of this category
+      uint64_t suballocatedBytes{};
+    };
+
+    struct MemoryBudget
+    {
+      uint64_t usageBytes{};
+      uint64_t budgetBytes{};
+    };
+
+    void TrackAllocation(MemoryCategory category, VkDeviceSize bytes);
+    void UntrackAllocation(MemoryCategory category, VkDeviceSize bytes);
+    void TrackSuballocation(MemoryCategory category, VkDeviceSize bytes);
+    void UntrackSuballocation(MemoryCategory category, VkDeviceSize bytes);
+
+    [[nodiscard]] MemoryCategoryUsage GetMemoryUsage(MemoryCategory category) const;
+
+    // Usage and budget of the first device-local heap. The budget is affected by factors external to this program,
+    // and is only an estimate if VK_EXT_memory_budget is unsupported
+    [[nodiscard]] MemoryBudget GetDeviceLocalMemoryBudget() const;
+
+    // Systems that can defer allocations (e.g., loading and streaming) should back off while this is true
+    [[nodiscard]] bool IsNearMemoryBudget(double fractionOfBudget = 0.9) const;
+
+    [[nodiscard]] std::string GetMemoryReportJson() const;
+
+    struct MemoryCategoryCounters
+    {
+      std::atomic<uint64_t> allocatedBytes;
+      std::atomic<uint64_t> allocationCount;
+      std::atomic<uint64_t> suballocatedBytes;
+    };
+
+    MemoryCategoryCounters memoryCategoryCounters_[static_cast<size_t>(MemoryCategory::COUNT)]{};
+    bool hasMemoryBudgetExtension_{};
+    // VK_EXT_mesh_shader with task and mesh shaders. Optional, so anything that uses them needs a fallback
+    bool supportsMeshShaders_{};
+
     // Descriptor stuff
+    // Lock-free allocator for descriptor indices. A set bit means the index is in use.
     class IndexAllocator
     {
     public:
@@ -84,8 +229,15 @@ namespace Fvog
       [[nodiscard]] uint32_t Allocate();
       void Free(uint32_t index);
 
+      // Number of indices in use. Only exact while no other thread is allocating or freeing
+      [[nodiscard]] uint32_t NumAllocated() const;
+
     private:
-      std::stack<uint32_t> freeSlots_;
+      uint32_t numIndices_{};
+      uint32_t numWords_{};
+      std::unique_ptr<std::atomic<uint64_t>[]> words_;
+      // Word at which to start searching for a free bit. Only a hint, so relaxed ordering is fine
+      std::atomic<uint32_t> searchStart_{};
     };
 
     constexpr static uint32_t maxResourceDescriptors = 100'000;
@@ -103,8 +255,42 @@ namespace Fvog
     VkDescriptorPool descriptorPool_{};
     VkDescriptorSetLayout descriptorSetLayout_{};
     VkDescriptorSet descriptorSet_{};
+    // Writes to descriptorSet_ must be externally synchronized. Also guards pendingDescriptorWrites_
+    std::mutex descriptorSetMutex_;
+
+    // The Allocate*Descriptor functions queue their writes, which are made in one vkUpdateDescriptorSets call before the
+    // next submission. Every binding is update-after-bind, so the set may be bound by commands that are being recorded or executed
+    struct PendingDescriptorWrite
+    {
+      uint32_t binding{};
+      uint32_t arrayElement{};
+      VkDescriptorType type{};
+      VkDescriptorBufferInfo bufferInfo{};
+      VkDescriptorImageInfo imageInfo{};
+    };
+    std::vector<PendingDescriptorWrite> pendingDescriptorWrites_;
+    // If false, every write is made immediately (one vkUpdateDescriptorSets call per descriptor), for comparison
+    bool batchDescriptorWrites_ = true;
+    void QueueDescriptorWrite(const PendingDescriptorWrite& write);
+    // Called before every submission that may use descriptors. Thread-safe
+    void FlushDescriptorWrites();
+    void FlushDescriptorWritesLocked();
+    // Host time spent writing descriptors, for comparing batched writes with immediate ones
+    std::atomic<uint32_t> descriptorWriteCount_{};
+    std::atomic<uint32_t> descriptorUpdateCount_{};
+    std::atomic<uint64_t> descriptorUpdateNanoseconds_{};
     VkPipelineLayout defaultPipelineLayout{};
 
+    // Pipeline cache stuff
+    // Passed to every pipeline creation. Loaded from pipelineCachePath at startup and saved there at shutdown
+    static constexpr const char* pipelineCachePath = "pipeline_cache.bin";
+    VkPipelineCache pipelineCache_{};
+    // Size of the data the cache was created with. Zero if the file was missing, damaged, or made by a different device or driver
+    size_t pipelineCacheInitialBytes_{};
+    // Host time spent creating pipelines, for comparing startup with a cold and a warm cache
+    std::atomic<uint64_t> pipelineCreationNanoseconds_{};
+    std::atomic<uint32_t> pipelineCreationCount_{};
+
     enum class ResourceType : uint32_t
     {
       INVALID,
@@ -142,7 +328,7 @@ namespace Fvog
       ResourceHandle handle_{};
     };
 
-    DescriptorInfo AllocateStorageBufferDescriptor(VkBuffer buffer);
+    DescriptorInfo AllocateStorageBufferDescriptor(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
     DescriptorInfo AllocateCombinedImageSamplerDescriptor(VkSampler sampler, VkImageView imageView, VkImageLayout imageLayout);
     DescriptorInfo AllocateStorageImageDescriptor(VkImageView imageView, VkImageLayout imageLayout);
     DescriptorInfo AllocateSampledImageDescriptor(VkImageView imageView, VkImageLayout imageLayout);
@@ -152,6 +338,81 @@ namespace Fvog
     VkQueue graphicsQueue_{};
     uint32_t graphicsQueueFamilyIndex_{};
     VkSemaphore graphicsQueueTimelineSemaphore_{};
+    // Must be held when submitting to or presenting on graphicsQueue_
+    std::mutex graphicsQueueMutex_;
+
+    // Signaled by graphics submissions made partway through a frame, so other queues can wait on them
+    VkSemaphore graphicsQueueSplitTimelineSemaphore_{};
+    uint64_t graphicsSplitTimelineValue_{};
+
+    // A second queue in the graphics family, or graphicsQueue_ itself if the family only has one.
+    // Submissions to it must also hold graphicsQueueMutex_
+    VkQueue computeQueue_{};
+    VkSemaphore computeQueueTimelineSemaphore_{};
+    uint64_t computeTimelineValue_{};
+
+    [[nodiscard]] bool HasAsyncComputeQueue() const noexcept
+    {
+      return computeQueue_ != graphicsQueue_;
+    }
+
+    // Resets the current frame's command pools. The frame's first graphics command buffer becomes GetCurrentFrameData().commandBuffer
+    void ResetFrameCommandPools();
+
+    // Makes the current frame's next graphics submission wait for the semaphore
+    void AddFrameWait(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags2 stages);
+
+    // Submits the current frame's graphics command buffer and begins another in its place, with the bindless descriptor set bound.
+    // Returns the value graphicsQueueSplitTimelineSemaphore_ will reach once the submitted commands complete
+    [[nodiscard]] uint64_t SplitFrameCommandBuffer();
+
+    // Begins a command buffer for computeQueue_ with the bindless descriptor set bound
+    [[nodiscard]] VkCommandBuffer BeginFrameComputeCommandBuffer();
+
+    // Returns the value computeQueueTimelineSemaphore_ will reach once the commands complete
+    [[nodiscard]] uint64_t SubmitFrameComputeCommandBuffer(VkCommandBuffer commandBuffer, std::span<const VkSemaphoreSubmitInfo> waits);
+
+    // May be called from any thread. Begins a secondary command buffer from the calling thread's pool for the current frame,
+    // with the bindless descriptor set bound. It must be executed by a command buffer of the same frame
+    [[nodiscard]] VkCommandBuffer BeginFrameSecondaryCommandBuffer();
+    // Guards the list of worker pools in each PerFrameData, not the pools themselves
+    std::mutex workerCommandPoolsMutex_;
+
+    // May be the same queue as graphicsQueue_ if the device has no separate transfer queue family
+    VkQueue transferQueue_{};
+    uint32_t transferQueueFamilyIndex_{};
+    VkSemaphore transferQueueTimelineSemaphore_{};
+
+    [[nodiscard]] bool HasDedicatedTransferQueue() const noexcept
+    {
+      return transferQueueFamilyIndex_ != graphicsQueueFamilyIndex_;
+    }
+
+    struct InFlightUpload
+    {
+      uint64_t uploadValue{};
+      VkCommandBuffer commandBuffer{};
+    };
+
+    struct PendingOwnershipAcquire
+    {
+      uint64_t uploadValue{};
+      UploadOwnershipTransfer transfer{};
+    };
+
+    // Guards everything below, as well as transferQueue_ when it is dedicated
+    std::mutex uploadMutex_;
+    VkCommandPool uploadCommandPool_{};
+    uint64_t uploadTimelineValue_{};
+    std::deque<InFlightUpload> inFlightUploads_;
+    std::vector<VkCommandBuffer> freeUploadCommandBuffers_;
+    std::deque<PendingOwnershipAcquire> pendingOwnershipAcquires_;
+
+    // Guards every deletion queue below. Only FreeUnusedResources touches them, after moving in what the threads staged
+    std::mutex deletionQueueMutex_;
+
+    // Frees every queued or staged resource whose last use is at or before the graphics timeline value
+    void FreeResourcesLastUsedBy(uint64_t value);
 
     struct BufferDeleteInfo
     {
@@ -159,6 +420,7 @@ namespace Fvog
       VmaAllocation allocation{};
       VkBuffer buffer{};
       std::string name;
+      MemoryCategory category{};
     };
 
     std::deque<BufferDeleteInfo> bufferDeletionQueue_;
@@ -169,6 +431,7 @@ namespace Fvog
       VmaAllocation allocation{};
       VkImage image{};
       std::string name;
+      MemoryCategory category{};
     };
 
     std::deque<ImageDeleteInfo> imageDeletionQueue_;
@@ -189,8 +452,37 @@ namespace Fvog
 
     std::deque<DescriptorDeleteInfo> descriptorDeletionQueue_;
 
+    // Resources may be destroyed on any thread. Each thread stages its deletions in lists of its own, so destroying a resource
+    // only takes a lock that FreeUnusedResources contends for, never another destroying thread
+    struct DeletionStaging
+    {
+      std::mutex mutex;
+      std::vector<BufferDeleteInfo> buffers;
+      std::vector<ImageDeleteInfo> images;
+      std::vector<ImageViewDeleteInfo> imageViews;
+      std::vector<DescriptorDeleteInfo> descriptors;
+      std::vector<std::function<bool(uint64_t)>> generic;
+      // Set when the thread exits, after which it stages nothing more and the lists are dropped once they're drained
+      std::atomic<bool> threadExited{false};
+    };
+
+    // Returns the calling thread's staging lists, creating them the first time the thread destroys something
+    [[nodiscard]] DeletionStaging& GetThreadDeletionStaging();
+    // Moves every thread's staged deletions into the deletion queues. Requires deletionQueueMutex_
+    void DrainDeletionStagingLocked();
+    // Guards deletionStagings_, not the lists in them
+    std::mutex deletionStagingsMutex_;
+    // Shared with the threads, so a thread that outlives the device doesn't hold a dangling pointer
+    std::vector<std::shared_ptr<DeletionStaging>> deletionStagings_;
+    // Identifies this device in the threads' cached staging pointers, as a new device may be created where a destroyed one was
+    uint64_t deviceId_{};
+
     std::unique_ptr<detail::SamplerCache> samplerCache_;
 
+    std::unique_ptr<StagingAllocator> stagingAllocator_;
+
+    std::unique_ptr<SmallBufferPool> smallBufferPool_;
+
     std::deque<std::function<bool(uint64_t)>> genericDeletionQueue_;
   };
 }
@@ -10,6 +10,7 @@
 #include <tracy/Tracy.hpp>
 
 #include <array>
+#include <chrono>
 #include <cassert>
 #include <utility>
 #include <vector>
@@ -28,13 +29,40 @@ namespace Fvog
 
     auto stages = std::vector<VkPipelineShaderStageCreateInfo>();
     
-    assert(info.vertexShader);
-    stages.emplace_back(VkPipelineShaderStageCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-      .stage = VK_SHADER_STAGE_VERTEX_BIT,
-      .module = info.vertexShader->Handle(),
-      .pName = "main",
-    });
+    // Mesh pipelines have no vertex input or input assembly state
+    const bool isMeshPipeline = info.meshShader != nullptr;
+    assert(isMeshPipeline != (info.vertexShader != nullptr));
+    assert(!info.taskShader || isMeshPipeline);
+    assert(!isMeshPipeline || device.supportsMeshShaders_);
+
+    if (info.taskShader)
+    {
+      stages.emplace_back(VkPipelineShaderStageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_TASK_BIT_EXT,
+        .module = info.taskShader->Handle(),
+        .pName = "main",
+      });
+    }
+
+    if (isMeshPipeline)
+    {
+      stages.emplace_back(VkPipelineShaderStageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_MESH_BIT_EXT,
+        .module = info.meshShader->Handle(),
+        .pName = "main",
+      });
+    }
+    else
+    {
+      stages.emplace_back(VkPipelineShaderStageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = info.vertexShader->Handle(),
+        .pName = "main",
+      });
+    }
 
     if (info.fragmentShader)
     {
@@ -72,9 +100,10 @@ namespace Fvog
       colorAttachmentFormatsVk[i] = detail::FormatToVk(info.renderTargetFormats.colorAttachmentFormats[i]);
     }
 
+    const auto creationStart = std::chrono::steady_clock::now();
     CheckVkResult(vkCreateGraphicsPipelines(
       device.device_,
-      nullptr,
+      device.pipelineCache_,
       1,
       Address(VkGraphicsPipelineCreateInfo{
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
@@ -87,10 +116,10 @@ namespace Fvog
         }),
         .stageCount = (uint32_t)stages.size(),
         .pStages = stages.data(),
-        .pVertexInputState = Address(VkPipelineVertexInputStateCreateInfo{
+        .pVertexInputState = isMeshPipeline ? nullptr : Address(VkPipelineVertexInputStateCreateInfo{
           .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         }),
-        .pInputAssemblyState = Address(VkPipelineInputAssemblyStateCreateInfo{
+        .pInputAssemblyState = isMeshPipeline ? nullptr : Address(VkPipelineInputAssemblyStateCreateInfo{
           .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
           .topology = info.inputAssemblyState.topology,
           .primitiveRestartEnable = info.inputAssemblyState.primitiveRestartEnable,
@@ -151,6 +180,8 @@ namespace Fvog
       }),
       nullptr,
       &pipeline_));
+    device_->pipelineCreationNanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - creationStart).count();
+    device_->pipelineCreationCount_++;
     
     // TODO: gate behind compile-time switch
     vkSetDebugUtilsObjectNameEXT(device_->device_, detail::Address(VkDebugUtilsObjectNameInfoEXT{
@@ -170,8 +201,10 @@ namespace Fvog
     // TODO: put this into a queue for delayed deletion
     if (device_)
     {
-      device_->genericDeletionQueue_.emplace_back(
-        [device = device_, pipeline = pipeline_, frameOfLastUse = device_->frameNumber](uint64_t value) -> bool {
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.generic.emplace_back(
+        [device = device_, pipeline = pipeline_, frameOfLastUse = device_->frameNumber.load()](uint64_t value) -> bool {
           if (value >= frameOfLastUse)
           {
             vkDestroyPipeline(device->device_, pipeline, nullptr);
@@ -206,9 +239,10 @@ namespace Fvog
     ZoneNamed(_, true);
     ZoneNameV(_, name_.data(), name_.size());
 
+    const auto creationStart = std::chrono::steady_clock::now();
     CheckVkResult(vkCreateComputePipelines(
       device_->device_,
-      nullptr,
+      device_->pipelineCache_,
       1,
       Address(VkComputePipelineCreateInfo{
         .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
@@ -222,6 +256,8 @@ namespace Fvog
       }),
       nullptr,
       &pipeline_));
+    device_->pipelineCreationNanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - creationStart).count();
+    device_->pipelineCreationCount_++;
     
     // TODO: gate behind compile-time switch
     vkSetDebugUtilsObjectNameEXT(device_->device_, detail::Address(VkDebugUtilsObjectNameInfoEXT{
@@ -130,9 +130,15 @@ namespace Fvog
     /// @brief An optional name for viewing in a graphics debugger
     std::string name = {};
 
-    /// @brief Non-null pointer to a vertex shader
+    /// @brief Non-null pointer to a vertex shader, unless meshShader is set
     const Shader* vertexShader            = nullptr;
 
+    /// @brief Optional pointer to a task shader. Requires meshShader
+    const Shader* taskShader              = nullptr;
+
+    /// @brief Optional pointer to a mesh shader, which replaces the vertex shader and input assembly
+    const Shader* meshShader              = nullptr;
+
     /// @brief Optional pointer to a fragment shader
     const Shader* fragmentShader          = nullptr;
 
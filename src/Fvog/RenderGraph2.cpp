@@ -0,0 +1,856 @@
+#include "RenderGraph2.h"
+
+#include "Buffer2.h"
+#include "Device.h"
+#include "Rendering2.h"
+#include "Texture2.h"
+#include "detail/ApiToEnum2.h"
+#include "detail/Common.h"
+
+#include <volk.h>
+
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <execution>
+#include <unordered_set>
+#include <utility>
+
+namespace Fvog
+{
+  namespace
+  {
+    constexpr VkAccessFlags2 writeAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+                                               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |
+                                               VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+    constexpr uint32_t graphicsQueue = 0;
+    constexpr uint32_t computeQueue = 1;
+
+    VkImageAspectFlags GetAspectMask(const Texture& texture)
+    {
+      VkImageAspectFlags aspectMask{};
+      aspectMask |= detail::FormatIsColor(texture.GetCreateInfo().format) ? VK_IMAGE_ASPECT_COLOR_BIT : 0;
+      aspectMask |= detail::FormatIsDepth(texture.GetCreateInfo().format) ? VK_IMAGE_ASPECT_DEPTH_BIT : 0;
+      aspectMask |= detail::FormatIsStencil(texture.GetCreateInfo().format) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0;
+      return aspectMask;
+    }
+  } // namespace
+
+  struct RenderGraph::BarrierBatch
+  {
+    // Same-layout image barriers are merged into a global memory barrier, see Context::ImageBarrier
+    VkMemoryBarrier2 memoryBarrier{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+  };
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+  {
+    return Access(buffer, stages, access);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+  {
+    return Access(buffer, stages, access);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::ReadWrite(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+  {
+    return Access(buffer, stages, access);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(Texture& texture, VkPipelineStageFlags2 stages)
+  {
+    const auto layout = GetSampledImageLayout(texture.GetCreateInfo().usage, texture.GetCreateInfo().format);
+    return Access(texture, stages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT, layout);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(Texture& texture, VkPipelineStageFlags2 stages, bool discard)
+  {
+    return Access(texture, stages, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, discard);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::ReadWrite(Texture& texture, VkPipelineStageFlags2 stages)
+  {
+    return Access(texture, stages, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::ColorAttachment(Texture& texture, VkAttachmentLoadOp loadOp)
+  {
+    return Access(texture,
+      VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+      loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::DepthAttachment(Texture& texture, VkAttachmentLoadOp loadOp)
+  {
+    return Access(texture,
+      VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+      VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
+      loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Access(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+  {
+    for (auto& usage : pass_->usages)
+    {
+      if (auto** other = std::get_if<Buffer*>(&usage.resource); other && (*other)->GetDeviceAddress() == buffer.GetDeviceAddress())
+      {
+        usage.stages |= stages;
+        usage.access |= access;
+        return *this;
+      }
+    }
+
+    pass_->usages.emplace_back(&buffer, stages, access);
+    return *this;
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Access(Texture& texture, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout, bool discard)
+  {
+    for (auto& usage : pass_->usages)
+    {
+      if (auto** other = std::get_if<Texture*>(&usage.resource); other && (*other)->Image() == texture.Image())
+      {
+        // A texture can only be in one layout for the duration of a pass
+        assert(usage.layout == layout);
+        usage.stages |= stages;
+        usage.access |= access;
+        usage.discard = usage.discard && discard;
+        return *this;
+      }
+    }
+
+    pass_->usages.emplace_back(&texture, stages, access, layout, discard);
+    return *this;
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::SideEffects()
+  {
+    pass_->sideEffects = true;
+    return *this;
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::AsyncCompute()
+  {
+    pass_->asyncCompute = true;
+    return *this;
+  }
+
+  RenderGraph::PassBuilder& RenderGraph::PassBuilder::Parallel()
+  {
+    pass_->parallel = true;
+    return *this;
+  }
+
+  RenderGraph::RenderGraph(Device& device)
+    : device_(&device)
+  {
+    ResizeFrameSlots();
+  }
+
+  RenderGraph::~RenderGraph()
+  {
+    if (timestampQueryPool_)
+    {
+      vkDestroyQueryPool(device_->device_, timestampQueryPool_, nullptr);
+    }
+  }
+
+  void RenderGraph::ResizeFrameSlots()
+  {
+    frameTimestamps_.assign(device_->FramesInFlight(), {});
+    if (!device_->HasAsyncComputeQueue())
+    {
+      return;
+    }
+
+    if (timestampQueryPool_)
+    {
+      vkDestroyQueryPool(device_->device_, timestampQueryPool_, nullptr);
+    }
+
+    // Every slot's queries are reset before they are first written
+    detail::CheckVkResult(vkCreateQueryPool(device_->device_,
+      detail::Address(VkQueryPoolCreateInfo{
+        .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = maxTimestampsPerFrame * device_->FramesInFlight(),
+      }),
+      nullptr,
+      &timestampQueryPool_));
+  }
+
+  void RenderGraph::AddPass(std::string name, const std::function<void(PassBuilder&)>& setup, std::function<void(VkCommandBuffer)> execute)
+  {
+    auto& pass = passes_.emplace_back(std::move(name), std::vector<Usage>{}, std::move(execute));
+    auto builder = PassBuilder(pass);
+    setup(builder);
+  }
+
+  void RenderGraph::Export(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+  {
+    exports_.emplace_back(&buffer, stages, access);
+  }
+
+  void RenderGraph::Export(Texture& texture, VkImageLayout layout, VkPipelineStageFlags2 stages, VkAccessFlags2 access)
+  {
+    exports_.emplace_back(&texture, stages, access, layout);
+  }
+
+  VkCommandBuffer RenderGraph::Execute(VkCommandBuffer commandBuffer)
+  {
+    ZoneScoped;
+    assert(commandBuffer == device_->GetCurrentFrameData().commandBuffer);
+    const auto startTime = std::chrono::steady_clock::now();
+    auto ctx = Context(*device_, commandBuffer);
+    stats_ = {};
+
+    // The number of frames in flight only changes while the device is idle, so the old queries can be dropped
+    if (frameTimestamps_.size() != device_->FramesInFlight())
+    {
+      ResizeFrameSlots();
+    }
+
+    // The device waited for this frame slot's previous submissions before the frame began
+    frameSlot_ = static_cast<uint32_t>(device_->frameNumber % frameTimestamps_.size());
+    ReadTimestamps();
+
+    // Walk backward from the exports to find the passes whose writes are consumed
+    auto isLive = std::vector<bool>(passes_.size());
+    {
+      auto needed = std::unordered_set<ResourceHandle>();
+      for (const auto& usage : exports_)
+      {
+        needed.emplace(GetHandle(usage));
+      }
+
+      for (size_t i = passes_.size(); i-- > 0;)
+      {
+        const auto& pass = passes_[i];
+        isLive[i] = pass.sideEffects;
+        for (const auto& usage : pass.usages)
+        {
+          if ((usage.access & writeAccessMask) && needed.contains(GetHandle(usage)))
+          {
+            isLive[i] = true;
+          }
+        }
+
+        if (!isLive[i])
+        {
+          stats_.culledPasses++;
+          continue;
+        }
+
+        // Writes that discard the previous contents don't depend on earlier passes. Everything else might
+        for (const auto& usage : pass.usages)
+        {
+          if (usage.discard)
+          {
+            needed.erase(GetHandle(usage));
+          }
+          else
+          {
+            needed.emplace(GetHandle(usage));
+          }
+        }
+      }
+    }
+
+    // Uploads and anything else recorded before the graph
+    ctx.Barrier();
+    stats_.barrierBatches++;
+    stats_.memoryBarriers++;
+
+    OpenSegment(graphicsQueue);
+    queues_[graphicsQueue].empty = false;
+    firstGraphicsSegment_ = queues_[graphicsQueue].segment;
+
+    // The previous frame's compute work may not have been waited on by its graphics work
+    queues_[graphicsQueue].waitedValue = 0;
+    queues_[computeQueue].waitedValue = 0;
+    if (device_->HasAsyncComputeQueue() && device_->computeTimelineValue_ > 0)
+    {
+      device_->AddFrameWait(device_->computeQueueTimelineSemaphore_, device_->computeTimelineValue_, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+      queues_[graphicsQueue].waitedValue = device_->computeTimelineValue_;
+    }
+
+    auto getQueue = [this](const Pass& pass) { return pass.asyncCompute && device_->HasAsyncComputeQueue() ? computeQueue : graphicsQueue; };
+
+    auto batch = BarrierBatch{};
+    auto parallelRun = std::vector<Pass*>();
+    for (size_t i = 0; i < passes_.size(); i++)
+    {
+      if (!isLive[i])
+      {
+        continue;
+      }
+
+      auto& pass = passes_[i];
+      const auto queue = getQueue(pass);
+      if (!pass.parallel || !parallelRecording)
+      {
+        RecordPass(pass, queue, batch);
+        continue;
+      }
+
+      // Extend the run while each texture keeps one layout, so the layouts the passes see while recording are the ones they'll execute with
+      parallelRun.clear();
+      parallelRun.push_back(&pass);
+      auto runLayouts = std::unordered_map<VkImage, VkImageLayout>();
+      auto addLayouts = [&runLayouts](const Pass& p)
+      {
+        for (const auto& usage : p.usages)
+        {
+          if (auto* texture = std::get_if<Texture*>(&usage.resource))
+          {
+            if (auto [it, inserted] = runLayouts.try_emplace((*texture)->Image(), usage.layout); !inserted && it->second != usage.layout)
+            {
+              return false;
+            }
+          }
+        }
+        return true;
+      };
+      addLayouts(pass);
+
+      for (size_t j = i + 1; j < passes_.size(); j++)
+      {
+        if (!isLive[j])
+        {
+          continue;
+        }
+
+        auto& next = passes_[j];
+        if (!next.parallel || getQueue(next) != queue || !addLayouts(next))
+        {
+          break;
+        }
+        parallelRun.push_back(&next);
+        i = j;
+      }
+
+      if (parallelRun.size() == 1)
+      {
+        RecordPass(pass, queue, batch);
+      }
+      else
+      {
+        RecordPassesInParallel(parallelRun, queue);
+      }
+    }
+
+    // Whatever comes after the graph is recorded on the graphics queue
+    for (const auto& usage : exports_)
+    {
+      Synchronize(graphicsQueue, usage);
+    }
+    for (const auto& usage : exports_)
+    {
+      AddBarriers(batch, usage, graphicsQueue);
+    }
+    FlushBarriers(queues_[graphicsQueue].commandBuffer, batch);
+
+    if (queues_[computeQueue].commandBuffer)
+    {
+      CloseSegment(computeQueue);
+    }
+
+    auto& graphics = queues_[graphicsQueue];
+    if (const auto endTimestamp = WriteTimestamp(graphics.commandBuffer); graphics.beginTimestamp != UINT32_MAX && endTimestamp != UINT32_MAX)
+    {
+      frameTimestamps_[frameSlot_].intervals.emplace_back(graphicsQueue, graphics.beginTimestamp, endTimestamp);
+    }
+
+    passes_.clear();
+    exports_.clear();
+    states_.clear();
+
+    stats_.recordMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    return graphics.commandBuffer;
+  }
+
+  void RenderGraph::RecordPass(Pass& pass, uint32_t queue, BarrierBatch& batch)
+  {
+    ZoneNamedN(passZone, "Pass", true);
+    ZoneNameV(passZone, pass.name.data(), pass.name.size());
+    stats_.passes++;
+
+    for (const auto& usage : pass.usages)
+    {
+      Synchronize(queue, usage);
+    }
+
+    if (!queues_[queue].commandBuffer)
+    {
+      OpenSegment(queue);
+    }
+
+    auto& recording = queues_[queue];
+    for (const auto& usage : pass.usages)
+    {
+      AddBarriers(batch, usage, queue);
+    }
+    FlushBarriers(recording.commandBuffer, batch);
+
+    auto marker = Context(*device_, recording.commandBuffer).MakeScopedDebugMarker(pass.name.c_str());
+    pass.execute(recording.commandBuffer);
+    recording.empty = false;
+  }
+
+  void RenderGraph::RecordPassesInParallel(std::span<Pass* const> passes, uint32_t queue)
+  {
+    ZoneScoped;
+    stats_.passes += static_cast<uint32_t>(passes.size());
+    stats_.parallelPasses += static_cast<uint32_t>(passes.size());
+
+    // Waits are hoisted to the start of the run, as the passes can't be split between submissions once recorded
+    for (const auto* pass : passes)
+    {
+      for (const auto& usage : pass->usages)
+      {
+        Synchronize(queue, usage);
+      }
+    }
+
+    if (!queues_[queue].commandBuffer)
+    {
+      OpenSegment(queue);
+    }
+
+    struct ParallelPass
+    {
+      Pass* pass{};
+      BarrierBatch barriers;
+      VkCommandBuffer commandBuffer{};
+    };
+
+    // Barriers are computed up front, which leaves textures in the layouts the passes will execute with
+    auto parallelPasses = std::vector<ParallelPass>(passes.size());
+    for (size_t i = 0; i < passes.size(); i++)
+    {
+      parallelPasses[i].pass = passes[i];
+      for (const auto& usage : passes[i]->usages)
+      {
+        AddBarriers(parallelPasses[i].barriers, usage, queue);
+      }
+    }
+
+    std::for_each(std::execution::par,
+      parallelPasses.begin(),
+      parallelPasses.end(),
+      [this](ParallelPass& parallelPass)
+      {
+        ZoneNamedN(passZone, "Record Pass", true);
+        ZoneNameV(passZone, parallelPass.pass->name.data(), parallelPass.pass->name.size());
+        parallelPass.commandBuffer = device_->BeginFrameSecondaryCommandBuffer();
+        {
+          auto marker = Context(*device_, parallelPass.commandBuffer).MakeScopedDebugMarker(parallelPass.pass->name.c_str());
+          parallelPass.pass->execute(parallelPass.commandBuffer);
+        }
+        detail::CheckVkResult(vkEndCommandBuffer(parallelPass.commandBuffer));
+      });
+
+    auto& recording = queues_[queue];
+    for (auto& parallelPass : parallelPasses)
+    {
+      FlushBarriers(recording.commandBuffer, parallelPass.barriers);
+      vkCmdExecuteCommands(recording.commandBuffer, 1, &parallelPass.commandBuffer);
+    }
+    recording.empty = false;
+  }
+
+  bool RenderGraph::WritesOrTransitions(const Usage& usage)
+  {
+    if (usage.access & writeAccessMask)
+    {
+      return true;
+    }
+
+    auto* texture = std::get_if<Texture*>(&usage.resource);
+    return texture && (usage.discard || *(*texture)->currentLayout != usage.layout);
+  }
+
+  void RenderGraph::Synchronize(uint32_t queue, const Usage& usage)
+  {
+    auto [it, inserted] = states_.try_emplace(GetHandle(usage));
+    auto& resource = it->second;
+    if (inserted)
+    {
+      // Anything before the graph is treated as a write on the graphics queue
+      resource.lastWriteQueue = graphicsQueue;
+      resource.lastWriteSegment = firstGraphicsSegment_;
+    }
+
+    const auto otherQueue = 1 - queue;
+    if (inserted && usage.discard)
+    {
+      // The texture may alias one that the other queue used earlier in the graph. The discard barrier only orders work on this queue,
+      // so wait for everything the other queue has recorded so far
+      const auto& other = queues_[otherQueue];
+      if (other.commandBuffer && !other.empty)
+      {
+        WaitForSegment(queue, other.segment);
+      }
+      else
+      {
+        WaitForSegment(queue, otherQueue == graphicsQueue ? device_->graphicsSplitTimelineValue_ : device_->computeTimelineValue_);
+      }
+    }
+
+    if (resource.lastWriteQueue == otherQueue)
+    {
+      WaitForSegment(queue, resource.lastWriteSegment);
+    }
+
+    if (WritesOrTransitions(usage))
+    {
+      WaitForSegment(queue, resource.lastReadSegments[otherQueue]);
+    }
+  }
+
+  void RenderGraph::WaitForSegment(uint32_t queue, uint64_t otherQueueSegment)
+  {
+    auto& recording = queues_[queue];
+    if (otherQueueSegment == 0 || recording.waitedValue >= otherQueueSegment)
+    {
+      return;
+    }
+
+    // The segment may still be recording, in which case it must be submitted before anything can wait on it
+    auto& other = queues_[1 - queue];
+    if (other.commandBuffer && other.segment == otherQueueSegment)
+    {
+      CloseSegment(1 - queue);
+    }
+
+    // Semaphore waits happen at the start of a submission, so commands already recorded for this queue must go in an earlier one
+    if (recording.commandBuffer && !recording.empty)
+    {
+      CloseSegment(queue);
+    }
+
+    if (!recording.commandBuffer)
+    {
+      OpenSegment(queue);
+    }
+
+    if (queue == graphicsQueue)
+    {
+      device_->AddFrameWait(device_->computeQueueTimelineSemaphore_, otherQueueSegment, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+    }
+    else
+    {
+      recording.computeWaits.emplace_back(VkSemaphoreSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = device_->graphicsQueueSplitTimelineSemaphore_,
+        .value = otherQueueSegment,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      });
+    }
+
+    recording.waitedValue = otherQueueSegment;
+    stats_.queueWaits++;
+  }
+
+  void RenderGraph::OpenSegment(uint32_t queue)
+  {
+    auto& recording = queues_[queue];
+    if (queue == graphicsQueue)
+    {
+      recording.commandBuffer = device_->GetCurrentFrameData().commandBuffer;
+      recording.segment = device_->graphicsSplitTimelineValue_ + 1;
+    }
+    else
+    {
+      recording.commandBuffer = device_->BeginFrameComputeCommandBuffer();
+      recording.segment = device_->computeTimelineValue_ + 1;
+    }
+
+    recording.empty = true;
+    recording.beginTimestamp = WriteTimestamp(recording.commandBuffer);
+  }
+
+  void RenderGraph::CloseSegment(uint32_t queue)
+  {
+    auto& recording = queues_[queue];
+    if (const auto endTimestamp = WriteTimestamp(recording.commandBuffer); recording.beginTimestamp != UINT32_MAX && endTimestamp != UINT32_MAX)
+    {
+      frameTimestamps_[frameSlot_].intervals.emplace_back(queue, recording.beginTimestamp, endTimestamp);
+    }
+
+    if (queue == graphicsQueue)
+    {
+      [[maybe_unused]] const auto signalValue = device_->SplitFrameCommandBuffer();
+      assert(signalValue == recording.segment);
+      stats_.graphicsSubmits++;
+      OpenSegment(graphicsQueue);
+    }
+    else
+    {
+      [[maybe_unused]] const auto signalValue = device_->SubmitFrameComputeCommandBuffer(recording.commandBuffer, recording.computeWaits);
+      assert(signalValue == recording.segment);
+      stats_.computeSubmits++;
+      recording.computeWaits.clear();
+      recording.commandBuffer = VK_NULL_HANDLE;
+    }
+  }
+
+  uint32_t RenderGraph::WriteTimestamp(VkCommandBuffer commandBuffer)
+  {
+    auto& timestamps = frameTimestamps_[frameSlot_];
+    if (!timestampQueryPool_ || timestamps.queryCount == maxTimestampsPerFrame)
+    {
+      return UINT32_MAX;
+    }
+
+    // ALL_COMMANDS so the timestamp isn't written before a semaphore wait at the start of the submission is satisfied
+    const auto query = frameSlot_ * maxTimestampsPerFrame + timestamps.queryCount++;
+    vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestampQueryPool_, query);
+    return query;
+  }
+
+  void RenderGraph::ReadTimestamps()
+  {
+    ZoneScoped;
+    if (!timestampQueryPool_)
+    {
+      return;
+    }
+
+    auto& timestamps = frameTimestamps_[frameSlot_];
+    const auto firstQuery = frameSlot_ * maxTimestampsPerFrame;
+    if (timestamps.queryCount > 0)
+    {
+      // Pairs of timestamp and availability
+      auto results = std::vector<uint64_t>(timestamps.queryCount * 2);
+      vkGetQueryPoolResults(device_->device_,
+        timestampQueryPool_,
+        firstQuery,
+        timestamps.queryCount,
+        results.size() * sizeof(uint64_t),
+        results.data(),
+        sizeof(uint64_t) * 2,
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+      auto getInterval = [&](const TimestampInterval& interval) -> std::pair<uint64_t, uint64_t>
+      {
+        const auto begin = (interval.beginQuery - firstQuery) * 2;
+        const auto end = (interval.endQuery - firstQuery) * 2;
+        if (results[begin + 1] == 0 || results[end + 1] == 0)
+        {
+          return {};
+        }
+        return {results[begin], std::max(results[begin], results[end])};
+      };
+
+      // Each queue's segments execute in order, so only compute and graphics intervals can overlap
+      auto computeTicks = uint64_t{};
+      auto overlapTicks = uint64_t{};
+      for (const auto& compute : timestamps.intervals)
+      {
+        if (compute.queue != computeQueue)
+        {
+          continue;
+        }
+
+        const auto [computeBegin, computeEnd] = getInterval(compute);
+        computeTicks += computeEnd - computeBegin;
+        for (const auto& graphics : timestamps.intervals)
+        {
+          if (graphics.queue != graphicsQueue)
+          {
+            continue;
+          }
+
+          const auto [graphicsBegin, graphicsEnd] = getInterval(graphics);
+          const auto begin = std::max(computeBegin, graphicsBegin);
+          const auto end = std::min(computeEnd, graphicsEnd);
+          overlapTicks += end > begin ? end - begin : 0;
+        }
+      }
+
+      const auto msPerTick = static_cast<double>(device_->physicalDevice_.properties.limits.timestampPeriod) / 1'000'000.0;
+      stats_.asyncComputeMs = static_cast<double>(computeTicks) * msPerTick;
+      stats_.asyncComputeOverlapMs = static_cast<double>(overlapTicks) * msPerTick;
+    }
+
+    timestamps = {};
+    vkResetQueryPool(device_->device_, timestampQueryPool_, firstQuery, maxTimestampsPerFrame);
+  }
+
+  RenderGraph::ResourceHandle RenderGraph::GetHandle(const Usage& usage)
+  {
+    // Suballocated buffers share a VkBuffer, but never an address
+    if (auto* buffer = std::get_if<Buffer*>(&usage.resource))
+    {
+      return (*buffer)->GetDeviceAddress();
+    }
+
+    return std::get<Texture*>(usage.resource)->Image();
+  }
+
+  void RenderGraph::AddBarriers(BarrierBatch& batch, const Usage& usage, uint32_t queue)
+  {
+    // Synchronize has added the resource
+    auto& resource = states_.at(GetHandle(usage));
+    auto& state = resource.barriers[queue];
+    const bool firstUse = !std::exchange(resource.tracked[queue], true);
+    const bool writes = (usage.access & writeAccessMask) != 0;
+
+    if (WritesOrTransitions(usage))
+    {
+      // The other queue has to wait on a semaphore before touching the resource again
+      resource.tracked[1 - queue] = false;
+      resource.lastWriteQueue = queue;
+      resource.lastWriteSegment = queues_[queue].segment;
+      std::ranges::fill(resource.lastReadSegments, uint64_t{});
+    }
+    else
+    {
+      resource.lastReadSegments[queue] = queues_[queue].segment;
+    }
+
+    // Layout transitions count as writes
+    if (auto* texture = std::get_if<Texture*>(&usage.resource); texture && (usage.discard || *(*texture)->currentLayout != usage.layout))
+    {
+      auto srcStages = state.writeStages | state.pendingReadStages;
+      auto srcAccess = state.writeAccess;
+      if (firstUse)
+      {
+        // The texture may alias one that was used earlier in the graph, in which case we can't know which passes on this queue touched its memory
+        // (Synchronize has made the other queue's passes wait). Otherwise, waiting on the same stages forms a dependency chain with the initial barrier or semaphore wait
+        srcStages = usage.discard ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT : usage.stages;
+        srcAccess = usage.discard ? VK_ACCESS_2_MEMORY_WRITE_BIT : VK_ACCESS_2_NONE;
+      }
+
+      batch.imageBarriers.emplace_back(VkImageMemoryBarrier2{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = srcStages,
+        .srcAccessMask = srcAccess,
+        .dstStageMask = usage.stages,
+        .dstAccessMask = usage.access,
+        .oldLayout = usage.discard ? VK_IMAGE_LAYOUT_UNDEFINED : *(*texture)->currentLayout,
+        .newLayout = usage.layout,
+        .image = (*texture)->Image(),
+        .subresourceRange = {
+          .aspectMask = GetAspectMask(**texture),
+          .levelCount = VK_REMAINING_MIP_LEVELS,
+          .layerCount = VK_REMAINING_ARRAY_LAYERS,
+        },
+      });
+      *(*texture)->currentLayout = usage.layout;
+
+      // Writes made before the transition are already available, so later reads only need to wait for the transition to make them visible
+      state = {
+        .writeStages = usage.stages,
+        .writeAccess = usage.access & writeAccessMask,
+        .syncedReadStages = writes ? 0 : usage.stages,
+        .syncedReadAccess = writes ? 0 : usage.access,
+        .pendingReadStages = writes ? 0 : usage.stages,
+      };
+      return;
+    }
+
+    if (firstUse)
+    {
+      // The initial barrier or a semaphore wait made everything before visible
+      state = {
+        .writeStages = writes ? usage.stages : 0,
+        .writeAccess = usage.access & writeAccessMask,
+        .syncedReadStages = writes ? 0 : usage.stages,
+        .syncedReadAccess = writes ? 0 : usage.access,
+        .pendingReadStages = writes ? 0 : usage.stages,
+      };
+      return;
+    }
+
+    auto srcStages = VkPipelineStageFlags2{};
+    auto srcAccess = VkAccessFlags2{};
+    if (writes)
+    {
+      srcStages = state.writeStages | state.pendingReadStages;
+      srcAccess = state.writeAccess;
+      state = {
+        .writeStages = usage.stages,
+        .writeAccess = usage.access & writeAccessMask,
+        .syncedReadStages = 0,
+        .syncedReadAccess = 0,
+        .pendingReadStages = 0,
+      };
+    }
+    else
+    {
+      state.pendingReadStages |= usage.stages;
+      if ((usage.stages & ~state.syncedReadStages) == 0 && (usage.access & ~state.syncedReadAccess) == 0)
+      {
+        // Already waited for the last write
+        return;
+      }
+      srcStages = state.writeStages;
+      srcAccess = state.writeAccess;
+      state.syncedReadStages |= usage.stages;
+      state.syncedReadAccess |= usage.access;
+    }
+
+    if (srcStages == 0)
+    {
+      // Nothing in the graph has written to the resource yet
+      return;
+    }
+
+    if (auto* buffer = std::get_if<Buffer*>(&usage.resource))
+    {
+      batch.bufferBarriers.emplace_back(VkBufferMemoryBarrier2{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        .srcStageMask = srcStages,
+        .srcAccessMask = srcAccess,
+        .dstStageMask = usage.stages,
+        .dstAccessMask = usage.access,
+        .buffer = (*buffer)->Handle(),
+        .offset = (*buffer)->Offset(),
+        .size = std::max((*buffer)->SizeBytes(), VkDeviceSize(1)),
+      });
+    }
+    else
+    {
+      batch.memoryBarrier.srcStageMask |= srcStages;
+      batch.memoryBarrier.srcAccessMask |= srcAccess;
+      batch.memoryBarrier.dstStageMask |= usage.stages;
+      batch.memoryBarrier.dstAccessMask |= usage.access;
+    }
+  }
+
+  void RenderGraph::FlushBarriers(VkCommandBuffer commandBuffer, BarrierBatch& batch)
+  {
+    const bool hasMemoryBarrier = batch.memoryBarrier.srcStageMask != 0;
+    if (!hasMemoryBarrier && batch.bufferBarriers.empty() && batch.imageBarriers.empty())
+    {
+      return;
+    }
+
+    vkCmdPipelineBarrier2(commandBuffer, detail::Address(VkDependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = hasMemoryBarrier ? 1u : 0u,
+      .pMemoryBarriers = &batch.memoryBarrier,
+      .bufferMemoryBarrierCount = static_cast<uint32_t>(batch.bufferBarriers.size()),
+      .pBufferMemoryBarriers = batch.bufferBarriers.data(),
+      .imageMemoryBarrierCount = static_cast<uint32_t>(batch.imageBarriers.size()),
+      .pImageMemoryBarriers = batch.imageBarriers.data(),
+    }));
+
+    stats_.barrierBatches++;
+    stats_.memoryBarriers += hasMemoryBarrier ? 1 : 0;
+    stats_.bufferBarriers += static_cast<uint32_t>(batch.bufferBarriers.size());
+    stats_.imageBarriers += static_cast<uint32_t>(batch.imageBarriers.size());
+
+    batch = {};
+  }
+} // namespace Fvog
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace Fvog
+{
+  class Device;
+  class Buffer;
+  class Texture;
+
+  // Records passes along with the buffers and textures they access, then executes them with only the barriers needed between them.
+  //
+  // graph.AddPass("Name",
+  //   [&](RenderGraph::PassBuilder& pass) { pass.Read(buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT).Write(texture, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT); },
+  //   [&](VkCommandBuffer commandBuffer) { ... });
+  // graph.Export(texture, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
+  // graph.Execute(commandBuffer);
+  //
+  // Passes execute in the order they were added. A pass is culled if nothing after it (or an export) consumes what it writes, unless it has side effects.
+  // The graph only orders passes against each other. Dependencies between commands inside a pass are the pass's responsibility.
+  // Because the graph doesn't know what happened before it, it begins with one barrier that waits for all prior work.
+  // Discarding a texture for the first time also waits for all prior work on the same queue, and makes the queue wait on a semaphore for everything
+  // the other queue has recorded so far. Together, these make it safe to alias textures whose first use discards them.
+  //
+  // Async compute passes are recorded into separate submissions to the device's compute queue. Where a resource is handed between queues,
+  // the graph submits what has been recorded for the queue that last accessed it, and the next submission on the other queue waits on a timeline semaphore.
+  //
+  // A run of adjacent parallel passes on one queue is recorded concurrently, as long as no texture changes layout within the run
+  // (Context reads a texture's current layout while recording). Each pass's barriers are then issued between the secondary command buffers.
+  class RenderGraph
+  {
+    struct Pass;
+
+  public:
+    class PassBuilder
+    {
+    public:
+      // Uniform or storage buffer reads
+      PassBuilder& Read(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access = VK_ACCESS_2_SHADER_READ_BIT);
+      PassBuilder& Write(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+      PassBuilder& ReadWrite(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+      // Sampled reads, in the layout that the texture's sampled descriptors expect
+      PassBuilder& Read(Texture& texture, VkPipelineStageFlags2 stages);
+
+      // Storage image accesses in the GENERAL layout. Discarding is only safe if the pass overwrites the whole texture
+      PassBuilder& Write(Texture& texture, VkPipelineStageFlags2 stages, bool discard = false);
+      PassBuilder& ReadWrite(Texture& texture, VkPipelineStageFlags2 stages);
+
+      // The contents are discarded unless loadOp is LOAD
+      PassBuilder& ColorAttachment(Texture& texture, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_LOAD);
+      PassBuilder& DepthAttachment(Texture& texture, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_LOAD);
+
+      PassBuilder& Access(Buffer& buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access);
+      PassBuilder& Access(Texture& texture, VkPipelineStageFlags2 stages, VkAccessFlags2 access, VkImageLayout layout, bool discard = false);
+
+      // The pass is never culled. Use for passes whose results are consumed outside the graph but aren't exported (e.g., they're read on the host)
+      PassBuilder& SideEffects();
+
+      // The pass runs on the async compute queue, or on the graphics queue if the device has none. It may only record compute and transfer commands
+      PassBuilder& AsyncCompute();
+
+      // The pass may be recorded into a secondary command buffer on a worker thread, concurrently with adjacent parallel passes.
+      // Its execute callback must not touch host state that another pass's callback touches (e.g., a timer)
+      PassBuilder& Parallel();
+
+    private:
+      friend class RenderGraph;
+      explicit PassBuilder(Pass& pass) : pass_(&pass) {}
+      Pass* pass_;
+    };
+
+    struct Stats
+    {
+      uint32_t passes{};
+      uint32_t culledPasses{};
+      // Number of vkCmdPipelineBarrier2 calls, and the barriers within them
+      uint32_t barrierBatches{};
+      uint32_t bufferBarriers{};
+      uint32_t imageBarriers{};
+      uint32_t memoryBarriers{};
+      // Submissions made by the graph, and semaphore waits between the queues
+      uint32_t graphicsSubmits{};
+      uint32_t computeSubmits{};
+      uint32_t queueWaits{};
+      // GPU time spent on the async compute queue, and how much of it overlapped with graph work on the graphics queue.
+      // Read back from an earlier frame. Zero if the device has no async compute queue
+      double asyncComputeMs{};
+      double asyncComputeOverlapMs{};
+      // Passes recorded on worker threads, and the host time spent in Execute
+      uint32_t parallelPasses{};
+      double recordMs{};
+    };
+
+    explicit RenderGraph(Device& device);
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    void AddPass(std::string name, const std::function<void(PassBuilder&)>& setup, std::function<void(VkCommandBuffer)> execute);
+
+    // Declares that the resource is used after the graph executes. Exported textures are left in the given layout
+    void Export(Buffer& buffer, VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VkAccessFlags2 access = VK_ACCESS_2_MEMORY_READ_BIT);
+    void Export(Texture& texture, VkImageLayout layout, VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VkAccessFlags2 access = VK_ACCESS_2_MEMORY_READ_BIT);
+
+    // Records every pass that isn't culled. The graph is spent afterward.
+    // commandBuffer must be the device's current frame command buffer, as the graph may submit it and continue in another. Returns the one to continue recording in
+    [[nodiscard]] VkCommandBuffer Execute(VkCommandBuffer commandBuffer);
+
+    [[nodiscard]] const Stats& GetStats() const noexcept
+    {
+      return stats_;
+    }
+
+    // Parallel passes are recorded on the calling thread when disabled
+    bool parallelRecording = true;
+
+  private:
+    struct Usage
+    {
+      std::variant<Buffer*, Texture*> resource;
+      VkPipelineStageFlags2 stages{};
+      VkAccessFlags2 access{};
+      VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      bool discard{};
+    };
+
+    struct Pass
+    {
+      std::string name;
+      std::vector<Usage> usages;
+      std::function<void(VkCommandBuffer)> execute;
+      bool sideEffects{};
+      bool asyncCompute{};
+      bool parallel{};
+    };
+
+    static constexpr uint32_t queueCount = 2;
+
+    // Accesses on one queue since the last write to a resource
+    struct BarrierState
+    {
+      VkPipelineStageFlags2 writeStages{};
+      VkAccessFlags2 writeAccess{};
+      // Reads that have already waited for the last write
+      VkPipelineStageFlags2 syncedReadStages{};
+      VkAccessFlags2 syncedReadAccess{};
+      // Reads that a subsequent write must wait for
+      VkPipelineStageFlags2 pendingReadStages{};
+    };
+
+    struct ResourceState
+    {
+      BarrierState barriers[queueCount];
+      // A queue's barrier state is meaningless until it first accesses the resource, and after the other queue writes to it.
+      // Either way, the initial barrier or a semaphore wait has made prior accesses visible
+      bool tracked[queueCount]{};
+      // Segments (see QueueRecording) containing the last write and each queue's reads since then. Zero if there are none
+      uint32_t lastWriteQueue{};
+      uint64_t lastWriteSegment{};
+      uint64_t lastReadSegments[queueCount]{};
+    };
+
+    // Commands recorded for one queue between two of its submissions
+    struct QueueRecording
+    {
+      // Null while the compute queue has no open segment. The graphics queue always has one
+      VkCommandBuffer commandBuffer{};
+      // The value the queue's timeline semaphore will reach when the segment completes, which also identifies it
+      uint64_t segment{};
+      bool empty = true;
+      // The largest value of the other queue's semaphore that this queue has waited on
+      uint64_t waitedValue{};
+      // Graphics waits go to the device so they are picked up by whichever submission comes next
+      std::vector<VkSemaphoreSubmitInfo> computeWaits;
+      uint32_t beginTimestamp{};
+    };
+
+    struct TimestampInterval
+    {
+      uint32_t queue{};
+      uint32_t beginQuery{};
+      uint32_t endQuery{};
+    };
+
+    struct FrameTimestamps
+    {
+      std::vector<TimestampInterval> intervals;
+      uint32_t queryCount{};
+    };
+
+    static constexpr uint32_t maxTimestampsPerFrame = 64;
+
+    using ResourceHandle = std::variant<VkDeviceAddress, VkImage>;
+    static ResourceHandle GetHandle(const Usage& usage);
+    static bool WritesOrTransitions(const Usage& usage);
+
+    // Makes the queue wait for whatever the other queue last did to the resource that this usage conflicts with
+    void Synchronize(uint32_t queue, const Usage& usage);
+    void WaitForSegment(uint32_t queue, uint64_t otherQueueSegment);
+    void OpenSegment(uint32_t queue);
+    void CloseSegment(uint32_t queue);
+
+    // Makes a timestamp range for each frame in flight
+    void ResizeFrameSlots();
+    uint32_t WriteTimestamp(VkCommandBuffer commandBuffer);
+    void ReadTimestamps();
+
+    struct BarrierBatch;
+    void RecordPass(Pass& pass, uint32_t queue, BarrierBatch& batch);
+    void RecordPassesInParallel(std::span<Pass* const> passes, uint32_t queue);
+    void AddBarriers(BarrierBatch& batch, const Usage& usage, uint32_t queue);
+    void FlushBarriers(VkCommandBuffer commandBuffer, BarrierBatch& batch);
+
+    Device* device_{};
+    std::vector<Pass> passes_;
+    std::vector<Usage> exports_;
+    std::unordered_map<ResourceHandle, ResourceState> states_;
+    Stats stats_{};
+
+    QueueRecording queues_[queueCount];
+    // The graphics segment that was open when the graph began executing. Everything before the graph is in it
+    uint64_t firstGraphicsSegment_{};
+
+    // Only created if the device has an async compute queue. Each frame in flight has its own range of queries
+    VkQueryPool timestampQueryPool_{};
+    std::vector<FrameTimestamps> frameTimestamps_;
+    uint32_t frameSlot_{};
+  };
+} // namespace Fvog
@@ -258,6 +258,22 @@ namespace Fvog
     }));
   }
 
+  void Context::Barrier(const GlobalBarrier& barrier) const
+  {
+    ZoneScoped;
+    vkCmdPipelineBarrier2(commandBuffer_, Address(VkDependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = Address(VkMemoryBarrier2{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = barrier.srcStageMask,
+        .srcAccessMask = barrier.srcAccessMask,
+        .dstStageMask = barrier.dstStageMask,
+        .dstAccessMask = barrier.dstAccessMask,
+      }),
+    }));
+  }
+
   void Context::ClearTexture(const Texture& texture, const TextureClearInfo& clearInfo) const
   {
     ZoneScoped;
@@ -292,7 +308,7 @@ namespace Fvog
       .regionCount = 1,
       .pRegions = detail::Address(VkBufferImageCopy2{
         .sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2,
-        .bufferOffset = 0,
+        .bufferOffset = src.Offset(),
         .bufferRowLength = info.rowLength,
         .bufferImageHeight = info.imageHeight,
         .imageSubresource = VkImageSubresourceLayers{
@@ -315,8 +331,8 @@ namespace Fvog
       .regionCount = 1,
       .pRegions = Address(VkBufferCopy2{
         .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
-        .srcOffset = copyInfo.srcOffset,
-        .dstOffset = copyInfo.dstOffset,
+        .srcOffset = src.Offset() + copyInfo.srcOffset,
+        .dstOffset = dst.Offset() + copyInfo.dstOffset,
         .size = copyInfo.size,
       }),
     }));
@@ -325,7 +341,7 @@ namespace Fvog
   void Context::TeenyBufferUpdate(Buffer& buffer, TriviallyCopyableByteSpan data, size_t offset) const
   {
     ZoneScoped;
-    vkCmdUpdateBuffer(commandBuffer_, buffer.Handle(), offset, data.size_bytes(), data.data());
+    vkCmdUpdateBuffer(commandBuffer_, buffer.Handle(), buffer.Offset() + offset, data.size_bytes(), data.data());
   }
 
   void Context::BindGraphicsPipeline(const GraphicsPipeline& pipeline) const
@@ -368,7 +384,7 @@ namespace Fvog
   void Context::DispatchIndirect(const Fvog::Buffer& buffer, VkDeviceSize offset) const
   {
     ZoneScoped;
-    vkCmdDispatchIndirect(commandBuffer_, buffer.Handle(), offset);
+    vkCmdDispatchIndirect(commandBuffer_, buffer.Handle(), buffer.Offset() + offset);
   }
 
   void Context::Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) const
@@ -380,19 +396,26 @@ namespace Fvog
   void Context::DrawIndirect(const Fvog::Buffer& buffer, VkDeviceSize bufferOffset, uint32_t drawCount, uint32_t stride) const
   {
     ZoneScoped;
-    vkCmdDrawIndirect(commandBuffer_, buffer.Handle(), bufferOffset, drawCount, stride);
+    vkCmdDrawIndirect(commandBuffer_, buffer.Handle(), buffer.Offset() + bufferOffset, drawCount, stride);
   }
 
   void Context::DrawIndexedIndirect(const Fvog::Buffer& buffer, VkDeviceSize bufferOffset, uint32_t drawCount, uint32_t stride) const
   {
     ZoneScoped;
-    vkCmdDrawIndexedIndirect(commandBuffer_, buffer.Handle(), bufferOffset, drawCount, stride);
+    vkCmdDrawIndexedIndirect(commandBuffer_, buffer.Handle(), buffer.Offset() + bufferOffset, drawCount, stride);
+  }
+
+  void Context::DrawMeshTasksIndirect(const Fvog::Buffer& buffer, VkDeviceSize bufferOffset, uint32_t drawCount, uint32_t stride) const
+  {
+    ZoneScoped;
+    assert(device_->supportsMeshShaders_);
+    vkCmdDrawMeshTasksIndirectEXT(commandBuffer_, buffer.Handle(), buffer.Offset() + bufferOffset, drawCount, stride);
   }
 
   void Context::BindIndexBuffer(const Buffer& buffer, VkDeviceSize offset, VkIndexType indexType) const
   {
     ZoneScoped;
-    vkCmdBindIndexBuffer(commandBuffer_, buffer.Handle(), offset, indexType);
+    vkCmdBindIndexBuffer(commandBuffer_, buffer.Handle(), buffer.Offset() + offset, indexType);
   }
 
   void Context::SetPushConstants(TriviallyCopyableByteSpan values, uint32_t offset) const
@@ -171,6 +171,8 @@ namespace Fvog
     void BufferBarrier(VkBuffer buffer) const;
     // Everything->everything barrier
     void Barrier() const;
+    // Execution and memory dependency between commands in the same pass
+    void Barrier(const GlobalBarrier& barrier) const;
 
     void ClearTexture(const Texture& texture, const TextureClearInfo& clearInfo) const;
 
@@ -199,6 +201,8 @@ namespace Fvog
     void Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) const;
     void DrawIndirect(const Fvog::Buffer& buffer, VkDeviceSize bufferOffset, uint32_t drawCount, uint32_t stride) const;
     void DrawIndexedIndirect(const Fvog::Buffer& buffer, VkDeviceSize bufferOffset, uint32_t drawCount, uint32_t stride) const;
+    // Requires Device::supportsMeshShaders_. Each command has the layout of VkDrawMeshTasksIndirectCommandEXT, which is the same as DispatchIndirectCommand
+    void DrawMeshTasksIndirect(const Fvog::Buffer& buffer, VkDeviceSize bufferOffset, uint32_t drawCount, uint32_t stride) const;
 
     void BindIndexBuffer(const Buffer& buffer, VkDeviceSize offset, VkIndexType indexType) const;
 
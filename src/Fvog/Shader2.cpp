@@ -1,5 +1,6 @@
 #include "Shader2.h"
 #include "detail/Common.h"
+#include "detail/ShaderCache2.h"
 #include "TriviallyCopyableByteSpan.h"
 
 #include <volk.h>
@@ -10,6 +11,8 @@
 
 #include <tracy/Tracy.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <cassert>
 #include <stdexcept>
@@ -30,6 +33,8 @@ namespace Fvog
       case PipelineStage::VERTEX_SHADER: return VK_SHADER_STAGE_VERTEX_BIT;
       case PipelineStage::FRAGMENT_SHADER: return VK_SHADER_STAGE_FRAGMENT_BIT;
       case PipelineStage::COMPUTE_SHADER: return VK_SHADER_STAGE_COMPUTE_BIT;
+      case PipelineStage::TASK_SHADER: return VK_SHADER_STAGE_TASK_BIT_EXT;
+      case PipelineStage::MESH_SHADER: return VK_SHADER_STAGE_MESH_BIT_EXT;
       default: assert(0); return {};
       }
     }
@@ -122,13 +127,82 @@ namespace Fvog
       case VkShaderStageFlagBits::VK_SHADER_STAGE_VERTEX_BIT: return EShLanguage::EShLangVertex;
       case VkShaderStageFlagBits::VK_SHADER_STAGE_FRAGMENT_BIT: return EShLanguage::EShLangFragment;
       case VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT: return EShLanguage::EShLangCompute;
+      case VkShaderStageFlagBits::VK_SHADER_STAGE_TASK_BIT_EXT: return EShLanguage::EShLangTask;
+      case VkShaderStageFlagBits::VK_SHADER_STAGE_MESH_BIT_EXT: return EShLanguage::EShLangMesh;
       }
       return static_cast<EShLanguage>(-1);
     }
 
-    detail::ShaderCompileInfo CompileShaderToSpirv(VkShaderStageFlagBits stage, std::string_view source, glslang::TShader::Includer* includer)
+    // Everything below that affects the output of CompileShaderToSpirv must also be hashed in MakeShaderCacheKey
+    constexpr auto targetClientVersion = glslang::EShTargetClientVersion::EShTargetVulkan_1_3;
+    constexpr auto targetLanguageVersion = glslang::EShTargetLanguageVersion::EShTargetSpv_1_6;
+    constexpr auto glslVersion = 460;
+    constexpr auto preamble = "#extension GL_GOOGLE_include_directive : enable\n";
+
+    // Shaders may be compiled on any thread
+    std::atomic<ShaderProfile> shaderProfile{ShaderProfile::DEBUG};
+    std::atomic<uint32_t> shaderModules{};
+    std::atomic<uint64_t> shaderSpirvBytes{};
+    std::atomic<uint64_t> shaderCompileNanoseconds{};
+
+    glslang::SpvOptions GetSpvOptions(ShaderProfile profile)
+    {
+      if (profile == ShaderProfile::RELEASE)
+      {
+        // Equivalent to -O without -g. Stripping is a no-op if glslang was built without SPIRV-Tools, but there's nothing to strip anyway
+        return {
+          .generateDebugInfo = false,
+          .stripDebugInfo = true,
+          .disableOptimizer = false,
+        };
+      }
+
+      // Equivalent to -gVS, which should be sufficient for RenderDoc to debug our shaders.
+      // https://github.com/KhronosGroup/glslang/blob/vulkan-sdk-1.3.283.0/StandAlone/StandAlone.cpp#L998-L1016
+      return {
+        .generateDebugInfo = true,
+        .stripDebugInfo = false,
+        .disableOptimizer = true,
+        .emitNonSemanticShaderDebugInfo = true,
+        .emitNonSemanticShaderDebugSource = true,
+      };
+    }
+
+  } // namespace
+
+  uint64_t detail::MakeShaderCacheKey(VkShaderStageFlagBits stage, std::string_view source, ShaderProfile profile)
+  {
+    const auto options = GetSpvOptions(profile);
+    return ShaderCache::KeyBuilder()
+      .Add(source)
+      .Add(stage)
+      .Add(static_cast<uint64_t>(profile))
+      .Add(targetClientVersion)
+      .Add(targetLanguageVersion)
+      .Add(glslVersion)
+      .Add(preamble)
+      .Add(glslang::GetSpirvGeneratorVersion())
+      .Add(options.generateDebugInfo)
+      .Add(options.stripDebugInfo)
+      .Add(options.disableOptimizer)
+      .Add(options.optimizeSize)
+      .Add(options.emitNonSemanticShaderDebugInfo)
+      .Add(options.emitNonSemanticShaderDebugSource)
+      .Key();
+  }
+
+  namespace
+  {
+    detail::ShaderCache& GetShaderCache()
+    {
+      static auto cache = detail::ShaderCache("shader_cache");
+      return cache;
+    }
+
+    detail::ShaderCompileInfo CompileShaderToSpirv(VkShaderStageFlagBits stage, std::string_view source, glslang::TShader::Includer* includer, ShaderProfile profile)
     {
       ZoneScoped;
+      const auto start = std::chrono::steady_clock::now();
       constexpr auto compilerMessages = EShMessages(EShMessages::EShMsgSpvRules | EShMessages::EShMsgVulkanRules);
       const auto glslangStage = VkShaderStageToGlslang(stage);
 
@@ -137,22 +211,22 @@ namespace Fvog
       const char* data = source.data();
       shader.setStringsWithLengths(&data, &length, 1);
       shader.setEnvInput(glslang::EShSource::EShSourceGlsl, glslangStage, glslang::EShClient::EShClientVulkan, 100);
-      shader.setEnvClient(glslang::EShClient::EShClientVulkan, glslang::EShTargetClientVersion::EShTargetVulkan_1_3);
-      shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_6);
-      shader.setPreamble("#extension GL_GOOGLE_include_directive : enable\n");
-      shader.setOverrideVersion(460);
-      shader.setDebugInfo(true);
+      shader.setEnvClient(glslang::EShClient::EShClientVulkan, targetClientVersion);
+      shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, targetLanguageVersion);
+      shader.setPreamble(preamble);
+      shader.setOverrideVersion(glslVersion);
+      shader.setDebugInfo(profile == ShaderProfile::DEBUG);
 
       bool parseResult;
       {
         ZoneScopedN("Parse shader");
         if (includer)
         {
-          parseResult = shader.parse(GetDefaultResources(), 460, EProfile::ECoreProfile, false, false, compilerMessages, *includer);
+          parseResult = shader.parse(GetDefaultResources(), glslVersion, EProfile::ECoreProfile, false, false, compilerMessages, *includer);
         }
         else
         {
-          parseResult = shader.parse(GetDefaultResources(), 460, EProfile::ECoreProfile, false, false, compilerMessages);
+          parseResult = shader.parse(GetDefaultResources(), glslVersion, EProfile::ECoreProfile, false, false, compilerMessages);
         }
       }
 
@@ -179,23 +253,14 @@ namespace Fvog
       program.buildReflection();
       detail::ShaderCompileInfo info;
 
-      // TODO: task/mesh stages
-      if (stage == VK_SHADER_STAGE_COMPUTE_BIT)
+      if (stage == VK_SHADER_STAGE_COMPUTE_BIT || stage == VK_SHADER_STAGE_TASK_BIT_EXT || stage == VK_SHADER_STAGE_MESH_BIT_EXT)
       {
         info.workgroupSize_.width = program.getLocalSize(0);
         info.workgroupSize_.height = program.getLocalSize(1);
         info.workgroupSize_.depth = program.getLocalSize(2);
       }
 
-      // Equivalent to -gVS, which should be sufficient for RenderDoc to debug our shaders.
-      // https://github.com/KhronosGroup/glslang/blob/vulkan-sdk-1.3.283.0/StandAlone/StandAlone.cpp#L998-L1016
-      auto options = glslang::SpvOptions{
-        .generateDebugInfo = true,
-        .stripDebugInfo = false,
-        .disableOptimizer = true,
-        .emitNonSemanticShaderDebugInfo = true,
-        .emitNonSemanticShaderDebugSource = true,
-      };
+      auto options = GetSpvOptions(profile);
 
       {
         
@@ -212,10 +277,50 @@ namespace Fvog
       // For debug-dumping SPIR-V to a file
       //WriteBinaryFile("TEST.spv", std::span(info.binarySpv));
 
+      shaderCompileNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      return info;
+    }
+
+    detail::ShaderCompileInfo CompileShaderToSpirvCached(VkShaderStageFlagBits stage, std::string_view source)
+    {
+      ZoneScoped;
+      const auto profile = shaderProfile.load();
+      const auto key = detail::MakeShaderCacheKey(stage, source, profile);
+      if (auto cached = GetShaderCache().Find(key))
+      {
+        return std::move(*cached);
+      }
+
+      auto info = CompileShaderToSpirv(stage, source, nullptr, profile);
+      GetShaderCache().Store(key, info);
       return info;
     }
   } // namespace
 
+  void SetShaderProfile(ShaderProfile profile)
+  {
+    shaderProfile = profile;
+  }
+
+  ShaderProfile GetShaderProfile()
+  {
+    return shaderProfile;
+  }
+
+  ShaderStats GetShaderStats()
+  {
+    return {
+      .modules = shaderModules.load(),
+      .spirvBytes = shaderSpirvBytes.load(),
+      .compileMs = static_cast<double>(shaderCompileNanoseconds.load()) / 1'000'000.0,
+    };
+  }
+
+  ShaderCacheStats GetShaderCacheStats()
+  {
+    return GetShaderCache().GetStats();
+  }
+
   void Shader::Initialize(VkDevice device, const detail::ShaderCompileInfo& info)
   {
     using namespace detail;
@@ -233,6 +338,8 @@ namespace Fvog
         &shaderModule_));
 
     workgroupSize_ = info.workgroupSize_;
+    shaderModules++;
+    shaderSpirvBytes += info.binarySpv.size() * sizeof(uint32_t);
     
     // TODO: gate behind compile-time switch
     vkSetDebugUtilsObjectNameEXT(device_, detail::Address(VkDebugUtilsObjectNameInfoEXT{
@@ -250,7 +357,7 @@ namespace Fvog
     ZoneScoped;
     ZoneNamed(_, true);
     ZoneNameV(_, name_.data(), name_.size());
-    Initialize(device, CompileShaderToSpirv(PipelineStageToVK(stage), source, nullptr));
+    Initialize(device, CompileShaderToSpirvCached(PipelineStageToVK(stage), source));
   }
   
   Shader::Shader(VkDevice device, PipelineStage stage, const std::filesystem::path& path, std::string name)
@@ -260,7 +367,7 @@ namespace Fvog
     ZoneScoped;
     ZoneNamed(_, true);
     ZoneNameV(_, name_.data(), name_.size());
-    Initialize(device, CompileShaderToSpirv(PipelineStageToVK(stage), LoadFile(path), detail::Address(IncludeHandler(path))));
+    Initialize(device, CompileShaderToSpirv(PipelineStageToVK(stage), LoadFile(path), detail::Address(IncludeHandler(path)), shaderProfile.load()));
   }
 
   Shader::Shader(Shader&& old) noexcept
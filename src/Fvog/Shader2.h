@@ -18,11 +18,52 @@ namespace Fvog
     };
   }
 
+  enum class ShaderProfile
+  {
+    // Unoptimized, with debug info and source embedded so shaders can be debugged in RenderDoc
+    DEBUG,
+    // Optimized by spirv-opt (if FROGRENDER_SHADER_OPTIMIZER is enabled), without debug info
+    RELEASE,
+  };
+
+  // Only affects shaders compiled afterward, so it should be set before any are created
+  void SetShaderProfile(ShaderProfile profile);
+  [[nodiscard]] ShaderProfile GetShaderProfile();
+
+  namespace detail
+  {
+    // The SPIR-V cache key for already-processed source. Covers everything else that affects the compiler's output
+    [[nodiscard]] uint64_t MakeShaderCacheKey(VkShaderStageFlagBits stage, std::string_view source, ShaderProfile profile);
+  }
+
+  struct ShaderStats
+  {
+    uint32_t modules{};
+    uint64_t spirvBytes{};
+    // Host time spent in glslang and spirv-opt. Shaders found in the SPIR-V cache don't contribute
+    double compileMs{};
+  };
+
+  // Totals for every shader module created so far
+  [[nodiscard]] ShaderStats GetShaderStats();
+
+  struct ShaderCacheStats
+  {
+    uint32_t hits{};
+    uint32_t misses{};
+  };
+
+  // Hits and misses of the on-disk SPIR-V cache, which is only used by shaders constructed from already-processed source
+  [[nodiscard]] ShaderCacheStats GetShaderCacheStats();
+
   enum class PipelineStage
   {
     VERTEX_SHADER,
     FRAGMENT_SHADER,
-    COMPUTE_SHADER
+    COMPUTE_SHADER,
+    // Require VK_EXT_mesh_shader (see Device::supportsMeshShaders_)
+    TASK_SHADER,
+    MESH_SHADER,
   };
 
   /// @brief A shader object to be used in one or more GraphicsPipeline or ComputePipeline objects
@@ -51,6 +92,7 @@ namespace Fvog
       return shaderModule_;
     }
 
+    // Only set for compute, task, and mesh shaders
     [[nodiscard]] Extent3D WorkgroupSize() const
     {
       return workgroupSize_;
@@ -21,73 +21,92 @@ namespace Fvog
   {
   }
 
+  namespace
+  {
+    VkImageCreateInfo MakeImageCreateInfo(const TextureCreateInfo& createInfo)
+    {
+      using namespace detail;
+
+      // Inferred usages
+      // TextureUsage::GENERAL
+      uint32_t colorOrDepthStencilUsage = FormatIsColor(createInfo.format) ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+      // Storage is only supported for non-sRGB color formats on most hardware
+      uint32_t storageUsage = (FormatIsColor(createInfo.format) && !FormatIsSrgb(createInfo.format)) ? VK_IMAGE_USAGE_STORAGE_BIT : 0;
+
+      uint32_t usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | 
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT | 
+                       VK_IMAGE_USAGE_SAMPLED_BIT |
+                       storageUsage |
+                       colorOrDepthStencilUsage;
+
+      if (createInfo.usage == TextureUsage::READ_ONLY)
+      {
+        usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                VK_IMAGE_USAGE_SAMPLED_BIT;
+      }
+      
+      if (createInfo.usage == TextureUsage::ATTACHMENT_READ_ONLY)
+      {
+        usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                VK_IMAGE_USAGE_SAMPLED_BIT |
+                colorOrDepthStencilUsage;
+      }
+
+      return VkImageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .flags = VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT, // TODO: blindly applying this to every image is against IHV recommendations.
+        .imageType = ViewTypeToImageType(createInfo.viewType),
+        .format = detail::FormatToVk(createInfo.format),
+        .extent = createInfo.extent,
+        .mipLevels = createInfo.mipLevels,
+        .arrayLayers = createInfo.arrayLayers,
+        .samples = createInfo.sampleCount,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      };
+    }
+  }
+
   Texture::Texture(Device& device, const TextureCreateInfo& createInfo, std::string name)
     : currentLayout(std::make_unique<VkImageLayout>(VK_IMAGE_LAYOUT_UNDEFINED)),
       device_(&device),
       createInfo_(createInfo),
       name_(std::move(name))
   {
+    if (createInfo_.category == MemoryCategory::UNCATEGORIZED)
+    {
+      createInfo_.category = createInfo.usage == TextureUsage::READ_ONLY ? MemoryCategory::TEXTURES : MemoryCategory::RENDER_TARGETS;
+    }
+
     using namespace detail;
     ZoneScoped;
 
-    // Inferred usages
-    // TextureUsage::GENERAL
-    uint32_t colorOrDepthStencilUsage = FormatIsColor(createInfo.format) ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-
-    // Storage is only supported for non-sRGB color formats on most hardware
-    uint32_t storageUsage = (FormatIsColor(createInfo.format) && !FormatIsSrgb(createInfo.format)) ? VK_IMAGE_USAGE_STORAGE_BIT : 0;
-
-    uint32_t usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | 
-                     VK_IMAGE_USAGE_TRANSFER_DST_BIT | 
-                     VK_IMAGE_USAGE_SAMPLED_BIT |
-                     storageUsage |
-                     colorOrDepthStencilUsage;
-
     auto vmaAllocationFlags = VmaAllocationCreateFlags{};
 
-    if (createInfo.usage == TextureUsage::READ_ONLY)
-    {
-      usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-              VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-              VK_IMAGE_USAGE_SAMPLED_BIT;
-    }
-    
     if (createInfo.usage == TextureUsage::ATTACHMENT_READ_ONLY)
     {
-      usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-              VK_IMAGE_USAGE_SAMPLED_BIT |
-              colorOrDepthStencilUsage;
-
       // IHVs recommend putting render targets in dedicated allocations.
       vmaAllocationFlags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
     }
 
+    auto allocationInfo = VmaAllocationInfo{};
     CheckVkResult(vmaCreateImage(
       device_->allocator_,
-      Address(VkImageCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .flags = VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT, // TODO: blindly applying this to every image is against IHV recommendations.
-        .imageType = ViewTypeToImageType(createInfo.viewType),
-        .format = detail::FormatToVk(createInfo.format),
-        .extent = createInfo.extent,
-        .mipLevels = createInfo.mipLevels,
-        .arrayLayers = createInfo.arrayLayers,
-        .samples = createInfo.sampleCount,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      }),
+      Address(MakeImageCreateInfo(createInfo)),
       Address(VmaAllocationCreateInfo{
         .flags = vmaAllocationFlags,
         .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
       }),
       &image_,
       &allocation_,
-      nullptr
+      &allocationInfo
     ));
 
-
+    device_->TrackAllocation(createInfo_.category, allocationInfo.size);
 
     // TODO: gate behind compile-time switch
     vkSetDebugUtilsObjectNameEXT(device_->device_, detail::Address(VkDebugUtilsObjectNameInfoEXT{
@@ -101,11 +120,36 @@ namespace Fvog
     textureView_ = CreateFormatView(createInfo.format, name_);
   }
 
+  Texture::Texture(Device& device, const TextureCreateInfo& createInfo, VmaAllocation memory, VkDeviceSize memoryOffset, std::string name)
+    : currentLayout(std::make_unique<VkImageLayout>(VK_IMAGE_LAYOUT_UNDEFINED)),
+      device_(&device),
+      createInfo_(createInfo),
+      name_(std::move(name))
+  {
+    using namespace detail;
+    ZoneScoped;
+
+    // allocation_ is left null, so destroying this texture won't free the memory it's bound to
+    CheckVkResult(vmaCreateAliasingImage2(device_->allocator_, memory, memoryOffset, Address(MakeImageCreateInfo(createInfo)), &image_));
+
+    // TODO: gate behind compile-time switch
+    vkSetDebugUtilsObjectNameEXT(device_->device_, detail::Address(VkDebugUtilsObjectNameInfoEXT{
+      .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
+      .objectType = VK_OBJECT_TYPE_IMAGE,
+      .objectHandle = reinterpret_cast<uint64_t>(image_),
+      .pObjectName = name_.data(),
+    }));
+
+    textureView_ = CreateFormatView(createInfo.format, name_);
+  }
+
   Texture::~Texture()
   {
     if (device_ != nullptr && image_ != VK_NULL_HANDLE)
     {
-      device_->imageDeletionQueue_.emplace_back(device_->frameNumber, allocation_, image_, std::move(name_));
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.images.emplace_back(device_->frameNumber, allocation_, image_, std::move(name_), createInfo_.category);
     }
   }
 
@@ -188,26 +232,26 @@ namespace Fvog
   void Texture::UpdateImageSLOW(const TextureUpdateInfo& info)
   {
     ZoneScoped;
-    device_->ImmediateSubmit(
-    [this, &info](VkCommandBuffer commandBuffer)
+    // Convenience- so the user doesn't have to explicitly specify 1 for height or depth when writing 1D or 2D images
+    auto extent = info.extent;
+    extent.height = std::max(extent.height, 1u);
+    extent.depth = std::max(extent.depth, 1u);
+
+    uint64_t size;
+    if (detail::FormatIsBlockCompressed(createInfo_.format))
+    {
+      size = detail::BlockCompressedImageSize(createInfo_.format, extent.width, extent.height, extent.depth);
+    }
+    else
     {
-      // Convenience- so the user doesn't have to explicitly specify 1 for height or depth when writing 1D or 2D images
-      auto extent = info.extent;
-      extent.height = std::max(extent.height, 1u);
-      extent.depth = std::max(extent.depth, 1u);
+      size = extent.width * extent.height * extent.depth * detail::FormatStorageSize(createInfo_.format);
+    }
+    auto uploadBuffer = device_->stagingAllocator_->AcquireBuffer(size);
+    // TODO: account for row length and image height here
+    std::memcpy(uploadBuffer.GetMappedMemory(), info.data, size);
 
-      uint64_t size;
-      if (detail::FormatIsBlockCompressed(createInfo_.format))
-      {
-        size = detail::BlockCompressedImageSize(createInfo_.format, extent.width, extent.height, extent.depth);
-      }
-      else
-      {
-        size = extent.width * extent.height * extent.depth * detail::FormatStorageSize(createInfo_.format);
-      }
-      auto uploadBuffer = Buffer(*device_, {.size = size, .flag = BufferFlagThingy::MAP_SEQUENTIAL_WRITE}, "UpdateImageSLOW Staging Buffer");
-      // TODO: account for row length and image height here
-      std::memcpy(uploadBuffer.GetMappedMemory(), info.data, size);
+    auto recordCopy = [&](VkCommandBuffer commandBuffer)
+    {
       auto ctx = Fvog::Context(*device_, commandBuffer);
       ctx.ImageBarrier(*this, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
@@ -232,7 +276,29 @@ namespace Fvog
         }),
       }));
       ctx.ImageBarrier(*this, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-    });
+    };
+
+    // Only an image that has never been written is free to use on the transfer queue.
+    // Once it has been written, the graphics queue owns it (or will, when it acquires the previous upload) and may still be reading it,
+    // so later updates are copied on the graphics queue, which acquires pending uploads first and is ordered after every frame already submitted
+    if (*currentLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+    {
+      device_->ImmediateSubmit(recordCopy);
+      device_->stagingAllocator_->ReleaseBuffer(std::move(uploadBuffer));
+      return;
+    }
+
+    const auto ownershipTransfer = Device::UploadOwnershipTransfer{
+      .image = image_,
+      .layout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    };
+
+    const auto uploadValue = device_->Upload(recordCopy, {&ownershipTransfer, 1});
+
+    // Still slow, but it no longer stalls the graphics queue
+    device_->WaitForUpload(uploadValue);
+    device_->stagingAllocator_->ReleaseBuffer(std::move(uploadBuffer));
   }
 
   Texture::Texture(Texture&& old) noexcept
@@ -283,16 +349,11 @@ namespace Fvog
 
     const auto usage = parentCreateInfo_.usage;
 
-    // Storage is only allowed for GENERAL images with a color format
-    auto layout = VK_IMAGE_LAYOUT_GENERAL;
-    if (usage == TextureUsage::GENERAL && detail::FormatIsColor(createInfo.format))
+    const auto layout = GetSampledImageLayout(usage, createInfo.format);
+    if (layout == VK_IMAGE_LAYOUT_GENERAL)
     {
       storageDescriptorInfo_ = device.AllocateStorageImageDescriptor(imageView_, layout);
     }
-    else
-    {
-      layout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
-    }
     
     sampledDescriptorInfo_ = device.AllocateSampledImageDescriptor(imageView_, layout);
   }
@@ -302,7 +363,9 @@ namespace Fvog
     if (device_ != nullptr && imageView_ != VK_NULL_HANDLE)
     {
       // It's safe to pass VMA null allocators and/or handles, so we can reuse the image deletion queue here
-      device_->imageViewDeletionQueue_.emplace_back(device_->frameNumber, imageView_, std::move(name_));
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.imageViews.emplace_back(device_->frameNumber, imageView_, std::move(name_));
     }
   }
 
@@ -326,6 +389,26 @@ namespace Fvog
     return *new (this) TextureView(std::move(old));
   }
 
+  VkImageLayout GetSampledImageLayout(TextureUsage usage, Format format)
+  {
+    if (usage == TextureUsage::GENERAL && detail::FormatIsColor(format))
+    {
+      return VK_IMAGE_LAYOUT_GENERAL;
+    }
+
+    return VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
+  }
+
+  VkMemoryRequirements GetTextureMemoryRequirements(Device& device, const TextureCreateInfo& createInfo)
+  {
+    auto memoryRequirements = VkMemoryRequirements2{.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2};
+    vkGetDeviceImageMemoryRequirements(device.device_, detail::Address(VkDeviceImageMemoryRequirements{
+      .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+      .pCreateInfo = detail::Address(MakeImageCreateInfo(createInfo)),
+    }), &memoryRequirements);
+    return memoryRequirements.memoryRequirements;
+  }
+
   Texture CreateTexture2D(Device& device, VkExtent2D size, Format format, TextureUsage usage, std::string name)
   {
     ZoneScoped;
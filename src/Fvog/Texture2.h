@@ -51,6 +51,9 @@ namespace Fvog
     ATTACHMENT_READ_ONLY, // Ideal for gbuffer attachments that are later read
   };
 
+  // Storage images are only supported for GENERAL textures with a color format. Every other texture is sampled in READ_ONLY_OPTIMAL
+  [[nodiscard]] VkImageLayout GetSampledImageLayout(TextureUsage usage, Format format);
+
   struct TextureCreateInfo
   {
     VkImageViewType viewType = {};
@@ -60,6 +63,8 @@ namespace Fvog
     uint32_t arrayLayers = 1;
     VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
     TextureUsage usage = TextureUsage::GENERAL;
+    // If uncategorized, READ_ONLY textures are counted as TEXTURES and the rest as RENDER_TARGETS
+    MemoryCategory category = MemoryCategory::UNCATEGORIZED;
   };
 
   struct TextureViewCreateInfo
@@ -189,6 +194,10 @@ namespace Fvog
   public:
     // Verbose constructor
     explicit Texture(Device& device, const TextureCreateInfo& createInfo, std::string name = {});
+
+    // Places the texture in memory owned by someone else (e.g., to alias it with other resources).
+    // The memory must satisfy GetTextureMemoryRequirements(createInfo) at memoryOffset and outlive the texture
+    explicit Texture(Device& device, const TextureCreateInfo& createInfo, VmaAllocation memory, VkDeviceSize memoryOffset, std::string name = {});
     ~Texture();
 
     [[nodiscard]] TextureView CreateFormatView(Format format, std::string name = {}) const;
@@ -202,6 +211,8 @@ namespace Fvog
     /// @param info The subresource and data to upload
     /// @note info.data must be in a compatible image format
     /// @note This function is provided for backwards compatibility only
+    /// @note The first update of an image runs on the transfer queue and blocks until it completes. The graphics queue acquires the image at the start of the next frame
+    /// @note Later updates run on the graphics queue after all work already submitted to it, so upload a whole image in one call where possible
     void UpdateImageSLOW(const TextureUpdateInfo& info);
 
     Texture(const Texture&) = delete;
@@ -242,6 +253,8 @@ namespace Fvog
     std::string name_;
   };
 
+  [[nodiscard]] VkMemoryRequirements GetTextureMemoryRequirements(Device& device, const TextureCreateInfo& createInfo);
+
   // convenience functions
   [[nodiscard]] Texture CreateTexture2D(Device& device, VkExtent2D size, Format format, TextureUsage usage, std::string name = {});
   [[nodiscard]] Texture CreateTexture2DMip(Device& device, VkExtent2D size, Format format, uint32_t mipLevels, TextureUsage usage, std::string name = {});
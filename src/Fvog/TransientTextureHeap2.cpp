@@ -0,0 +1,183 @@
+#include "TransientTextureHeap2.h"
+
+#include "detail/Common.h"
+
+#include <volk.h>
+#include <vk_mem_alloc.h>
+
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <numeric>
+#include <utility>
+
+namespace Fvog
+{
+  namespace
+  {
+    VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+      return (value + alignment - 1) / alignment * alignment;
+    }
+
+    bool LifetimesOverlap(const TransientTextureHeap::TextureDesc& a, const TransientTextureHeap::TextureDesc& b)
+    {
+      return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+    }
+  }
+
+  TransientTextureHeap::TransientTextureHeap(Device& device, std::span<const TextureDesc> textures, std::string name)
+    : device_(&device),
+      name_(std::move(name))
+  {
+    ZoneScoped;
+
+    auto requirements = std::vector<VkMemoryRequirements>();
+    auto memoryTypeBits = ~0u;
+    for (const auto& desc : textures)
+    {
+      assert(desc.firstPass <= desc.lastPass);
+      const auto& req = requirements.emplace_back(GetTextureMemoryRequirements(device, desc.createInfo));
+      memoryTypeBits &= req.memoryTypeBits;
+      stats_.unaliasedBytes += req.size;
+    }
+
+    // In practice, every render target supports the same memory types. If that isn't the case, place the
+    // textures that support the most common memory type in the heap and give the rest their own allocation
+    if (memoryTypeBits == 0 && !requirements.empty())
+    {
+      auto bestCount = 0;
+      for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+      {
+        auto count = (int)std::ranges::count_if(requirements, [i](const auto& req) { return (req.memoryTypeBits & (1u << i)) != 0; });
+        if (count > bestCount)
+        {
+          bestCount = count;
+          memoryTypeBits = 1u << i;
+        }
+      }
+    }
+
+    placements_.reserve(textures.size());
+    for (size_t i = 0; i < textures.size(); i++)
+    {
+      placements_.emplace_back(textures[i], 0, requirements[i].size, (requirements[i].memoryTypeBits & memoryTypeBits) == 0);
+    }
+
+    // Greedily place the largest textures first. A texture is bumped past every texture it overlaps in both time and memory
+    auto order = std::vector<size_t>(textures.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::ranges::stable_sort(order, std::greater{}, [&](size_t i) { return requirements[i].size; });
+
+    auto placed = std::vector<size_t>();
+    auto heapSize = VkDeviceSize{};
+    auto heapAlignment = VkDeviceSize{1};
+    for (auto i : order)
+    {
+      auto& placement = placements_[i];
+      if (placement.standalone)
+      {
+        stats_.heapBytes += placement.size;
+        continue;
+      }
+
+      const auto alignment = requirements[i].alignment;
+      heapAlignment = std::max(heapAlignment, alignment);
+
+      auto offset = VkDeviceSize{};
+      for (bool moved = true; moved;)
+      {
+        moved = false;
+        for (auto j : placed)
+        {
+          const auto& other = placements_[j];
+          if (LifetimesOverlap(placement.desc, other.desc) && offset < other.offset + other.size && other.offset < offset + placement.size)
+          {
+            offset = AlignUp(other.offset + other.size, alignment);
+            moved = true;
+          }
+        }
+      }
+
+      placement.offset = offset;
+      heapSize = std::max(heapSize, offset + placement.size);
+      placed.emplace_back(i);
+    }
+
+    if (heapSize > 0)
+    {
+      auto allocationInfo = VmaAllocationInfo{};
+      detail::CheckVkResult(vmaAllocateMemory(
+        device_->allocator_,
+        detail::Address(VkMemoryRequirements{
+          .size = heapSize,
+          .alignment = heapAlignment,
+          .memoryTypeBits = memoryTypeBits,
+        }),
+        detail::Address(VmaAllocationCreateInfo{
+          // IHVs recommend putting render targets in dedicated allocations.
+          .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+          .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        }),
+        &allocation_,
+        &allocationInfo));
+
+      vmaSetAllocationName(device_->allocator_, allocation_, name_.c_str());
+      device_->TrackAllocation(MemoryCategory::RENDER_TARGETS, allocationInfo.size);
+      stats_.heapBytes += heapSize;
+    }
+  }
+
+  TransientTextureHeap::~TransientTextureHeap()
+  {
+    if (allocation_)
+    {
+      // Textures placed in the heap are destroyed in the same frame as it at the earliest, so they'll never be used after the memory is freed
+      auto& staging = device_->GetThreadDeletionStaging();
+      auto lock = std::lock_guard{staging.mutex};
+      staging.generic.emplace_back(
+        [device = device_, allocation = allocation_, frameOfLastUse = device_->frameNumber.load()](uint64_t value) -> bool
+        {
+          if (value >= frameOfLastUse)
+          {
+            auto info = VmaAllocationInfo{};
+            vmaGetAllocationInfo(device->allocator_, allocation, &info);
+            device->UntrackAllocation(MemoryCategory::RENDER_TARGETS, info.size);
+            vmaFreeMemory(device->allocator_, allocation);
+            return true;
+          }
+          return false;
+        });
+    }
+  }
+
+  TransientTextureHeap::TransientTextureHeap(TransientTextureHeap&& old) noexcept
+    : device_(std::exchange(old.device_, nullptr)),
+      allocation_(std::exchange(old.allocation_, nullptr)),
+      placements_(std::move(old.placements_)),
+      stats_(std::exchange(old.stats_, {})),
+      name_(std::move(old.name_))
+  {
+  }
+
+  TransientTextureHeap& TransientTextureHeap::operator=(TransientTextureHeap&& old) noexcept
+  {
+    if (&old == this)
+      return *this;
+    this->~TransientTextureHeap();
+    return *new (this) TransientTextureHeap(std::move(old));
+  }
+
+  Texture TransientTextureHeap::CreateTexture(size_t index) const
+  {
+    const auto& placement = placements_[index];
+    if (placement.standalone)
+    {
+      return Texture(*device_, placement.desc.createInfo, placement.desc.name);
+    }
+
+    return Texture(*device_, placement.desc.createInfo, allocation_, placement.offset, placement.desc.name);
+  }
+} // namespace Fvog
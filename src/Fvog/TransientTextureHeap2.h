@@ -0,0 +1,68 @@
+#pragma once
+#include "Device.h"
+#include "Texture2.h"
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Fvog
+{
+  // Places textures whose lifetimes within a frame don't overlap in the same memory.
+  // Lifetimes are inclusive ranges of pass indices, which are only meaningful relative to each other.
+  // Because aliases clobber each other, the first use of a texture in each frame must discard its contents (e.g., Context::ImageBarrierDiscard).
+  class TransientTextureHeap
+  {
+  public:
+    struct TextureDesc
+    {
+      TextureCreateInfo createInfo;
+      uint32_t firstPass{};
+      uint32_t lastPass{};
+      std::string name;
+    };
+
+    struct Stats
+    {
+      // Memory that would be consumed if every texture had its own allocation
+      VkDeviceSize unaliasedBytes{};
+      // Memory actually consumed by the heap and by textures that could not be placed in it
+      VkDeviceSize heapBytes{};
+    };
+
+    explicit TransientTextureHeap(Device& device, std::span<const TextureDesc> textures, std::string name = {});
+    ~TransientTextureHeap();
+
+    TransientTextureHeap(const TransientTextureHeap&) = delete;
+    TransientTextureHeap& operator=(const TransientTextureHeap&) = delete;
+    TransientTextureHeap(TransientTextureHeap&&) noexcept;
+    TransientTextureHeap& operator=(TransientTextureHeap&&) noexcept;
+
+    // Creates the texture described by textures[index] in the constructor. The heap must outlive the texture
+    [[nodiscard]] Texture CreateTexture(size_t index) const;
+
+    [[nodiscard]] const Stats& GetStats() const noexcept
+    {
+      return stats_;
+    }
+
+  private:
+    struct Placement
+    {
+      TextureDesc desc;
+      VkDeviceSize offset{};
+      VkDeviceSize size{};
+      // Textures that can't be bound to the heap's memory type get their own allocation
+      bool standalone{};
+    };
+
+    Device* device_{};
+    VmaAllocation allocation_{};
+    std::vector<Placement> placements_;
+    Stats stats_{};
+    std::string name_;
+  };
+} // namespace Fvog
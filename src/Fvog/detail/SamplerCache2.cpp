@@ -15,6 +15,7 @@ namespace Fvog::detail
     ZoneScoped;
     ZoneNamed(_, true);
     ZoneNameV(_, name.data(), name.size());
+    auto lock = std::lock_guard{mutex_};
     if (auto it = samplerCache_.find(samplerState); it != samplerCache_.end())
     {
       return it->second;
@@ -56,6 +57,7 @@ namespace Fvog::detail
 
   size_t SamplerCache::Size() const
   {
+    auto lock = std::lock_guard{mutex_};
     return samplerCache_.size();
   }
 
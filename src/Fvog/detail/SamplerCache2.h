@@ -1,5 +1,6 @@
 #pragma once
 #include "../Texture2.h"
+#include <mutex>
 #include <unordered_map>
 
 template<>
@@ -21,8 +22,8 @@ namespace Fvog::detail
     SamplerCache(Device* device) : device_(device) {}
     SamplerCache(const SamplerCache&) = delete;
     SamplerCache& operator=(const SamplerCache&) = delete;
-    SamplerCache(SamplerCache&&) noexcept = default;
-    SamplerCache& operator=(SamplerCache&&) noexcept = default;
+    SamplerCache(SamplerCache&&) noexcept = delete;
+    SamplerCache& operator=(SamplerCache&&) noexcept = delete;
     ~SamplerCache()
     {
       Clear();
@@ -34,6 +35,7 @@ namespace Fvog::detail
 
   private:
     Device* device_;
+    mutable std::mutex mutex_;
     std::unordered_map<SamplerCreateInfo, Sampler> samplerCache_;
     std::unordered_map<SamplerCreateInfo, Device::DescriptorInfo> descriptorCache_;
   };
@@ -0,0 +1,119 @@
+#include "ShaderCache2.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+namespace Fvog::detail
+{
+  namespace
+  {
+    struct CacheFileHeader
+    {
+      static constexpr uint32_t expectedMagic = 0x56505346; // "FSPV"
+      // Bump when the layout of cache files changes
+      static constexpr uint32_t expectedVersion = 1;
+
+      uint32_t magic{};
+      uint32_t version{};
+      uint64_t key{};
+      uint32_t workgroupSize[3]{};
+      uint32_t spirvWordCount{};
+    };
+  } // namespace
+
+  ShaderCache::KeyBuilder& ShaderCache::KeyBuilder::Add(std::string_view bytes)
+  {
+    // Include the length so adjacent strings can't be shuffled into the same key
+    Add(static_cast<uint64_t>(bytes.size()));
+    for (char c : bytes)
+    {
+      hash_ ^= static_cast<uint8_t>(c);
+      hash_ *= 1099511628211ull;
+    }
+    return *this;
+  }
+
+  ShaderCache::KeyBuilder& ShaderCache::KeyBuilder::Add(uint64_t value)
+  {
+    for (int i = 0; i < 8; i++)
+    {
+      hash_ ^= (value >> (i * 8)) & 0xFF;
+      hash_ *= 1099511628211ull;
+    }
+    return *this;
+  }
+
+  std::optional<ShaderCompileInfo> ShaderCache::Find(uint64_t key)
+  {
+    ZoneScoped;
+    auto file = std::ifstream(PathForKey(key), std::ios::in | std::ios::binary);
+    auto header = CacheFileHeader{};
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CacheFileHeader::expectedMagic ||
+        header.version != CacheFileHeader::expectedVersion || header.key != key || header.spirvWordCount == 0)
+    {
+      misses_++;
+      return std::nullopt;
+    }
+
+    auto info = ShaderCompileInfo{
+      .binarySpv = std::vector<uint32_t>(header.spirvWordCount),
+      .workgroupSize_ = {header.workgroupSize[0], header.workgroupSize[1], header.workgroupSize[2]},
+    };
+    if (!file.read(reinterpret_cast<char*>(info.binarySpv.data()), static_cast<std::streamsize>(info.binarySpv.size() * sizeof(uint32_t))))
+    {
+      misses_++;
+      return std::nullopt;
+    }
+
+    hits_++;
+    return info;
+  }
+
+  void ShaderCache::Store(uint64_t key, const ShaderCompileInfo& info)
+  {
+    ZoneScoped;
+    auto errorCode = std::error_code{};
+    std::filesystem::create_directories(directory_, errorCode);
+    if (errorCode)
+    {
+      return;
+    }
+
+    // Another thread may be storing the same key, so each writes its own temporary file and the last rename wins
+    const auto path = PathForKey(key);
+    auto tempPath = path;
+    tempPath += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+      auto file = std::ofstream(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+      const auto header = CacheFileHeader{
+        .magic = CacheFileHeader::expectedMagic,
+        .version = CacheFileHeader::expectedVersion,
+        .key = key,
+        .workgroupSize = {info.workgroupSize_.width, info.workgroupSize_.height, info.workgroupSize_.depth},
+        .spirvWordCount = static_cast<uint32_t>(info.binarySpv.size()),
+      };
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(info.binarySpv.data()), static_cast<std::streamsize>(info.binarySpv.size() * sizeof(uint32_t)));
+      if (!file)
+      {
+        file.close();
+        std::filesystem::remove(tempPath, errorCode);
+        return;
+      }
+    }
+
+    std::filesystem::rename(tempPath, path, errorCode);
+  }
+
+  std::filesystem::path ShaderCache::PathForKey(uint64_t key) const
+  {
+    char name[32]{};
+    std::snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key));
+    return directory_ / name;
+  }
+} // namespace Fvog::detail
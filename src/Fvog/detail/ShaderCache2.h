@@ -0,0 +1,56 @@
+#pragma once
+#include "../Shader2.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+namespace Fvog::detail
+{
+  // Compiled SPIR-V stored on disk, one file per key. Keys should cover everything that affects compilation (source, stage, target, options).
+  // Pure CPU work, so it can be used and measured without a device. Thread-safe
+  class ShaderCache
+  {
+  public:
+    explicit ShaderCache(std::filesystem::path directory) : directory_(std::move(directory)) {}
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+    ShaderCache(ShaderCache&&) noexcept = delete;
+    ShaderCache& operator=(ShaderCache&&) noexcept = delete;
+
+    // Incrementally hashes the inputs of a compilation (FNV-1a)
+    class KeyBuilder
+    {
+    public:
+      KeyBuilder& Add(std::string_view bytes);
+      KeyBuilder& Add(uint64_t value);
+
+      [[nodiscard]] uint64_t Key() const noexcept
+      {
+        return hash_;
+      }
+
+    private:
+      uint64_t hash_ = 14695981039346656037ull;
+    };
+
+    // Counts a hit or a miss. Files that are missing or damaged are misses
+    [[nodiscard]] std::optional<ShaderCompileInfo> Find(uint64_t key);
+    // Failing to write is not an error, the shader will just be compiled again next time
+    void Store(uint64_t key, const ShaderCompileInfo& info);
+
+    [[nodiscard]] ShaderCacheStats GetStats() const noexcept
+    {
+      return {hits_.load(), misses_.load()};
+    }
+
+  private:
+    [[nodiscard]] std::filesystem::path PathForKey(uint64_t key) const;
+
+    std::filesystem::path directory_;
+    std::atomic<uint32_t> hits_{};
+    std::atomic<uint32_t> misses_{};
+  };
+} // namespace Fvog::detail
@@ -0,0 +1,58 @@
+#include "ThreadPool2.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+
+namespace Fvog::detail
+{
+  ThreadPool::ThreadPool(uint32_t threadCount, const char* name)
+    : name_(name)
+  {
+    if (threadCount == 0)
+    {
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    threads_.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+      threads_.emplace_back([this] { WorkerMain(); });
+    }
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      auto lock = std::lock_guard{mutex_};
+      stopping_ = true;
+    }
+    condition_.notify_all();
+
+    for (auto& thread : threads_)
+    {
+      thread.join();
+    }
+  }
+
+  void ThreadPool::WorkerMain()
+  {
+    tracy::SetThreadName(name_.c_str());
+    while (true)
+    {
+      auto job = std::function<void()>();
+      {
+        auto lock = std::unique_lock{mutex_};
+        condition_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty())
+        {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+
+      job();
+    }
+  }
+} // namespace Fvog::detail
@@ -0,0 +1,59 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Fvog::detail
+{
+  // A fixed set of worker threads that run jobs in the order they were submitted
+  class ThreadPool
+  {
+  public:
+    // Zero means one thread per hardware thread
+    explicit ThreadPool(uint32_t threadCount = 0, const char* name = "Worker");
+    // Runs every job that has been submitted, then joins the workers
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) noexcept = delete;
+    ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+    // Exceptions thrown by the job are rethrown by the future's get()
+    template<class F>
+    [[nodiscard]] std::future<std::invoke_result_t<F>> Submit(F&& job)
+    {
+      // packaged_task is move-only, but std::function requires a copyable callable
+      auto task   = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(job));
+      auto future = task->get_future();
+      {
+        auto lock = std::lock_guard{mutex_};
+        jobs_.emplace_back([task] { (*task)(); });
+      }
+      condition_.notify_one();
+      return future;
+    }
+
+    [[nodiscard]] uint32_t ThreadCount() const noexcept
+    {
+      return static_cast<uint32_t>(threads_.size());
+    }
+
+  private:
+    void WorkerMain();
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_{};
+    std::string name_;
+    std::vector<std::thread> threads_;
+  };
+} // namespace Fvog::detail
@@ -12,6 +12,7 @@
 #include "ImGui/imgui_impl_fvog.h"
 
 #include "RendererUtilities.h"
+#include "MathUtilities.h"
 
 #include "vulkan/vulkan_core.h"
 #include <GLFW/glfw3.h>
@@ -20,6 +21,7 @@
 
 #include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <stack>
 #include <unordered_map>
@@ -732,6 +734,62 @@ void FrogRenderer2::GuiDrawDebugWindow(VkCommandBuffer)
       shouldRemakeSwapchainNextFrame = true;
       presentMode = static_cast<VkPresentModeKHR>(pMode);
     }
+
+    ImGui::BeginDisabled(IsBenchmarkingFramesInFlight());
+    auto framesInFlightInt = static_cast<int>(framesInFlight);
+    if (ImGui::SliderInt("Frames In Flight", &framesInFlightInt, 1, static_cast<int>(Fvog::Device::maxFramesInFlight)))
+    {
+      framesInFlight = static_cast<uint32_t>(framesInFlightInt);
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled | ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip("How far the CPU may get ahead of the GPU. More frames absorb CPU spikes, but add latency");
+    }
+    if (ImGui::Button("Benchmark Frames In Flight"))
+    {
+      StartFramesInFlightBenchmark();
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled | ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip("Prints the frame time and latency of each setting to the console. Use a present mode other than FIFO");
+    }
+    ImGui::EndDisabled();
+    ImGui::BeginDisabled(IsStressTestingResources());
+    if (ImGui::Button("Stress Test Resource Creation"))
+    {
+      StartResourceStressTest();
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled | ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip("Creates and destroys buffers and textures on several threads, then checks for shared descriptor indices and leaks. Prints to the console");
+    }
+    ImGui::EndDisabled();
+    ImGui::BeginDisabled(parallelRecordingBenchmark.has_value());
+    if (ImGui::Button("Benchmark Parallel Recording"))
+    {
+      StartParallelRecordingBenchmark();
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled | ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip("Prints the render graph's average recording time with parallel recording off and on to the console");
+    }
+    ImGui::EndDisabled();
+    if (ImGui::Button("Benchmark Light BVH"))
+    {
+      BenchmarkLightBvh();
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip("Prints the time taken to build and refit the light BVH over 1k, 10k, and 100k random lights to the console. Stalls the app while it runs");
+    }
+    if (ImGui::Button("Validate Light Clusters"))
+    {
+      ValidateLightClusters();
+    }
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip("Compares the lights assigned to each cluster on the GPU with a CPU reference and prints the differences to the console");
+    }
     
     ImGui::Checkbox("Display Main Frustum", &debugDisplayMainFrustum);
     ImGui::Checkbox("Generate Hi-Z Buffer", &generateHizBuffer);
@@ -739,6 +797,14 @@ void FrogRenderer2::GuiDrawDebugWindow(VkCommandBuffer)
     {
       ImGui::SetTooltip("If unchecked, the hi-z buffer is cleared every frame, essentially forcing this test to pass");
     }
+    ImGui::BeginDisabled(!visbufferMeshPipeline.has_value());
+    ImGui::Checkbox("Use Mesh Shaders", &useMeshShaders);
+    ImGui::EndDisabled();
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled | ImGuiHoveredFlags_DelayNormal))
+    {
+      ImGui::SetTooltip(visbufferMeshPipeline ? "Culls and draws the main view's triangles in a mesh shader instead of expanding them into an index buffer"
+                                              : "Mesh shaders are not supported by this device");
+    }
     
 
     ImGui::SeparatorText("Debug Drawing");
@@ -765,6 +831,10 @@ void FrogRenderer2::GuiDrawDebugWindow(VkCommandBuffer)
     ImGui_FlagCheckbox("Show Dirty Pages", &shadingUniforms.debugFlags, VSM_SHOW_DIRTY_PAGES);
     ImGui_FlagCheckbox("Show Overdraw", &shadingUniforms.debugFlags, VSM_SHOW_OVERDRAW);
     ImGui_FlagCheckbox("Blend Normals", &shadingUniforms.debugFlags, BLEND_NORMALS);
+    ImGui_FlagCheckbox("Shade All Lights", &shadingUniforms.debugFlags, SHADE_ALL_LIGHTS);
+    ImGui::Checkbox("Use Light BVH", &useLightBvh);
+    ImGui::SliderFloat("Light Cluster Near Depth", &lightClusterNearDepth, 0.01f, lightClusterFarDepth, "%.2f", ImGuiSliderFlags_Logarithmic);
+    ImGui::SliderFloat("Light Cluster Far Depth", &lightClusterFarDepth, lightClusterNearDepth, 10'000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
 
     ImGui::Separator();
     ImGui::SliderFloat("Alpha Hash Scale", &globalUniforms.alphaHashScale, 1, 3);
@@ -795,10 +865,17 @@ void FrogRenderer2::GuiDrawShadowWindow(VkCommandBuffer commandBuffer)
     ImGui_HoverTooltip("The HPB (hierarchical page buffer) is used to cull\nmeshlets and primitives that are not touching an active page.");
     ImGui_FlagCheckbox("Disable Page Caching", &vsmUniforms.debugFlags, (uint32_t)Techniques::VirtualShadowMaps::DebugFlag::VSM_FORCE_DIRTY_VISIBLE_PAGES);
     ImGui_HoverTooltip("Page caching reduces the amount of per-frame work\nby only drawing the pages whose visibility changed this frame.");
+    ImGui::Text("Dirty Caster Bounds: %u", vsmContext.NumDirtyBounds());
+    ImGui_HoverTooltip("Old and new bounds of meshes that moved, appeared, or disappeared this frame.\nOnly the pages they overlap are redrawn, with every caster over them.");
 
     auto SliderUint = [](const char* label, uint32_t* v, uint32_t v_min, uint32_t v_max) -> bool
     { return ImGui::SliderScalar(label, ImGuiDataType_U32, v, &v_min, &v_max, "%u"); };
 
+    ImGui::Checkbox("Local Light Shadows", &vsmLocalLightsEnable);
+    ImGui_HoverTooltip("Point and spot lights in view cast shadows, starting with the lights that cover the most pixels.");
+    SliderUint("Max Shadowed Lights", &vsmLocalLightBudget, 1, vsmMaxLocalLights);
+    ImGui::Text("Shadowed Lights: %u (%zu views)", vsmLocalLights.NumShadowedLights(), vsmLocalLights.GetViews().size());
+
     int shadowMode = shadowUniforms.shadowFilter;
     ImGui::RadioButton("PCSS", &shadowMode, SHADOW_FILTER_PCSS);
     ImGui::SameLine();
@@ -961,11 +1038,16 @@ void FrogRenderer2::GuiDrawPerfWindow(VkCommandBuffer)
         ImPlot::SetupAxisLimits(ImAxis_X1, accumTime - 5.0, accumTime, ImGuiCond_Always);
         ImPlot::SetupLegend(ImPlotLocation_NorthWest, ImPlotLegendFlags_Outside);
 
-        for (size_t statIdx = 0; const auto& stat : stats[groupIdx])
+        for (size_t statIdx = 0; statIdx < stats[groupIdx].size(); statIdx++)
         {
+          // Timers of passes that never ran, like those of clipmaps the sun doesn't have
+          const auto& stat = stats[groupIdx][statIdx];
+          if (stat.timings.size == 0)
+          {
+            continue;
+          }
           ImPlot::SetNextFillStyle(IMPLOT_AUTO_COL, 1.0f);
-          ImPlot::PlotLine(statGroup.statNames[statIdx], accumTimes.data.get(), stat.timings.data.get(), (int)stat.timings.size, 0, (int)stat.timings.offset, sizeof(double));
-          statIdx++;
+          ImPlot::PlotLine(statGroup.statNames[statIdx].c_str(), accumTimes.data.get(), stat.timings.data.get(), (int)stat.timings.size, 0, (int)stat.timings.offset, sizeof(double));
         }
         ImPlot::EndPlot();
       }
@@ -976,13 +1058,80 @@ void FrogRenderer2::GuiDrawPerfWindow(VkCommandBuffer)
         for (size_t statIdx = 0; statIdx < stats[groupIdx].size(); statIdx++)
         {
           const auto& stat = stats[groupIdx][statIdx];
-          ImGui::Text("%-20s: %-10fms", statGroup.statNames[statIdx], stat.movingAverage);
+          if (stat.timings.size == 0)
+          {
+            continue;
+          }
+          ImGui::Text("%-20s: %-10fms", statGroup.statNames[statIdx].c_str(), stat.movingAverage);
           ImGui::Separator();
         }
         ImGui::TreePop();
       }
       groupIdx++;
     }
+
+    // Per-pass timings above are measured on whichever queue a pass ran on, so they can add up to more than the frame
+    if (device_->HasAsyncComputeQueue())
+    {
+      const auto& graphStats = renderGraph.GetStats();
+      const auto overlapPercent = graphStats.asyncComputeMs > 0 ? 100.0 * graphStats.asyncComputeOverlapMs / graphStats.asyncComputeMs : 0.0;
+      ImGui::Text("Async compute: %.3fms, %.3fms (%.0f%%) overlapped with graphics", graphStats.asyncComputeMs, graphStats.asyncComputeOverlapMs, overlapPercent);
+    }
+    else
+    {
+      ImGui::TextUnformatted("Async compute: unavailable, passes run on the graphics queue");
+    }
+  }
+  ImGui::End();
+}
+
+void FrogRenderer2::GuiDrawMemoryWindow(VkCommandBuffer)
+{
+  if (ImGui::Begin("Memory##memory_window"))
+  {
+    const auto budget = device_->GetDeviceLocalMemoryBudget();
+    const auto fraction = budget.budgetBytes > 0 ? float(double(budget.usageBytes) / double(budget.budgetBytes)) : 0.0f;
+    char overlay[64]{};
+    snprintf(overlay, std::size(overlay), "%llu/%llu MB", (unsigned long long)(budget.usageBytes / 1'000'000), (unsigned long long)(budget.budgetBytes / 1'000'000));
+    ImGui::ProgressBar(fraction, {-1, 0}, overlay);
+    if (!device_->hasMemoryBudgetExtension_)
+    {
+      ImGui::TextUnformatted("VK_EXT_memory_budget is unsupported, so the budget is an estimate");
+    }
+
+    if (ImGui::BeginTable("memory_categories", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+      ImGui::TableSetupColumn("Category");
+      ImGui::TableSetupColumn("Allocated (MB)");
+      ImGui::TableSetupColumn("Allocations");
+      ImGui::TableSetupColumn("Suballocated (MB)");
+      ImGui::TableHeadersRow();
+      for (uint32_t i = 0; i < static_cast<uint32_t>(Fvog::MemoryCategory::COUNT); i++)
+      {
+        const auto category = static_cast<Fvog::MemoryCategory>(i);
+        const auto usage = device_->GetMemoryUsage(category);
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(Fvog::MemoryCategoryToString(category));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", double(usage.allocatedBytes) / 1'000'000);
+        ImGui::TableNextColumn();
+        ImGui::Text("%llu", (unsigned long long)usage.allocationCount);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", double(usage.suballocatedBytes) / 1'000'000);
+      }
+      ImGui::EndTable();
+    }
+
+    if (ImGui::Button("Dump JSON Report"))
+    {
+      auto file = std::ofstream("memory_report.json", std::ios::out | std::ios::trunc);
+      file << device_->GetMemoryReportJson();
+    }
+    if (ImGui::IsItemHovered())
+    {
+      ImGui::SetTooltip("Writes memory_report.json to the working directory");
+    }
   }
   ImGui::End();
 }
@@ -1601,24 +1750,59 @@ void FrogRenderer2::OnGui([[maybe_unused]] double dt, VkCommandBuffer commandBuf
   ImGui::TextUnformatted(device_->device_.physical_device.properties.deviceName);
   Gui::BeginProperties();
 
-  auto budgets = std::make_unique<VmaBudget[]>(device_->physicalDevice_.memory_properties.memoryHeapCount);
-
-  // Search for the first heap with DEVICE_LOCAL_BIT.
-  // This could totally fail and report e.g. a host-visible BAR heap, but that's fine because this is just a silly lil' UI element.
-  // Existing systems seem to put the normal device-local heap first anyway.
-  uint32_t deviceHeapIndex = 0;
-  for (uint32_t i = 0; i < device_->physicalDevice_.memory_properties.memoryHeapCount; i++)
+  const auto budget   = device_->GetDeviceLocalMemoryBudget();
+  const auto usageMb  = budget.usageBytes / 1'000'000;
+  const auto budgetMb = budget.budgetBytes / 1'000'000;
+  Gui::Text("VRAM Consumed", "%llu/%llu MB", "The total is a budget that is affected\nby factors external to this program.", usageMb, budgetMb);
+  if (frame.transientTextureHeap)
   {
-    if (device_->physicalDevice_.memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
-    {
-      deviceHeapIndex = i;
-      break;
-    }
+    const auto& stats = frame.transientTextureHeap->GetStats();
+    Gui::Text("Transient RT Memory",
+      "%llu/%llu MB",
+      "Memory consumed by render targets that alias each other,\nversus what they would consume without aliasing.",
+      stats.heapBytes / 1'000'000,
+      stats.unaliasedBytes / 1'000'000);
   }
-  vmaGetHeapBudgets(device_->allocator_, budgets.get());
-  const auto usageMb    = budgets[deviceHeapIndex].usage / 1'000'000;
-  const auto budgetMb   = budgets[deviceHeapIndex].budget / 1'000'000;
-  Gui::Text("VRAM Consumed", "%llu/%llu MB", "The total is a budget that is affected\nby factors external to this program.", usageMb, budgetMb);
+  {
+    const auto& stats = instancedMeshletBufferStats;
+    Gui::Text("Visible Index Buffer",
+      "%u/%u K indices",
+      "Indices needed to hold every view's surviving triangles,\nversus the capacity of the post-culling index buffer.\nThe buffer is resized from feedback a couple of frames late.",
+      stats.requested / 1000,
+      stats.capacity / 1000);
+    Gui::Text("Clamped Triangles",
+      "%u (%llu frames)",
+      "Triangles that were dropped because the index buffer was too small,\nand the total number of frames in which that happened.",
+      stats.clamped / 3,
+      (unsigned long long)stats.framesClamped);
+  }
+  {
+    const auto& stats = renderGraph.GetStats();
+    Gui::Text("Render Graph",
+      "%u passes (%u culled)",
+      "Passes recorded last frame, and passes skipped because nothing consumed their output.",
+      stats.passes,
+      stats.culledPasses);
+    Gui::Text("Barriers",
+      "%u batches: %u buffer, %u image, %u memory",
+      "Pipeline barrier commands issued by the render graph last frame, and the barriers within them.",
+      stats.barrierBatches,
+      stats.bufferBarriers,
+      stats.imageBarriers,
+      stats.memoryBarriers);
+    Gui::Text("Queue Submits",
+      "%u graphics, %u compute, %u waits",
+      "Submissions made partway through last frame to hand resources between the graphics\nand async compute queues, and the semaphore waits between them.",
+      stats.graphicsSubmits,
+      stats.computeSubmits,
+      stats.queueWaits);
+    Gui::Text("Graph Recording",
+      "%.3f ms CPU, %u passes in parallel",
+      "Host time spent recording the render graph last frame, and how many passes were\nrecorded into secondary command buffers on worker threads.",
+      stats.recordMs,
+      stats.parallelPasses);
+  }
+  Gui::Checkbox("Parallel Recording", &renderGraph.parallelRecording, "Record runs of independent passes (e.g., VSM clipmaps) on worker threads.\nToggle to compare the graph's recording time.");
   Gui::Checkbox("Show FPS", &showFpsInfo);
   Gui::Checkbox("Show Scene Info", &showSceneInfo);
 
@@ -1698,6 +1882,19 @@ void FrogRenderer2::OnGui([[maybe_unused]] double dt, VkCommandBuffer commandBuf
 
     viewportIsHovered = ImGui::IsItemHovered();
 
+    // Clicking the viewport selects the node holding the mesh under the cursor
+    if (ImGui::IsItemClicked(ImGuiMouseButton_Left))
+    {
+      const auto mousePos    = ImGui::GetMousePos();
+      const auto uv          = (glm::vec2(mousePos.x, mousePos.y) - viewportContentOffset) / glm::vec2(viewportContentSize.x, viewportContentSize.y);
+      const auto invViewProj = glm::inverse(Math::InfReverseZPerspectiveRH(cameraFovyRadians, aspectRatio, cameraNearPlane) * mainCamera.GetViewMatrix());
+      const auto nearPoint   = Math::UnprojectUV_ZO(1, uv, invViewProj);
+      if (auto* node = scene.Pick(mainCamera.position, nearPoint - mainCamera.position))
+      {
+        selectedThingy = node;
+      }
+    }
+
     // FPS viewer
     {
       auto newCursorPos = ImGui::GetWindowContentRegionMin();
@@ -1746,6 +1943,7 @@ void FrogRenderer2::OnGui([[maybe_unused]] double dt, VkCommandBuffer commandBuf
   GuiDrawViewer(commandBuffer);
   GuiDrawMaterialsArray(commandBuffer);
   GuiDrawPerfWindow(commandBuffer);
+  GuiDrawMemoryWindow(commandBuffer);
   GuiDrawComponentEditor(commandBuffer);
   GuiDrawHdrWindow(commandBuffer);
   GuiDrawSceneGraph(commandBuffer);
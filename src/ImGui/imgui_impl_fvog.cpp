@@ -276,7 +276,7 @@ static void ImGui_ImplFvog_SetupRenderState(
   if (draw_data->TotalVtxCount > 0)
   {
     pushConstants.vertexBufferIndex = rb->vertexBuffer->GetResourceHandle().index;
-    vkCmdBindIndexBuffer(command_buffer, rb->indexBuffer->Handle(), 0, sizeof(ImDrawIdx) == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+    vkCmdBindIndexBuffer(command_buffer, rb->indexBuffer->Handle(), rb->indexBuffer->Offset(), sizeof(ImDrawIdx) == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
   }
 
   // Setup viewport:
@@ -496,7 +496,7 @@ void ImGui_ImplFvog_CreateFontsTexture()
   bd->device->ImmediateSubmit(
     [&](VkCommandBuffer cmd) {
       auto ctx = Fvog::Context(*bd->device, cmd);
-      auto uploadBuffer = Fvog::Buffer(*bd->device, {.size = upload_size, .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE}, "ImGui Upload Buffer");
+      auto uploadBuffer = Fvog::Buffer(*bd->device, {.size = upload_size, .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE, .category = Fvog::MemoryCategory::STAGING}, "ImGui Upload Buffer");
       memcpy(uploadBuffer.GetMappedMemory(), pixels, upload_size);
       ctx.ImageBarrierDiscard(bd->FontImage.value(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
       ctx.CopyBufferToTexture(uploadBuffer, bd->FontImage.value(), {.extent = {(uint32_t)width, (uint32_t)height, 1},});
@@ -7,6 +7,8 @@
 #include "Fvog/detail/Common.h"
 
 #include <array>
+#include <string>
+#include <vector>
 #include "Pipelines2.h"
 
 
@@ -32,6 +34,87 @@ namespace Pipelines2
     });
   }
 
+  Fvog::ComputePipeline CullMeshlets(Fvog::Device& device, uint32_t cullFlags, bool debugDrawing)
+  {
+    auto defines = std::vector<ShaderDefine>{{.name = "CULL_FLAGS", .value = std::to_string(cullFlags)}};
+    if (debugDrawing)
+    {
+      defines.push_back({.name = "ENABLE_DEBUG_DRAWING"});
+    }
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/CullMeshlets.comp.glsl", defines);
+
+    auto name = "Cull Meshlets (flags " + std::to_string(cullFlags) + (debugDrawing ? ", debug)" : ")");
+    return Fvog::ComputePipeline(device, {
+      .name = name,
+      .shader = &comp,
+    });
+  }
+
+  Fvog::ComputePipeline CullTriangles(Fvog::Device& device, uint32_t cullFlags)
+  {
+    const auto defines = std::array{ShaderDefine{.name = "CULL_FLAGS", .value = std::to_string(cullFlags)}};
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/CullTriangles.comp.glsl", defines);
+
+    auto name = "Cull Triangles (flags " + std::to_string(cullFlags) + ")";
+    return Fvog::ComputePipeline(device, {
+      .name = name,
+      .shader = &comp,
+    });
+  }
+
+  Fvog::ComputePipeline CullInstances(Fvog::Device& device)
+  {
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/CullInstances.comp.glsl");
+
+    return Fvog::ComputePipeline(device, {
+      .name = "Cull Instances",
+      .shader = &comp,
+    });
+  }
+
+  Fvog::ComputePipeline CullInstancesMultiView(Fvog::Device& device)
+  {
+    const auto defines = std::array{ShaderDefine{.name = "CULL_MULTI_VIEW"}};
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/CullInstances.comp.glsl", defines);
+
+    return Fvog::ComputePipeline(device, {
+      .name = "Cull Instances (multi-view)",
+      .shader = &comp,
+    });
+  }
+
+  Fvog::ComputePipeline CullMeshletsMultiView(Fvog::Device& device)
+  {
+    const auto defines = std::array{ShaderDefine{.name = "CULL_MULTI_VIEW"}};
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/CullMeshlets.comp.glsl", defines);
+
+    return Fvog::ComputePipeline(device, {
+      .name = "Cull Meshlets (multi-view)",
+      .shader = &comp,
+    });
+  }
+
+  Fvog::ComputePipeline MultiViewPrefixSum(Fvog::Device& device)
+  {
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/MultiViewPrefixSum.comp.glsl");
+
+    return Fvog::ComputePipeline(device, {
+      .name = "Multi-View Prefix Sum",
+      .shader = &comp,
+    });
+  }
+
+  Fvog::ComputePipeline CullTrianglesMultiView(Fvog::Device& device)
+  {
+    const auto defines = std::array{ShaderDefine{.name = "CULL_MULTI_VIEW"}};
+    auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/visbuffer/CullTriangles.comp.glsl", defines);
+
+    return Fvog::ComputePipeline(device, {
+      .name = "Cull Triangles (multi-view)",
+      .shader = &comp,
+    });
+  }
+
   Fvog::ComputePipeline HzbCopy(Fvog::Device& device)
   {
     auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/hzb/HZBCopy.comp.glsl");
@@ -73,6 +156,27 @@ namespace Pipelines2
     });
   }
 
+  Fvog::GraphicsPipeline VisbufferMesh(Fvog::Device& device, const Fvog::RenderTargetFormats& renderTargetFormats)
+  {
+    const auto defines = std::array{ShaderDefine{.name = "VISBUFFER_MESH_SHADER"}};
+    auto ms = LoadShaderWithIncludes2(device, Fvog::PipelineStage::MESH_SHADER, "shaders/visbuffer/Visbuffer.mesh.glsl");
+    auto fs = LoadShaderWithIncludes2(device, Fvog::PipelineStage::FRAGMENT_SHADER, "shaders/visbuffer/Visbuffer.frag.glsl", defines);
+
+    return Fvog::GraphicsPipeline(device, {
+      .name = "Visbuffer Mesh",
+      .meshShader = &ms,
+      .fragmentShader = &fs,
+      .rasterizationState = {.cullMode = VK_CULL_MODE_NONE},
+      .depthState =
+        {
+          .depthTestEnable = true,
+          .depthWriteEnable = true,
+          .depthCompareOp = FVOG_COMPARE_OP_NEARER,
+        },
+      .renderTargetFormats = renderTargetFormats,
+    });
+  }
+
   Fvog::GraphicsPipeline VisbufferResolve(Fvog::Device& device, const Fvog::RenderTargetFormats& renderTargetFormats)
   {
     auto vs = LoadShaderWithIncludes2(device, Fvog::PipelineStage::VERTEX_SHADER, "shaders/visbuffer/VisbufferResolve.vert.glsl");
@@ -5,9 +5,21 @@ namespace Pipelines2
 {
   [[nodiscard]] Fvog::ComputePipeline CullMeshlets(Fvog::Device& device);
   [[nodiscard]] Fvog::ComputePipeline CullTriangles(Fvog::Device& device);
+  // Permutations specialized for a fixed set of GlobalFlags culling bits. Tests that aren't in cullFlags are compiled out.
+  // The overloads above read the flags at runtime instead
+  [[nodiscard]] Fvog::ComputePipeline CullMeshlets(Fvog::Device& device, uint32_t cullFlags, bool debugDrawing);
+  [[nodiscard]] Fvog::ComputePipeline CullTriangles(Fvog::Device& device, uint32_t cullFlags);
+  [[nodiscard]] Fvog::ComputePipeline CullInstances(Fvog::Device& device);
+  // CULL_MULTI_VIEW variants that cull several VSM views at once
+  [[nodiscard]] Fvog::ComputePipeline CullInstancesMultiView(Fvog::Device& device);
+  [[nodiscard]] Fvog::ComputePipeline CullMeshletsMultiView(Fvog::Device& device);
+  [[nodiscard]] Fvog::ComputePipeline MultiViewPrefixSum(Fvog::Device& device);
+  [[nodiscard]] Fvog::ComputePipeline CullTrianglesMultiView(Fvog::Device& device);
   [[nodiscard]] Fvog::ComputePipeline HzbCopy(Fvog::Device& device);
   [[nodiscard]] Fvog::ComputePipeline HzbReduce(Fvog::Device& device);
   [[nodiscard]] Fvog::GraphicsPipeline Visbuffer(Fvog::Device& device, const Fvog::RenderTargetFormats& renderTargetFormats);
+  // Culls and draws visible meshlets with a mesh shader. Requires Device::supportsMeshShaders_
+  [[nodiscard]] Fvog::GraphicsPipeline VisbufferMesh(Fvog::Device& device, const Fvog::RenderTargetFormats& renderTargetFormats);
   [[nodiscard]] Fvog::GraphicsPipeline VisbufferResolve(Fvog::Device& device, const Fvog::RenderTargetFormats& renderTargetFormats);
   [[nodiscard]] Fvog::GraphicsPipeline Shading(Fvog::Device& device, const Fvog::RenderTargetFormats& renderTargetFormats);
   [[nodiscard]] Fvog::ComputePipeline Tonemap(Fvog::Device& device);
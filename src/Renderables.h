@@ -108,6 +108,16 @@ namespace Render
     glm::mat4 modelCurrent;
   };
 
+  // Used to cull whole meshes before their meshlets are culled
+  struct GpuMeshInstance
+  {
+    float aabbMin[3]               = {}; // Object space bounds of the mesh's meshlets
+    uint32_t meshletInstanceOffset = 0;
+    float aabbMax[3]               = {};
+    uint32_t meshletCount          = 0;
+    uint32_t instanceId            = 0; // Index of the mesh's ObjectUniforms
+  };
+
   // The ID structs below this line mainly exist in this file as a hack to prevent
   // a circular dependency between FrogRenderer2.h and Scene.h.
   struct MeshGeometryID
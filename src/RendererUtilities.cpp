@@ -37,7 +37,7 @@ Fvog::Texture LoadTextureShrimple(Fvog::Device& device, const std::filesystem::p
 //  return Fvog::Shader(device.device_, stage, path, path.filename().string().c_str());
 //}
 
-Fvog::Shader LoadShaderWithIncludes2(Fvog::Device& device, Fvog::PipelineStage stage, const std::filesystem::path& path)
+Fvog::Shader LoadShaderWithIncludes2(Fvog::Device& device, Fvog::PipelineStage stage, const std::filesystem::path& path, std::span<const ShaderDefine> defines)
 {
   if (!std::filesystem::exists(path) || std::filesystem::is_directory(path))
   {
@@ -52,5 +52,27 @@ Fvog::Shader LoadShaderWithIncludes2(Fvog::Device& device, Fvog::PipelineStage s
   {
     throw std::runtime_error("Failed to process includes");
   }
-  return Fvog::Shader(device.device_, stage, std::string_view(processedSource.get()), path.filename().string().c_str());
+
+  if (defines.empty())
+  {
+    return Fvog::Shader(device.device_, stage, std::string_view(processedSource.get()), path.filename().string().c_str());
+  }
+
+  // Defines must follow #version, which has to be the first directive. Since the definitions are part of the source, each permutation gets its own shader cache entry
+  auto source = std::string(processedSource.get());
+  auto insertAt = size_t(0);
+  if (auto versionPos = source.find("#version"); versionPos != std::string::npos)
+  {
+    insertAt = source.find('\n', versionPos);
+    insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
+  }
+
+  auto definitions = std::string();
+  for (const auto& define : defines)
+  {
+    definitions.append("#define ").append(define.name).append(" ").append(define.value).append("\n");
+  }
+  source.insert(insertAt, definitions);
+
+  return Fvog::Shader(device.device_, stage, std::string_view(source), path.filename().string().c_str());
 }
@@ -3,6 +3,9 @@
 #include "Fvog/Shader2.h"
 
 #include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
 
 namespace Fvog
 {
@@ -10,6 +13,13 @@ namespace Fvog
   class Texture;
 }
 
-Fvog::Shader LoadShaderWithIncludes2(Fvog::Device& device, Fvog::PipelineStage stage, const std::filesystem::path& path);
+// A preprocessor definition that is inserted after the #version directive of a shader. Used to compile permutations of one source
+struct ShaderDefine
+{
+  std::string_view name;
+  std::string value = "1";
+};
+
+Fvog::Shader LoadShaderWithIncludes2(Fvog::Device& device, Fvog::PipelineStage stage, const std::filesystem::path& path, std::span<const ShaderDefine> defines = {});
 
 Fvog::Texture LoadTextureShrimple(Fvog::Device& device, const std::filesystem::path& path);
\ No newline at end of file
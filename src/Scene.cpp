@@ -8,6 +8,8 @@
 #include "fastgltf/util.hpp"
 #include <glm/gtc/type_ptr.hpp>
 
+#include <limits>
+
 namespace Scene
 {
   void SceneMeshlet::Import(FrogRenderer2& renderer, Utility::LoadModelResultA loadModelResult)
@@ -38,8 +40,18 @@ namespace Scene
     const auto baseMeshGeometryIndex = meshGeometryIds.size();
     const auto baseMaterialIndex = materialIds.size();
 
+    auto meshGeometryAabbs = std::vector<Aabb>();
+    meshGeometryAabbs.reserve(loadModelResult.meshGeometries.size());
+
     for (const auto& meshGeometry : loadModelResult.meshGeometries)
     {
+      auto& aabb = meshGeometryAabbs.emplace_back(Aabb{glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest())});
+      for (const auto& meshlet : meshGeometry.meshlets)
+      {
+        aabb.min = glm::min(aabb.min, glm::make_vec3(meshlet.aabbMin));
+        aabb.max = glm::max(aabb.max, glm::make_vec3(meshlet.aabbMax));
+      }
+
       auto info = FrogRenderer2::MeshGeometryInfo{
         .meshlets   = meshGeometry.meshlets,
         .vertices   = meshGeometry.vertices,
@@ -100,8 +112,15 @@ namespace Scene
         auto meshId = meshIds.emplace_back(renderer.SpawnMesh(meshInstanceId));
         // TODO: make a new node instead of putting a bunch of meshes on one node (or not, honestly this is fine)
         newNode->meshIds.push_back(meshId);
+        newNode->meshAabbs.push_back(meshGeometryAabbs[meshIndex]);
       }
 
+      // World-space bounds are filled in when the new node is first traversed
+      newNode->firstBvhItem = static_cast<uint32_t>(bvhItemNodes.size());
+      bvhItemNodes.insert(bvhItemNodes.end(), newNode->meshIds.size(), newNode.get());
+      bvhItemBounds.resize(bvhItemNodes.size());
+      bvhNeedsRebuild = bvhNeedsRebuild || !newNode->meshIds.empty();
+
       if (node->light)
       {
         newNode->light = node->light.value();
@@ -137,7 +156,7 @@ namespace Scene
     }
   }
 
-  void SceneMeshlet::CalcUpdatedData(FrogRenderer2& renderer) const
+  void SceneMeshlet::CalcUpdatedData(FrogRenderer2& renderer)
   {
     ZoneScoped;
 
@@ -177,6 +196,8 @@ namespace Scene
 
       if (node->isDirty)
       {
+        node->globalTransform = globalTransform;
+
         for (auto meshId : node->meshIds)
         {
           const auto uniforms = Render::ObjectUniforms{
@@ -186,6 +207,16 @@ namespace Scene
           renderer.UpdateMesh(meshId, uniforms);
         }
 
+        for (size_t i = 0; i < node->meshAabbs.size(); i++)
+        {
+          const auto item     = node->firstBvhItem + static_cast<uint32_t>(i);
+          bvhItemBounds[item] = TransformAabb(globalTransform, node->meshAabbs[i]);
+          if (!bvhNeedsRebuild)
+          {
+            bvh.UpdateItem(item, bvhItemBounds[item]);
+          }
+        }
+
         if (node->lightId)
         {
           auto gpuLight = node->light;
@@ -210,6 +241,26 @@ namespace Scene
       node->isDirty = false;
       node->isDescendantDirty = false;
     }
+
+    if (bvhNeedsRebuild)
+    {
+      bvh.Build(bvhItemBounds);
+      bvhNeedsRebuild = false;
+    }
+    else
+    {
+      bvh.Refit();
+    }
+  }
+
+  Node* SceneMeshlet::Pick(glm::vec3 origin, glm::vec3 direction) const
+  {
+    ZoneScoped;
+    if (const auto hit = bvh.QueryRay(origin, direction))
+    {
+      return bvhItemNodes[hit->item];
+    }
+    return nullptr;
   }
 
   glm::mat4 Node::CalcLocalTransform() const noexcept
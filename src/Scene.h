@@ -3,6 +3,7 @@
 #include "Fvog/Device.h"
 
 #include "Renderables.h"
+#include "SceneBvh.h"
 
 #include "shaders/ShadeDeferredPbr.h.glsl"
 
@@ -36,8 +37,6 @@ namespace Scene
     void DeleteLight(FrogRenderer2& renderer);
 
     glm::mat4 globalTransform;
-    //glm::vec3 globalAabbMin;
-    //glm::vec3 globalAabbMax;
 
     // Relationship
     Node* parent = nullptr;
@@ -49,6 +48,8 @@ namespace Scene
     void MarkDirty();
     
     std::vector<Render::MeshID> meshIds;
+    std::vector<Aabb> meshAabbs; // Object-space bounds of each mesh in meshIds
+    uint32_t firstBvhItem = 0; // Item in the scene's BVH of the first mesh in meshIds
     Render::LightID lightId;
     GpuLight light; // Only contains valid data if lightId is not null
   };
@@ -58,7 +59,10 @@ namespace Scene
     void Import(FrogRenderer2& renderer, Utility::LoadModelResultA loadModelResult);
 
     // Epic interface
-    void CalcUpdatedData(FrogRenderer2& renderer) const;
+    void CalcUpdatedData(FrogRenderer2& renderer);
+
+    // Returns the node holding the mesh whose bounds are hit first by a world-space ray
+    [[nodiscard]] Node* Pick(glm::vec3 origin, glm::vec3 direction) const;
 
     std::vector<Node*> rootNodes;
     std::vector<std::unique_ptr<Node>> nodes;
@@ -69,5 +73,11 @@ namespace Scene
     std::vector<Render::MeshID> meshIds;
     std::vector<Render::LightID> lightIds;
     std::vector<Render::MaterialID> materialIds;
+
+    // World-space bounds of every mesh instance. Rebuilt after meshes are added, otherwise refitted when nodes move
+    Bvh bvh;
+    std::vector<Node*> bvhItemNodes; // Node holding each item in bvh
+    std::vector<Aabb> bvhItemBounds;
+    bool bvhNeedsRebuild = false;
   };
 }
@@ -0,0 +1,764 @@
+#include "SceneBvh.h"
+
+#include "Fvog/detail/ThreadPool2.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/vector_relational.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <future>
+#include <numeric>
+#include <thread>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define FROG_BVH_SSE 1
+  #include <xmmintrin.h>
+#endif
+
+namespace Scene
+{
+  namespace
+  {
+    constexpr uint32_t binCount = 16;
+    // Ranges this small always become leaves
+    constexpr uint32_t minLeafSize = 4;
+    // Ranges up to this size become leaves when splitting them isn't cheaper according to the SAH
+    constexpr uint32_t maxLeafSize = 16;
+    // Subtrees smaller than this are not worth a job of their own
+    constexpr uint32_t minParallelSubtreeSize = 4096;
+
+    // Subtrees built in parallel each write to their own array of nodes, so nodes are referred to by both
+    struct BuildRef
+    {
+      uint32_t tree;
+      uint32_t node;
+    };
+
+    struct BuildNode
+    {
+      Aabb bounds;
+      uint32_t first;
+      uint32_t count; // Zero for inner nodes
+      BuildRef children[2];
+    };
+
+    struct BuildInput
+    {
+      std::span<const Aabb> bounds;
+      std::span<const glm::vec3> centroids;
+      std::span<uint32_t> items;
+    };
+
+    struct PendingSubtree
+    {
+      uint32_t first;
+      uint32_t count;
+    };
+
+    Fvog::detail::ThreadPool& GetBuildThreadPool()
+    {
+      // Only created once a BVH is large enough to be built in parallel
+      static Fvog::detail::ThreadPool pool(0, "BVH Builder");
+      return pool;
+    }
+
+    Aabb EmptyAabb()
+    {
+      return {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+    }
+
+    void Grow(Aabb& aabb, const Aabb& other)
+    {
+      aabb.min = glm::min(aabb.min, other.min);
+      aabb.max = glm::max(aabb.max, other.max);
+    }
+
+    float HalfArea(const Aabb& aabb)
+    {
+      const auto d = aabb.max - aabb.min;
+      if (d.x < 0 || d.y < 0 || d.z < 0)
+      {
+        return 0;
+      }
+      return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    uint32_t BinIndex(float centroid, float min, float scale)
+    {
+      return std::min(binCount - 1, static_cast<uint32_t>((centroid - min) * scale));
+    }
+
+    Aabb RangeBounds(const BuildInput& input, uint32_t first, uint32_t count)
+    {
+      auto bounds = EmptyAabb();
+      for (uint32_t i = first; i < first + count; i++)
+      {
+        Grow(bounds, input.bounds[input.items[i]]);
+      }
+      return bounds;
+    }
+
+    // Reorders the range so that the items of the left child come first. Returns the number of them, or zero if the range should be a leaf
+    uint32_t Partition(const BuildInput& input, uint32_t first, uint32_t count, const Aabb& bounds)
+    {
+      if (count <= minLeafSize)
+      {
+        return 0;
+      }
+
+      auto centroidBounds = EmptyAabb();
+      for (uint32_t i = first; i < first + count; i++)
+      {
+        const auto c = input.centroids[input.items[i]];
+        Grow(centroidBounds, {c, c});
+      }
+      const auto extent = centroidBounds.max - centroidBounds.min;
+
+      auto bestCost = INFINITY;
+      auto bestAxis = 0;
+      auto bestBin  = 0u;
+      for (int axis = 0; axis < 3; axis++)
+      {
+        if (extent[axis] <= 0)
+        {
+          continue;
+        }
+
+        const auto scale = static_cast<float>(binCount) / extent[axis];
+        Aabb binBounds[binCount];
+        uint32_t binCounts[binCount]{};
+        std::fill_n(binBounds, binCount, EmptyAabb());
+        for (uint32_t i = first; i < first + count; i++)
+        {
+          const auto item = input.items[i];
+          const auto bin  = BinIndex(input.centroids[item][axis], centroidBounds.min[axis], scale);
+          binCounts[bin]++;
+          Grow(binBounds[bin], input.bounds[item]);
+        }
+
+        // Sweep from the right to find the cost of everything at or above each split, then from the left to find the total
+        float rightCosts[binCount]{};
+        auto rightBounds = EmptyAabb();
+        auto rightCount  = 0u;
+        for (uint32_t bin = binCount - 1; bin > 0; bin--)
+        {
+          Grow(rightBounds, binBounds[bin]);
+          rightCount += binCounts[bin];
+          rightCosts[bin] = HalfArea(rightBounds) * static_cast<float>(rightCount);
+        }
+
+        auto leftBounds = EmptyAabb();
+        auto leftCount  = 0u;
+        for (uint32_t bin = 1; bin < binCount; bin++)
+        {
+          Grow(leftBounds, binBounds[bin - 1]);
+          leftCount += binCounts[bin - 1];
+          const auto cost = HalfArea(leftBounds) * static_cast<float>(leftCount) + rightCosts[bin];
+          if (leftCount > 0 && leftCount < count && cost < bestCost)
+          {
+            bestCost = cost;
+            bestAxis = axis;
+            bestBin  = bin;
+          }
+        }
+      }
+
+      // Every centroid is in the same place, so the only option is an arbitrary split
+      if (bestCost == INFINITY)
+      {
+        return count <= maxLeafSize ? 0 : count / 2;
+      }
+
+      // Traversing a node is assumed to cost as much as testing one item
+      const auto area = HalfArea(bounds);
+      if (count <= maxLeafSize && area + bestCost >= area * static_cast<float>(count))
+      {
+        return 0;
+      }
+
+      const auto scale = static_cast<float>(binCount) / extent[bestAxis];
+      const auto begin = input.items.begin() + first;
+      const auto mid   = std::partition(begin,
+        begin + count,
+        [&](uint32_t item) { return BinIndex(input.centroids[item][bestAxis], centroidBounds.min[bestAxis], scale) < bestBin; });
+      return static_cast<uint32_t>(mid - begin);
+    }
+
+    uint32_t BuildSubtree(const BuildInput& input, uint32_t first, uint32_t count, uint32_t tree, std::vector<BuildNode>& nodes)
+    {
+      const auto bounds    = RangeBounds(input, first, count);
+      const auto nodeIndex = static_cast<uint32_t>(nodes.size());
+      nodes.push_back({.bounds = bounds, .first = first, .count = count});
+
+      if (const auto leftCount = Partition(input, first, count, bounds); leftCount > 0)
+      {
+        const auto left  = BuildSubtree(input, first, leftCount, tree, nodes);
+        const auto right = BuildSubtree(input, first + leftCount, count - leftCount, tree, nodes);
+        nodes[nodeIndex].count       = 0;
+        nodes[nodeIndex].children[0] = {tree, left};
+        nodes[nodeIndex].children[1] = {tree, right};
+      }
+
+      return nodeIndex;
+    }
+
+    // Builds the top of the tree into the first array of nodes and leaves every range smaller than subtreeSize to be built by a job
+    BuildRef BuildTop(const BuildInput& input, uint32_t first, uint32_t count, uint32_t subtreeSize, std::vector<BuildNode>& nodes, std::vector<PendingSubtree>& pending)
+    {
+      if (count <= subtreeSize)
+      {
+        pending.push_back({first, count});
+        return {static_cast<uint32_t>(pending.size()), 0};
+      }
+
+      const auto bounds    = RangeBounds(input, first, count);
+      const auto nodeIndex = static_cast<uint32_t>(nodes.size());
+      nodes.push_back({.bounds = bounds, .first = first, .count = count});
+
+      if (const auto leftCount = Partition(input, first, count, bounds); leftCount > 0)
+      {
+        const auto left  = BuildTop(input, first, leftCount, subtreeSize, nodes, pending);
+        const auto right = BuildTop(input, first + leftCount, count - leftCount, subtreeSize, nodes, pending);
+        nodes[nodeIndex].count       = 0;
+        nodes[nodeIndex].children[0] = left;
+        nodes[nodeIndex].children[1] = right;
+      }
+
+      return {0, nodeIndex};
+    }
+
+    template<class Node>
+    void SetLaneBounds(Node& node, uint32_t lane, const Aabb& aabb)
+    {
+      node.minX[lane] = aabb.min.x;
+      node.minY[lane] = aabb.min.y;
+      node.minZ[lane] = aabb.min.z;
+      node.maxX[lane] = aabb.max.x;
+      node.maxY[lane] = aabb.max.y;
+      node.maxZ[lane] = aabb.max.z;
+    }
+
+    template<class Node>
+    Aabb GetLaneBounds(const Node& node, uint32_t lane)
+    {
+      return {
+        {node.minX[lane], node.minY[lane], node.minZ[lane]},
+        {node.maxX[lane], node.maxY[lane], node.maxZ[lane]},
+      };
+    }
+
+    // The lane tests return a mask with one bit for each lane whose bounds intersect the query
+
+    template<class Node>
+    uint32_t IntersectLanesAabb(const Node& node, const Aabb& aabb)
+    {
+#ifdef FROG_BVH_SSE
+      auto mask = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.minX), _mm_set1_ps(aabb.max.x)), _mm_cmpge_ps(_mm_load_ps(node.maxX), _mm_set1_ps(aabb.min.x)));
+      mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.minY), _mm_set1_ps(aabb.max.y)), _mm_cmpge_ps(_mm_load_ps(node.maxY), _mm_set1_ps(aabb.min.y))));
+      mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.minZ), _mm_set1_ps(aabb.max.z)), _mm_cmpge_ps(_mm_load_ps(node.maxZ), _mm_set1_ps(aabb.min.z))));
+      return static_cast<uint32_t>(_mm_movemask_ps(mask)) & node.laneMask;
+#else
+      auto mask = 0u;
+      for (uint32_t lane = 0; lane < 4; lane++)
+      {
+        if (node.minX[lane] <= aabb.max.x && node.maxX[lane] >= aabb.min.x && node.minY[lane] <= aabb.max.y && node.maxY[lane] >= aabb.min.y &&
+            node.minZ[lane] <= aabb.max.z && node.maxZ[lane] >= aabb.min.z)
+        {
+          mask |= 1u << lane;
+        }
+      }
+      return mask & node.laneMask;
+#endif
+    }
+
+    template<class Node>
+    uint32_t IntersectLanesFrustum(const Node& node, const glm::vec4 (&planes)[6])
+    {
+#ifdef FROG_BVH_SSE
+      const auto half    = _mm_set1_ps(0.5f);
+      const auto centerX = _mm_mul_ps(_mm_add_ps(_mm_load_ps(node.minX), _mm_load_ps(node.maxX)), half);
+      const auto centerY = _mm_mul_ps(_mm_add_ps(_mm_load_ps(node.minY), _mm_load_ps(node.maxY)), half);
+      const auto centerZ = _mm_mul_ps(_mm_add_ps(_mm_load_ps(node.minZ), _mm_load_ps(node.maxZ)), half);
+      const auto extentX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), _mm_load_ps(node.minX)), half);
+      const auto extentY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), _mm_load_ps(node.minY)), half);
+      const auto extentZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), _mm_load_ps(node.minZ)), half);
+
+      auto mask = node.laneMask;
+      for (const auto& plane : planes)
+      {
+        auto distance = _mm_mul_ps(centerX, _mm_set1_ps(plane.x));
+        distance      = _mm_add_ps(distance, _mm_mul_ps(centerY, _mm_set1_ps(plane.y)));
+        distance      = _mm_add_ps(distance, _mm_mul_ps(centerZ, _mm_set1_ps(plane.z)));
+        distance      = _mm_sub_ps(distance, _mm_set1_ps(plane.w));
+        auto radius   = _mm_mul_ps(extentX, _mm_set1_ps(std::abs(plane.x)));
+        radius        = _mm_add_ps(radius, _mm_mul_ps(extentY, _mm_set1_ps(std::abs(plane.y))));
+        radius        = _mm_add_ps(radius, _mm_mul_ps(extentZ, _mm_set1_ps(std::abs(plane.z))));
+        mask &= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps())));
+        if (mask == 0)
+        {
+          break;
+        }
+      }
+      return mask;
+#else
+      auto mask = 0u;
+      for (uint32_t lane = 0; lane < 4; lane++)
+      {
+        const auto aabb   = GetLaneBounds(node, lane);
+        const auto center = (aabb.min + aabb.max) * 0.5f;
+        const auto extent = (aabb.max - aabb.min) * 0.5f;
+        auto inside       = true;
+        for (const auto& plane : planes)
+        {
+          const auto normal = glm::vec3(plane);
+          inside            = inside && glm::dot(normal, center) - plane.w + glm::dot(glm::abs(normal), extent) >= 0;
+        }
+        if (inside)
+        {
+          mask |= 1u << lane;
+        }
+      }
+      return mask & node.laneMask;
+#endif
+    }
+
+    // Where a ray enters and exits the slab between the planes of one axis.
+    // A ray parallel to the slab (the inverse direction is infinite) is inside it everywhere or nowhere. Handling that case
+    // separately means the multiplication never sees 0 * inf, which is NaN, when the ray lies in one of the planes
+    std::pair<float, float> IntersectSlab(float min, float max, float origin, float invDirection)
+    {
+      if (std::isinf(invDirection))
+      {
+        return min <= origin && origin <= max ? std::pair{-INFINITY, INFINITY} : std::pair{INFINITY, -INFINITY};
+      }
+      const auto t0 = (min - origin) * invDirection;
+      const auto t1 = (max - origin) * invDirection;
+      return {std::min(t0, t1), std::max(t0, t1)};
+    }
+
+#ifdef FROG_BVH_SSE
+    void IntersectSlabs(const float* mins, const float* maxs, float origin, float invDirection, __m128& tMin, __m128& tMax)
+    {
+      const auto min = _mm_load_ps(mins);
+      const auto max = _mm_load_ps(maxs);
+      if (std::isinf(invDirection))
+      {
+        const auto inside = _mm_and_ps(_mm_cmple_ps(min, _mm_set1_ps(origin)), _mm_cmpge_ps(max, _mm_set1_ps(origin)));
+        tMin              = _mm_or_ps(_mm_and_ps(inside, _mm_set1_ps(-INFINITY)), _mm_andnot_ps(inside, _mm_set1_ps(INFINITY)));
+        tMax              = _mm_sub_ps(_mm_setzero_ps(), tMin);
+        return;
+      }
+      const auto t0 = _mm_mul_ps(_mm_sub_ps(min, _mm_set1_ps(origin)), _mm_set1_ps(invDirection));
+      const auto t1 = _mm_mul_ps(_mm_sub_ps(max, _mm_set1_ps(origin)), _mm_set1_ps(invDirection));
+      tMin          = _mm_min_ps(t0, t1);
+      tMax          = _mm_max_ps(t0, t1);
+    }
+#endif
+
+    // Also writes where the ray enters each lane, clamped to the start of the ray
+    template<class Node>
+    uint32_t IntersectLanesRay(const Node& node, glm::vec3 origin, glm::vec3 invDirection, float maxT, float (&tNear)[4])
+    {
+#ifdef FROG_BVH_SSE
+      __m128 tMinX, tMaxX, tMinY, tMaxY, tMinZ, tMaxZ;
+      IntersectSlabs(node.minX, node.maxX, origin.x, invDirection.x, tMinX, tMaxX);
+      IntersectSlabs(node.minY, node.maxY, origin.y, invDirection.y, tMinY, tMaxY);
+      IntersectSlabs(node.minZ, node.maxZ, origin.z, invDirection.z, tMinZ, tMaxZ);
+
+      auto enter = _mm_max_ps(tMinX, _mm_max_ps(tMinY, tMinZ));
+      auto exit  = _mm_min_ps(tMaxX, _mm_min_ps(tMaxY, tMaxZ));
+      enter      = _mm_max_ps(enter, _mm_setzero_ps());
+      exit       = _mm_min_ps(exit, _mm_set1_ps(maxT));
+      _mm_storeu_ps(tNear, enter);
+      return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(enter, exit))) & node.laneMask;
+#else
+      auto mask = 0u;
+      for (uint32_t lane = 0; lane < 4; lane++)
+      {
+        const auto [tMinX, tMaxX] = IntersectSlab(node.minX[lane], node.maxX[lane], origin.x, invDirection.x);
+        const auto [tMinY, tMaxY] = IntersectSlab(node.minY[lane], node.maxY[lane], origin.y, invDirection.y);
+        const auto [tMinZ, tMaxZ] = IntersectSlab(node.minZ[lane], node.maxZ[lane], origin.z, invDirection.z);
+        const auto enter          = std::max({tMinX, tMinY, tMinZ, 0.0f});
+        const auto exit           = std::min({tMaxX, tMaxY, tMaxZ, maxT});
+        tNear[lane]               = enter;
+        if (enter <= exit)
+        {
+          mask |= 1u << lane;
+        }
+      }
+      return mask & node.laneMask;
+#endif
+    }
+
+    std::optional<float> IntersectRay(const Aabb& aabb, glm::vec3 origin, glm::vec3 invDirection, float maxT)
+    {
+      const auto [tMinX, tMaxX] = IntersectSlab(aabb.min.x, aabb.max.x, origin.x, invDirection.x);
+      const auto [tMinY, tMaxY] = IntersectSlab(aabb.min.y, aabb.max.y, origin.y, invDirection.y);
+      const auto [tMinZ, tMaxZ] = IntersectSlab(aabb.min.z, aabb.max.z, origin.z, invDirection.z);
+      const auto enter          = std::max({tMinX, tMinY, tMinZ, 0.0f});
+      const auto exit           = std::min({tMaxX, tMaxY, tMaxZ, maxT});
+      if (enter > exit)
+      {
+        return std::nullopt;
+      }
+      return enter;
+    }
+
+    bool Overlaps(const Aabb& a, const Aabb& b)
+    {
+      return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::greaterThanEqual(a.max, b.min));
+    }
+
+    bool IsInFrustum(const Aabb& aabb, const glm::vec4 (&planes)[6])
+    {
+      const auto center = (aabb.min + aabb.max) * 0.5f;
+      const auto extent = (aabb.max - aabb.min) * 0.5f;
+      for (const auto& plane : planes)
+      {
+        const auto normal = glm::vec3(plane);
+        if (glm::dot(normal, center) - plane.w + glm::dot(glm::abs(normal), extent) < 0)
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Traversal stacks are reused between queries on the same thread to avoid allocating for each one
+    std::vector<uint32_t>& GetTraversalStack()
+    {
+      thread_local auto stack = std::vector<uint32_t>();
+      stack.clear();
+      return stack;
+    }
+  } // namespace
+
+  Aabb TransformAabb(const glm::mat4& transform, const Aabb& aabb) noexcept
+  {
+    const auto center = glm::vec3(transform * glm::vec4((aabb.min + aabb.max) * 0.5f, 1));
+    const auto extent = glm::mat3(glm::abs(transform[0]), glm::abs(transform[1]), glm::abs(transform[2])) * ((aabb.max - aabb.min) * 0.5f);
+    return {center - extent, center + extent};
+  }
+
+  void Bvh::Build(std::span<const Aabb> itemBounds)
+  {
+    ZoneScoped;
+    ZoneTextF("Items: %llu", itemBounds.size());
+    itemBounds_.assign(itemBounds.begin(), itemBounds.end());
+    itemNodes_.assign(itemBounds.size(), noParent);
+    nodes_.clear();
+    items_.clear();
+    if (itemBounds.empty())
+    {
+      return;
+    }
+
+    const auto itemCount = static_cast<uint32_t>(itemBounds.size());
+    auto centroids       = std::vector<glm::vec3>(itemCount);
+    for (uint32_t i = 0; i < itemCount; i++)
+    {
+      centroids[i] = (itemBounds[i].min + itemBounds[i].max) * 0.5f;
+    }
+    items_.resize(itemCount);
+    std::iota(items_.begin(), items_.end(), 0u);
+    const auto input = BuildInput{itemBounds_, centroids, items_};
+
+    // Split the top of the tree until there are enough subtrees to keep every thread busy
+    const auto threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const auto subtreeSize = std::max(minParallelSubtreeSize, itemCount / (threadCount * 4));
+    auto pending           = std::vector<PendingSubtree>();
+    auto trees             = std::vector<std::vector<BuildNode>>(1);
+    const auto root        = BuildTop(input, 0, itemCount, subtreeSize, trees[0], pending);
+
+    trees.resize(1 + pending.size());
+    if (pending.size() == 1)
+    {
+      BuildSubtree(input, pending[0].first, pending[0].count, 1, trees[1]);
+    }
+    else
+    {
+      ZoneScopedN("Build Subtrees");
+      auto jobs = std::vector<std::future<void>>();
+      jobs.reserve(pending.size());
+      for (uint32_t i = 0; i < pending.size(); i++)
+      {
+        jobs.emplace_back(GetBuildThreadPool().Submit(
+          [&input, &trees, subtree = pending[i], tree = i + 1]
+          {
+            ZoneScopedN("Build Subtree");
+            BuildSubtree(input, subtree.first, subtree.count, tree, trees[tree]);
+          }));
+      }
+      for (auto& job : jobs)
+      {
+        job.get();
+      }
+    }
+
+    // Collapse the binary tree by pulling the largest grandchildren of each node up until it has four children
+    auto collapse = [&](auto& self, BuildRef ref, uint32_t parent) -> uint32_t
+    {
+      auto getNode = [&](BuildRef r) -> const BuildNode& { return trees[r.tree][r.node]; };
+
+      BuildRef lanes[width]{};
+      auto laneCount = 0u;
+      if (getNode(ref).count > 0)
+      {
+        // Only happens when the whole tree is a single leaf
+        lanes[laneCount++] = ref;
+      }
+      else
+      {
+        lanes[laneCount++] = getNode(ref).children[0];
+        lanes[laneCount++] = getNode(ref).children[1];
+        while (laneCount < width)
+        {
+          auto largest     = width;
+          auto largestArea = -1.0f;
+          for (uint32_t lane = 0; lane < laneCount; lane++)
+          {
+            const auto& child = getNode(lanes[lane]);
+            if (child.count == 0 && HalfArea(child.bounds) > largestArea)
+            {
+              largest     = lane;
+              largestArea = HalfArea(child.bounds);
+            }
+          }
+          if (largest == width)
+          {
+            break;
+          }
+          const auto& opened = getNode(lanes[largest]);
+          lanes[largest]     = opened.children[0];
+          lanes[laneCount++] = opened.children[1];
+        }
+      }
+
+      const auto nodeIndex = static_cast<uint32_t>(nodes_.size());
+      auto& newNode        = nodes_.emplace_back(Node{.parent = parent});
+      for (uint32_t lane = 0; lane < width; lane++)
+      {
+        SetLaneBounds(newNode, lane, EmptyAabb());
+      }
+
+      for (uint32_t lane = 0; lane < laneCount; lane++)
+      {
+        const auto& child = getNode(lanes[lane]);
+        auto childIndex   = child.first;
+        if (child.count > 0)
+        {
+          for (uint32_t i = child.first; i < child.first + child.count; i++)
+          {
+            itemNodes_[items_[i]] = nodeIndex;
+          }
+        }
+        else
+        {
+          childIndex = self(self, lanes[lane], nodeIndex);
+        }
+
+        // Collapsing children may have reallocated the nodes
+        auto& node           = nodes_[nodeIndex];
+        node.child[lane]     = childIndex;
+        node.itemCount[lane] = child.count;
+        node.laneMask |= 1u << lane;
+        SetLaneBounds(node, lane, child.bounds);
+      }
+
+      return nodeIndex;
+    };
+
+    {
+      ZoneScopedN("Collapse");
+      nodes_.reserve(itemCount / 2 + 1);
+      collapse(collapse, root, noParent);
+    }
+  }
+
+  void Bvh::UpdateItem(uint32_t item, const Aabb& bounds)
+  {
+    itemBounds_[item] = bounds;
+    for (auto nodeIndex = itemNodes_[item]; nodeIndex != noParent && !nodes_[nodeIndex].needsRefit; nodeIndex = nodes_[nodeIndex].parent)
+    {
+      nodes_[nodeIndex].needsRefit = true;
+    }
+  }
+
+  void Bvh::Refit()
+  {
+    ZoneScoped;
+    if (!nodes_.empty() && nodes_[0].needsRefit)
+    {
+      RefitNode(0);
+    }
+  }
+
+  void Bvh::RefitNode(uint32_t nodeIndex)
+  {
+    auto& node = nodes_[nodeIndex];
+    for (uint32_t lane = 0; lane < width; lane++)
+    {
+      if ((node.laneMask & (1u << lane)) == 0)
+      {
+        continue;
+      }
+
+      auto bounds = EmptyAabb();
+      if (node.itemCount[lane] > 0)
+      {
+        for (uint32_t i = node.child[lane]; i < node.child[lane] + node.itemCount[lane]; i++)
+        {
+          Grow(bounds, itemBounds_[items_[i]]);
+        }
+      }
+      else
+      {
+        auto& child = nodes_[node.child[lane]];
+        if (child.needsRefit)
+        {
+          RefitNode(node.child[lane]);
+        }
+        for (uint32_t childLane = 0; childLane < width; childLane++)
+        {
+          if (child.laneMask & (1u << childLane))
+          {
+            Grow(bounds, GetLaneBounds(child, childLane));
+          }
+        }
+      }
+      SetLaneBounds(node, lane, bounds);
+    }
+    node.needsRefit = false;
+  }
+
+  void Bvh::QueryFrustum(const glm::vec4 (&planes)[6], std::vector<uint32_t>& items) const
+  {
+    if (nodes_.empty())
+    {
+      return;
+    }
+
+    auto& stack = GetTraversalStack();
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+      const auto& node = nodes_[stack.back()];
+      stack.pop_back();
+
+      for (auto mask = IntersectLanesFrustum(node, planes); mask != 0; mask &= mask - 1)
+      {
+        const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+        if (node.itemCount[lane] == 0)
+        {
+          stack.push_back(node.child[lane]);
+          continue;
+        }
+
+        for (uint32_t i = node.child[lane]; i < node.child[lane] + node.itemCount[lane]; i++)
+        {
+          if (IsInFrustum(itemBounds_[items_[i]], planes))
+          {
+            items.push_back(items_[i]);
+          }
+        }
+      }
+    }
+  }
+
+  void Bvh::QueryAabb(const Aabb& aabb, std::vector<uint32_t>& items) const
+  {
+    if (nodes_.empty())
+    {
+      return;
+    }
+
+    auto& stack = GetTraversalStack();
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+      const auto& node = nodes_[stack.back()];
+      stack.pop_back();
+
+      for (auto mask = IntersectLanesAabb(node, aabb); mask != 0; mask &= mask - 1)
+      {
+        const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+        if (node.itemCount[lane] == 0)
+        {
+          stack.push_back(node.child[lane]);
+          continue;
+        }
+
+        for (uint32_t i = node.child[lane]; i < node.child[lane] + node.itemCount[lane]; i++)
+        {
+          if (Overlaps(itemBounds_[items_[i]], aabb))
+          {
+            items.push_back(items_[i]);
+          }
+        }
+      }
+    }
+  }
+
+  std::optional<Bvh::RayHit> Bvh::QueryRay(glm::vec3 origin, glm::vec3 direction, float maxT) const
+  {
+    if (nodes_.empty())
+    {
+      return std::nullopt;
+    }
+
+    // Zero components become infinities, which the slab tests treat as parallel to the slab
+    const auto invDirection = 1.0f / direction;
+
+    auto hit    = std::optional<RayHit>();
+    auto& stack = GetTraversalStack();
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+      const auto& node = nodes_[stack.back()];
+      stack.pop_back();
+
+      float tNear[width];
+      const auto mask = IntersectLanesRay(node, origin, invDirection, maxT, tNear);
+
+      // Push the nearest children last so they are visited first and shrink maxT as soon as possible
+      uint32_t innerLanes[width];
+      auto innerCount = 0u;
+      for (auto remaining = mask; remaining != 0; remaining &= remaining - 1)
+      {
+        const auto lane = static_cast<uint32_t>(std::countr_zero(remaining));
+        if (node.itemCount[lane] == 0)
+        {
+          innerLanes[innerCount++] = lane;
+          continue;
+        }
+
+        for (uint32_t i = node.child[lane]; i < node.child[lane] + node.itemCount[lane]; i++)
+        {
+          if (const auto t = IntersectRay(itemBounds_[items_[i]], origin, invDirection, maxT))
+          {
+            maxT = *t;
+            hit  = RayHit{.item = items_[i], .t = *t};
+          }
+        }
+      }
+
+      std::sort(innerLanes, innerLanes + innerCount, [&](uint32_t a, uint32_t b) { return tNear[a] > tNear[b]; });
+      for (uint32_t i = 0; i < innerCount; i++)
+      {
+        // The lane may have been entered after the nearest hit found among its siblings
+        if (tNear[innerLanes[i]] <= maxT)
+        {
+          stack.push_back(node.child[innerLanes[i]]);
+        }
+      }
+    }
+
+    return hit;
+  }
+} // namespace Scene
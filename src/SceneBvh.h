@@ -0,0 +1,95 @@
+#pragma once
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace Scene
+{
+  struct Aabb
+  {
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  // Bounds of the box after transformation, which may be looser than the bounds of the transformed geometry
+  [[nodiscard]] Aabb TransformAabb(const glm::mat4& transform, const Aabb& aabb) noexcept;
+
+  // Bounding volume hierarchy over world-space boxes, such as those of every mesh instance in a scene.
+  // Items are referred to by their index in the span given to Build.
+  // Every node holds the bounds of up to four children in SoA form so they can be tested against a query at once (with SSE where available).
+  // Pure CPU work, so it can be used and measured without a device
+  class Bvh
+  {
+  public:
+    struct RayHit
+    {
+      uint32_t item;
+      float t; // Distance along the direction at which the ray enters the item's box
+    };
+
+    // Binned SAH build. Large inputs are split into subtrees that are built in parallel
+    void Build(std::span<const Aabb> itemBounds);
+
+    // Moves an item without changing the topology. Takes effect on the next call to Refit
+    void UpdateItem(uint32_t item, const Aabb& bounds);
+    // Recomputes the bounds of every node above an item that was updated since the last refit.
+    // The tree degrades as items move away from where they were at build time, so rebuild after large changes
+    void Refit();
+
+    // Append the items whose boxes intersect the query. Planes are in the form made by Math::MakeFrustumPlanes
+    void QueryFrustum(const glm::vec4 (&planes)[6], std::vector<uint32_t>& items) const;
+    void QueryAabb(const Aabb& aabb, std::vector<uint32_t>& items) const;
+    // Finds the item whose box is entered first by a ray. Boxes containing the origin are hit at t = 0
+    [[nodiscard]] std::optional<RayHit> QueryRay(glm::vec3 origin, glm::vec3 direction, float maxT = INFINITY) const;
+
+    [[nodiscard]] uint32_t ItemCount() const noexcept
+    {
+      return static_cast<uint32_t>(itemBounds_.size());
+    }
+
+    [[nodiscard]] uint32_t NodeCount() const noexcept
+    {
+      return static_cast<uint32_t>(nodes_.size());
+    }
+
+    [[nodiscard]] const Aabb& GetItemBounds(uint32_t item) const
+    {
+      return itemBounds_[item];
+    }
+
+  private:
+    static constexpr uint32_t width = 4;
+    static constexpr uint32_t noParent = ~0u;
+
+    struct Node
+    {
+      // Unused lanes hold inverted bounds and are left out of laneMask
+      alignas(16) float minX[width];
+      float minY[width];
+      float minZ[width];
+      float maxX[width];
+      float maxY[width];
+      float maxZ[width];
+      // Index of the child node, or of the first item in items_ for leaves
+      uint32_t child[width];
+      // Zero for inner children
+      uint32_t itemCount[width];
+      uint32_t laneMask;
+      uint32_t parent;
+      bool needsRefit;
+    };
+
+    void RefitNode(uint32_t nodeIndex);
+
+    std::vector<Node> nodes_; // The root is the first node
+    std::vector<uint32_t> items_; // Items in the order they are referenced by leaves
+    std::vector<Aabb> itemBounds_;
+    std::vector<uint32_t> itemNodes_; // Node whose leaf holds each item
+  };
+} // namespace Scene
@@ -381,7 +381,8 @@ namespace Utility
       imagesToBarrier.reserve(rawImageData.size());
 
       constexpr size_t BATCH_SIZE = 1'000'000'000;
-      auto stagingBuffer = Fvog::Buffer(device, {.size = BATCH_SIZE, .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE}, "Scene Loader Staging Buffer");
+      auto stagingBuffer = Fvog::Buffer(device, {.size = BATCH_SIZE, .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE, .category = Fvog::MemoryCategory::STAGING}, "Scene Loader Staging Buffer");
+      auto lastUploadValue = uint64_t{};
 
       auto flushImageUploads = [&] {
         ZoneScopedN("Flush Image Uploads");
@@ -389,13 +390,19 @@ namespace Utility
         // Recreate staging buffer if it's too small
         if (currentBufferOffset + imageUploadInfos.back().size > stagingBuffer.SizeBytes())
         {
+          device.DestroyAfterUpload(lastUploadValue, std::move(stagingBuffer));
           stagingBuffer = Fvog::Buffer(device,
-            {.size = VkDeviceSize((currentBufferOffset + imageUploadInfos.back().size) * 1.5), .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE},
+            {.size = VkDeviceSize((currentBufferOffset + imageUploadInfos.back().size) * 1.5), .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE, .category = Fvog::MemoryCategory::STAGING},
             "Scene Loader Staging Buffer");
         }
+        else
+        {
+          // The previous batch may still be reading from the staging buffer
+          device.WaitForUpload(lastUploadValue);
+        }
 
-        // Fire off copies in one batch
-        device.ImmediateSubmit([&](VkCommandBuffer commandBuffer)
+        // Fire off copies in one batch on the transfer queue
+        lastUploadValue = device.Upload([&](VkCommandBuffer commandBuffer)
         {
           auto ctx = Fvog::Context(device, commandBuffer);
           for (auto* loadedImage : imagesToBarrier)
@@ -522,6 +529,7 @@ namespace Utility
           flushImageUploads();
 
           imageUploadInfos.clear();
+          imagesToBarrier.clear();
 
           // Reset offset for next batch.
           currentBufferOffset = 0;
@@ -533,8 +541,18 @@ namespace Utility
         flushImageUploads();
       }
 
-      // Transition every loaded image to READ_ONLY
-      device.ImmediateSubmit(
+      // Transition every loaded image to READ_ONLY and hand them over to the graphics queue
+      auto ownershipTransfers = std::vector<Fvog::Device::UploadOwnershipTransfer>();
+      ownershipTransfers.reserve(loadedImages.size());
+      for (const auto& loadedImage : loadedImages)
+      {
+        ownershipTransfers.push_back({
+          .image = loadedImage.Image(),
+          .layout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+        });
+      }
+
+      lastUploadValue = device.Upload(
         [&](VkCommandBuffer commandBuffer)
         {
           auto ctx = Fvog::Context(device, commandBuffer);
@@ -542,7 +560,13 @@ namespace Utility
           {
             ctx.ImageBarrier(loadedImage, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
           }
-        });
+        },
+        ownershipTransfers);
+
+      device.DestroyAfterUpload(lastUploadValue, std::move(stagingBuffer));
+
+      // Only blocks the loading thread. The graphics queue acquires the images in the first frame after this returns
+      device.WaitForUpload(lastUploadValue);
 
       // Free CPU pixel data in parallel for better performance. Omitting this block will only affect perf.
       {
@@ -12,7 +12,7 @@
  * [X] Visibility buffer
  * [X] Frustum culling
  * [X] Hi-z occlusion culling
- * [ ] Clustered light culling
+ * [x] Clustered light culling
  * [-] Raster occlusion culling
  * [X] Multi-view
  * [X] Triangle culling: https://www.slideshare.net/gwihlidal/optimizing-the-graphics-pipeline-with-compute-gdc-2016
@@ -3,6 +3,7 @@
 #include "Fvog/Device.h"
 #include "Fvog/Rendering2.h"
 #include "Fvog/Shader2.h"
+#include "Fvog/detail/ThreadPool2.h"
 
 #include "../RendererUtilities.h"
 
@@ -30,17 +31,24 @@ namespace Techniques
     });
   }
 
-  AutoExposure::AutoExposure(Fvog::Device& device)
+  AutoExposure::PipelineBuilds AutoExposure::StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool)
+  {
+    return {
+      .generateLuminanceHistogram = threadPool.Submit([&device] { return CreateGenerateLuminanceHistogramPipeline(device); }),
+      .resolveLuminanceHistogram = threadPool.Submit([&device] { return CreateResolveLuminanceHistogramPipeline(device); }),
+    };
+  }
+
+  AutoExposure::AutoExposure(Fvog::Device& device, PipelineBuilds pipelineBuilds)
     : device_(&device),
-      dataBuffer_(device, 1, "Auto Exposure Data"),
-      generateLuminanceHistogramPipeline_(CreateGenerateLuminanceHistogramPipeline(device)),
-      resolveLuminanceHistogramPipeline_(CreateResolveLuminanceHistogramPipeline(device))
+      dataBuffer_(device, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Auto Exposure Data"),
+      generateLuminanceHistogramPipeline_(pipelineBuilds.generateLuminanceHistogram.get()),
+      resolveLuminanceHistogramPipeline_(pipelineBuilds.resolveLuminanceHistogram.get())
   {
     // Initialize buckets to zero
-    //dataBuffer_.FillData();
     device.ImmediateSubmit(
       [this](VkCommandBuffer cmd) {
-        vkCmdFillBuffer(cmd, dataBuffer_.GetDeviceBuffer().Handle(), 0, VK_WHOLE_SIZE, 0);
+        dataBuffer_.FillData(cmd);
       });
   }
 
@@ -58,13 +66,19 @@ namespace Techniques
       .numPixels = params.image.GetCreateInfo().extent.width * params.image.GetCreateInfo().extent.height,
     };
     auto uploaded = AutoExposureBufferData{uniforms};
-    dataBuffer_.UpdateData(cmd, {&uploaded, 1});
+    // Small enough to be recorded inline, which avoids a staging copy in the middle of the frame
+    ctx.TeenyBufferUpdate(dataBuffer_, uploaded);
     
-    ctx.Barrier();
+    ctx.Barrier({
+      .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    });
 
     // Generate histogram
     ctx.SetPushConstants(AutoExposurePushConstants{
-      .autoExposureBufferIndex = dataBuffer_.GetDeviceBuffer().GetResourceHandle().index,
+      .autoExposureBufferIndex = dataBuffer_.GetResourceHandle().index,
       .exposureBufferIndex = params.exposureBuffer.GetResourceHandle().index,
       .hdrBufferIndex = params.image.ImageView().GetSampledResourceHandle().index,
     });
@@ -72,12 +86,15 @@ namespace Techniques
     ctx.BindComputePipeline(generateLuminanceHistogramPipeline_);
     ctx.DispatchInvocations(params.image.GetCreateInfo().extent);
     
-    ctx.Barrier();
+    ctx.Barrier({
+      .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    });
 
     // Resolve histogram
     ctx.BindComputePipeline(resolveLuminanceHistogramPipeline_);
     ctx.Dispatch(1, 1, 1);
-
-    ctx.Barrier();
   }
 } // namespace Techniques
\ No newline at end of file
@@ -8,9 +8,16 @@
 
 #include "shaders/Resources.h.glsl"
 
+#include <future>
+
 namespace Fvog
 {
   class Device;
+
+  namespace detail
+  {
+    class ThreadPool;
+  }
 }
 
 namespace Techniques
@@ -18,14 +25,24 @@ namespace Techniques
   class AutoExposure
   {
   public:
-    explicit AutoExposure(Fvog::Device& device);
+    // Pipelines being built on a thread pool, so the owner can start every build before waiting on any of them
+    struct PipelineBuilds
+    {
+      std::future<Fvog::ComputePipeline> generateLuminanceHistogram;
+      std::future<Fvog::ComputePipeline> resolveLuminanceHistogram;
+    };
+
+    [[nodiscard]] static PipelineBuilds StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool);
+
+    // Waits for the pipelines to finish building
+    AutoExposure(Fvog::Device& device, PipelineBuilds pipelineBuilds);
 
     struct ApplyParams
     {
-      // Image whose average luminance is to be computed
+      // Image whose average luminance is to be computed. It must be readable by compute shaders
       Fvog::Texture& image;
 
-      // Buffer containing the output exposure value
+      // Buffer containing the output exposure value. It's read and written by compute shaders, and the caller is responsible for synchronizing later accesses
       Fvog::Buffer& exposureBuffer;
 
       float deltaTime;
@@ -69,7 +86,7 @@ namespace Techniques
     };
 
     Fvog::Device* device_{};
-    Fvog::NDeviceBuffer<AutoExposureBufferData> dataBuffer_;
+    Fvog::TypedBuffer<AutoExposureBufferData> dataBuffer_;
 
     Fvog::ComputePipeline generateLuminanceHistogramPipeline_;
     Fvog::ComputePipeline resolveLuminanceHistogramPipeline_;
@@ -4,6 +4,7 @@
 
 #include "Fvog/Rendering2.h"
 #include "Fvog/Shader2.h"
+#include "Fvog/detail/ThreadPool2.h"
 
 #include "../RendererUtilities.h"
 
@@ -39,11 +40,20 @@ namespace Techniques
     });
   }
 
-  Bloom::Bloom(Fvog::Device& device)
+  Bloom::PipelineBuilds Bloom::StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool)
+  {
+    return {
+      .downsampleLowPass = threadPool.Submit([&device] { return CreateBloomDownsampleLowPassPipeline(device); }),
+      .downsample = threadPool.Submit([&device] { return CreateBloomDownsamplePipeline(device); }),
+      .upsample = threadPool.Submit([&device] { return CreateBloomUpsamplePipeline(device); }),
+    };
+  }
+
+  Bloom::Bloom(Fvog::Device& device, PipelineBuilds pipelineBuilds)
     : device_(&device),
-      downsampleLowPassPipeline(CreateBloomDownsampleLowPassPipeline(device)),
-      downsamplePipeline(CreateBloomDownsamplePipeline(device)),
-      upsamplePipeline(CreateBloomUpsamplePipeline(device))
+      downsampleLowPassPipeline(pipelineBuilds.downsampleLowPass.get()),
+      downsamplePipeline(pipelineBuilds.downsample.get()),
+      upsamplePipeline(pipelineBuilds.upsample.get())
   {
   }
 
@@ -62,14 +72,22 @@ namespace Techniques
     auto ctx = Fvog::Context(*device_, commandBuffer);
     auto marker = ctx.MakeScopedDebugMarker("Bloom");
 
-    ctx.ImageBarrier(params.target, VK_IMAGE_LAYOUT_GENERAL);
-    ctx.ImageBarrierDiscard(params.scratchTexture, VK_IMAGE_LAYOUT_GENERAL);
+    // Each pass samples the result of the previous one
+    constexpr auto passBarrier = Fvog::GlobalBarrier{
+      .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    };
 
     {
       auto marker2 = ctx.MakeScopedDebugMarker("Downsample");
       for (uint32_t i = 0; i < params.passes; i++)
       {
-        ctx.Barrier();
+        if (i > 0)
+        {
+          ctx.Barrier(passBarrier);
+        }
 
         Fvog::Extent2D sourceDim{};
         Fvog::Extent2D targetDim = params.target.GetCreateInfo().extent >> (i + 1);
@@ -120,7 +138,7 @@ namespace Techniques
       ctx.BindComputePipeline(upsamplePipeline);
       for (int32_t i = params.passes - 1; i >= 0; i--)
       {
-        ctx.Barrier();
+        ctx.Barrier(passBarrier);
 
         Fvog::Extent2D sourceDim = params.target.GetCreateInfo().extent >> (i + 1);
         Fvog::Extent2D targetDim{};
@@ -7,9 +7,16 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <future>
+
 namespace Fvog
 {
   class Device;
+
+  namespace detail
+  {
+    class ThreadPool;
+  }
 }
 
 namespace Techniques
@@ -17,15 +24,28 @@ namespace Techniques
   class Bloom
   {
   public:
-    explicit Bloom(Fvog::Device& device);
+    // Pipelines being built on a thread pool, so the owner can start every build before waiting on any of them
+    struct PipelineBuilds
+    {
+      std::future<Fvog::ComputePipeline> downsampleLowPass;
+      std::future<Fvog::ComputePipeline> downsample;
+      std::future<Fvog::ComputePipeline> upsample;
+    };
+
+    [[nodiscard]] static PipelineBuilds StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool);
+
+    // Waits for the pipelines to finish building
+    Bloom(Fvog::Device& device, PipelineBuilds pipelineBuilds);
 
     struct ApplyParams
     {
       // The input and output texture.
+      // Must be in the GENERAL layout and visible to compute shaders.
       Fvog::Texture& target;
 
       // A scratch texture to be used for intermediate storage.
       // Its dimensions should be _half_ those of the target.
+      // Must be in the GENERAL layout. Its contents are overwritten.
       Fvog::Texture& scratchTexture;
 
       // Maximum number of times to downsample before upsampling.
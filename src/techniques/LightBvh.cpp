@@ -0,0 +1,271 @@
+#include "LightBvh.h"
+#include "LightBvhCpu.h"
+
+#include "Fvog/Device.h"
+#include "Fvog/Rendering2.h"
+#include "Fvog/Shader2.h"
+#include "Fvog/Timer2.h"
+#include "Fvog/detail/ThreadPool2.h"
+
+#include "../RendererUtilities.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <glm/common.hpp>
+#include <glm/vector_relational.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace Techniques
+{
+  static Fvog::ComputePipeline CreateLightBvhPipeline(Fvog::Device& device, const char* name, const char* path)
+  {
+    auto cs = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, path);
+
+    return Fvog::ComputePipeline(device, {
+      .name = name,
+      .shader = &cs,
+    });
+  }
+
+  // Keys are padded to a power of two so the bitonic sort can compare any pair of halves
+  static uint32_t GetSortCount(uint32_t numLights)
+  {
+    return std::bit_ceil(std::max(numLights, uint32_t(LIGHT_BVH_SORT_GROUP_KEYS)));
+  }
+
+  static constexpr auto computeBarrier = Fvog::GlobalBarrier{
+    .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+  };
+
+  static constexpr auto transferToComputeBarrier = Fvog::GlobalBarrier{
+    .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+  };
+
+  LightBvh::Storage::Storage(Fvog::Device& device, uint32_t maxLights)
+    : capacity(maxLights),
+      keys(device, {.count = GetSortCount(maxLights)}, "Light BVH Keys"),
+      nodes(device, {.count = 2 * maxLights - 1}, "Light BVH Nodes"),
+      refitCounters(device, {.count = std::max(maxLights - 1, 1u)}, "Light BVH Refit Counters"),
+      sceneBounds(device, {}, "Light BVH Scene Bounds")
+  {
+  }
+
+  LightBvh::PipelineBuilds LightBvh::StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool)
+  {
+    return {
+      .bounds = threadPool.Submit([&device] { return CreateLightBvhPipeline(device, "Light BVH Bounds", "shaders/lights/LightBvhBounds.comp.glsl"); }),
+      .mortonCodes = threadPool.Submit([&device] { return CreateLightBvhPipeline(device, "Light BVH Morton Codes", "shaders/lights/LightBvhMortonCodes.comp.glsl"); }),
+      .sort = threadPool.Submit([&device] { return CreateLightBvhPipeline(device, "Light BVH Sort", "shaders/lights/LightBvhSort.comp.glsl"); }),
+      .hierarchy = threadPool.Submit([&device] { return CreateLightBvhPipeline(device, "Light BVH Hierarchy", "shaders/lights/LightBvhHierarchy.comp.glsl"); }),
+      .refit = threadPool.Submit([&device] { return CreateLightBvhPipeline(device, "Light BVH Refit", "shaders/lights/LightBvhRefit.comp.glsl"); }),
+    };
+  }
+
+  LightBvh::LightBvh(Fvog::Device& device, PipelineBuilds pipelineBuilds)
+    : device_(&device),
+      storage_(device, LIGHT_BVH_SORT_GROUP_KEYS),
+      boundsPipeline_(pipelineBuilds.bounds.get()),
+      mortonCodesPipeline_(pipelineBuilds.mortonCodes.get()),
+      sortPipeline_(pipelineBuilds.sort.get()),
+      hierarchyPipeline_(pipelineBuilds.hierarchy.get()),
+      refitPipeline_(pipelineBuilds.refit.get())
+  {
+  }
+
+  void LightBvh::Reserve(uint32_t numLights)
+  {
+    if (numLights > storage_.capacity)
+    {
+      // The old buffers are destroyed once the frames that are still using them have retired
+      storage_ = Storage(*device_, GetSortCount(numLights));
+    }
+  }
+
+  void LightBvh::Build(VkCommandBuffer commandBuffer, Fvog::Buffer& lightBuffer, uint32_t numLights)
+  {
+    ZoneScoped;
+    assert(numLights <= storage_.capacity);
+    auto marker = Fvog::Context(*device_, commandBuffer).MakeScopedDebugMarker("Build Light BVH");
+    RecordBuild(commandBuffer, storage_, lightBuffer, numLights);
+  }
+
+  void LightBvh::Refit(VkCommandBuffer commandBuffer, Fvog::Buffer& lightBuffer, uint32_t numLights)
+  {
+    ZoneScoped;
+    assert(numLights <= storage_.capacity);
+    auto marker = Fvog::Context(*device_, commandBuffer).MakeScopedDebugMarker("Refit Light BVH");
+    RecordRefit(commandBuffer, storage_, lightBuffer, numLights);
+  }
+
+  void LightBvh::RecordBuild(VkCommandBuffer commandBuffer, Storage& storage, Fvog::Buffer& lightBuffer, uint32_t numLights)
+  {
+    if (numLights == 0)
+    {
+      return;
+    }
+
+    auto ctx = Fvog::Context(*device_, commandBuffer);
+    const auto sortCount = GetSortCount(numLights);
+    auto pushConstants = LightBvhPushConstants{
+      .lightBufferIndex   = lightBuffer.GetResourceHandle().index,
+      .numLights          = numLights,
+      .keysIndex          = storage.keys.GetResourceHandle().index,
+      .nodesIndex         = storage.nodes.GetResourceHandle().index,
+      .refitCountersIndex = storage.refitCounters.GetResourceHandle().index,
+      .sceneBoundsIndex   = storage.sceneBounds.GetResourceHandle().index,
+      .sortCount          = sortCount,
+    };
+
+    ctx.TeenyBufferUpdate(storage.sceneBounds, LightBvhSceneBounds{.min = {~0u, ~0u, ~0u}, .max = {0, 0, 0}});
+    ctx.Barrier(transferToComputeBarrier);
+
+    ctx.BindComputePipeline(boundsPipeline_);
+    ctx.SetPushConstants(pushConstants);
+    ctx.DispatchInvocations(numLights, 1, 1);
+    ctx.Barrier(computeBarrier);
+
+    ctx.BindComputePipeline(mortonCodesPipeline_);
+    ctx.DispatchInvocations(sortCount, 1, 1);
+    ctx.Barrier(computeBarrier);
+
+    // Bitonic sort. Merges are done in global steps until the keys being compared are within a group
+    const auto sortGroups = sortCount / LIGHT_BVH_SORT_GROUP_KEYS;
+    ctx.BindComputePipeline(sortPipeline_);
+    pushConstants.sortMode = LIGHT_BVH_SORT_MODE_LOCAL;
+    ctx.SetPushConstants(pushConstants);
+    ctx.Dispatch(sortGroups, 1, 1);
+    ctx.Barrier(computeBarrier);
+    for (uint32_t k = 2 * LIGHT_BVH_SORT_GROUP_KEYS; k <= sortCount; k *= 2)
+    {
+      pushConstants.sortK = k;
+      for (uint32_t j = k / 2; j >= LIGHT_BVH_SORT_GROUP_KEYS; j /= 2)
+      {
+        pushConstants.sortMode = LIGHT_BVH_SORT_MODE_GLOBAL_STEP;
+        pushConstants.sortJ    = j;
+        ctx.SetPushConstants(pushConstants);
+        ctx.DispatchInvocations(sortCount / 2, 1, 1);
+        ctx.Barrier(computeBarrier);
+      }
+
+      pushConstants.sortMode = LIGHT_BVH_SORT_MODE_LOCAL_MERGE;
+      ctx.SetPushConstants(pushConstants);
+      ctx.Dispatch(sortGroups, 1, 1);
+      ctx.Barrier(computeBarrier);
+    }
+
+    if (numLights > 1)
+    {
+      ctx.BindComputePipeline(hierarchyPipeline_);
+      ctx.SetPushConstants(pushConstants);
+      ctx.DispatchInvocations(numLights - 1, 1, 1);
+      ctx.Barrier(computeBarrier);
+    }
+
+    RecordRefit(commandBuffer, storage, lightBuffer, numLights);
+  }
+
+  void LightBvh::RecordRefit(VkCommandBuffer commandBuffer, Storage& storage, Fvog::Buffer& lightBuffer, uint32_t numLights)
+  {
+    if (numLights == 0)
+    {
+      return;
+    }
+
+    auto ctx = Fvog::Context(*device_, commandBuffer);
+    if (numLights > 1)
+    {
+      storage.refitCounters.FillData(commandBuffer, {.size = (numLights - 1) * sizeof(uint32_t)});
+      ctx.Barrier(transferToComputeBarrier);
+    }
+
+    ctx.BindComputePipeline(refitPipeline_);
+    ctx.SetPushConstants(LightBvhPushConstants{
+      .lightBufferIndex   = lightBuffer.GetResourceHandle().index,
+      .numLights          = numLights,
+      .keysIndex          = storage.keys.GetResourceHandle().index,
+      .nodesIndex         = storage.nodes.GetResourceHandle().index,
+      .refitCountersIndex = storage.refitCounters.GetResourceHandle().index,
+      .sceneBoundsIndex   = storage.sceneBounds.GetResourceHandle().index,
+      .sortCount          = GetSortCount(numLights),
+    });
+    ctx.DispatchInvocations(numLights, 1, 1);
+  }
+
+  LightBvh::BenchmarkResult LightBvh::Benchmark(std::span<const GpuLight> lights, uint32_t iterations)
+  {
+    ZoneScoped;
+    const auto numLights = static_cast<uint32_t>(lights.size());
+    assert(numLights > 0);
+    auto result = BenchmarkResult{};
+
+    // Separate buffers, so the ones that frames in flight are reading are left alone
+    auto storage      = Storage(*device_, GetSortCount(numLights));
+    auto lightBuffer  = Fvog::TypedBuffer<GpuLight>(*device_, {.count = numLights}, "Light BVH Benchmark Lights");
+    auto lightsUpload = Fvog::TypedBuffer<GpuLight>(*device_,
+      {.count = numLights, .flag = Fvog::BufferFlagThingy::MAP_SEQUENTIAL_WRITE | Fvog::BufferFlagThingy::NO_DESCRIPTOR, .category = Fvog::MemoryCategory::STAGING},
+      "Light BVH Benchmark Lights Upload");
+    auto nodesReadback = Fvog::TypedBuffer<LightBvhNode>(*device_,
+      {.count = 2 * numLights - 1, .flag = Fvog::BufferFlagThingy::MAP_RANDOM_ACCESS | Fvog::BufferFlagThingy::NO_DESCRIPTOR, .category = Fvog::MemoryCategory::STAGING},
+      "Light BVH Benchmark Nodes Readback");
+    std::memcpy(lightsUpload.GetMappedMemory(), lights.data(), lights.size_bytes());
+
+    auto buildTimer = Fvog::TimerQueryAsync(*device_, 1, "Light BVH Benchmark Build");
+    auto refitTimer = Fvog::TimerQueryAsync(*device_, 1, "Light BVH Benchmark Refit");
+    device_->ImmediateSubmit(
+      [&](VkCommandBuffer commandBuffer)
+      {
+        auto ctx = Fvog::Context(*device_, commandBuffer);
+        ctx.CopyBuffer(lightsUpload, lightBuffer, {.size = lights.size_bytes()});
+        ctx.Barrier();
+
+        buildTimer.BeginZone(commandBuffer);
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+          RecordBuild(commandBuffer, storage, lightBuffer, numLights);
+          ctx.Barrier();
+        }
+        buildTimer.EndZone(commandBuffer);
+
+        refitTimer.BeginZone(commandBuffer);
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+          RecordRefit(commandBuffer, storage, lightBuffer, numLights);
+          ctx.Barrier();
+        }
+        refitTimer.EndZone(commandBuffer);
+
+        ctx.Barrier();
+        ctx.CopyBuffer(storage.nodes, nodesReadback, {.size = nodesReadback.SizeBytes()});
+      });
+
+    result.gpuBuildMs = static_cast<double>(buildTimer.PopTimestamp().value_or(0)) / 1e6 / iterations;
+    result.gpuRefitMs = static_cast<double>(refitTimer.PopTimestamp().value_or(0)) / 1e6 / iterations;
+
+    const auto cpuNodes = LightBvhCpu::Build(lights);
+
+    nodesReadback.InvalidateMappedMemory();
+    const auto* gpuNodes = nodesReadback.GetMappedMemory();
+    auto nearlyEqual     = [](glm::vec3 a, glm::vec3 b) { return glm::all(glm::lessThanEqual(glm::abs(a - b), 1e-4f * glm::max(glm::abs(a), glm::abs(b)) + 1e-6f)); };
+    for (size_t i = 0; i < cpuNodes.size(); i++)
+    {
+      const auto& gpu = gpuNodes[i];
+      const auto& cpu = cpuNodes[i];
+      const bool sameTopology = gpu.left == cpu.left && gpu.right == cpu.right && gpu.parent == cpu.parent;
+      const bool samePower    = std::abs(gpu.power - cpu.power) <= 1e-4f * std::max(std::abs(gpu.power), std::abs(cpu.power)) + 1e-6f;
+      result.mismatchedNodes += !(sameTopology && samePower && nearlyEqual(gpu.boundsMin, cpu.boundsMin) && nearlyEqual(gpu.boundsMax, cpu.boundsMax));
+    }
+
+    return result;
+  }
+} // namespace Techniques
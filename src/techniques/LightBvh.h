@@ -0,0 +1,115 @@
+#pragma once
+#include "Fvog/Buffer2.h"
+#include "Fvog/Pipeline2.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "shaders/lights/LightBvh.h.glsl"
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstdint>
+#include <future>
+#include <span>
+#include <vector>
+
+namespace Fvog
+{
+  class Device;
+
+  namespace detail
+  {
+    class ThreadPool;
+  }
+}
+
+namespace Techniques
+{
+  // Linear BVH over the bounds of lights, built on the GPU. See LightBvh.h.glsl for the layout.
+  // Building sorts every light, so it should only happen when lights are added or removed. Refitting is enough when they only move
+  class LightBvh
+  {
+  public:
+    // Pipelines being built on a thread pool, so the owner can start every build before waiting on any of them
+    struct PipelineBuilds
+    {
+      std::future<Fvog::ComputePipeline> bounds;
+      std::future<Fvog::ComputePipeline> mortonCodes;
+      std::future<Fvog::ComputePipeline> sort;
+      std::future<Fvog::ComputePipeline> hierarchy;
+      std::future<Fvog::ComputePipeline> refit;
+    };
+
+    [[nodiscard]] static PipelineBuilds StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool);
+
+    // Waits for the pipelines to finish building
+    LightBvh(Fvog::Device& device, PipelineBuilds pipelineBuilds);
+
+    // Grows the buffers to fit numLights. The old buffers are replaced, so call this before declaring accesses to them
+    void Reserve(uint32_t numLights);
+
+    // lightBuffer holds numLights GpuLights and is read by compute shaders.
+    // The BVH buffers are written by transfers and compute shaders, and the caller is responsible for synchronizing later accesses
+    void Build(VkCommandBuffer commandBuffer, Fvog::Buffer& lightBuffer, uint32_t numLights);
+    // Recomputes the bounds of every node for the lights' current positions and ranges without changing the topology.
+    // The set of lights must be the same as at the last build. The tree degrades as lights move away from where they were then
+    void Refit(VkCommandBuffer commandBuffer, Fvog::Buffer& lightBuffer, uint32_t numLights);
+
+    struct BenchmarkResult
+    {
+      double gpuBuildMs;
+      double gpuRefitMs;
+      // Nodes whose topology or bounds differ between the GPU build and LightBvhCpu::Build
+      uint32_t mismatchedNodes;
+    };
+
+    // Builds and refits over the lights in separate buffers, averaging the time taken over several iterations, then compares the result with LightBvhCpu::Build.
+    // Stalls the app. The CPU build is timed by the lightBvhBenchmark test target instead
+    [[nodiscard]] BenchmarkResult Benchmark(std::span<const GpuLight> lights, uint32_t iterations);
+
+    [[nodiscard]] Fvog::Buffer& GetNodesBuffer() noexcept
+    {
+      return storage_.nodes;
+    }
+
+    [[nodiscard]] Fvog::Buffer& GetKeysBuffer() noexcept
+    {
+      return storage_.keys;
+    }
+
+    [[nodiscard]] Fvog::Buffer& GetRefitCountersBuffer() noexcept
+    {
+      return storage_.refitCounters;
+    }
+
+    [[nodiscard]] Fvog::Buffer& GetSceneBoundsBuffer() noexcept
+    {
+      return storage_.sceneBounds;
+    }
+
+  private:
+    struct Storage
+    {
+      Storage(Fvog::Device& device, uint32_t capacity);
+
+      uint32_t capacity;
+      Fvog::TypedBuffer<glm::uvec2> keys;
+      Fvog::TypedBuffer<LightBvhNode> nodes;
+      Fvog::TypedBuffer<uint32_t> refitCounters;
+      Fvog::TypedBuffer<LightBvhSceneBounds> sceneBounds;
+    };
+
+    void RecordBuild(VkCommandBuffer commandBuffer, Storage& storage, Fvog::Buffer& lightBuffer, uint32_t numLights);
+    void RecordRefit(VkCommandBuffer commandBuffer, Storage& storage, Fvog::Buffer& lightBuffer, uint32_t numLights);
+
+    Fvog::Device* device_{};
+    Storage storage_;
+
+    Fvog::ComputePipeline boundsPipeline_;
+    Fvog::ComputePipeline mortonCodesPipeline_;
+    Fvog::ComputePipeline sortPipeline_;
+    Fvog::ComputePipeline hierarchyPipeline_;
+    Fvog::ComputePipeline refitPipeline_;
+  };
+} // namespace Techniques
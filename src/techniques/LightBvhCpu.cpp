@@ -0,0 +1,187 @@
+#include "LightBvhCpu.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+namespace Techniques::LightBvhCpu
+{
+  // The functions below mirror those in LightBvh.h.glsl and the build shaders
+  static bool IsBounded(const GpuLight& light)
+  {
+    return light.type != LIGHT_TYPE_DIRECTIONAL && !std::isinf(light.range);
+  }
+
+  static float GetLightPower(const GpuLight& light)
+  {
+    const auto luminanceWeights = light.colorSpace == COLOR_SPACE_BT2020_LINEAR ? glm::vec3(0.2627f, 0.6780f, 0.0593f) : glm::vec3(0.2126f, 0.7152f, 0.0722f);
+    const float luminousIntensity = light.intensity * glm::dot(light.color, luminanceWeights);
+    if (light.type == LIGHT_TYPE_POINT)
+    {
+      return 4.0f * 3.141592654f * luminousIntensity;
+    }
+    if (light.type == LIGHT_TYPE_SPOT)
+    {
+      return 2.0f * 3.141592654f * (1.0f - std::cos(light.outerConeAngle)) * luminousIntensity;
+    }
+    return 0;
+  }
+
+  static uint32_t ExpandBits(uint32_t v)
+  {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+  }
+
+  static uint32_t MortonCode(glm::vec3 p)
+  {
+    const auto q = glm::uvec3(glm::clamp(p * 1024.0f, 0.0f, 1023.0f));
+    return (ExpandBits(q.x) << 2) | (ExpandBits(q.y) << 1) | ExpandBits(q.z);
+  }
+
+  std::vector<LightBvhNode> Build(std::span<const GpuLight> lights)
+  {
+    ZoneScoped;
+    const auto numLights = static_cast<uint32_t>(lights.size());
+    if (numLights == 0)
+    {
+      return {};
+    }
+
+    auto boundsMin = glm::vec3(INFINITY);
+    auto boundsMax = glm::vec3(-INFINITY);
+    for (const auto& light : lights)
+    {
+      if (IsBounded(light))
+      {
+        boundsMin = glm::min(boundsMin, light.position);
+        boundsMax = glm::max(boundsMax, light.position);
+      }
+    }
+
+    auto keys = std::vector<glm::uvec2>(numLights);
+    for (uint32_t i = 0; i < numLights; i++)
+    {
+      keys[i] = IsBounded(lights[i]) ? glm::uvec2(MortonCode((lights[i].position - boundsMin) / glm::max(boundsMax - boundsMin, glm::vec3(1e-6f))), i) : glm::uvec2(~0u, i);
+    }
+    std::ranges::sort(keys, [](glm::uvec2 a, glm::uvec2 b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+
+    auto nodes = std::vector<LightBvhNode>(2 * numLights - 1);
+    nodes[0].parent = LIGHT_BVH_INVALID_NODE;
+
+    const auto n = static_cast<int>(numLights);
+    auto delta = [&](int i, int j)
+    {
+      if (j < 0 || j >= n)
+      {
+        return -1;
+      }
+
+      if (keys[i].x == keys[j].x)
+      {
+        return 32 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+      }
+      return std::countl_zero(keys[i].x ^ keys[j].x);
+    };
+
+    auto childIndex = [&](int rangeEnd, int child) { return rangeEnd == child ? numLights - 1 + uint32_t(child) : uint32_t(child); };
+
+    for (int i = 0; i < n - 1; i++)
+    {
+      const int d        = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+      const int deltaMin = delta(i, i - d);
+      int lengthMax      = 2;
+      while (delta(i, i + lengthMax * d) > deltaMin)
+      {
+        lengthMax *= 2;
+      }
+
+      int length = 0;
+      for (int t = lengthMax / 2; t >= 1; t /= 2)
+      {
+        if (delta(i, i + (length + t) * d) > deltaMin)
+        {
+          length += t;
+        }
+      }
+      const int j = i + length * d;
+
+      const int deltaNode = delta(i, j);
+      int split           = 0;
+      int t               = length;
+      do
+      {
+        t = (t + 1) / 2;
+        if (delta(i, i + (split + t) * d) > deltaNode)
+        {
+          split += t;
+        }
+      } while (t > 1);
+      const int gamma = i + split * d + std::min(d, 0);
+
+      const auto left     = childIndex(std::min(i, j), gamma);
+      const auto right    = childIndex(std::max(i, j), gamma + 1);
+      auto& node          = nodes[static_cast<uint32_t>(i)];
+      node.left           = left;
+      node.right          = right;
+      nodes[left].parent  = static_cast<uint32_t>(i);
+      nodes[right].parent = static_cast<uint32_t>(i);
+    }
+
+    // Leaves are in sorted order and point at their lights
+    for (uint32_t i = 0; i < numLights; i++)
+    {
+      auto& leaf = nodes[numLights - 1 + i];
+      leaf.left  = keys[i].y;
+      leaf.right = LIGHT_BVH_LEAF;
+    }
+
+    Refit(nodes, lights);
+    return nodes;
+  }
+
+  void Refit(std::span<LightBvhNode> nodes, std::span<const GpuLight> lights)
+  {
+    ZoneScoped;
+    const auto numLights = static_cast<uint32_t>(lights.size());
+    assert(nodes.size() == (numLights == 0 ? 0 : 2 * numLights - 1));
+
+    // The same way as the GPU, with the second child to arrive at a node computing its bounds
+    auto refitCounters = std::vector<uint32_t>(numLights == 0 ? 0 : numLights - 1);
+    for (uint32_t i = 0; i < numLights; i++)
+    {
+      auto& leaf        = nodes[numLights - 1 + i];
+      const auto& light = lights[leaf.left];
+      if (IsBounded(light))
+      {
+        leaf.boundsMin = light.position - light.range;
+        leaf.boundsMax = light.position + light.range;
+      }
+      else
+      {
+        leaf.boundsMin = glm::vec3(-static_cast<float>(LIGHT_BVH_INFINITY));
+        leaf.boundsMax = glm::vec3(static_cast<float>(LIGHT_BVH_INFINITY));
+      }
+      leaf.power = GetLightPower(light);
+
+      for (auto node = leaf.parent; node != LIGHT_BVH_INVALID_NODE && refitCounters[node]++ > 0; node = nodes[node].parent)
+      {
+        const auto& left      = nodes[nodes[node].left];
+        const auto& right     = nodes[nodes[node].right];
+        nodes[node].boundsMin = glm::min(left.boundsMin, right.boundsMin);
+        nodes[node].boundsMax = glm::max(left.boundsMax, right.boundsMax);
+        nodes[node].power     = left.power + right.power;
+      }
+    }
+  }
+} // namespace Techniques::LightBvhCpu
@@ -0,0 +1,18 @@
+#pragma once
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "shaders/lights/LightBvh.h.glsl"
+
+#include <span>
+#include <vector>
+
+// Reference implementation of LightBvh's GPU build and refit, which needs no device. Used to check and benchmark them
+namespace Techniques::LightBvhCpu
+{
+  // Float rounding may differ from the GPU's, which can move lights that lie on the boundary of a Morton cell
+  [[nodiscard]] std::vector<LightBvhNode> Build(std::span<const GpuLight> lights);
+
+  // Recomputes the bounds and power of every node of a tree built from the same set of lights, without changing its topology
+  void Refit(std::span<LightBvhNode> nodes, std::span<const GpuLight> lights);
+} // namespace Techniques::LightBvhCpu
@@ -0,0 +1,249 @@
+#include "LightClusters.h"
+
+#include "Fvog/Device.h"
+#include "Fvog/Rendering2.h"
+#include "Fvog/Shader2.h"
+#include "Fvog/detail/ThreadPool2.h"
+
+#include "../RendererUtilities.h"
+
+#include "shaders/Config.shared.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace Techniques
+{
+  static Fvog::ComputePipeline CreateAssignLightsPipeline(Fvog::Device& device)
+  {
+    auto cs = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/lights/AssignLightsToClusters.comp.glsl");
+
+    return Fvog::ComputePipeline(device, {
+      .name = "Assign Lights to Clusters",
+      .shader = &cs,
+    });
+  }
+
+  static LightClusterUniforms MakeUniforms(const LightClusters::AssignParams& params, uint32_t indexCapacity)
+  {
+    return {
+      .view = params.view,
+      .invProj = params.invProj,
+      .nearDepth = params.nearDepth,
+      .farDepth = params.farDepth,
+      .numLights = params.numLights,
+      .indexCapacity = indexCapacity,
+    };
+  }
+
+  // The functions below mirror those in LightClusters.h.glsl
+  static float GetSliceStart(uint32_t slice, float nearDepth, float farDepth)
+  {
+    if (slice == 0)
+    {
+      return 0;
+    }
+
+    if (slice >= LIGHT_CLUSTERS_Z)
+    {
+      return static_cast<float>(LIGHT_CLUSTER_MAX_DEPTH);
+    }
+
+    return nearDepth * std::pow(farDepth / nearDepth, static_cast<float>(slice - 1) / (LIGHT_CLUSTERS_Z - 2));
+  }
+
+  static uint32_t GetClusterIndex(uint32_t x, uint32_t y, uint32_t z)
+  {
+    return x + y * LIGHT_CLUSTERS_X + z * LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y;
+  }
+
+  LightClusters::PipelineBuilds LightClusters::StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool)
+  {
+    return {
+      .assignLights = threadPool.Submit([&device] { return CreateAssignLightsPipeline(device); }),
+    };
+  }
+
+  LightClusters::LightClusters(Fvog::Device& device, PipelineBuilds pipelineBuilds)
+    : device_(&device),
+      uniformsBuffer_(device, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Light Cluster Uniforms"),
+      clustersBuffer_(device, {.count = LIGHT_CLUSTER_COUNT}, "Light Clusters"),
+      lightIndicesBuffer_(device, {.count = 1 + indexCapacity}, "Light Cluster Indices"),
+      assignLightsPipeline_(pipelineBuilds.assignLights.get())
+  {
+  }
+
+  void LightClusters::Record(VkCommandBuffer commandBuffer,
+    const LightClusterUniforms& uniforms,
+    Fvog::Buffer& lightBuffer,
+    Fvog::Buffer* lightBvhNodes,
+    Fvog::Buffer& uniformsBuffer,
+    Fvog::Buffer& clusters,
+    Fvog::Buffer& lightIndices)
+  {
+    auto ctx = Fvog::Context(*device_, commandBuffer);
+
+    ctx.TeenyBufferUpdate(uniformsBuffer, uniforms);
+    lightIndices.FillData(commandBuffer, {.size = sizeof(uint32_t)});
+
+    ctx.Barrier({
+      .srcStageMask  = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    });
+
+    ctx.BindComputePipeline(assignLightsPipeline_);
+    ctx.SetPushConstants(AssignLightsToClustersPushConstants{
+      .lightClusterUniformsIndex = uniformsBuffer.GetResourceHandle().index,
+      .lightClustersIndex        = clusters.GetResourceHandle().index,
+      .lightIndicesIndex         = lightIndices.GetResourceHandle().index,
+      .lightBufferIndex          = lightBuffer.GetResourceHandle().index,
+      .lightBvhNodesIndex        = lightBvhNodes ? lightBvhNodes->GetResourceHandle().index : 0,
+      .useLightBvh               = lightBvhNodes != nullptr,
+    });
+    ctx.Dispatch(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z);
+  }
+
+  void LightClusters::Assign(VkCommandBuffer commandBuffer, const AssignParams& params)
+  {
+    ZoneScoped;
+    auto marker = Fvog::Context(*device_, commandBuffer).MakeScopedDebugMarker("Assign Lights to Clusters");
+    Record(commandBuffer, MakeUniforms(params, indexCapacity), params.lightBuffer, params.lightBvhNodes, uniformsBuffer_, clustersBuffer_, lightIndicesBuffer_);
+  }
+
+  std::vector<std::vector<uint32_t>> LightClusters::AssignLightsCpu(const LightClusterUniforms& uniforms, std::span<const GpuLight> lights, float radiusScale)
+  {
+    ZoneScoped;
+    auto clusters = std::vector<std::vector<uint32_t>>(LIGHT_CLUSTER_COUNT);
+
+    // Lights are transformed once rather than per cluster
+    auto centers = std::vector<glm::vec3>(lights.size());
+    std::ranges::transform(lights, centers.begin(), [&](const GpuLight& light) { return glm::vec3(uniforms.view * glm::vec4(light.position, 1)); });
+
+    for (uint32_t z = 0; z < LIGHT_CLUSTERS_Z; z++)
+    {
+      const float depthStart = GetSliceStart(z, uniforms.nearDepth, uniforms.farDepth);
+      const float depthEnd   = GetSliceStart(z + 1, uniforms.nearDepth, uniforms.farDepth);
+      for (uint32_t y = 0; y < LIGHT_CLUSTERS_Y; y++)
+      {
+        for (uint32_t x = 0; x < LIGHT_CLUSTERS_X; x++)
+        {
+          const auto uvMin = glm::vec2(x, y) / glm::vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y);
+          const auto uvMax = glm::vec2(x + 1, y + 1) / glm::vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y);
+          auto clusterMin  = glm::vec3(static_cast<float>(LIGHT_CLUSTER_MAX_DEPTH));
+          auto clusterMax  = glm::vec3(-static_cast<float>(LIGHT_CLUSTER_MAX_DEPTH));
+          for (uint32_t i = 0; i < 4; i++)
+          {
+            const auto uv               = glm::vec2((i & 1) == 0 ? uvMin.x : uvMax.x, (i & 2) == 0 ? uvMin.y : uvMax.y);
+            const auto pointOnNearPlane = uniforms.invProj * glm::vec4(uv * 2.0f - 1.0f, NEAR_DEPTH, 1);
+            const auto point            = glm::vec3(pointOnNearPlane) / pointOnNearPlane.w;
+            const auto direction        = point / -point.z;
+            clusterMin                  = glm::min(clusterMin, glm::min(direction * depthStart, direction * depthEnd));
+            clusterMax                  = glm::max(clusterMax, glm::max(direction * depthStart, direction * depthEnd));
+          }
+
+          auto& cluster = clusters[GetClusterIndex(x, y, z)];
+          for (uint32_t i = 0; i < lights.size(); i++)
+          {
+            const auto& light = lights[i];
+            if (light.type == LIGHT_TYPE_DIRECTIONAL || std::isinf(light.range))
+            {
+              cluster.push_back(i);
+              continue;
+            }
+
+            const auto offset = centers[i] - glm::clamp(centers[i], clusterMin, clusterMax);
+            const auto range  = light.range * radiusScale;
+            if (glm::dot(offset, offset) <= range * range)
+            {
+              cluster.push_back(i);
+            }
+          }
+        }
+      }
+    }
+
+    return clusters;
+  }
+
+  LightClusters::ValidationResult LightClusters::Validate(const AssignParams& params)
+  {
+    ZoneScoped;
+    const auto uniforms = MakeUniforms(params, indexCapacity);
+
+    // Separate buffers, so the ones that frames in flight are reading are left alone
+    auto uniformsBuffer = Fvog::TypedBuffer<LightClusterUniforms>(*device_, {}, "Light Cluster Uniforms Validation");
+    auto clusters       = Fvog::TypedBuffer<LightCluster>(*device_, {.count = LIGHT_CLUSTER_COUNT}, "Light Clusters Validation");
+    auto lightIndices   = Fvog::TypedBuffer<uint32_t>(*device_, {.count = 1 + indexCapacity}, "Light Cluster Indices Validation");
+
+    const auto readbackFlags = Fvog::BufferFlagThingy::MAP_RANDOM_ACCESS | Fvog::BufferFlagThingy::NO_DESCRIPTOR;
+    auto clustersReadback     = Fvog::TypedBuffer<LightCluster>(*device_, {.count = LIGHT_CLUSTER_COUNT, .flag = readbackFlags, .category = Fvog::MemoryCategory::STAGING}, "Light Clusters Readback");
+    auto lightIndicesReadback = Fvog::TypedBuffer<uint32_t>(*device_, {.count = 1 + indexCapacity, .flag = readbackFlags, .category = Fvog::MemoryCategory::STAGING}, "Light Cluster Indices Readback");
+    // The lights are read back too, so the reference sees exactly what the GPU saw
+    auto lightsReadback = Fvog::TypedBuffer<GpuLight>(*device_, {.count = std::max(1u, params.numLights), .flag = readbackFlags, .category = Fvog::MemoryCategory::STAGING}, "Lights Readback");
+
+    device_->ImmediateSubmit(
+      [&](VkCommandBuffer commandBuffer)
+      {
+        auto ctx = Fvog::Context(*device_, commandBuffer);
+        // Wait for frames that may still be writing the light buffer
+        ctx.Barrier();
+        Record(commandBuffer, uniforms, params.lightBuffer, params.lightBvhNodes, uniformsBuffer, clusters, lightIndices);
+        ctx.Barrier();
+        ctx.CopyBuffer(clusters, clustersReadback, {.size = clusters.SizeBytes()});
+        ctx.CopyBuffer(lightIndices, lightIndicesReadback, {.size = lightIndices.SizeBytes()});
+        if (params.numLights > 0)
+        {
+          ctx.CopyBuffer(params.lightBuffer, lightsReadback, {.size = params.numLights * sizeof(GpuLight)});
+        }
+      });
+
+    clustersReadback.InvalidateMappedMemory();
+    lightIndicesReadback.InvalidateMappedMemory();
+    lightsReadback.InvalidateMappedMemory();
+
+    const auto lights     = std::span(lightsReadback.GetMappedMemory(), params.numLights);
+    const auto* gpuIndices = lightIndicesReadback.GetMappedMemory();
+
+    // Lights within a small margin of a cluster are in the loose set but not the strict one. The GPU may list them or not
+    constexpr float margin = 1e-3f;
+    const auto strict      = AssignLightsCpu(uniforms, lights, 1 - margin);
+    const auto loose       = AssignLightsCpu(uniforms, lights, 1 + margin);
+
+    auto result       = ValidationResult{};
+    result.gpuIndices = gpuIndices[0];
+    auto gpuCluster   = std::vector<uint32_t>();
+    auto difference   = std::vector<uint32_t>();
+    for (uint32_t i = 0; i < LIGHT_CLUSTER_COUNT; i++)
+    {
+      const auto cluster = clustersReadback.GetMappedMemory()[i];
+      gpuCluster.assign(gpuIndices + 1 + cluster.offset, gpuIndices + 1 + cluster.offset + cluster.count);
+      std::ranges::sort(gpuCluster);
+
+      // Clusters are truncated when they reach too many lights, or when they were given the end of a full index list
+      const bool truncated = loose[i].size() > MAX_LIGHTS_PER_CLUSTER || (result.gpuIndices > indexCapacity && cluster.offset + cluster.count >= indexCapacity);
+      result.truncatedClusters += truncated;
+
+      difference.clear();
+      std::ranges::set_difference(strict[i], gpuCluster, std::back_inserter(difference));
+      const auto missing = truncated ? 0 : static_cast<uint32_t>(difference.size());
+
+      difference.clear();
+      std::ranges::set_difference(gpuCluster, loose[i], std::back_inserter(difference));
+      const auto extra = static_cast<uint32_t>(difference.size());
+
+      result.missingLights += missing;
+      result.extraLights += extra;
+      result.mismatchedClusters += missing + extra > 0;
+    }
+
+    return result;
+  }
+} // namespace Techniques
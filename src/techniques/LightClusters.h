@@ -0,0 +1,134 @@
+#pragma once
+#include "Fvog/Buffer2.h"
+#include "Fvog/Pipeline2.h"
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "shaders/ShadeDeferredPbr.h.glsl"
+#include "shaders/lights/LightClusters.h.glsl"
+
+#include <vulkan/vulkan_core.h>
+
+#include <cstdint>
+#include <future>
+#include <span>
+#include <vector>
+
+namespace Fvog
+{
+  class Device;
+
+  namespace detail
+  {
+    class ThreadPool;
+  }
+}
+
+namespace Techniques
+{
+  // Clustered light culling. Each frame, the lights that can reach each cluster of the view frustum are written to compact per-cluster lists,
+  // which the shading pass reads instead of looping over every light
+  class LightClusters
+  {
+  public:
+    // Pipelines being built on a thread pool, so the owner can start every build before waiting on any of them
+    struct PipelineBuilds
+    {
+      std::future<Fvog::ComputePipeline> assignLights;
+    };
+
+    [[nodiscard]] static PipelineBuilds StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool);
+
+    // Waits for the pipelines to finish building
+    LightClusters(Fvog::Device& device, PipelineBuilds pipelineBuilds);
+
+    struct AssignParams
+    {
+      glm::mat4 view;
+
+      // Inverse of the projection that the shaded image was rendered with, so clusters line up with its pixels
+      glm::mat4 invProj;
+
+      // View depths between which slices are exponentially distributed. See LightClusters.h.glsl
+      float nearDepth;
+      float farDepth;
+
+      // Buffer of GpuLight. It's read by compute shaders
+      Fvog::Buffer& lightBuffer;
+      uint32_t numLights;
+
+      // Nodes of a LightBvh over the lights, which lets clusters skip groups of lights that can't reach them. Read by compute shaders.
+      // If null, every light is tested against every cluster
+      Fvog::Buffer* lightBvhNodes = nullptr;
+    };
+
+    // Writes the uniforms, cluster, and light index buffers. They are written by transfers and compute shaders, and the caller is responsible for synchronizing later accesses
+    void Assign(VkCommandBuffer commandBuffer, const AssignParams& params);
+
+    struct ValidationResult
+    {
+      uint32_t mismatchedClusters;
+      // Lights that the CPU found to clearly reach a cluster, but the GPU didn't list. Truncated clusters aren't counted
+      uint32_t missingLights;
+      // Listed lights that the CPU found to clearly not reach a cluster
+      uint32_t extraLights;
+      uint32_t truncatedClusters;
+      uint32_t gpuIndices;
+    };
+
+    // Runs the assignment in a separate submission that is waited on, then compares it with AssignLightsCpu. Stalls the app.
+    // Lights that just touch a cluster's bounds are not counted either way, as the CPU and GPU may round them differently
+    [[nodiscard]] ValidationResult Validate(const AssignParams& params);
+
+    // Reference implementation of AssignLightsToClusters.comp. Returns the sorted indices of the lights that reach each cluster.
+    // Light ranges are scaled by radiusScale. Clusters are not truncated to MAX_LIGHTS_PER_CLUSTER
+    [[nodiscard]] static std::vector<std::vector<uint32_t>> AssignLightsCpu(const LightClusterUniforms& uniforms, std::span<const GpuLight> lights, float radiusScale = 1);
+
+    [[nodiscard]] Fvog::Buffer& GetUniformsBuffer() noexcept
+    {
+      return uniformsBuffer_;
+    }
+
+    [[nodiscard]] Fvog::Buffer& GetClustersBuffer() noexcept
+    {
+      return clustersBuffer_;
+    }
+
+    [[nodiscard]] Fvog::Buffer& GetLightIndicesBuffer() noexcept
+    {
+      return lightIndicesBuffer_;
+    }
+
+  private:
+    FVOG_DECLARE_ARGUMENTS(AssignLightsToClustersPushConstants)
+    {
+      FVOG_UINT32 lightClusterUniformsIndex;
+      FVOG_UINT32 lightClustersIndex;
+      FVOG_UINT32 lightIndicesIndex;
+      FVOG_UINT32 lightBufferIndex;
+      FVOG_UINT32 lightBvhNodesIndex;
+      FVOG_UINT32 useLightBvh;
+    };
+
+    static constexpr uint32_t indexCapacity = LIGHT_CLUSTER_COUNT * AVERAGE_LIGHTS_PER_CLUSTER;
+
+    void Record(VkCommandBuffer commandBuffer,
+      const LightClusterUniforms& uniforms,
+      Fvog::Buffer& lightBuffer,
+      Fvog::Buffer* lightBvhNodes,
+      Fvog::Buffer& uniformsBuffer,
+      Fvog::Buffer& clusters,
+      Fvog::Buffer& lightIndices);
+
+    Fvog::Device* device_{};
+    Fvog::TypedBuffer<LightClusterUniforms> uniformsBuffer_;
+    Fvog::TypedBuffer<LightCluster> clustersBuffer_;
+    // A count of requested indices, followed by the indices
+    Fvog::TypedBuffer<uint32_t> lightIndicesBuffer_;
+
+    Fvog::ComputePipeline assignLightsPipeline_;
+  };
+} // namespace Techniques
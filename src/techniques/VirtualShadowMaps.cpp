@@ -6,10 +6,13 @@
 
 #include <Fvog/Buffer2.h>
 #include <Fvog/Rendering2.h>
+#include <Fvog/detail/ThreadPool2.h>
 
+#include <glm/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <bit>
 
@@ -17,6 +20,14 @@ namespace Techniques::VirtualShadowMaps
 {
   namespace
   {
+    // Orders the bookkeeping dispatches and buffer fills against each other without waiting on graphics work
+    constexpr auto computeBarrier = Fvog::GlobalBarrier{
+      .srcStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask  = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+    };
+
     Fvog::ComputePipeline CreateResetPageVisibilityPipeline(Fvog::Device& device)
     {
       auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/shadows/vsm/VsmResetPageVisibility.comp.glsl");
@@ -79,9 +90,52 @@ namespace Techniques::VirtualShadowMaps
         .shader = &comp,
       });
     }
+
+    Fvog::ComputePipeline CreateMarkDirtyBoundsPipeline(Fvog::Device& device)
+    {
+      auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/shadows/vsm/VsmMarkDirtyBounds.comp.glsl");
+
+      return Fvog::ComputePipeline(device, {
+        .shader = &comp,
+      });
+    }
+
+    Fvog::ComputePipeline CreateMarkVisibleLocalPagesPipeline(Fvog::Device& device)
+    {
+      auto comp = LoadShaderWithIncludes2(device, Fvog::PipelineStage::COMPUTE_SHADER, "shaders/shadows/vsm/VsmMarkVisibleLocalPages.comp.glsl");
+
+      return Fvog::ComputePipeline(device, {
+        .shader = &comp,
+      });
+    }
+
+    // Cube faces in the order GetVsmLocalViewIndex expects
+    constexpr glm::vec3 cubeFaceDirections[VSM_POINT_LIGHT_VIEWS] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+    constexpr glm::vec3 cubeFaceUps[VSM_POINT_LIGHT_VIEWS] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+
+    bool SphereIntersectsBounds(glm::vec3 center, float radius, const VsmDirtyBounds& bounds)
+    {
+      const auto offset = center - glm::clamp(center, bounds.boundsMin, bounds.boundsMax);
+      return glm::dot(offset, offset) <= radius * radius;
+    }
   }
 
-  Context::Context(Fvog::Device& device, const CreateInfo& createInfo)
+  Context::PipelineBuilds Context::StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool)
+  {
+    return {
+      .resetPageVisibility = threadPool.Submit([&device] { return CreateResetPageVisibilityPipeline(device); }),
+      .allocatePages = threadPool.Submit([&device] { return CreateAllocatorPipeline(device); }),
+      .markVisiblePages = threadPool.Submit([&device] { return CreateMarkVisiblePipeline(device); }),
+      .listDirtyPages = threadPool.Submit([&device] { return CreateListDirtyPagesPipeline(device); }),
+      .clearDirtyPages = threadPool.Submit([&device] { return CreateClearDirtyPagesPipeline(device); }),
+      .freeNonVisiblePages = threadPool.Submit([&device] { return CreateFreeNonVisiblePagesPipeline(device); }),
+      .reduceVsmHzb = threadPool.Submit([&device] { return CreateReduceVsmHzbPipeline(device); }),
+      .markDirtyBounds = threadPool.Submit([&device] { return CreateMarkDirtyBoundsPipeline(device); }),
+      .markVisibleLocalPages = threadPool.Submit([&device] { return CreateMarkVisibleLocalPagesPipeline(device); }),
+    };
+  }
+
+  Context::Context(Fvog::Device& device, const CreateInfo& createInfo, PipelineBuilds pipelineBuilds)
     : device_(&device),
       freeLayersBitmask_(size_t(std::ceil(float(createInfo.maxVsms) / 32)), 0xFFFFFFu),
       pageTables_(device,
@@ -109,6 +163,7 @@ namespace Techniques::VirtualShadowMaps
           .extent = {(uint32_t)std::ceil(std::sqrt(createInfo.numPages)) * pageSize, (uint32_t)std::ceil(std::sqrt(createInfo.numPages)) * pageSize, 1},
           .mipLevels = 1,
           .arrayLayers = 1,
+          .category = Fvog::MemoryCategory::VSM_PHYSICAL_PAGES,
         },
         "VSM Physical Pages"),
       physicalPagesUint_(physicalPages_.CreateFormatView(Fvog::Format::R32_UINT)),
@@ -118,19 +173,22 @@ namespace Techniques::VirtualShadowMaps
         Fvog::TextureUsage::GENERAL,
         "VSM Physical Pages Heatmap")),
       visiblePagesBitmask_(device, {sizeof(uint32_t) * createInfo.numPages / 32}, "Visible Pages Bitmask"),
-      uniformBuffer_(device, {}, "VSM Uniforms"),
+      uniformBuffer_(device, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "VSM Uniforms"),
       pageAllocRequests_(device, {sizeof(PageAllocRequest) * (createInfo.numPages + 1)}, "Page Alloc Requests"),
       pagesToClear_(device, {sizeof(uint32_t) + sizeof(uint32_t) * createInfo.numPages}, "Pages to Clear"),
-      pageClearDispatchParams_(device, {}, "Page Clear Dispatch Params"),
-      resetPageVisibility_(CreateResetPageVisibilityPipeline(device)),
-      allocatePages_(CreateAllocatorPipeline(device)),
-      markVisiblePages_(CreateMarkVisiblePipeline(device)),
-      listDirtyPages_(CreateListDirtyPagesPipeline(device)),
-      clearDirtyPages_(CreateClearDirtyPagesPipeline(device)),
-      freeNonVisiblePages_(CreateFreeNonVisiblePagesPipeline(device)),
+      pageClearDispatchParams_(device, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Page Clear Dispatch Params"),
+      dirtyBounds_(device, {.count = 256}, "VSM Dirty Bounds"),
+      resetPageVisibility_(pipelineBuilds.resetPageVisibility.get()),
+      allocatePages_(pipelineBuilds.allocatePages.get()),
+      markVisiblePages_(pipelineBuilds.markVisiblePages.get()),
+      listDirtyPages_(pipelineBuilds.listDirtyPages.get()),
+      clearDirtyPages_(pipelineBuilds.clearDirtyPages.get()),
+      freeNonVisiblePages_(pipelineBuilds.freeNonVisiblePages.get()),
       // reducePhysicalPages_(CreateReducePhysicalPipeline()),
       // reduceVirtualPages_(CreateReduceVirtualPipeline()),
-      reduceVsmHzb_(CreateReduceVsmHzbPipeline(device))
+      reduceVsmHzb_(pipelineBuilds.reduceVsmHzb.get()),
+      markDirtyBounds_(pipelineBuilds.markDirtyBounds.get()),
+      markVisibleLocalPages_(pipelineBuilds.markVisibleLocalPages.get())
   {
     device.ImmediateSubmit([this](VkCommandBuffer cmd) {
       auto ctx = Fvog::Context(*device_, cmd);
@@ -155,6 +213,40 @@ namespace Techniques::VirtualShadowMaps
     ctx.TeenyBufferUpdate(uniformBuffer_, uniforms);
   }
 
+  /*
+   *  OUT:
+   *    dirtyBounds_
+   */
+  void Context::UpdateDirtyBounds(VkCommandBuffer cmd, std::span<const VsmDirtyBounds> bounds)
+  {
+    cpuDirtyBounds_.assign(bounds.begin(), bounds.end());
+
+    numDirtyBounds_ = static_cast<uint32_t>(std::min<size_t>(bounds.size(), maxDirtyBounds));
+    if (numDirtyBounds_ == 0)
+    {
+      return;
+    }
+
+    if (dirtyBounds_.Size() < numDirtyBounds_)
+    {
+      dirtyBounds_ = Fvog::TypedBuffer<VsmDirtyBounds>(*device_, {.count = std::min(std::bit_ceil(numDirtyBounds_), maxDirtyBounds)}, "VSM Dirty Bounds");
+    }
+
+    if (bounds.size() <= maxDirtyBounds)
+    {
+      dirtyBounds_.UpdateDataExpensive(cmd, bounds);
+      return;
+    }
+
+    auto merged = std::vector<VsmDirtyBounds>(bounds.begin(), bounds.begin() + maxDirtyBounds);
+    for (size_t i = maxDirtyBounds; i < bounds.size(); i++)
+    {
+      merged.back().boundsMin = glm::min(merged.back().boundsMin, bounds[i].boundsMin);
+      merged.back().boundsMax = glm::max(merged.back().boundsMax, bounds[i].boundsMax);
+    }
+    dirtyBounds_.UpdateDataExpensive(cmd, std::span<const VsmDirtyBounds>(merged));
+  }
+
   std::optional<uint32_t> Context::AllocateLayer()
   {
     for (size_t i = 0; i < freeLayersBitmask_.size(); i++)
@@ -191,14 +283,10 @@ namespace Techniques::VirtualShadowMaps
   {
     auto ctx = Fvog::Context(*device_, cmd);
     auto marker = ctx.MakeScopedDebugMarker("VSM Reset Page Visibility");
-    
-    ctx.ImageBarrier(pageTables_, VK_IMAGE_LAYOUT_GENERAL);
 
 #if VSM_RENDER_OVERDRAW
     // This just needs to happen sometime before the shadow maps are rendered
-    ctx.ImageBarrierDiscard(physicalPagesOverdrawHeatmap_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
     ctx.ClearTexture(physicalPagesOverdrawHeatmap_, {});
-    ctx.ImageBarrier(physicalPagesOverdrawHeatmap_, VK_IMAGE_LAYOUT_GENERAL);
 #endif
 
     ctx.BindComputePipeline(resetPageVisibility_);
@@ -225,8 +313,7 @@ namespace Techniques::VirtualShadowMaps
     auto ctx = Fvog::Context(*device_, cmd);
     auto marker = ctx.MakeScopedDebugMarker("VSM Free Non-Visible Pages");
 
-    ctx.Barrier(); // Appease sync val
-    ctx.ImageBarrier(pageTables_, VK_IMAGE_LAYOUT_GENERAL);
+    ctx.Barrier(computeBarrier);
 
     ctx.BindComputePipeline(freeNonVisiblePages_);
 
@@ -259,7 +346,7 @@ namespace Techniques::VirtualShadowMaps
     ctx.SetPushConstants(pushConstants);
 
     ctx.BindComputePipeline(allocatePages_);
-    ctx.Barrier();
+    ctx.Barrier(computeBarrier);
     ctx.Dispatch(1, 1, 1); // Only 1-32 threads will allocate
   }
 
@@ -286,28 +373,12 @@ namespace Techniques::VirtualShadowMaps
     auto ctx = Fvog::Context(*device_, cmd);
     auto marker = ctx.MakeScopedDebugMarker("VSM Enqueue and Clear Dirty Pages");
 
-    ctx.Barrier();
+    ctx.Barrier(computeBarrier);
 
     pageClearDispatchParams_.FillData(cmd, {.offset = offsetof(Fvog::DispatchIndirectCommand, groupCountZ), .size = sizeof(uint32_t)});
     pagesToClear_.FillData(cmd, {.offset = 0, .size = sizeof(uint32_t)});
 
-    ctx.Barrier();
-
-    ctx.ImageBarrier(pageTables_, VK_IMAGE_LAYOUT_GENERAL);
-    ctx.ImageBarrier(physicalPages_, VK_IMAGE_LAYOUT_GENERAL);
-
-    // Experimental
-    //ctx.Barriers({{
-    //  Fvog::GlobalBarrier{},
-    //  Fvog::ImageBarrier{
-    //    .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-    //    .image = &pageTables_,
-    //  },
-    //  Fvog::ImageBarrier{
-    //    .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-    //    .image = &physicalPages_,
-    //  }
-    //}});
+    ctx.Barrier(computeBarrier);
 
     auto pushConstants = GetPushConstants();
     ctx.SetPushConstants(pushConstants);
@@ -317,7 +388,7 @@ namespace Techniques::VirtualShadowMaps
     ctx.DispatchInvocations(pageTables_.GetCreateInfo().extent.width, pageTables_.GetCreateInfo().extent.height, pageTables_.GetCreateInfo().arrayLayers);
     
     ctx.BindComputePipeline(clearDirtyPages_);
-    ctx.Barrier();
+    ctx.Barrier(computeBarrier);
     ctx.DispatchIndirect(pageClearDispatchParams_);
   }
 
@@ -345,6 +416,8 @@ namespace Techniques::VirtualShadowMaps
       .visiblePagesBitmaskIndex = visiblePagesBitmask_.GetResourceHandle().index,
       .physicalPagesUintIndex = physicalPagesUint_.GetStorageResourceHandle().index,
       .physicalPagesOverdrawIndex = physicalPagesOverdrawHeatmap_.ImageView().GetStorageResourceHandle().index,
+      .dirtyBoundsIndex = dirtyBounds_.GetResourceHandle().index,
+      .numDirtyBounds = numDirtyBounds_,
     };
   }
 
@@ -352,7 +425,7 @@ namespace Techniques::VirtualShadowMaps
     : context_(createInfo.context),
       numClipmaps_(createInfo.numClipmaps),
       virtualExtent_(createInfo.virtualExtent),
-      clipmapUniformsBuffer_(*createInfo.context.device_, {}, "Directional VSM Uniforms")
+      clipmapUniformsBuffer_(*createInfo.context.device_, {.flag = Fvog::BufferFlagThingy::SUBALLOCATE}, "Directional VSM Uniforms")
   {
     uniforms_.numClipmaps = createInfo.numClipmaps;
 
@@ -387,13 +460,11 @@ namespace Techniques::VirtualShadowMaps
     auto ctx = Fvog::Context(*context_.device_, cmd);
     auto marker = ctx.MakeScopedDebugMarker("VSM Mark Visible Pages");
 
-    ctx.Barrier();
+    ctx.Barrier(computeBarrier);
 
     context_.visiblePagesBitmask_.FillData(cmd);
 
-    ctx.Barrier();
-    ctx.ImageBarrier(gDepth, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL);
-    ctx.ImageBarrier(context_.pageTables_, VK_IMAGE_LAYOUT_GENERAL);
+    ctx.Barrier(computeBarrier);
 
     ctx.BindComputePipeline(context_.markVisiblePages_);
 
@@ -479,6 +550,35 @@ namespace Techniques::VirtualShadowMaps
     ctx.TeenyBufferUpdate(clipmapUniformsBuffer_, uniforms_);
   }
 
+  /*
+   *  IN:
+   *    dirtyBounds_
+   *    clipmapUniformsBuffer_
+   *
+   *  INOUT:
+   *    pageTables_
+   */
+  void DirectionalVirtualShadowMap::MarkDirtyBounds(VkCommandBuffer cmd)
+  {
+    if (context_.numDirtyBounds_ == 0)
+    {
+      return;
+    }
+
+    auto ctx = Fvog::Context(*context_.device_, cmd);
+    auto marker = ctx.MakeScopedDebugMarker("VSM Mark Dirty Bounds");
+
+    ctx.Barrier(computeBarrier);
+
+    ctx.BindComputePipeline(context_.markDirtyBounds_);
+
+    auto pushConstants = context_.GetPushConstants();
+    pushConstants.clipmapUniformsBufferIndex = clipmapUniformsBuffer_.GetResourceHandle().index;
+    ctx.SetPushConstants(pushConstants);
+
+    ctx.Dispatch(context_.numDirtyBounds_, numClipmaps_, 1);
+  }
+
   /*
    *  IN:
    *    pageTables_ (first pass)
@@ -491,8 +591,6 @@ namespace Techniques::VirtualShadowMaps
     auto ctx = Fvog::Context(*context_.device_, cmd);
     auto marker = ctx.MakeScopedDebugMarker("VSM Generate Bitmap HZB");
 
-    ctx.ImageBarrier(context_.pageTables_, VK_IMAGE_LAYOUT_GENERAL);
-
     // TODO: only reduce necessary VSMs
     ctx.BindComputePipeline(context_.reduceVsmHzb_);
 
@@ -500,7 +598,7 @@ namespace Techniques::VirtualShadowMaps
 
     for (uint32_t currentPass = 0; currentPass <= (uint32_t)std::log2(pageTableSize); currentPass++)
     {
-      ctx.Barrier();
+      ctx.Barrier(computeBarrier);
 
       if (currentPass > 0)
       {
@@ -522,4 +620,225 @@ namespace Techniques::VirtualShadowMaps
       ctx.DispatchInvocations(invocations);
     }
   }
+
+  LocalLightVirtualShadowMaps::LocalLightVirtualShadowMaps(const CreateInfo& createInfo)
+    : context_(createInfo.context),
+      maxLights_(createInfo.maxLights),
+      maxShadowRange_(createInfo.maxShadowRange),
+      viewsBuffer_(*createInfo.context.device_, {.count = std::max(createInfo.maxLights, 1u) * VSM_POINT_LIGHT_VIEWS}, "Local VSM Views"),
+      lightViewsBuffer_(*createInfo.context.device_, {.count = 256}, "Local VSM Light Views")
+  {
+  }
+
+  LocalLightVirtualShadowMaps::~LocalLightVirtualShadowMaps()
+  {
+    for (auto& [id, slot] : slots_)
+    {
+      for (auto layer : slot.layers)
+      {
+        context_.FreeLayer(layer);
+      }
+    }
+  }
+
+  /*
+   *  OUT:
+   *    viewsBuffer_
+   *    lightViewsBuffer_
+   *    pageTables_ (cleared layers)
+   */
+  void LocalLightVirtualShadowMaps::Update(VkCommandBuffer cmd, std::span<const ShadowedLight> lights, uint32_t numLights)
+  {
+    auto ctx = Fvog::Context(*context_.device_, cmd);
+    auto marker = ctx.MakeScopedDebugMarker("VSM Update Local Lights");
+
+    lights = lights.first(std::min<size_t>(lights.size(), maxLights_));
+
+    // Give the layers of lights that are no longer shadowed back first, so new lights can take them
+    for (auto it = slots_.begin(); it != slots_.end();)
+    {
+      if (std::ranges::none_of(lights, [&](const ShadowedLight& light) { return light.id == it->first; }))
+      {
+        for (auto layer : it->second.layers)
+        {
+          context_.FreeLayer(layer);
+        }
+        it = slots_.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    views_.clear();
+    lightViews_.assign(numLights, VSM_NO_LOCAL_VIEW);
+    auto layersToClear = std::vector<uint32_t>();
+
+    for (const auto& shadowedLight : lights)
+    {
+      const auto lightIndex = shadowedLight.lightIndex;
+      const auto& light = shadowedLight.light;
+      const auto level = shadowedLight.level;
+      assert(lightIndex < numLights);
+      assert(light.type == LIGHT_TYPE_POINT || light.type == LIGHT_TYPE_SPOT);
+
+      const auto numViews = light.type == LIGHT_TYPE_POINT ? uint32_t(VSM_POINT_LIGHT_VIEWS) : 1u;
+      const auto range = std::isfinite(light.range) && light.range > 0 ? light.range : maxShadowRange_;
+      auto [it, inserted] = slots_.try_emplace(shadowedLight.id);
+      auto& slot = it->second;
+
+      auto invalidate = inserted || !(slot.light == light) || slot.level != level;
+      if (slot.layers.size() != numViews)
+      {
+        for (auto layer : slot.layers)
+        {
+          context_.FreeLayer(layer);
+        }
+        slot.layers.clear();
+
+        while (slot.layers.size() < numViews)
+        {
+          auto layer = context_.AllocateLayer();
+          if (!layer)
+          {
+            break;
+          }
+          slot.layers.push_back(*layer);
+        }
+
+        // Out of layers, so this light and the rest go unshadowed
+        if (slot.layers.size() < numViews)
+        {
+          for (auto layer : slot.layers)
+          {
+            context_.FreeLayer(layer);
+          }
+          slots_.erase(it);
+          continue;
+        }
+        invalidate = true;
+      }
+
+      // The light can only cast shadows within its range, so casters that moved outside of it don't affect it
+      invalidate = invalidate || std::ranges::any_of(context_.cpuDirtyBounds_, [&](const VsmDirtyBounds& bounds) { return SphereIntersectsBounds(light.position, range, bounds); });
+
+      if (invalidate)
+      {
+        layersToClear.insert(layersToClear.end(), slot.layers.begin(), slot.layers.end());
+      }
+
+      slot.light = light;
+      slot.level = level;
+
+      lightViews_[lightIndex] = static_cast<uint32_t>(views_.size());
+      const auto extent = static_cast<float>(GetExtent(level).width);
+      const auto nearPlane = std::max(range * 1e-3f, 0.01f);
+
+      if (light.type == LIGHT_TYPE_POINT)
+      {
+        const auto proj = glm::perspectiveZO(glm::radians(90.0f), 1.0f, nearPlane, range);
+        for (uint32_t face = 0; face < VSM_POINT_LIGHT_VIEWS; face++)
+        {
+          views_.push_back({
+            .viewProj = proj * glm::lookAt(light.position, light.position + cubeFaceDirections[face], cubeFaceUps[face]),
+            .tableIndex = slot.layers[face],
+            .tableLevel = level,
+            .texelSizeAtUnitDistance = 2.0f / extent,
+          });
+        }
+      }
+      else
+      {
+        const auto fovy = std::min(2.0f * light.outerConeAngle, glm::radians(170.0f));
+        const auto up = 1.0f - glm::abs(light.direction.y) < 1e-4f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+        views_.push_back({
+          .viewProj = glm::perspectiveZO(fovy, 1.0f, nearPlane, range) * glm::lookAt(light.position, light.position + light.direction, up),
+          .tableIndex = slot.layers[0],
+          .tableLevel = level,
+          .texelSizeAtUnitDistance = 2.0f * std::tan(fovy / 2.0f) / extent,
+        });
+      }
+    }
+
+    // Clearing to 0 marks pages as not backed, so they're reallocated and redrawn when they're visible.
+    // Most frames clear nothing, so they skip waiting for earlier accesses to the page tables too
+    if (!layersToClear.empty())
+    {
+      ctx.Barrier();
+      for (auto layer : layersToClear)
+      {
+        ctx.ClearTexture(context_.pageTables_, {.baseArrayLayer = layer, .layerCount = 1});
+      }
+    }
+
+    if (viewsBuffer_.Size() < views_.size())
+    {
+      viewsBuffer_ = Fvog::TypedBuffer<VsmLocalView>(*context_.device_, {.count = std::bit_ceil(static_cast<uint32_t>(views_.size()))}, "Local VSM Views");
+    }
+
+    if (lightViewsBuffer_.Size() < numLights)
+    {
+      lightViewsBuffer_ = Fvog::TypedBuffer<uint32_t>(*context_.device_, {.count = std::bit_ceil(numLights)}, "Local VSM Light Views");
+    }
+
+    if (!views_.empty())
+    {
+      viewsBuffer_.UpdateDataExpensive(cmd, std::span<const VsmLocalView>(views_));
+    }
+
+    if (!lightViews_.empty())
+    {
+      lightViewsBuffer_.UpdateDataExpensive(cmd, std::span<const uint32_t>(lightViews_));
+    }
+
+    // This is recorded before the frame's render graph, which begins with a barrier that makes the clears and uploads visible to its passes
+  }
+
+  /*
+   *  IN:
+   *    g-buffer depth
+   *    global uniforms
+   *    VSM uniforms
+   *    lights and light clusters
+   *    viewsBuffer_
+   *    lightViewsBuffer_
+   *
+   *  INOUT:
+   *    visiblePagesBitmask_
+   *    pageTables_
+   *    pageAllocRequests_
+   */
+  void LocalLightVirtualShadowMaps::MarkVisiblePages(VkCommandBuffer cmd, const MarkVisiblePagesParams& params)
+  {
+    if (slots_.empty())
+    {
+      return;
+    }
+
+    auto ctx = Fvog::Context(*context_.device_, cmd);
+    auto marker = ctx.MakeScopedDebugMarker("VSM Mark Visible Local Pages");
+
+    ctx.Barrier(computeBarrier);
+
+    ctx.BindComputePipeline(context_.markVisibleLocalPages_);
+
+    const auto vsmPushConstants = context_.GetPushConstants();
+    ctx.SetPushConstants(VsmMarkLocalPagesPushConstants{
+      .globalUniformsIndex       = params.globalUniforms.GetResourceHandle().index,
+      .gDepthIndex               = params.gDepth.ImageView().GetSampledResourceHandle().index,
+      .pageTablesIndex           = vsmPushConstants.pageTablesIndex,
+      .vsmUniformsBufferIndex    = vsmPushConstants.vsmUniformsBufferIndex,
+      .allocRequestsIndex        = vsmPushConstants.allocRequestsIndex,
+      .visiblePagesBitmaskIndex  = vsmPushConstants.visiblePagesBitmaskIndex,
+      .lightBufferIndex          = params.lights.GetResourceHandle().index,
+      .lightClusterUniformsIndex = params.lightClusterUniforms.GetResourceHandle().index,
+      .lightClustersIndex        = params.lightClusters.GetResourceHandle().index,
+      .lightIndicesIndex         = params.lightIndices.GetResourceHandle().index,
+      .vsmLocalViewsIndex        = viewsBuffer_.GetResourceHandle().index,
+      .vsmLocalLightViewsIndex   = lightViewsBuffer_.GetResourceHandle().index,
+    });
+
+    ctx.DispatchInvocations(params.gDepth.GetCreateInfo().extent);
+  }
 } // namespace Techniques
\ No newline at end of file
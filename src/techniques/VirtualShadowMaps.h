@@ -4,12 +4,16 @@
 #include "Fvog/Texture2.h"
 
 #include "shaders/shadows/vsm/VsmCommon.h.glsl"
+#include "shaders/ShadeDeferredPbr.h.glsl"
 
 #include <vulkan/vulkan_core.h>
 
 #include <array>
 #include <cmath>
+#include <future>
 #include <optional>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 #include <glm/mat4x4.hpp>
@@ -18,6 +22,11 @@
 namespace Fvog
 {
   class Device;
+
+  namespace detail
+  {
+    class ThreadPool;
+  }
 }
 
 namespace Techniques::VirtualShadowMaps
@@ -29,6 +38,8 @@ namespace Techniques::VirtualShadowMaps
   inline constexpr uint32_t pageTableSize = maxExtent / pageSize;
   inline const uint32_t pageTableMipLevels = 1 + static_cast<uint32_t>(std::log2(pageTableSize));
   inline constexpr uint32_t MAX_CLIPMAPS = 32;
+  // Each set of bounds is marked by its own workgroup, so this is the minimum limit of a dispatch dimension
+  inline constexpr uint32_t maxDirtyBounds = 65535;
 
   enum class DebugFlag
   {
@@ -51,7 +62,24 @@ namespace Techniques::VirtualShadowMaps
       uint32_t numPages{};
     };
 
-    explicit Context(Fvog::Device& device, const CreateInfo& createInfo);
+    // Pipelines being built on a thread pool, so the owner can start every build before waiting on any of them
+    struct PipelineBuilds
+    {
+      std::future<Fvog::ComputePipeline> resetPageVisibility;
+      std::future<Fvog::ComputePipeline> allocatePages;
+      std::future<Fvog::ComputePipeline> markVisiblePages;
+      std::future<Fvog::ComputePipeline> listDirtyPages;
+      std::future<Fvog::ComputePipeline> clearDirtyPages;
+      std::future<Fvog::ComputePipeline> freeNonVisiblePages;
+      std::future<Fvog::ComputePipeline> reduceVsmHzb;
+      std::future<Fvog::ComputePipeline> markDirtyBounds;
+      std::future<Fvog::ComputePipeline> markVisibleLocalPages;
+    };
+
+    [[nodiscard]] static PipelineBuilds StartPipelineBuilds(Fvog::Device& device, Fvog::detail::ThreadPool& threadPool);
+
+    // Waits for the pipelines to finish building
+    explicit Context(Fvog::Device& device, const CreateInfo& createInfo, PipelineBuilds pipelineBuilds);
 
     struct VsmGlobalUniforms
     {
@@ -62,10 +90,21 @@ namespace Techniques::VirtualShadowMaps
 
     void UpdateUniforms(VkCommandBuffer cmd, const VsmGlobalUniforms& uniforms);
 
+    // Replaces the bounds of casters that changed since the last frame. Pass both the old and new bounds of casters that moved.
+    // Bounds beyond maxDirtyBounds are merged into the last, which can only invalidate more pages than needed
+    void UpdateDirtyBounds(VkCommandBuffer cmd, std::span<const VsmDirtyBounds> bounds);
+
+    [[nodiscard]] uint32_t NumDirtyBounds() const noexcept
+    {
+      return numDirtyBounds_;
+    }
+
     /// TABLE MAPPINGS
     // If there is a free layer, returns its index, otherwise returns nothing
     [[nodiscard]] std::optional<uint32_t> AllocateLayer();
     void FreeLayer(uint32_t layerIndex);
+    // The bookkeeping functions below must be called in order with pageTables_, physicalPages_, physicalPagesOverdrawHeatmap_, and vsmBitmaskHzb_
+    // in the GENERAL layout and visible to compute and transfer commands. They only synchronize against each other
     void ResetPageVisibility(VkCommandBuffer cmd);
 
     void FreeNonVisiblePages(VkCommandBuffer cmd);
@@ -83,6 +122,7 @@ namespace Techniques::VirtualShadowMaps
 
   private:
     friend class DirectionalVirtualShadowMap;
+    friend class LocalLightVirtualShadowMaps;
 
     // Bitmask indicating which layers of the page mappings array are free
     std::vector<uint32_t> freeLayersBitmask_;
@@ -123,14 +163,25 @@ namespace Techniques::VirtualShadowMaps
       // Address of the requester
       glm::ivec3 pageTableAddress;
 
-      // Unused until local lights are supported
+      // LOD level of local lights. Clipmaps are always level 0
       uint32_t pageTableLevel;
     };
     Fvog::Buffer pageAllocRequests_;
 
+  public:
+    // List of dirty pages, which is also read when debugging shading
     Fvog::Buffer pagesToClear_;
+  private:
     Fvog::TypedBuffer<Fvog::DispatchIndirectCommand> pageClearDispatchParams_;
 
+  public:
+    // Bounds of casters that changed since the last frame. Reallocated by UpdateDirtyBounds when it grows
+    Fvog::TypedBuffer<VsmDirtyBounds> dirtyBounds_;
+  private:
+    uint32_t numDirtyBounds_ = 0;
+    // Local lights are invalidated on the CPU, since they are few and their layers are cleared whole
+    std::vector<VsmDirtyBounds> cpuDirtyBounds_;
+
     /// PIPELINES
     Fvog::ComputePipeline resetPageVisibility_;
     Fvog::ComputePipeline allocatePages_;
@@ -141,6 +192,8 @@ namespace Techniques::VirtualShadowMaps
     //Fwog::ComputePipeline reducePhysicalPages_;
     //Fwog::ComputePipeline reduceVirtualPages_;
     Fvog::ComputePipeline reduceVsmHzb_;
+    Fvog::ComputePipeline markDirtyBounds_;
+    Fvog::ComputePipeline markVisibleLocalPages_;
   };
 
   class DirectionalVirtualShadowMap
@@ -164,6 +217,7 @@ namespace Techniques::VirtualShadowMaps
     // void EnqueueDirtyPages();
 
     // Analyze the g-buffer depth to determine which pages of the VSMs are visible
+    // gDepth must be in a read-only layout. Called between FreeNonVisiblePages and ResetPageVisibility
     void MarkVisiblePages(VkCommandBuffer cmd, Fvog::Texture& gDepth, Fvog::Buffer& globalUniforms);
 
     // Invalidates ALL pages in the referenced VSMs.
@@ -173,6 +227,11 @@ namespace Techniques::VirtualShadowMaps
     // Cheap, call every frame
     void UpdateOffset(VkCommandBuffer cmd, glm::vec3 worldOffset);
 
+    // Marks the backed pages of every clipmap that overlap the context's dirty bounds as dirty, so only they are redrawn.
+    // Dirty pages are cleared, so every caster over them is redrawn, static or not. There is no separate static layer to keep.
+    // Called after AllocateRequestedPages, since ResetPageVisibility clears every dirty bit, and before GenerateBitmaskHzb
+    void MarkDirtyBounds(VkCommandBuffer cmd);
+
     //void BindResourcesForDrawing();
 
     void GenerateBitmaskHzb(VkCommandBuffer cmd);
@@ -236,4 +295,90 @@ namespace Techniques::VirtualShadowMaps
   public:
     Fvog::TypedBuffer<ClipmapUniforms> clipmapUniformsBuffer_;
   };
+
+  // Perspective VSMs for point and spot lights. Each view of a shadowed light (six for point lights, one for spot lights) has its own page table layer.
+  // A light's LOD level is chosen by the caller from its size on screen. Level L uses only the first (pageTableSize >> L) pages on each side of its layers,
+  // so small or distant lights don't request as many pages
+  class LocalLightVirtualShadowMaps
+  {
+  public:
+    struct CreateInfo
+    {
+      Context& context;
+      uint32_t maxLights{};
+      // Used in place of the range of lights whose range is infinite
+      float maxShadowRange = 100;
+    };
+
+    struct ShadowedLight
+    {
+      uint64_t id{};
+      uint32_t lightIndex{}; // Index of the light in the light buffer
+      GpuLight light{};
+      uint32_t level{};
+    };
+
+    explicit LocalLightVirtualShadowMaps(const CreateInfo& createInfo);
+    ~LocalLightVirtualShadowMaps();
+
+    LocalLightVirtualShadowMaps(const LocalLightVirtualShadowMaps&) = delete;
+    LocalLightVirtualShadowMaps(LocalLightVirtualShadowMaps&&) noexcept = delete;
+    LocalLightVirtualShadowMaps& operator=(const LocalLightVirtualShadowMaps&) = delete;
+    LocalLightVirtualShadowMaps& operator=(LocalLightVirtualShadowMaps&&) noexcept = delete;
+
+    // Assigns layers to the lights and uploads their views. numLights is the number of lights in the light buffer.
+    // The layers of lights that are new, changed, or within reach of the context's dirty bounds are cleared, so they're redrawn.
+    // Call after Context::UpdateDirtyBounds and before the render graph that reads the views executes, as it leaves synchronizing them to the graph.
+    // Lights beyond maxLights or the free layers aren't shadowed
+    void Update(VkCommandBuffer cmd, std::span<const ShadowedLight> lights, uint32_t numLights);
+
+    struct MarkVisiblePagesParams
+    {
+      Fvog::Texture& gDepth;
+      Fvog::Buffer& globalUniforms;
+      Fvog::Buffer& lights;
+      Fvog::Buffer& lightClusterUniforms;
+      Fvog::Buffer& lightClusters;
+      Fvog::Buffer& lightIndices;
+    };
+
+    // Only lights in a pixel's light cluster are considered. Called after DirectionalVirtualShadowMap::MarkVisiblePages, since it resets the visible pages bitmask
+    void MarkVisiblePages(VkCommandBuffer cmd, const MarkVisiblePagesParams& params);
+
+    [[nodiscard]] std::span<const VsmLocalView> GetViews() const noexcept
+    {
+      return views_;
+    }
+
+    [[nodiscard]] uint32_t NumShadowedLights() const noexcept
+    {
+      return static_cast<uint32_t>(slots_.size());
+    }
+
+    // Lights that share an LOD level share an extent
+    [[nodiscard]] static Fvog::Extent2D GetExtent(uint32_t level) noexcept
+    {
+      return {maxExtent >> level, maxExtent >> level};
+    }
+
+  private:
+    struct Slot
+    {
+      GpuLight light;
+      uint32_t level{};
+      std::vector<uint32_t> layers;
+    };
+
+    Context& context_;
+    uint32_t maxLights_;
+    float maxShadowRange_;
+    std::unordered_map<uint64_t, Slot> slots_;
+    std::vector<VsmLocalView> views_;
+    std::vector<uint32_t> lightViews_;
+
+  public:
+    Fvog::TypedBuffer<VsmLocalView> viewsBuffer_;
+    // First view of each light in the light buffer, or VSM_NO_LOCAL_VIEW
+    Fvog::TypedBuffer<uint32_t> lightViewsBuffer_;
+  };
 } // namespace Techniques::VirtualShadowMaps
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdio>
+
+// The tests only cover CPU code, so they get by with a check that counts failures instead of a test framework
+namespace Test
+{
+  inline int failures = 0;
+}
+
+#define CHECK(condition)                                                            \
+  do                                                                                \
+  {                                                                                 \
+    if (!(condition))                                                               \
+    {                                                                               \
+      std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);     \
+      Test::failures++;                                                             \
+    }                                                                               \
+  } while (0)
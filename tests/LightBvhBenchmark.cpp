@@ -0,0 +1,94 @@
+// Times the CPU light BVH build and refit over random lights. The GPU build is timed in the app, with the Benchmark Light BVH button.
+// Usage: lightBvhBenchmark [light count...]
+#include "techniques/LightBvhCpu.h"
+#include "PCG.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  double ElapsedMs(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // The same lights as the app's benchmark: spread through a box that grows with their count, so their density stays the same
+  std::vector<GpuLight> MakeLights(uint32_t numLights)
+  {
+    const float halfExtent = 2.0f * std::cbrt(static_cast<float>(numLights));
+    auto lights            = std::vector<GpuLight>(numLights);
+    uint32_t rng           = numLights;
+    for (auto& light : lights)
+    {
+      light.type           = PCG::RandFloat(rng) < 0.75f ? LIGHT_TYPE_POINT : LIGHT_TYPE_SPOT;
+      light.color          = {PCG::RandFloat(rng), PCG::RandFloat(rng), PCG::RandFloat(rng)};
+      light.direction      = {0, -1, 0};
+      light.intensity      = PCG::RandFloat(rng, 1, 100);
+      light.position       = {PCG::RandFloat(rng, -halfExtent, halfExtent), PCG::RandFloat(rng, -halfExtent, halfExtent), PCG::RandFloat(rng, -halfExtent, halfExtent)};
+      light.range          = PCG::RandFloat(rng, 1, 5);
+      light.innerConeAngle = 0.3f;
+      light.outerConeAngle = 0.5f;
+    }
+    return lights;
+  }
+
+  void Benchmark(uint32_t numLights)
+  {
+    if (numLights == 0)
+    {
+      return;
+    }
+
+    auto lights = MakeLights(numLights);
+
+    constexpr uint32_t iterations = 10;
+    auto nodes                    = std::vector<LightBvhNode>();
+    auto start                    = Clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      nodes = Techniques::LightBvhCpu::Build(lights);
+    }
+    const auto buildMs = ElapsedMs(start) / iterations;
+
+    // Move every light a little, as when they are animated
+    auto rng = numLights + 1;
+    for (auto& light : lights)
+    {
+      light.position = light.position + glm::vec3(PCG::RandFloat(rng, -1, 1), PCG::RandFloat(rng, -1, 1), PCG::RandFloat(rng, -1, 1));
+    }
+
+    start = Clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      Techniques::LightBvhCpu::Refit(nodes, lights);
+    }
+    const auto refitMs = ElapsedMs(start) / iterations;
+
+    printf("Light BVH over %u lights: CPU build %.3f ms (%.1f M lights/s), CPU refit %.3f ms\n", numLights, buildMs, numLights / buildMs / 1000, refitMs);
+  }
+} // namespace
+
+int main(int argc, char** argv)
+{
+  if (argc > 1)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      Benchmark(static_cast<uint32_t>(std::strtoul(argv[i], nullptr, 10)));
+    }
+    return 0;
+  }
+
+  for (uint32_t numLights : {1'000u, 10'000u, 100'000u})
+  {
+    Benchmark(numLights);
+  }
+  return 0;
+}
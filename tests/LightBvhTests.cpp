@@ -0,0 +1,243 @@
+// Compares the CPU light BVH build and refit with bounds, powers, and Morton codes computed by brute force
+#include "Check.h"
+
+#include "techniques/LightBvhCpu.h"
+#include "PCG.h"
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+namespace LightBvhCpu = Techniques::LightBvhCpu;
+
+namespace
+{
+  glm::vec3 RandVec3(uint32_t& rng, float min, float max)
+  {
+    return {PCG::RandFloat(rng, min, max), PCG::RandFloat(rng, min, max), PCG::RandFloat(rng, min, max)};
+  }
+
+  // Mostly point and spot lights, with a few that reach everywhere
+  std::vector<GpuLight> RandLights(uint32_t& rng, uint32_t count)
+  {
+    auto lights = std::vector<GpuLight>(count);
+    for (auto& light : lights)
+    {
+      const auto kind      = PCG::RandU32(rng) % 20;
+      light.type           = kind == 0 ? LIGHT_TYPE_DIRECTIONAL : kind < 8 ? LIGHT_TYPE_SPOT : LIGHT_TYPE_POINT;
+      light.color          = RandVec3(rng, 0, 1);
+      light.direction      = {0, -1, 0};
+      light.intensity      = PCG::RandFloat(rng, 1, 100);
+      light.position       = RandVec3(rng, -50, 50);
+      light.range          = kind == 1 ? INFINITY : PCG::RandFloat(rng, 1, 5);
+      light.innerConeAngle = 0.3f;
+      light.outerConeAngle = 0.5f;
+      light.colorSpace     = kind == 2 ? COLOR_SPACE_BT2020_LINEAR : COLOR_SPACE_sRGB_LINEAR;
+    }
+    return lights;
+  }
+
+  bool IsBounded(const GpuLight& light)
+  {
+    return light.type != LIGHT_TYPE_DIRECTIONAL && !std::isinf(light.range);
+  }
+
+  float Power(const GpuLight& light)
+  {
+    const auto weights   = light.colorSpace == COLOR_SPACE_BT2020_LINEAR ? glm::vec3(0.2627f, 0.6780f, 0.0593f) : glm::vec3(0.2126f, 0.7152f, 0.0722f);
+    const auto intensity = light.intensity * (light.color.x * weights.x + light.color.y * weights.y + light.color.z * weights.z);
+    switch (light.type)
+    {
+    case LIGHT_TYPE_POINT: return 4 * 3.141592654f * intensity;
+    case LIGHT_TYPE_SPOT: return 2 * 3.141592654f * (1 - std::cos(light.outerConeAngle)) * intensity;
+    default: return 0;
+    }
+  }
+
+  // Interleaves the bits one at a time, rather than with the build's bit tricks
+  uint32_t MortonCode(glm::vec3 p)
+  {
+    uint32_t code = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      const auto q = static_cast<uint32_t>(std::clamp(p[axis] * 1024.0f, 0.0f, 1023.0f));
+      for (uint32_t bit = 0; bit < 10; bit++)
+      {
+        code |= ((q >> bit) & 1) << (bit * 3 + 2 - axis);
+      }
+    }
+    return code;
+  }
+
+  // Light indices sorted by the Morton codes of their positions within the bounds of the bounded lights, with lights that reach everywhere last
+  std::vector<uint32_t> SortedLights(const std::vector<GpuLight>& lights)
+  {
+    auto boundsMin = glm::vec3(INFINITY);
+    auto boundsMax = glm::vec3(-INFINITY);
+    for (const auto& light : lights)
+    {
+      if (IsBounded(light))
+      {
+        boundsMin = glm::min(boundsMin, light.position);
+        boundsMax = glm::max(boundsMax, light.position);
+      }
+    }
+
+    auto keys = std::vector<std::pair<uint32_t, uint32_t>>();
+    for (uint32_t i = 0; i < lights.size(); i++)
+    {
+      const auto code = IsBounded(lights[i]) ? MortonCode((lights[i].position - boundsMin) / glm::max(boundsMax - boundsMin, glm::vec3(1e-6f))) : ~0u;
+      keys.emplace_back(code, i);
+    }
+    std::ranges::sort(keys);
+
+    auto order = std::vector<uint32_t>();
+    for (const auto& key : keys)
+    {
+      order.push_back(key.second);
+    }
+    return order;
+  }
+
+  struct Subtree
+  {
+    glm::vec3 boundsMin{INFINITY};
+    glm::vec3 boundsMax{-INFINITY};
+    double power{};
+  };
+
+  // Walks the tree from the root, checking its structure and each node against the lights below it. Returns the leaves in the order they were reached
+  std::vector<uint32_t> CheckTree(const std::vector<LightBvhNode>& nodes, const std::vector<GpuLight>& lights)
+  {
+    const auto numLights = static_cast<uint32_t>(lights.size());
+    CHECK(nodes.size() == 2 * numLights - 1);
+    CHECK(nodes[0].parent == LIGHT_BVH_INVALID_NODE);
+
+    auto leaves  = std::vector<uint32_t>();
+    auto visited = std::vector<bool>(nodes.size());
+    auto visit   = [&](auto& self, uint32_t index) -> Subtree
+    {
+      CHECK(!visited[index]);
+      visited[index]   = true;
+      const auto& node = nodes[index];
+
+      auto subtree = Subtree{};
+      if (node.right == LIGHT_BVH_LEAF)
+      {
+        CHECK(index >= numLights - 1);
+        leaves.push_back(index);
+        const auto& light = lights[node.left];
+        subtree.boundsMin = IsBounded(light) ? light.position - light.range : glm::vec3(-static_cast<float>(LIGHT_BVH_INFINITY));
+        subtree.boundsMax = IsBounded(light) ? light.position + light.range : glm::vec3(static_cast<float>(LIGHT_BVH_INFINITY));
+        subtree.power     = Power(light);
+      }
+      else
+      {
+        CHECK(index < numLights - 1);
+        CHECK(nodes[node.left].parent == index && nodes[node.right].parent == index);
+        const auto left   = self(self, node.left);
+        const auto right  = self(self, node.right);
+        subtree.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+        subtree.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+        subtree.power     = left.power + right.power;
+      }
+
+      CHECK(node.boundsMin == subtree.boundsMin);
+      CHECK(node.boundsMax == subtree.boundsMax);
+      CHECK(std::abs(node.power - subtree.power) <= 1e-4 * subtree.power + 1e-6);
+      return subtree;
+    };
+
+    const auto root = visit(visit, 0);
+    CHECK(std::ranges::all_of(visited, [](bool v) { return v; }));
+
+    auto totalPower = 0.0;
+    for (const auto& light : lights)
+    {
+      totalPower += Power(light);
+    }
+    CHECK(std::abs(root.power - totalPower) <= 1e-4 * totalPower + 1e-6);
+    return leaves;
+  }
+
+  void CheckBuild(const std::vector<GpuLight>& lights)
+  {
+    const auto nodes  = LightBvhCpu::Build(lights);
+    const auto leaves = CheckTree(nodes, lights);
+
+    // Leaves are stored, and reached from the root, in the order of their lights' Morton codes
+    const auto order = SortedLights(lights);
+    for (uint32_t i = 0; i < leaves.size(); i++)
+    {
+      CHECK(leaves[i] == lights.size() - 1 + i);
+      CHECK(nodes[leaves[i]].left == order[i]);
+    }
+  }
+
+  void TestBuild()
+  {
+    CHECK(LightBvhCpu::Build({}).empty());
+
+    uint32_t rng = PCG::Hash(1);
+    for (uint32_t count : {1u, 2u, 3u, 17u, 100u, 1'000u, 10'000u})
+    {
+      CheckBuild(RandLights(rng, count));
+    }
+
+    // Lights sharing a position have the same Morton code, so their order comes from their indices
+    auto stacked = RandLights(rng, 64);
+    for (auto& light : stacked)
+    {
+      light.position = glm::vec3(1, 2, 3);
+    }
+    CheckBuild(stacked);
+
+    // No light has bounds, so there are no scene bounds either
+    auto unbounded = RandLights(rng, 10);
+    for (auto& light : unbounded)
+    {
+      light.type = LIGHT_TYPE_DIRECTIONAL;
+    }
+    CheckBuild(unbounded);
+  }
+
+  void TestRefit()
+  {
+    uint32_t rng = PCG::Hash(2);
+    for (uint32_t count : {1u, 2u, 100u, 1'000u})
+    {
+      auto lights = RandLights(rng, count);
+      auto nodes  = LightBvhCpu::Build(lights);
+      const auto built = nodes;
+
+      // Move the lights, and change their ranges and brightness, without adding or removing any
+      for (auto& light : lights)
+      {
+        light.position  = light.position + RandVec3(rng, -10, 10);
+        light.range     = IsBounded(light) ? PCG::RandFloat(rng, 1, 5) : light.range;
+        light.intensity = PCG::RandFloat(rng, 1, 100);
+      }
+      LightBvhCpu::Refit(nodes, lights);
+
+      CheckTree(nodes, lights);
+      for (size_t i = 0; i < nodes.size(); i++)
+      {
+        CHECK(nodes[i].left == built[i].left && nodes[i].right == built[i].right && nodes[i].parent == built[i].parent);
+      }
+    }
+  }
+} // namespace
+
+int main()
+{
+  TestBuild();
+  TestRefit();
+
+  std::printf("%d failures\n", Test::failures);
+  return Test::failures == 0 ? 0 : 1;
+}
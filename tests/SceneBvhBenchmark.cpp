@@ -0,0 +1,168 @@
+// Times builds, refits, and queries of the scene BVH over random boxes, and the same queries done with a linear scan.
+// Usage: sceneBvhBenchmark [item count...]
+#include "SceneBvh.h"
+#include "PCG.h"
+
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+#include "MathUtilities.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  double ElapsedMs(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // Boxes the size of props scattered through a city block, with a few large ones like buildings
+  std::vector<Scene::Aabb> MakeScene(uint32_t count)
+  {
+    auto rng   = PCG::Hash(count);
+    auto boxes = std::vector<Scene::Aabb>(count);
+    for (auto& box : boxes)
+    {
+      const auto center = glm::vec3(PCG::RandFloat(rng, -500, 500), PCG::RandFloat(rng, 0, 50), PCG::RandFloat(rng, -500, 500));
+      const auto size   = PCG::RandU32(rng) % 100 == 0 ? 20.0f : 1.0f;
+      const auto extent = glm::vec3(PCG::RandFloat(rng, 0.1f, size), PCG::RandFloat(rng, 0.1f, size), PCG::RandFloat(rng, 0.1f, size));
+      box               = {center - extent, center + extent};
+    }
+    return boxes;
+  }
+
+  void Benchmark(uint32_t itemCount)
+  {
+    if (itemCount == 0)
+    {
+      return;
+    }
+
+    auto itemBounds = MakeScene(itemCount);
+
+    constexpr uint32_t builds = 10;
+    auto bvh                  = Scene::Bvh();
+    auto start                = Clock::now();
+    for (uint32_t i = 0; i < builds; i++)
+    {
+      bvh.Build(itemBounds);
+    }
+    printf("BVH over %u boxes, %u nodes: %.3f ms per build\n", bvh.ItemCount(), bvh.NodeCount(), ElapsedMs(start) / builds);
+
+    // Move a tenth of the boxes a little, as when dynamic meshes are animated
+    auto rng = PCG::Hash(itemCount + 1);
+    start    = Clock::now();
+    for (uint32_t i = 0; i < itemCount; i += 10)
+    {
+      const auto offset = glm::vec3(PCG::RandFloat(rng, -1, 1), 0, PCG::RandFloat(rng, -1, 1));
+      itemBounds[i]     = {itemBounds[i].min + offset, itemBounds[i].max + offset};
+      bvh.UpdateItem(i, itemBounds[i]);
+    }
+    bvh.Refit();
+    printf("Refit after moving %u boxes: %.3f ms\n", (itemCount + 9) / 10, ElapsedMs(start));
+
+    // A camera spinning in the middle of the scene
+    constexpr uint32_t frustumQueries = 1000;
+    const auto proj                   = Math::InfReverseZPerspectiveRH(glm::radians(70.0f), 16.0f / 9.0f, 0.075f);
+    struct Frustum
+    {
+      glm::vec4 planes[6];
+    };
+    auto frustums = std::vector<Frustum>(frustumQueries);
+    for (uint32_t i = 0; i < frustumQueries; i++)
+    {
+      const auto angle = glm::two_pi<float>() * static_cast<float>(i) / frustumQueries;
+      const auto view  = glm::lookAt(glm::vec3(0, 10, 0), glm::vec3(std::cos(angle), 10, std::sin(angle)), glm::vec3(0, 1, 0));
+      Math::MakeFrustumPlanes(proj * view, frustums[i].planes);
+    }
+
+    auto items      = std::vector<uint32_t>();
+    auto foundItems = size_t{};
+    start           = Clock::now();
+    for (const auto& frustum : frustums)
+    {
+      items.clear();
+      bvh.QueryFrustum(frustum.planes, items);
+      foundItems += items.size();
+    }
+    const auto frustumMs = ElapsedMs(start);
+
+    start                     = Clock::now();
+    auto bruteForceFoundItems = size_t{};
+    for (const auto& frustum : frustums)
+    {
+      for (const auto& aabb : itemBounds)
+      {
+        const auto center = (aabb.min + aabb.max) * 0.5f;
+        const auto extent = (aabb.max - aabb.min) * 0.5f;
+        bruteForceFoundItems += std::ranges::all_of(frustum.planes,
+          [&](const glm::vec4& plane) { return glm::dot(glm::vec3(plane), center) - plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) >= 0; });
+      }
+    }
+    const auto bruteForceMs = ElapsedMs(start);
+    printf("Frustum: %.0f queries/s, %.1f boxes per query (linear scan: %.0f queries/s, %.1f boxes per query)\n",
+      frustumQueries / (frustumMs / 1000),
+      double(foundItems) / frustumQueries,
+      frustumQueries / (bruteForceMs / 1000),
+      double(bruteForceFoundItems) / frustumQueries);
+
+    // Rays from the middle of the scene in every direction, some of them axis-aligned
+    constexpr uint32_t rays = 65536;
+    auto hits               = uint32_t{};
+    start                   = Clock::now();
+    for (uint32_t i = 0; i < rays; i++)
+    {
+      auto direction = glm::vec3(PCG::RandFloat(rng, -1, 1), PCG::RandFloat(rng, -1, 1), PCG::RandFloat(rng, -1, 1));
+      if (i % 16 == 0)
+      {
+        direction = glm::vec3(0);
+        direction[i / 16 % 3] = 1;
+      }
+      hits += bvh.QueryRay(glm::vec3(0, 10, 0), direction).has_value();
+    }
+    const auto rayMs = ElapsedMs(start);
+    printf("Ray: %.0f queries/s, %.1f%% hit\n", rays / (rayMs / 1000), 100.0 * hits / rays);
+
+    // Boxes around each item, twice its size
+    foundItems = 0;
+    start      = Clock::now();
+    for (const auto& aabb : itemBounds)
+    {
+      const auto extent = aabb.max - aabb.min;
+      items.clear();
+      bvh.QueryAabb({aabb.min - extent * 0.5f, aabb.max + extent * 0.5f}, items);
+      foundItems += items.size();
+    }
+    const auto aabbMs = ElapsedMs(start);
+    printf("AABB: %.0f queries/s, %.1f boxes per query\n\n", itemBounds.size() / (aabbMs / 1000), double(foundItems) / itemBounds.size());
+  }
+} // namespace
+
+int main(int argc, char** argv)
+{
+  if (argc > 1)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      Benchmark(static_cast<uint32_t>(std::strtoul(argv[i], nullptr, 10)));
+    }
+    return 0;
+  }
+
+  for (uint32_t itemCount : {1'000u, 10'000u, 100'000u, 1'000'000u})
+  {
+    Benchmark(itemCount);
+  }
+  return 0;
+}
@@ -0,0 +1,302 @@
+// Compares the scene BVH's queries with a linear scan over the same boxes
+#include "Check.h"
+
+#include "SceneBvh.h"
+#include "PCG.h"
+
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include "MathUtilities.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+using Scene::Aabb;
+using Scene::Bvh;
+
+namespace
+{
+  glm::vec3 RandVec3(uint32_t& rng, float min, float max)
+  {
+    return {PCG::RandFloat(rng, min, max), PCG::RandFloat(rng, min, max), PCG::RandFloat(rng, min, max)};
+  }
+
+  Aabb RandAabb(uint32_t& rng, float worldSize)
+  {
+    const auto center = RandVec3(rng, -worldSize, worldSize);
+    const auto extent = RandVec3(rng, 0.01f, worldSize / 20);
+    return {center - extent, center + extent};
+  }
+
+  std::vector<Aabb> RandAabbs(uint32_t& rng, uint32_t count, float worldSize)
+  {
+    auto boxes = std::vector<Aabb>(count);
+    for (auto& box : boxes)
+    {
+      box = RandAabb(rng, worldSize);
+    }
+    return boxes;
+  }
+
+  std::vector<uint32_t> Sorted(std::vector<uint32_t> items)
+  {
+    std::ranges::sort(items);
+    return items;
+  }
+
+  std::vector<uint32_t> ScanFrustum(std::span<const Aabb> boxes, const glm::vec4 (&planes)[6])
+  {
+    auto items = std::vector<uint32_t>();
+    for (uint32_t i = 0; i < boxes.size(); i++)
+    {
+      const auto center = (boxes[i].min + boxes[i].max) * 0.5f;
+      const auto extent = (boxes[i].max - boxes[i].min) * 0.5f;
+      if (std::ranges::all_of(planes,
+            [&](const glm::vec4& plane) { return glm::dot(glm::vec3(plane), center) - plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) >= 0; }))
+      {
+        items.push_back(i);
+      }
+    }
+    return items;
+  }
+
+  std::vector<uint32_t> ScanAabb(std::span<const Aabb> boxes, const Aabb& query)
+  {
+    auto items = std::vector<uint32_t>();
+    for (uint32_t i = 0; i < boxes.size(); i++)
+    {
+      if (glm::all(glm::lessThanEqual(boxes[i].min, query.max)) && glm::all(glm::greaterThanEqual(boxes[i].max, query.min)))
+      {
+        items.push_back(i);
+      }
+    }
+    return items;
+  }
+
+  // Where the ray enters the box. An axis with a zero direction is only checked for whether the origin lies between the box's planes
+  std::optional<float> RayEnter(const Aabb& box, glm::vec3 origin, glm::vec3 direction)
+  {
+    auto enter = 0.0f;
+    auto exit  = INFINITY;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      if (direction[axis] == 0)
+      {
+        if (origin[axis] < box.min[axis] || origin[axis] > box.max[axis])
+        {
+          return std::nullopt;
+        }
+        continue;
+      }
+
+      const auto inv = 1.0f / direction[axis];
+      const auto t0  = (box.min[axis] - origin[axis]) * inv;
+      const auto t1  = (box.max[axis] - origin[axis]) * inv;
+      enter          = std::max(enter, std::min(t0, t1));
+      exit           = std::min(exit, std::max(t0, t1));
+    }
+    if (enter > exit)
+    {
+      return std::nullopt;
+    }
+    return enter;
+  }
+
+  std::optional<float> ScanRay(std::span<const Aabb> boxes, glm::vec3 origin, glm::vec3 direction)
+  {
+    auto nearest = std::optional<float>();
+    for (const auto& box : boxes)
+    {
+      if (const auto t = RayEnter(box, origin, direction); t && (!nearest || *t < *nearest))
+      {
+        nearest = t;
+      }
+    }
+    return nearest;
+  }
+
+  // Items may tie for the nearest hit, so only the distance is compared, and the item must be entered at that distance
+  void CheckRay(const Bvh& bvh, std::span<const Aabb> boxes, glm::vec3 origin, glm::vec3 direction)
+  {
+    const auto hit      = bvh.QueryRay(origin, direction);
+    const auto expected = ScanRay(boxes, origin, direction);
+    CHECK(hit.has_value() == expected.has_value());
+    if (hit && expected)
+    {
+      CHECK(!std::isnan(hit->t));
+      CHECK(hit->t == *expected);
+      CHECK(RayEnter(boxes[hit->item], origin, direction) == hit->t);
+    }
+  }
+
+  void CheckQueries(const Bvh& bvh, std::span<const Aabb> boxes, uint32_t& rng, float worldSize)
+  {
+    // Views from random places looking at random points, with near planes in front of and behind some boxes
+    for (int i = 0; i < 20; i++)
+    {
+      const auto eye    = RandVec3(rng, -worldSize * 1.5f, worldSize * 1.5f);
+      const auto target = RandVec3(rng, -worldSize, worldSize);
+      const auto proj   = Math::InfReverseZPerspectiveRH(PCG::RandFloat(rng, 0.2f, 2.5f), PCG::RandFloat(rng, 0.5f, 2.0f), PCG::RandFloat(rng, 0.01f, 10.0f));
+      glm::vec4 planes[6];
+      Math::MakeFrustumPlanes(proj * glm::lookAt(eye, target, glm::vec3(0, 1, 0)), planes);
+
+      auto items = std::vector<uint32_t>();
+      bvh.QueryFrustum(planes, items);
+      CHECK(Sorted(items) == ScanFrustum(boxes, planes));
+    }
+
+    for (int i = 0; i < 50; i++)
+    {
+      const auto query = RandAabb(rng, worldSize * 2);
+      auto items       = std::vector<uint32_t>();
+      bvh.QueryAabb(query, items);
+      CHECK(Sorted(items) == ScanAabb(boxes, query));
+    }
+
+    for (int i = 0; i < 200; i++)
+    {
+      CheckRay(bvh, boxes, RandVec3(rng, -worldSize * 1.5f, worldSize * 1.5f), RandVec3(rng, -1, 1));
+    }
+  }
+
+  void TestQueries()
+  {
+    auto rng = PCG::Hash(1);
+
+    // Empty, a single leaf, a few levels, and large enough to build subtrees in parallel
+    for (uint32_t count : {0u, 1u, 3u, 17u, 1000u, 20000u})
+    {
+      const auto boxes = RandAabbs(rng, count, 100);
+      auto bvh         = Bvh();
+      bvh.Build(boxes);
+      CHECK(bvh.ItemCount() == count);
+      CheckQueries(bvh, boxes, rng, 100);
+    }
+
+    // Every box in the same place, so the build can only split arbitrarily
+    {
+      const auto boxes = std::vector<Aabb>(100, Aabb{glm::vec3(-1), glm::vec3(1)});
+      auto bvh         = Bvh();
+      bvh.Build(boxes);
+      CheckQueries(bvh, boxes, rng, 2);
+    }
+  }
+
+  void TestRefit()
+  {
+    auto rng   = PCG::Hash(2);
+    auto boxes = RandAabbs(rng, 5000, 100);
+    auto bvh   = Bvh();
+    bvh.Build(boxes);
+
+    for (int round = 0; round < 5; round++)
+    {
+      // Nudge some boxes, and throw others far from where they were built
+      for (int i = 0; i < 200; i++)
+      {
+        const auto item = PCG::RandU32(rng) % boxes.size();
+        if (i % 2 == 0)
+        {
+          const auto offset = RandVec3(rng, -5, 5);
+          boxes[item]       = {boxes[item].min + offset, boxes[item].max + offset};
+        }
+        else
+        {
+          boxes[item] = RandAabb(rng, 1000);
+        }
+        bvh.UpdateItem(item, boxes[item]);
+      }
+      bvh.Refit();
+
+      for (uint32_t item = 0; item < boxes.size(); item++)
+      {
+        CHECK(bvh.GetItemBounds(item).min == boxes[item].min && bvh.GetItemBounds(item).max == boxes[item].max);
+      }
+      CheckQueries(bvh, boxes, rng, 1000);
+    }
+
+    // A single moved item must be found at its new position and not at its old one
+    const auto oldBounds = boxes[0];
+    boxes[0]             = {glm::vec3(5000), glm::vec3(5001)};
+    bvh.UpdateItem(0, boxes[0]);
+    bvh.Refit();
+    auto items = std::vector<uint32_t>();
+    bvh.QueryAabb(boxes[0], items);
+    CHECK(std::ranges::find(items, 0u) != items.end());
+    items.clear();
+    bvh.QueryAabb(oldBounds, items);
+    CHECK(Sorted(items) == ScanAabb(boxes, oldBounds));
+  }
+
+  void TestAxisAlignedRays()
+  {
+    auto rng = PCG::Hash(3);
+
+    // Boxes on an integer grid, so rays can start exactly on their faces
+    auto boxes = std::vector<Aabb>();
+    for (int x = 0; x < 10; x++)
+    {
+      for (int y = 0; y < 10; y++)
+      {
+        for (int z = 0; z < 10; z++)
+        {
+          if (PCG::RandU32(rng) % 3 == 0)
+          {
+            boxes.push_back({glm::vec3(x, y, z) * 2.0f, glm::vec3(x, y, z) * 2.0f + 1.0f});
+          }
+        }
+      }
+    }
+    auto bvh = Bvh();
+    bvh.Build(boxes);
+
+    const glm::vec3 directions[] = {
+      {1, 0, 0},
+      {-1, 0, 0},
+      {0, 1, 0},
+      {0, -1, 0},
+      {0, 0, 1},
+      {0, 0, -1},
+      {-0.0f, 0, 1},
+      {0, -0.0f, -1},
+      {1, 1, 0},
+      {0, -1, 1},
+    };
+    for (const auto& direction : directions)
+    {
+      for (int i = 0; i < 500; i++)
+      {
+        // Origins on the grid lie in the planes of box faces, and those between lie in the gaps
+        const auto origin = glm::vec3(PCG::RandU32(rng) % 44, PCG::RandU32(rng) % 44, PCG::RandU32(rng) % 44) * 0.5f - 1.0f;
+        CheckRay(bvh, boxes, origin, direction);
+      }
+    }
+
+    // Rays along the planes of both the min and the max faces of a box
+    const auto box = Aabb{glm::vec3(0), glm::vec3(1)};
+    auto single    = Bvh();
+    single.Build({&box, 1});
+    for (float y : {0.0f, 1.0f})
+    {
+      const auto hit = single.QueryRay({-1, y, 0.5f}, {1, 0, 0});
+      CHECK(hit && hit->t == 1);
+    }
+    CHECK(!single.QueryRay({-1, 1.5f, 0.5f}, {1, 0, 0}));
+    CHECK(!single.QueryRay({-1, 0.5f, 0.5f}, {-1, 0, 0}));
+  }
+} // namespace
+
+int main()
+{
+  TestQueries();
+  TestRefit();
+  TestAxisAlignedRays();
+
+  std::printf("%d failures\n", Test::failures);
+  return Test::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+// Times building cache keys for the renderer's shaders, then storing and looking them up in the on-disk SPIR-V cache. No device is created.
+// Usage: shaderCacheBenchmark [shader directory]
+#include "Fvog/Shader2.h"
+#include "Fvog/detail/ShaderCache2.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using Fvog::ShaderProfile;
+using Fvog::detail::MakeShaderCacheKey;
+using Fvog::detail::ShaderCache;
+using Fvog::detail::ShaderCompileInfo;
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  double ElapsedMs(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  struct ShaderSource
+  {
+    VkShaderStageFlagBits stage{};
+    std::string source;
+  };
+
+  // Headers are skipped, as only whole shaders are looked up. Includes are not resolved, so the hashed source is a little shorter than in the renderer
+  std::vector<ShaderSource> LoadShaders(const std::filesystem::path& directory)
+  {
+    constexpr std::pair<const char*, VkShaderStageFlagBits> extensions[] = {
+      {".vert.glsl", VK_SHADER_STAGE_VERTEX_BIT},
+      {".frag.glsl", VK_SHADER_STAGE_FRAGMENT_BIT},
+      {".comp.glsl", VK_SHADER_STAGE_COMPUTE_BIT},
+      {".task.glsl", VK_SHADER_STAGE_TASK_BIT_EXT},
+      {".mesh.glsl", VK_SHADER_STAGE_MESH_BIT_EXT},
+    };
+
+    auto shaders = std::vector<ShaderSource>();
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory))
+    {
+      const auto name = entry.path().filename().string();
+      for (const auto& [extension, stage] : extensions)
+      {
+        if (name.ends_with(extension))
+        {
+          auto file = std::ifstream(entry.path(), std::ios::binary);
+          auto contents = std::stringstream();
+          contents << file.rdbuf();
+          shaders.push_back({stage, contents.str()});
+          break;
+        }
+      }
+    }
+    return shaders;
+  }
+
+  // Stands in for compiled SPIR-V, which is usually a few times the size of its source
+  ShaderCompileInfo MakeSpirv(const ShaderSource& shader)
+  {
+    auto info = ShaderCompileInfo{.workgroupSize_ = {8, 8, 1}};
+    info.binarySpv.resize(shader.source.size(), 0x07230203);
+    return info;
+  }
+
+  void Benchmark(const std::filesystem::path& shaderDirectory)
+  {
+    const auto shaders = LoadShaders(shaderDirectory);
+    if (shaders.empty())
+    {
+      printf("No shaders found in %s\n", shaderDirectory.string().c_str());
+      return;
+    }
+
+    size_t sourceBytes = 0;
+    for (const auto& shader : shaders)
+    {
+      sourceBytes += shader.source.size();
+    }
+    printf("%zu shaders, %.1f KiB of source\n", shaders.size(), sourceBytes / 1024.0);
+
+    constexpr uint32_t keyPasses = 100;
+    auto keys = std::vector<uint64_t>(shaders.size());
+    auto start = Clock::now();
+    for (uint32_t pass = 0; pass < keyPasses; pass++)
+    {
+      for (size_t i = 0; i < shaders.size(); i++)
+      {
+        keys[i] = MakeShaderCacheKey(shaders[i].stage, shaders[i].source, ShaderProfile::RELEASE);
+      }
+    }
+    const auto keyMs = ElapsedMs(start) / keyPasses;
+    printf("Keys: %.3f ms for all shaders, %.0f MiB/s\n", keyMs, sourceBytes / (1024.0 * 1024.0) / (keyMs / 1000));
+
+    const auto directory = std::filesystem::temp_directory_path() / "frogfood_shader_cache_benchmark";
+    std::filesystem::remove_all(directory);
+
+    // An empty cache, as on the first run after shaders or the compiler changed
+    {
+      auto cache = ShaderCache(directory);
+      start = Clock::now();
+      for (const auto key : keys)
+      {
+        (void)cache.Find(key);
+      }
+      printf("Misses: %.3f ms for all shaders\n", ElapsedMs(start));
+
+      start = Clock::now();
+      for (size_t i = 0; i < shaders.size(); i++)
+      {
+        cache.Store(keys[i], MakeSpirv(shaders[i]));
+      }
+      printf("Stores: %.3f ms for all shaders\n", ElapsedMs(start));
+    }
+
+    // A new cache over the stored files, as on startup. The OS may still have the files cached, so this is only cold for the process
+    {
+      auto cache = ShaderCache(directory);
+      start = Clock::now();
+      for (const auto key : keys)
+      {
+        (void)cache.Find(key);
+      }
+      printf("Cold hits: %.3f ms for all shaders\n", ElapsedMs(start));
+
+      constexpr uint32_t warmPasses = 10;
+      start = Clock::now();
+      for (uint32_t pass = 0; pass < warmPasses; pass++)
+      {
+        for (const auto key : keys)
+        {
+          (void)cache.Find(key);
+        }
+      }
+      printf("Warm hits: %.3f ms for all shaders\n", ElapsedMs(start) / warmPasses);
+
+      const auto stats = cache.GetStats();
+      printf("%u hits, %u misses\n", stats.hits, stats.misses);
+    }
+
+    std::filesystem::remove_all(directory);
+  }
+} // namespace
+
+int main(int argc, char** argv)
+{
+  Benchmark(argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::path(FROGRENDER_SHADER_DIRECTORY));
+  return 0;
+}
@@ -0,0 +1,215 @@
+// CPU-only tests of the on-disk SPIR-V cache. No device is created
+#include "Check.h"
+
+#include "Fvog/Shader2.h"
+#include "Fvog/detail/ShaderCache2.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Fvog::detail::ShaderCache;
+using Fvog::detail::ShaderCompileInfo;
+
+namespace
+{
+  ShaderCompileInfo MakeInfo(uint32_t seed, size_t words)
+  {
+    auto info = ShaderCompileInfo{.workgroupSize_ = {seed, seed + 1, seed + 2}};
+    for (size_t i = 0; i < words; i++)
+    {
+      info.binarySpv.push_back(seed * 1000 + static_cast<uint32_t>(i));
+    }
+    return info;
+  }
+
+  bool Equal(const ShaderCompileInfo& a, const ShaderCompileInfo& b)
+  {
+    return a.binarySpv == b.binarySpv && a.workgroupSize_.width == b.workgroupSize_.width && a.workgroupSize_.height == b.workgroupSize_.height &&
+           a.workgroupSize_.depth == b.workgroupSize_.depth;
+  }
+
+  std::filesystem::path PathForKey(const std::filesystem::path& directory, uint64_t key)
+  {
+    char name[32]{};
+    std::snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key));
+    return directory / name;
+  }
+
+  // Each test gets an empty directory
+  std::filesystem::path MakeDirectory(const char* name)
+  {
+    auto directory = std::filesystem::temp_directory_path() / "frogfood_shader_cache_tests" / name;
+    std::filesystem::remove_all(directory);
+    return directory;
+  }
+
+  void TestHitAndMiss()
+  {
+    const auto directory = MakeDirectory("hit_and_miss");
+    auto cache = ShaderCache(directory);
+    const auto info = MakeInfo(1, 100);
+
+    CHECK(!cache.Find(1));
+    cache.Store(1, info);
+    const auto found = cache.Find(1);
+    CHECK(found && Equal(*found, info));
+    CHECK(!cache.Find(2));
+
+    // Storing again replaces the entry
+    const auto replacement = MakeInfo(2, 50);
+    cache.Store(1, replacement);
+    const auto replaced = cache.Find(1);
+    CHECK(replaced && Equal(*replaced, replacement));
+
+    CHECK(cache.GetStats().hits == 2);
+    CHECK(cache.GetStats().misses == 2);
+
+    // A new cache over the same directory sees the stored entries
+    auto reopened = ShaderCache(directory);
+    CHECK(reopened.Find(1));
+  }
+
+  void TestDamagedFiles()
+  {
+    const auto directory = MakeDirectory("damaged_files");
+    auto cache = ShaderCache(directory);
+    const auto info = MakeInfo(3, 64);
+    const auto path = PathForKey(directory, 1);
+    cache.Store(1, info);
+    const auto goodSize = std::filesystem::file_size(path);
+
+    // Truncated in the header and in the SPIR-V
+    for (auto size : {uintmax_t{0}, uintmax_t{4}, goodSize - 4, goodSize - 1})
+    {
+      cache.Store(1, info);
+      std::filesystem::resize_file(path, size);
+      CHECK(!cache.Find(1));
+    }
+
+    // Bad magic
+    cache.Store(1, info);
+    {
+      auto file = std::fstream(path, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(0);
+      file.put('X');
+    }
+    CHECK(!cache.Find(1));
+
+    // A file stored under another key
+    cache.Store(2, info);
+    std::filesystem::copy_file(PathForKey(directory, 2), path, std::filesystem::copy_options::overwrite_existing);
+    CHECK(!cache.Find(1));
+
+    // Empty SPIR-V is never a valid entry
+    cache.Store(3, ShaderCompileInfo{});
+    CHECK(!cache.Find(3));
+
+    // Damaged entries can be overwritten
+    cache.Store(1, info);
+    const auto found = cache.Find(1);
+    CHECK(found && Equal(*found, info));
+  }
+
+  void TestUnwritableDirectory()
+  {
+    const auto directory = MakeDirectory("unwritable");
+    std::filesystem::create_directories(directory.parent_path());
+    std::ofstream(directory) << "not a directory";
+
+    // Failing to store is not an error
+    auto cache = ShaderCache(directory);
+    cache.Store(1, MakeInfo(4, 16));
+    CHECK(!cache.Find(1));
+    std::filesystem::remove(directory);
+  }
+
+  void TestKeys()
+  {
+    using Fvog::detail::MakeShaderCacheKey;
+    using Fvog::ShaderProfile;
+    constexpr auto source = "void main() {}";
+    const auto key = MakeShaderCacheKey(VK_SHADER_STAGE_COMPUTE_BIT, source, ShaderProfile::DEBUG);
+
+    CHECK(key == MakeShaderCacheKey(VK_SHADER_STAGE_COMPUTE_BIT, source, ShaderProfile::DEBUG));
+    CHECK(key != MakeShaderCacheKey(VK_SHADER_STAGE_FRAGMENT_BIT, source, ShaderProfile::DEBUG));
+    CHECK(key != MakeShaderCacheKey(VK_SHADER_STAGE_COMPUTE_BIT, source, ShaderProfile::RELEASE));
+    CHECK(key != MakeShaderCacheKey(VK_SHADER_STAGE_COMPUTE_BIT, "void main() { }", ShaderProfile::DEBUG));
+    CHECK(key != MakeShaderCacheKey(VK_SHADER_STAGE_COMPUTE_BIT, "", ShaderProfile::DEBUG));
+
+    // Compiler options are hashed one by one, so each must change the key
+    CHECK(ShaderCache::KeyBuilder().Add(uint64_t{0}).Key() != ShaderCache::KeyBuilder().Add(uint64_t{1}).Key());
+    CHECK(ShaderCache::KeyBuilder().Add(uint64_t{0}).Add(uint64_t{1}).Key() != ShaderCache::KeyBuilder().Add(uint64_t{1}).Add(uint64_t{0}).Key());
+
+    // Strings can't be shuffled across a boundary into the same key
+    CHECK(ShaderCache::KeyBuilder().Add("ab").Add("c").Key() != ShaderCache::KeyBuilder().Add("a").Add("bc").Key());
+    CHECK(ShaderCache::KeyBuilder().Add("").Key() != ShaderCache::KeyBuilder().Key());
+  }
+
+  void TestConcurrentStore()
+  {
+    const auto directory = MakeDirectory("concurrent_store");
+    auto cache = ShaderCache(directory);
+    constexpr uint32_t threadCount = 8;
+    constexpr uint32_t iterations = 50;
+
+    auto infos = std::vector<ShaderCompileInfo>();
+    for (uint32_t t = 0; t < threadCount; t++)
+    {
+      infos.push_back(MakeInfo(t + 10, 1000 + t * 100));
+    }
+
+    // Every thread stores a different value under the same key while reading it back
+    auto torn = std::atomic<uint32_t>();
+    {
+      auto threads = std::vector<std::jthread>();
+      for (uint32_t t = 0; t < threadCount; t++)
+      {
+        threads.emplace_back(
+          [&, t]
+          {
+            for (uint32_t i = 0; i < iterations; i++)
+            {
+              cache.Store(1, infos[t]);
+              if (auto found = cache.Find(1); found && std::ranges::none_of(infos, [&](const auto& info) { return Equal(*found, info); }))
+              {
+                torn++;
+              }
+            }
+          });
+      }
+    }
+
+    // Readers only ever see a complete entry from one of the writers
+    CHECK(torn == 0);
+    const auto found = cache.Find(1);
+    CHECK(found && std::ranges::any_of(infos, [&](const auto& info) { return Equal(*found, info); }));
+
+    // No temporary files are left behind
+    auto files = 0;
+    for ([[maybe_unused]] const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+      files++;
+    }
+    CHECK(files == 1);
+  }
+} // namespace
+
+int main()
+{
+  TestHitAndMiss();
+  TestDamagedFiles();
+  TestUnwritableDirectory();
+  TestKeys();
+  TestConcurrentStore();
+
+  std::filesystem::remove_all(std::filesystem::temp_directory_path() / "frogfood_shader_cache_tests");
+  std::printf("%d failures\n", Test::failures);
+  return Test::failures == 0 ? 0 : 1;
+}